@@ -208,6 +208,12 @@ int CDeepZoomApp::Run()
             CMainFrame *pFrame = (CMainFrame*)m_pMainWnd;
             if (pFrame)
             {
+                // Draw scene objects finished in the background, like images opened by the image loader
+                if (m_SceneGraph2D->ValidateSignaledObjects() == S_OK)
+                {
+                    pFrame->Update();
+                }
+
                 if (!pFrame->OnIdle())
                     break;
             }
@@ -335,7 +341,7 @@ ISceneObjectCamera* CDeepZoomApp::GetCamera2D()
 
 void CDeepZoomApp::OnImageOpen()
 {
-    LPCTSTR filter = L"JPEG (*.jpg)|*.jpg|Bitmap (*.bmp)|*.bmp|PNG (*.png)|*.png||";
+    LPCTSTR filter = L"JPEG (*.jpg)|*.jpg|Bitmap (*.bmp)|*.bmp|PNG (*.png)|*.png|Deep Zoom (*.dzi)|*.dzi|Zoomify (ImageProperties.xml)|ImageProperties.xml|IIIF (info.json)|info.json||";
 
     CView* pActiveView = ((CFrameWnd*) AfxGetMainWnd())->GetActiveView();
     CFileDialog openImageDlg(TRUE, NULL, NULL, OFN_HIDEREADONLY, filter, pActiveView);
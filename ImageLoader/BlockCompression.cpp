@@ -0,0 +1,455 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <emmintrin.h>
+#include <math.h>
+#include "BlockCompression.h"
+
+static const UINT BLOCK_SIZE = 4;
+static const UINT BLOCK_PIXELS = BLOCK_SIZE * BLOCK_SIZE;
+static const UINT POWER_ITERATIONS = 8;
+
+// Channels of a BGRX pixel
+static const UINT CHANNEL_COUNT = 3;
+static const UINT CHANNEL_RED = 2;
+
+// BC7 mode 6 is one subset of RGBA endpoints with 7 bits per channel, a shared lowest bit per endpoint and 4 bit indices
+static const UINT BC7_MODE6 = 1 << 6;
+static const UINT BC7_MODE6_BITS = 7;
+static const UINT BC7_LOWEST_BIT = 1;
+static const UINT BC7_MAX_INDEX = 15;
+
+//-----------------------------------------------------------------------------
+// Copy a 4x4 block of tile pixels, columns and rows past the edge of the
+// tile repeat the last one
+//-----------------------------------------------------------------------------
+static void LoadBlock(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __in const UINT &x, __in const UINT &y, 
+                      __out_ecount(BLOCK_PIXELS) UINT32 *pBlock)
+{
+    for (UINT j = 0; j < BLOCK_SIZE; ++j)
+    {
+        const UINT32 *pRow = reinterpret_cast<const UINT32*>(pPixelData + (SIZE_T)min(y + j, height - 1) * cbStride);
+
+        if (x + BLOCK_SIZE <= width)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(pBlock + j * BLOCK_SIZE), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + x)));
+        }
+        else
+        {
+            for (UINT i = 0; i < BLOCK_SIZE; ++i)
+            {
+                pBlock[j * BLOCK_SIZE + i] = pRow[min(x + i, width - 1)];
+            }
+        }
+    }
+}
+
+inline static INT GetChannel(__in const UINT32 &pixel, __in const UINT &channel)
+{
+    return (pixel >> (channel * 8)) & 0xFF;
+}
+
+//-----------------------------------------------------------------------------
+// Principal axis of the colors of a block by power iteration on their
+// covariance, the axis is 0 for a block of a single color
+//-----------------------------------------------------------------------------
+static void GetPrincipalAxis(__in_ecount(BLOCK_PIXELS) const UINT32 *pBlock, __out_ecount(CHANNEL_COUNT) FLOAT *pAxis)
+{
+    FLOAT mean[CHANNEL_COUNT] = {0};
+    for (UINT i = 0; i < BLOCK_PIXELS; ++i)
+    {
+        for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            mean[c] += GetChannel(pBlock[i], c);
+        }
+    }
+
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        mean[c] /= BLOCK_PIXELS;
+    }
+
+    FLOAT covariance[CHANNEL_COUNT][CHANNEL_COUNT] = {0};
+    for (UINT i = 0; i < BLOCK_PIXELS; ++i)
+    {
+        FLOAT d[CHANNEL_COUNT];
+        for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            d[c] = GetChannel(pBlock[i], c) - mean[c];
+        }
+
+        for (UINT r = 0; r < CHANNEL_COUNT; ++r)
+        {
+            for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+            {
+                covariance[r][c] += d[r] * d[c];
+            }
+        }
+    }
+
+    // Start from the column of the channel with the largest variance, it is never orthogonal to the axis
+    UINT start = 0;
+    for (UINT c = 1; c < CHANNEL_COUNT; ++c)
+    {
+        if (covariance[c][c] > covariance[start][start])
+        {
+            start = c;
+        }
+    }
+
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        pAxis[c] = covariance[c][start];
+    }
+
+    for (UINT iteration = 0; iteration < POWER_ITERATIONS; ++iteration)
+    {
+        FLOAT next[CHANNEL_COUNT] = {0};
+        FLOAT largest = 0;
+        for (UINT r = 0; r < CHANNEL_COUNT; ++r)
+        {
+            for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+            {
+                next[r] += covariance[r][c] * pAxis[c];
+            }
+            largest = max(largest, fabsf(next[r]));
+        }
+
+        if (largest == 0)
+        {
+            pAxis[0] = pAxis[1] = pAxis[2] = 0;
+            return;
+        }
+
+        for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            pAxis[c] = next[c] / largest;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Dot products of the colors of a block less the origin with the direction,
+// four pixels at a time. Channels are at most 255 apart, so every product
+// and the sum of two of them fit the 32 bit lanes of the multiply-add.
+//-----------------------------------------------------------------------------
+static void ProjectBlock(__in_ecount(BLOCK_PIXELS) const UINT32 *pBlock, __in_ecount(CHANNEL_COUNT) const INT *pOrigin, __in_ecount(CHANNEL_COUNT) const INT *pDirection, 
+                         __out_ecount(BLOCK_PIXELS) INT *pDots)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i origin = _mm_set_epi16(0, (SHORT)pOrigin[2], (SHORT)pOrigin[1], (SHORT)pOrigin[0], 0, (SHORT)pOrigin[2], (SHORT)pOrigin[1], (SHORT)pOrigin[0]);
+    const __m128i direction = _mm_set_epi16(0, (SHORT)pDirection[2], (SHORT)pDirection[1], (SHORT)pDirection[0], 0, (SHORT)pDirection[2], (SHORT)pDirection[1], (SHORT)pDirection[0]);
+
+    for (UINT i = 0; i < BLOCK_PIXELS; i += 4)
+    {
+        __m128i pixels = _mm_load_si128(reinterpret_cast<const __m128i*>(pBlock + i));
+
+        // Blue * blue + green * green and red * red + 0 of two pixels in each
+        __m128 products01 = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), origin), direction));
+        __m128 products23 = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), origin), direction));
+
+        __m128i even = _mm_castps_si128(_mm_shuffle_ps(products01, products23, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i odd = _mm_castps_si128(_mm_shuffle_ps(products01, products23, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pDots + i), _mm_add_epi32(even, odd));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Round dot products of the pixels with the line between two endpoints to
+// the nearest of the steps between them, the squared length of the line is
+// the dot product of the second endpoint
+//-----------------------------------------------------------------------------
+static void QuantizeDots(__in_ecount(BLOCK_PIXELS) const INT *pDots, __in const INT &lengthSquared, __in const UINT &maxStep, __out_ecount(BLOCK_PIXELS) UINT *pSteps)
+{
+    const __m128 scale = _mm_set1_ps((FLOAT)maxStep / (FLOAT)lengthSquared);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lowest = _mm_setzero_ps();
+    const __m128 highest = _mm_set1_ps((FLOAT)maxStep);
+
+    for (UINT i = 0; i < BLOCK_PIXELS; i += 4)
+    {
+        __m128 step = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pDots + i))), scale), half);
+        step = _mm_min_ps(_mm_max_ps(step, lowest), highest);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pSteps + i), _mm_cvttps_epi32(step));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Pick the endpoints of a block, the extreme colors along the principal axis
+// moved inwards by a fraction of the distance between them, so the steps
+// between the endpoints cover the colors evenly
+//-----------------------------------------------------------------------------
+static void GetBlockEndpoints(__in_ecount(BLOCK_PIXELS) const UINT32 *pBlock, __in const FLOAT &inset, __out_ecount(CHANNEL_COUNT) FLOAT *pLow, __out_ecount(CHANNEL_COUNT) FLOAT *pHigh)
+{
+    FLOAT axis[CHANNEL_COUNT];
+    GetPrincipalAxis(pBlock, axis);
+
+    static const INT ORIGIN[CHANNEL_COUNT] = {0, 0, 0};
+    INT direction[CHANNEL_COUNT];
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        direction[c] = (INT)(axis[c] * 255.0f);
+    }
+
+    __declspec(align(16)) INT dots[BLOCK_PIXELS];
+    ProjectBlock(pBlock, ORIGIN, direction, dots);
+
+    UINT lowest = 0, highest = 0;
+    for (UINT i = 1; i < BLOCK_PIXELS; ++i)
+    {
+        if (dots[i] < dots[lowest])
+        {
+            lowest = i;
+        }
+        if (dots[i] > dots[highest])
+        {
+            highest = i;
+        }
+    }
+
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        FLOAT low = (FLOAT)GetChannel(pBlock[lowest], c);
+        FLOAT high = (FLOAT)GetChannel(pBlock[highest], c);
+        FLOAT offset = (high - low) * inset;
+
+        pLow[c] = low + offset;
+        pHigh[c] = high - offset;
+    }
+}
+
+inline static UINT QuantizeChannel(__in const FLOAT &value, __in const UINT &maxValue)
+{
+    INT quantized = (INT)(value * maxValue / 255.0f + 0.5f);
+    return (UINT)max(0, min((INT)maxValue, quantized));
+}
+
+static UINT16 ToRGB565(__in_ecount(CHANNEL_COUNT) const FLOAT *pColor)
+{
+    return (UINT16)((QuantizeChannel(pColor[2], 31) << 11) | (QuantizeChannel(pColor[1], 63) << 5) | QuantizeChannel(pColor[0], 31));
+}
+
+static void FromRGB565(__in const UINT16 &packed, __out_ecount(CHANNEL_COUNT) INT *pColor)
+{
+    INT blue = packed & 0x1F, green = (packed >> 5) & 0x3F, red = packed >> 11;
+
+    pColor[0] = (blue << 3) | (blue >> 2);
+    pColor[1] = (green << 2) | (green >> 4);
+    pColor[2] = (red << 3) | (red >> 2);
+}
+
+//-----------------------------------------------------------------------------
+// BC1 block in the four color mode, the first endpoint has to be the larger
+// 565 value. Both endpoints are the same for a block of a single color and
+// all pixels take the first one.
+//-----------------------------------------------------------------------------
+static void CompressBC1Block(__in_ecount(BLOCK_PIXELS) const UINT32 *pBlock, __out_bcount(8) BYTE *pOutput)
+{
+    FLOAT low[CHANNEL_COUNT], high[CHANNEL_COUNT];
+    GetBlockEndpoints(pBlock, 1.0f / 16.0f, low, high);
+
+    UINT16 color0 = ToRGB565(high);
+    UINT16 color1 = ToRGB565(low);
+    if (color0 < color1)
+    {
+        UINT16 swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+
+    UINT32 indices = 0;
+    if (color0 != color1)
+    {
+        INT endpoint0[CHANNEL_COUNT], endpoint1[CHANNEL_COUNT], direction[CHANNEL_COUNT];
+        FromRGB565(color0, endpoint0);
+        FromRGB565(color1, endpoint1);
+
+        INT lengthSquared = 0;
+        for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            direction[c] = endpoint1[c] - endpoint0[c];
+            lengthSquared += direction[c] * direction[c];
+        }
+
+        __declspec(align(16)) INT dots[BLOCK_PIXELS];
+        __declspec(align(16)) UINT steps[BLOCK_PIXELS];
+        ProjectBlock(pBlock, endpoint0, direction, dots);
+        QuantizeDots(dots, lengthSquared, 3, steps);
+
+        // Steps from the first endpoint to the second are the indices 0, 2, 3 and 1
+        static const UINT32 STEP_INDICES[4] = {0, 2, 3, 1};
+        for (UINT i = 0; i < BLOCK_PIXELS; ++i)
+        {
+            indices |= STEP_INDICES[steps[i]] << (i * 2);
+        }
+    }
+
+    pOutput[0] = (BYTE)color0;
+    pOutput[1] = (BYTE)(color0 >> 8);
+    pOutput[2] = (BYTE)color1;
+    pOutput[3] = (BYTE)(color1 >> 8);
+    for (UINT i = 0; i < 4; ++i)
+    {
+        pOutput[4 + i] = (BYTE)(indices >> (i * 8));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Writes the fields of a BC7 block from its lowest bit up
+//-----------------------------------------------------------------------------
+class BlockBitWriter
+{
+    BYTE* m_pBlock;
+    UINT m_Position;
+
+public:
+    BlockBitWriter(__out_bcount(16) BYTE *pBlock) : m_pBlock(pBlock), m_Position(0)
+    {
+        ZeroMemory(pBlock, 16);
+    };
+
+    void Write(__in const UINT &value, __in const UINT &bitCount)
+    {
+        for (UINT i = 0; i < bitCount; ++i, ++m_Position)
+        {
+            m_pBlock[m_Position >> 3] |= (BYTE)(((value >> i) & 1) << (m_Position & 7));
+        }
+    };
+};
+
+//-----------------------------------------------------------------------------
+// Quantize an endpoint to 7 bits per channel. The lowest bit shared by its
+// channels is always 1, it is the lowest bit of alpha too and only with it
+// the alpha of the block is 255.
+//-----------------------------------------------------------------------------
+static void QuantizeBC7Endpoint(__in_ecount(CHANNEL_COUNT) const FLOAT *pColor, __out_ecount(CHANNEL_COUNT) UINT *pQuantized, __out_ecount(CHANNEL_COUNT) INT *pEndpoint)
+{
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        INT value = (INT)((pColor[c] - (FLOAT)BC7_LOWEST_BIT) / 2.0f + 0.5f);
+        pQuantized[c] = (UINT)max(0, min(0x7F, value));
+        pEndpoint[c] = (pQuantized[c] << 1) | BC7_LOWEST_BIT;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// BC7 block in mode 6, the 16 steps between the endpoints suit the smooth
+// gradients of photos. Alpha of both endpoints is 255, 7 bits of 0x7F and
+// the lowest bit 1. The index of the first pixel has its highest bit implied 0, the endpoints are
+// swapped when it would be 1.
+//-----------------------------------------------------------------------------
+static void CompressBC7Block(__in_ecount(BLOCK_PIXELS) const UINT32 *pBlock, __out_bcount(16) BYTE *pOutput)
+{
+    FLOAT low[CHANNEL_COUNT], high[CHANNEL_COUNT];
+    GetBlockEndpoints(pBlock, 1.0f / 32.0f, low, high);
+
+    UINT quantized[2][CHANNEL_COUNT];
+    INT endpoint0[CHANNEL_COUNT], endpoint1[CHANNEL_COUNT], direction[CHANNEL_COUNT];
+    QuantizeBC7Endpoint(low, quantized[0], endpoint0);
+    QuantizeBC7Endpoint(high, quantized[1], endpoint1);
+
+    INT lengthSquared = 0;
+    for (UINT c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        direction[c] = endpoint1[c] - endpoint0[c];
+        lengthSquared += direction[c] * direction[c];
+    }
+
+    __declspec(align(16)) UINT indices[BLOCK_PIXELS] = {0};
+    if (lengthSquared > 0)
+    {
+        __declspec(align(16)) INT dots[BLOCK_PIXELS];
+        ProjectBlock(pBlock, endpoint0, direction, dots);
+        QuantizeDots(dots, lengthSquared, BC7_MAX_INDEX, indices);
+    }
+
+    UINT first = 0;
+    if (indices[0] > BC7_MAX_INDEX / 2)
+    {
+        first = 1;
+        for (UINT i = 0; i < BLOCK_PIXELS; ++i)
+        {
+            indices[i] = BC7_MAX_INDEX - indices[i];
+        }
+    }
+    UINT second = 1 - first;
+
+    BlockBitWriter writer(pOutput);
+    writer.Write(BC7_MODE6, BC7_MODE6_BITS);
+
+    for (INT c = CHANNEL_RED; c >= 0; --c)
+    {
+        writer.Write(quantized[first][c], BC7_MODE6_BITS);
+        writer.Write(quantized[second][c], BC7_MODE6_BITS);
+    }
+
+    writer.Write(0x7F, BC7_MODE6_BITS);
+    writer.Write(0x7F, BC7_MODE6_BITS);
+    writer.Write(BC7_LOWEST_BIT, 1);
+    writer.Write(BC7_LOWEST_BIT, 1);
+
+    writer.Write(indices[0], 3);
+    for (UINT i = 1; i < BLOCK_PIXELS; ++i)
+    {
+        writer.Write(indices[i], 4);
+    }
+}
+
+UINT GetBlockCompressedFormat(__in const TileCodecType &tileCodec)
+{
+    return (tileCodec == TCT_BC1) ? 71 : 98; // 71 == DXGI_FORMAT_BC1_UNORM, 98 == DXGI_FORMAT_BC7_UNORM
+}
+
+void GetBlockCompressedSize(__in const TileCodecType &tileCodec, __in const UINT &width, __in const UINT &height, __out UINT &rowPitch, __out UINT &cbSize)
+{
+    UINT cbBlock = (tileCodec == TCT_BC1) ? 8 : 16;
+
+    rowPitch = (width + BLOCK_SIZE - 1) / BLOCK_SIZE * cbBlock;
+    cbSize = rowPitch * ((height + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+void CompressTileBlocks(__in const TileCodecType &tileCodec, __in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                        __out BYTE *pBlocks, __in const UINT &rowPitch)
+{
+    UINT cbBlock = (tileCodec == TCT_BC1) ? 8 : 16;
+    __declspec(align(16)) UINT32 block[BLOCK_PIXELS];
+
+    for (UINT y = 0; y < height; y += BLOCK_SIZE)
+    {
+        BYTE *pBlockRow = pBlocks + (SIZE_T)(y / BLOCK_SIZE) * rowPitch;
+
+        for (UINT x = 0; x < width; x += BLOCK_SIZE)
+        {
+            LoadBlock(pPixelData, width, height, cbStride, x, y, block);
+
+            if (tileCodec == TCT_BC1)
+            {
+                CompressBC1Block(block, pBlockRow + (x / BLOCK_SIZE) * cbBlock);
+            }
+            else
+            {
+                CompressBC7Block(block, pBlockRow + (x / BLOCK_SIZE) * cbBlock);
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Block compression of tiles for the GPU. Every 4x4 block of BGRX pixels is
+// compressed to one BC1 or BC7 block, the blocks past the right and bottom
+// edge of a tile repeat its last column and row. The endpoints of a block
+// lie on the principal axis of its colors and the pixels are projected on
+// the line between them with SSE2.
+//-----------------------------------------------------------------------------
+
+// Tiles of the block codecs are uploaded to textures as they are stored
+inline BOOL IsBlockCompressedCodec(__in const TileCodecType &tileCodec) { return tileCodec == TCT_BC1 || tileCodec == TCT_BC7; };
+
+// Tiles of the codec are stored uncompressed by the tile container and served straight from its mapping
+inline BOOL IsMappedTileCodec(__in const TileCodecType &tileCodec) { return tileCodec == TCT_RAW || IsBlockCompressedCodec(tileCodec); };
+
+// DXGI format of the tiles of a block codec
+UINT GetBlockCompressedFormat(__in const TileCodecType &tileCodec);
+
+// Pitch of a row of blocks and size of all blocks of a tile
+void GetBlockCompressedSize(__in const TileCodecType &tileCodec, __in const UINT &width, __in const UINT &height, __out UINT &rowPitch, __out UINT &cbSize);
+
+// Compress tile pixels to rows of blocks with the block codec
+void CompressTileBlocks(__in const TileCodecType &tileCodec, __in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                        __out BYTE *pBlocks, __in const UINT &rowPitch);
@@ -20,8 +20,22 @@
 
 #include "stdafx.h"
 #include "DxImage.h"
+#include "PixelBufferPool.h"
+#include "Lz4Codec.h"
 
 
+//-----------------------------------------------------------------------------
+// Number of rows of the pixel data, a row of block compressed formats holds
+// 4 rows of pixels
+//-----------------------------------------------------------------------------
+static UINT GetRowCount(__in const UINT &dxFormat, __in const UINT &height)
+{
+    // 70 - 84 == DXGI_FORMAT_BC1_TYPELESS - DXGI_FORMAT_BC5_SNORM, 94 - 99 == DXGI_FORMAT_BC6H_TYPELESS - DXGI_FORMAT_BC7_UNORM_SRGB
+    BOOL isBlockCompressed = (dxFormat >= 70 && dxFormat <= 84) || (dxFormat >= 94 && dxFormat <= 99);
+
+    return isBlockCompressed ? (height + 3) / 4 : height;
+}
+
 DxImage::DxImage()
 {
     m_Width = 0;
@@ -30,11 +44,29 @@ DxImage::DxImage()
     m_RowPitch = 0;
     m_SlicePitch = 0;
     m_PixelData = NULL;
+    m_pViewData = NULL;
+    m_pBufferPool = NULL;
+    m_CbPixelData = 0;
 }
 
 DxImage::~DxImage()
 {
-    free(m_PixelData);
+    FreePixelData();
+}
+
+void DxImage::FreePixelData()
+{
+    if (m_pBufferPool)
+    {
+        m_pBufferPool->Return(m_PixelData, m_CbPixelData);
+    }
+    else
+    {
+        free(m_PixelData);
+    }
+
+    m_PixelData = NULL;
+    m_pBufferPool = NULL;
 }
 
 HRESULT DxImage::Destroy()
@@ -45,8 +77,10 @@ HRESULT DxImage::Destroy()
     m_RowPitch = 0;
     m_SlicePitch = 0;
 
-    free(m_PixelData);
-    m_PixelData = NULL;
+    FreePixelData();
+
+    m_pViewData = NULL;
+    m_spViewOwner.Release();
 
     return S_OK;
 }
@@ -70,6 +104,59 @@ HRESULT DxImage::Initialize(__in const WICRect &rect, __in const UINT &dxFormat,
     return pConverter->CopyPixels(&rect, m_RowPitch, bufferSize, m_PixelData);
 }
 
+//-----------------------------------------------------------------------------
+// Initialize from pixels already in memory. With an owner the image is just
+// a view and keeps the owner alive, otherwise the pixels are copied.
+//-----------------------------------------------------------------------------
+HRESULT DxImage::Initialize(__in const WICRect &rect, __in const UINT &dxFormat, __in const UINT &rowPitch, __in const BYTE *pPixelData, __in_opt IUnknown *pViewOwner)
+{
+    m_Width = rect.Width;
+    m_Height = rect.Height;
+    m_Format = dxFormat;
+    m_RowPitch = rowPitch;
+
+    if (pViewOwner)
+    {
+        m_spViewOwner = pViewOwner;
+        m_pViewData = pPixelData;
+
+        return S_OK;
+    }
+
+    UINT bufferSize = m_RowPitch * GetRowCount(m_Format, m_Height);
+
+    m_PixelData = reinterpret_cast<BYTE*>(malloc(bufferSize));
+    if (!m_PixelData)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    UINT error = memcpy_s(m_PixelData, bufferSize, pPixelData, bufferSize);
+    return (error == 0) ? S_OK : E_FAIL;
+}
+
+//-----------------------------------------------------------------------------
+// Initialize from an LZ4 tile, decoded straight into a buffer of the pool
+//-----------------------------------------------------------------------------
+HRESULT DxImage::Initialize(__in const WICRect &rect, __in_bcount(cbTileData) const BYTE *pTileData, __in const UINT &cbTileData, __in PixelBufferPool *pBufferPool, __in IUnknown *pPoolOwner)
+{
+    m_Width = rect.Width;
+    m_Height = rect.Height;
+    m_Format = 88; // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+    m_RowPitch = m_Width * 4;
+
+    m_PixelData = pBufferPool->Acquire(m_RowPitch * m_Height, m_CbPixelData);
+    if (!m_PixelData)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    m_pBufferPool = pBufferPool;
+    m_spViewOwner = pPoolOwner;
+
+    return DecompressLz4Tile(pTileData, cbTileData, m_Width, m_Height, m_PixelData, m_RowPitch);
+}
+
 void DxImage::GetSize(__out UINT &width, __out UINT &height)
 {
     width = m_Width;
@@ -88,5 +175,5 @@ UINT DxImage::GetRowPitch()
 
 const UINT8* DxImage::GetPixelData()
 {
-    return m_PixelData;
+    return m_pViewData ? m_pViewData : m_PixelData;
 }
\ No newline at end of file
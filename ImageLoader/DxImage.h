@@ -20,6 +20,8 @@
 
 #pragma once
 
+class PixelBufferPool;
+
 class DxImage : public ImplementSmartObject
     <
         DxImage, 
@@ -34,12 +36,24 @@ class DxImage : public ImplementSmartObject
     UINT        m_RowPitch;
     UINT        m_SlicePitch;
     BYTE*       m_PixelData;
+
+    // Owner of the memory when the pixels are a view, m_PixelData is not freed then
+    SmartPtr<IUnknown> m_spViewOwner;
+    const BYTE* m_pViewData;
+
+    // Pool m_PixelData goes back to, m_spViewOwner keeps the pool alive then
+    PixelBufferPool* m_pBufferPool;
+    UINT m_CbPixelData;
+
+    void FreePixelData();
  
 public:
     DxImage();
     ~DxImage();
 
     HRESULT Initialize(__in const WICRect &rect, __in const UINT &dxFormat, __in const UINT &rowPitch, __deref_in IWICFormatConverter *pConverter);
+    HRESULT Initialize(__in const WICRect &rect, __in const UINT &dxFormat, __in const UINT &rowPitch, __in const BYTE *pPixelData, __in_opt IUnknown *pViewOwner);
+    HRESULT Initialize(__in const WICRect &rect, __in_bcount(cbTileData) const BYTE *pTileData, __in const UINT &cbTileData, __in PixelBufferPool *pBufferPool, __in IUnknown *pPoolOwner);
 
     void GetSize(__out UINT &width, __out UINT &height);
     UINT GetFormat();
@@ -20,6 +20,23 @@
 
 #pragma once
 
+// Declared by wincodec.h, which only the users of CreateImageLoader with a supplied source need
+struct IWICBitmapSource;
+
+enum ImageTileFlags
+{
+    ITF_SOLID_COLOR = 0x1,
+
+    // Tile image is stored as 4x4 blocks of a block codec, padded to whole blocks
+    ITF_BLOCK_COMPRESSED = 0x2,
+};
+
+// Stored as is in the pyramid index file, keep the layout compact
+//
+// X, Y, Width and Height give the area of the level covered by the tile, the
+// tile image also holds the overlap border around it shared with its neighbors.
+// Coordinates are 32 bit like the image size reported by WIC, byte sizes and
+// offsets derived from them are computed in 64 bits.
 struct ImageTileMetadata
 {
     UINT X;
@@ -29,9 +46,263 @@ struct ImageTileMetadata
     UINT Level;
     UINT Row;
     UINT Column;
-    WCHAR TilePath[MAX_PATH];
-    ImageTileMetadata(UINT x, UINT y, UINT width, UINT height) : X(x), Y(y), Width(width), Height(height){};
-    ImageTileMetadata() {ImageTileMetadata(0, 0, 0, 0);};
+    UINT OverlapLeft;
+    UINT OverlapTop;
+    UINT OverlapRight;
+    UINT OverlapBottom;
+
+    // ITF_ flags, and the BGRX color of a solid color tile
+    UINT Flags;
+    UINT SolidColor;
+
+    ImageTileMetadata(UINT x, UINT y, UINT width, UINT height) : X(x), Y(y), Width(width), Height(height), Level(0), Row(0), Column(0), 
+                                                                 OverlapLeft(0), OverlapTop(0), OverlapRight(0), OverlapBottom(0), Flags(0), SolidColor(0) {};
+    ImageTileMetadata() : X(0), Y(0), Width(0), Height(0), Level(0), Row(0), Column(0), OverlapLeft(0), OverlapTop(0), OverlapRight(0), OverlapBottom(0), 
+                          Flags(0), SolidColor(0) {};
+
+    // Size of the tile image including the overlap border
+    UINT GetImageWidth() const { return OverlapLeft + Width + OverlapRight; };
+    UINT GetImageHeight() const { return OverlapTop + Height + OverlapBottom; };
+
+    // Every pixel of the tile image has the SolidColor, the tile is not stored
+    BOOL IsSolidColor() const { return (Flags & ITF_SOLID_COLOR) != 0; };
+
+    // Size of the texture of the tile image, block compressed images are padded to whole 4x4 blocks
+    UINT GetTextureWidth() const { return (Flags & ITF_BLOCK_COMPRESSED) ? (GetImageWidth() + 3) & ~3U : GetImageWidth(); };
+    UINT GetTextureHeight() const { return (Flags & ITF_BLOCK_COMPRESSED) ? (GetImageHeight() + 3) & ~3U : GetImageHeight(); };
+};
+
+enum TileStorageType
+{
+    // One encoded file per tile in the level directories
+    TST_FILES = 0,
+
+    // All encoded tiles appended to one tile container file
+    TST_PACKED = 1,
+};
+
+enum TileCodecType
+{
+    // Tiles encoded in the container format of the source image
+    TCT_SOURCE = 0,
+
+    // Uncompressed BGRX pixels, served straight from the mapped tile container, needs TST_PACKED
+    TCT_RAW = 1,
+
+    // BC1 blocks compressed on the CPU, half a byte per pixel, uploaded to the GPU as they are, needs TST_PACKED
+    TCT_BC1 = 2,
+
+    // BC7 blocks compressed on the CPU, one byte per pixel with better color than BC1, needs TST_PACKED and
+    // a renderer of feature level 11_0, see ImageLoaderOptions::RendererFeatureLevel
+    TCT_BC7 = 3,
+
+    // BGRX pixels compressed with LZ4, several times faster to decode than PNG or TIFF, files or packed
+    TCT_LZ4 = 4,
+
+    // JPEG tiles encoded with the JpegQuality, the smallest tiles of photographic images, lossy
+    TCT_JPEG = 5,
+
+    // PNG tiles encoded with the PngFilter, lossless and smaller than the TIFF or BMP of a source in those formats
+    TCT_PNG = 6,
+};
+
+enum PngFilterType
+{
+    // The encoder picks the row filter
+    PFT_DEFAULT = 0,
+
+    // No filtering, the fastest to encode and the largest tiles
+    PFT_NONE = 1,
+    PFT_SUB = 2,
+    PFT_UP = 3,
+    PFT_AVERAGE = 4,
+    PFT_PAETH = 5,
+
+    // Filter chosen for every row, the slowest to encode and usually the smallest tiles
+    PFT_ADAPTIVE = 6,
+};
+
+enum ReductionFilterType
+{
+    // 2x2 box average, the fastest
+    RFT_BOX = 0,
+
+    // Tent filter over 4x4 source pixels
+    RFT_BILINEAR = 1,
+
+    // Mitchell-Netravali cubic with B = C = 1/3 over 8x8 source pixels
+    RFT_MITCHELL = 2,
+
+    // Lanczos windowed sinc with 3 lobes over 12x12 source pixels, the sharpest
+    RFT_LANCZOS3 = 3,
+};
+
+enum PyramidBuildMode
+{
+    // Decode the source top to bottom in strips, works with any decoder and option
+    PBM_STRIP_SCAN = 0,
+
+    // Decode level 0 tile by tile on a work stealing pool and reduce every tile as soon as its four children
+    // are done. Meant for sources with cheap random access, uncompressed or tiled images, needs RFT_BOX and no overlap.
+    PBM_TILE_PARALLEL = 1,
+};
+
+//-----------------------------------------------------------------------------
+// Options for deep zoom pyramid generation
+//-----------------------------------------------------------------------------
+struct ImageLoaderOptions
+{
+    // Number of threads encoding and writing tiles, 0 == number of logical processors
+    UINT EncoderThreadCount;
+
+    // Number of finished tiles allowed to wait for a free encoder thread
+    UINT EncoderQueueLength;
+
+    // Number of decoded source strips allowed to wait for the downsample stage
+    UINT StripQueueLength;
+
+    // How the encoded tiles are stored next to the source image
+    TileStorageType TileStorage;
+
+    // How the tiles are encoded
+    TileCodecType TileCodec;
+
+    // Quality of TCT_JPEG tiles from 1 to 100, lower quality makes smaller tiles with more artifacts. TCT_SOURCE
+    // tiles of a JPEG source keep the default of the encoder, like the row filter of a PNG source.
+    UINT JpegQuality;
+
+    // Row filter of TCT_PNG tiles, trades encoding time for the size of the tiles
+    PngFilterType PngFilter;
+
+    // Filter reducing each level to the next one
+    ReductionFilterType ReductionFilter;
+
+    // Reduce in linear light instead of averaging sRGB values, keeps the brightness of fine detail. The box
+    // reduction then goes through lookup tables, gathered 8 pixels at a time with AVX2 and one at a time
+    // without, slower than the SIMD kernels either way, PyramidBenchmark -kernels reports the cost.
+    BOOL LinearLightReduction;
+
+    // Size of the tiles, 256, 512, 1024 or 2048 pixels, small tiles fetch less when zoomed in, large tiles make less files
+    UINT TileSize;
+
+    // Pixels each tile repeats from its neighbors on every inner edge, so sampling at the seams stays within one tile
+    UINT TileOverlap;
+
+    // Memory the generation should stay within in megabytes, 0 == no limit. Tile buffers of the widest
+    // levels go through a scratch file until the rest fits, buffers that can't be spilled are always kept.
+    UINT MemoryBudgetMegabytes;
+
+    // How the pyramid is built, both modes generate the same tiles
+    PyramidBuildMode BuildMode;
+
+    // Record tiles of a single color in the tile metadata instead of storing them, sparse pyramids open faster
+    BOOL DetectSolidColorTiles;
+
+    // Store tiles with the same pixels once, a 128 bit hash of the pixels finds them. Packed duplicates share
+    // the location in the tile container, duplicate tile files are hard links, which needs NTFS.
+    BOOL DeduplicateTiles;
+
+    // Publish the top levels from a quick low quality read of the source before the full build, from a decode
+    // scaled by the decoder, a reduced resolution frame or a large enough thumbnail of the source, or from a
+    // supplied source. Other sources would be decoded in full twice and get no overview. The full build replaces them.
+    BOOL ProgressiveOverview;
+
+    // Serve levels the source already holds as reduced resolution frames, like pyramid TIFF, straight from
+    // those frames and only build the levels between them. Needs RFT_BOX and no overlap, ignored otherwise. The
+    // build runs PBM_TILE_PARALLEL once a frame serves a level, sources without one keep the chosen build mode.
+    BOOL UseEmbeddedLevels;
+
+    // D3D_FEATURE_LEVEL of the renderer the tiles are uploaded by, 0 when it is not known. Below 11_0
+    // the GPU can't sample BC7 and TCT_BC7 falls back to TCT_BC1.
+    UINT RendererFeatureLevel;
+
+    ImageLoaderOptions() : EncoderThreadCount(0), EncoderQueueLength(8), StripQueueLength(4), TileStorage(TST_FILES), TileCodec(TCT_SOURCE), 
+                           JpegQuality(90), PngFilter(PFT_DEFAULT), ReductionFilter(RFT_BOX), LinearLightReduction(FALSE), TileSize(1024), TileOverlap(0), 
+                           MemoryBudgetMegabytes(0), BuildMode(PBM_STRIP_SCAN), DetectSolidColorTiles(FALSE), DeduplicateTiles(FALSE), 
+                           ProgressiveOverview(FALSE), UseEmbeddedLevels(FALSE), RendererFeatureLevel(0) {};
+};
+
+//-----------------------------------------------------------------------------
+// Timing of the pyramid generation stages, the stage with the highest busy
+// time and the lowest stall time is the bottleneck
+//-----------------------------------------------------------------------------
+struct PyramidGenerationStatistics
+{
+    // Wall clock time of the whole generation
+    DOUBLE TotalSeconds;
+
+    // Time from the start of the open until the ProgressiveOverview levels were published, the time to first pixel
+    DOUBLE OverviewSeconds;
+
+    // Busy time of each stage, encoding is summed over all encoder threads
+    DOUBLE DecodeSeconds;
+    DOUBLE DownsampleSeconds;
+    DOUBLE EncodeSeconds;
+
+    // Decode waiting for a free strip, downsample waiting for a free encoder job
+    DOUBLE DecodeStallSeconds;
+    DOUBLE DownsampleStallSeconds;
+
+    // Downsample waiting for a decoded strip
+    DOUBLE DownsampleStarveSeconds;
+
+    UINT EncoderThreadCount;
+
+    // Peak working set of the process when the generation finished
+    UINT64 PeakWorkingSetBytes;
+
+    // Levels whose tile buffers went through the scratch file, and the bytes written to it
+    UINT SpilledLevelCount;
+    UINT64 SpilledBytes;
+
+    // Tile jobs a worker of the tile parallel build took from the queue of another worker
+    UINT StolenTileJobCount;
+
+    // Tiles stored as a reference to a tile with the same pixels
+    UINT DuplicateTileCount;
+
+    // Tiles recorded as a color only
+    UINT SolidColorTileCount;
+
+    // Levels served from reduced resolution frames of the source instead of being built
+    UINT EmbeddedLevelCount;
+
+    PyramidGenerationStatistics() : TotalSeconds(0), OverviewSeconds(0), DecodeSeconds(0), DownsampleSeconds(0), EncodeSeconds(0), 
+                                    DecodeStallSeconds(0), DownsampleStallSeconds(0), DownsampleStarveSeconds(0), EncoderThreadCount(0),
+                                    PeakWorkingSetBytes(0), SpilledLevelCount(0), SpilledBytes(0), StolenTileJobCount(0), 
+                                    DuplicateTileCount(0), SolidColorTileCount(0), EmbeddedLevelCount(0) {};
+};
+
+//-----------------------------------------------------------------------------
+// Progress of an open running in the background, generation of the pyramid
+// is most of it. An open served from the manifest completes without progress.
+//-----------------------------------------------------------------------------
+struct PyramidOpenProgress
+{
+    // Source rows decoded, the tile parallel build decodes tiles and reports the rows they add up to
+    UINT DecodedRowCount;
+    UINT RowCount;
+
+    // Tiles reduced and handed over to the encoders, or recorded as a solid color
+    UINT CompletedTileCount;
+    UINT TileCount;
+
+    // Time since the open started and throughput over that time
+    DOUBLE ElapsedSeconds;
+    DOUBLE MegapixelsPerSecond;
+    DOUBLE TilesPerSecond;
+
+    PyramidOpenProgress() : DecodedRowCount(0), RowCount(0), CompletedTileCount(0), TileCount(0), ElapsedSeconds(0), MegapixelsPerSecond(0), TilesPerSecond(0) {};
+};
+
+// Implementations of the 2x2 reduction of pyramid levels
+enum ReductionKernelType
+{
+    RKT_SCALAR = 0,
+    RKT_SSE2 = 1,
+    RKT_AVX2 = 2,
+    RKT_AVX512 = 3,
+    RKT_COUNT = 4,
 };
 
 DECLAREINTERFACE(IDxImage, IUnknown, "{620C3AC9-2C90-4C6A-B0D5-C39408B6B133}")
@@ -43,15 +314,77 @@ DECLAREINTERFACE(IDxImage, IUnknown, "{620C3AC9-2C90-4C6A-B0D5-C39408B6B133}")
     HRESULT Destroy();
 };
 
-DECLAREINTERFACE(IImageLoader, IUnknown, "{CBAAB0D2-7090-4E4C-B768-557F3DC0BDA2}")
+DECLAREINTERFACE(IImageLoader, IUnknown, "{484FCB5D-6223-43AB-B32B-2E79DCB080E4}")
 {
+    // Open and OpenAsync fail with E_ILLEGAL_METHOD_CALL while another open of the loader runs
     HRESULT Open();
+
+    // Open on a background thread, the event is set once the open finished and GetOpenResult has its result.
+    // Until then the loader only serves GetOpenProgress, GetOpenResult and CancelOpen. A cancelled open
+    // fails with HRESULT_FROM_WIN32(ERROR_CANCELLED) and leaves no manifest, so the next open generates again.
+    // With ProgressiveOverview the overview event is set once the top levels can be served, before the open finished.
+    // It is set right away when the source has no quick overview and once the open finished at the latest.
+    HRESULT OpenAsync(__in_opt HANDLE hOpenedEvent, __in_opt HANDLE hOverviewEvent);
+    HRESULT CancelOpen();
+    HRESULT GetOpenProgress(__out PyramidOpenProgress &progress);
+
+    // E_PENDING while the open runs, S_OK or the error of the open once it finished
+    HRESULT GetOpenResult();
+
+    // Finest level whose tiles can be got, 0 once the open succeeded, the first overview level while only the
+    // overview is published, GetLevelCount when there is none. Metadata of all levels is valid from the overview on.
+    UINT GetFirstAvailableLevel();
+
     HRESULT Destroy();
     UINT GetLevelCount();
     HRESULT GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height);
     HRESULT GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount);
     HRESULT GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata);
     HRESULT GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage);
+    HRESULT GetGenerationStatistics(__out PyramidGenerationStatistics &statistics);
+
+    // Sharded generation for a pyramid split between processes or machines sharing the pyramid directory.
+    // Every shard builds the tiles depending on its band of level 0 tile rows only and keeps tiles on the
+    // seams between bands, the merge runs once all shards are done, builds the rest and writes the manifest.
+    // Builds the same tiles as PBM_TILE_PARALLEL with the same options, and also needs TST_FILES.
+    HRESULT BuildShard(__in const UINT &shardIndex, __in const UINT &shardCount);
+    HRESULT MergeShards(__in const UINT &shardCount);
+
+    // Update an open pyramid after a rectangle of the source changed, only the level 0 tiles over it are decoded
+    // again and only their parents in every level are reduced again. Needs a finished open, RFT_BOX, no overlap
+    // and a lossless tile codec, TCT_SOURCE of a JPEG is lossy too, and the source must keep its size. Tile metadata
+    // got before stays valid and is updated in place, raw tile images got before are invalidated. Tiles can be got
+    // while it runs, it fails with E_ILLEGAL_METHOD_CALL while an open or another update runs.
+    HRESULT UpdateDirtyRect(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height);
+
+    // Time getting every tile image of a level and add up the bytes its tiles are stored in, for comparing
+    // the tile codecs of pyramids built from the same source
+    HRESULT BenchmarkLevelDecode(__in const UINT &level, __out DOUBLE &averageMilliseconds, __out UINT64 &cbStored);
 };
 
-HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __deref_out IImageLoader **ppResult);
\ No newline at end of file
+// Create a loader of the file, a Deep Zoom descriptor (.dzi), a Zoomify ImageProperties.xml or an IIIF info.json
+// opens the existing tile tree next to it as the pyramid, without generating anything
+HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __deref_out IImageLoader **ppResult);
+HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions &options, __deref_out IImageLoader **ppResult);
+
+// Create a loader generating the pyramid of a source in memory or computed on the fly, the file path only names
+// the pyramid next to it. Tiles are decoded from the source by several threads at once, so its CopyPixels has to be
+// thread safe. The pyramid is generated again on every open, and the tiles need a codec other than TCT_SOURCE.
+HRESULT CreateImageLoader(__in IWICBitmapSource *pSource, __in_z const WCHAR *pFilePath, __in const ImageLoaderOptions &options, __deref_out IImageLoader **ppResult);
+
+//-----------------------------------------------------------------------------
+// Reduction kernel self checks, a kernel the processor does not support
+// fails with E_NOTIMPL. PyramidBenchmark -kernels runs them all.
+//-----------------------------------------------------------------------------
+
+// Throughput of a kernel over a synthetic level, in gigabytes of source pixels per second
+HRESULT BenchmarkReductionKernel(__in const ReductionKernelType &kernel, __out DOUBLE &gigabytesPerSecond);
+
+// Throughput of the linear light box reduction, compare with the widest kernel for its cost
+HRESULT BenchmarkLinearLightReduction(__out DOUBLE &gigabytesPerSecond);
+
+// Compare output of a kernel with the scalar kernel over random rows of all widths, S_FALSE when it differs
+HRESULT VerifyReductionKernel(__in const ReductionKernelType &kernel);
+
+// Compare output of the linear light reduction with its scalar version, S_FALSE when it differs
+HRESULT VerifyLinearLightReduction();
@@ -0,0 +1,1079 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "DxImage.h"
+#include "ImageLoaderTileTree.h"
+
+//-----------------------------------------------------------------------------
+// Read a small text file to a zero terminated buffer
+//-----------------------------------------------------------------------------
+static HRESULT ReadTextFile(__in_z const WCHAR *pFilePath, __in const UINT &cbMax, __out Vector<CHAR> &text)
+{
+    HANDLE hFile = CreateFile(pFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (fileSize.QuadPart > cbMax)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = text.SetSize((UINT)fileSize.QuadPart + 1);
+    }
+
+    DWORD cbRead = 0;
+    if (SUCCEEDED(hr) && !ReadFile(hFile, text.Ptr(), (DWORD)fileSize.QuadPart, &cbRead, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+    IF_FAILED_RETURN(hr);
+
+    text[cbRead] = '\0';
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Parse decimal digits to a UINT, fails on anything else and on overflow
+//-----------------------------------------------------------------------------
+static BOOL ParseDecimal(__in_ecount(length) const CHAR *pDigits, __in const SIZE_T &length, __out UINT &value)
+{
+    UINT64 result = 0;
+    for (SIZE_T i = 0; i < length; ++i)
+    {
+        if (pDigits[i] < '0' || pDigits[i] > '9')
+        {
+            return FALSE;
+        }
+
+        result = result * 10 + (pDigits[i] - '0');
+        if (result > UINT_MAX)
+        {
+            return FALSE;
+        }
+    }
+
+    value = (UINT)result;
+
+    return length > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Find an attribute of the first element of the given name. Descriptors of
+// the tile trees are a few elements with attributes, the element name may
+// have a namespace prefix and names are compared without case.
+//-----------------------------------------------------------------------------
+static BOOL FindXmlAttribute(__in_z const CHAR *pText, __in_z const CHAR *pElement, __in_z const CHAR *pAttribute, 
+                             __out_ecount_z(size) CHAR *pValue, __in const UINT &size)
+{
+    SIZE_T elementLength = strlen(pElement);
+    SIZE_T attributeLength = strlen(pAttribute);
+
+    for (const CHAR *pTag = strchr(pText, '<'); pTag; pTag = strchr(pTag + 1, '<'))
+    {
+        const CHAR *pName = pTag + 1;
+        SIZE_T nameLength = strcspn(pName, " \t\r\n/>");
+
+        const CHAR *pLocalName = pName;
+        for (SIZE_T i = 0; i < nameLength; ++i)
+        {
+            if (pName[i] == ':')
+            {
+                pLocalName = pName + i + 1;
+            }
+        }
+
+        if ((SIZE_T)(pName + nameLength - pLocalName) != elementLength || _strnicmp(pLocalName, pElement, elementLength) != 0)
+        {
+            continue;
+        }
+
+        const CHAR *p = pName + nameLength;
+        for (;;)
+        {
+            p += strspn(p, " \t\r\n");
+
+            const CHAR *pAttributeName = p;
+            SIZE_T attributeNameLength = strcspn(p, " \t\r\n=/>");
+            p += attributeNameLength;
+            p += strspn(p, " \t\r\n");
+
+            // End of the start tag
+            if (attributeNameLength == 0 || *p != '=')
+            {
+                return FALSE;
+            }
+
+            p++;
+            p += strspn(p, " \t\r\n");
+
+            CHAR quote = *p;
+            const CHAR *pValueEnd = (quote == '"' || quote == '\'') ? strchr(p + 1, quote) : NULL;
+            if (!pValueEnd)
+            {
+                return FALSE;
+            }
+
+            if (attributeNameLength == attributeLength && _strnicmp(pAttributeName, pAttribute, attributeLength) == 0)
+            {
+                SIZE_T valueLength = pValueEnd - p - 1;
+                if (valueLength >= size)
+                {
+                    return FALSE;
+                }
+
+                memcpy(pValue, p + 1, valueLength);
+                pValue[valueLength] = '\0';
+
+                return TRUE;
+            }
+
+            p = pValueEnd + 1;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOL FindXmlAttribute(__in_z const CHAR *pText, __in_z const CHAR *pElement, __in_z const CHAR *pAttribute, __out UINT &value)
+{
+    CHAR strValue[16];
+    return FindXmlAttribute(pText, pElement, pAttribute, strValue, ARRAYSIZE(strValue)) && ParseDecimal(strValue, strlen(strValue), value);
+}
+
+//-----------------------------------------------------------------------------
+// Just enough of JSON to read the IIIF image information. Each function takes
+// the text at the value and returns the text after it, NULL when malformed.
+//-----------------------------------------------------------------------------
+static const CHAR* SkipJsonWhitespace(__in_z const CHAR *p)
+{
+    return p + strspn(p, " \t\r\n");
+}
+
+static const CHAR* SkipJsonString(__in_z const CHAR *p)
+{
+    for (++p; *p; ++p)
+    {
+        if (*p == '\\' && *(p + 1))
+        {
+            ++p;
+        }
+        else if (*p == '"')
+        {
+            return p + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static const CHAR* SkipJsonValue(__in_z const CHAR *p)
+{
+    p = SkipJsonWhitespace(p);
+
+    if (*p == '"')
+    {
+        return SkipJsonString(p);
+    }
+
+    // Objects and arrays with everything nested in them
+    if (*p == '{' || *p == '[')
+    {
+        UINT depth = 0;
+        while (*p)
+        {
+            if (*p == '"')
+            {
+                p = SkipJsonString(p);
+                if (!p)
+                {
+                    return NULL;
+                }
+                continue;
+            }
+
+            if (*p == '{' || *p == '[')
+            {
+                depth++;
+            }
+            else if ((*p == '}' || *p == ']') && --depth == 0)
+            {
+                return p + 1;
+            }
+
+            ++p;
+        }
+
+        return NULL;
+    }
+
+    // Numbers and literals
+    SIZE_T length = strcspn(p, ",}] \t\r\n");
+    return (length > 0) ? p + length : NULL;
+}
+
+// Read the key of an object member and its colon, keys longer than the buffer are cut
+static const CHAR* ReadJsonKey(__in_z const CHAR *p, __out_ecount_z(size) CHAR *pKey, __in const UINT &size)
+{
+    p = SkipJsonWhitespace(p);
+    if (*p != '"')
+    {
+        return NULL;
+    }
+
+    const CHAR *pEnd = SkipJsonString(p);
+    if (!pEnd)
+    {
+        return NULL;
+    }
+
+    SIZE_T length = min((SIZE_T)(pEnd - p - 2), (SIZE_T)size - 1);
+    memcpy(pKey, p + 1, length);
+    pKey[length] = '\0';
+
+    p = SkipJsonWhitespace(pEnd);
+    return (*p == ':') ? p + 1 : NULL;
+}
+
+static const CHAR* ReadJsonUint(__in_z const CHAR *p, __out UINT &value)
+{
+    p = SkipJsonWhitespace(p);
+
+    SIZE_T length = strspn(p, "0123456789");
+    return ParseDecimal(p, length, value) ? p + length : NULL;
+}
+
+// Go to the next member or element after a comma, or past the closing bracket
+static const CHAR* NextJsonItem(__in_z const CHAR *p, __in const CHAR &closing, __out BOOL &isLast)
+{
+    p = SkipJsonWhitespace(p);
+    isLast = (*p == closing);
+
+    return (*p == ',' || *p == closing) ? p + 1 : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Read the first tiles entry of IIIF image information, the tile size and the
+// scale factors it comes in, each power of 2 scale factor sets its bit
+//-----------------------------------------------------------------------------
+static const CHAR* ReadIiifTiles(__in_z const CHAR *p, __out UINT &tileWidth, __out UINT &tileHeight, __out UINT &scaleFactorMask)
+{
+    p = SkipJsonWhitespace(p);
+    if (*p != '[')
+    {
+        return NULL;
+    }
+
+    p = SkipJsonWhitespace(p + 1);
+    if (*p != '{')
+    {
+        return NULL;
+    }
+
+    BOOL isLast = FALSE;
+    for (p = SkipJsonWhitespace(p + 1); p && *p != '}' && !isLast; )
+    {
+        CHAR key[32];
+        p = ReadJsonKey(p, key, ARRAYSIZE(key));
+        if (!p)
+        {
+            return NULL;
+        }
+
+        if (strcmp(key, "width") == 0)
+        {
+            p = ReadJsonUint(p, tileWidth);
+        }
+        else if (strcmp(key, "height") == 0)
+        {
+            p = ReadJsonUint(p, tileHeight);
+        }
+        else if (strcmp(key, "scaleFactors") == 0)
+        {
+            p = SkipJsonWhitespace(p);
+            if (*p != '[')
+            {
+                return NULL;
+            }
+
+            BOOL isLastFactor = FALSE;
+            for (p = SkipJsonWhitespace(p + 1); p && *p != ']' && !isLastFactor; )
+            {
+                UINT scaleFactor = 0;
+                p = ReadJsonUint(p, scaleFactor);
+                if (p && scaleFactor != 0 && (scaleFactor & (scaleFactor - 1)) == 0)
+                {
+                    DWORD bit = 0;
+                    _BitScanForward(&bit, scaleFactor);
+                    scaleFactorMask |= 1U << bit;
+                }
+
+                p = p ? NextJsonItem(p, ']', isLastFactor) : NULL;
+            }
+
+            // Empty array
+            p = (p && !isLastFactor) ? p + 1 : p;
+        }
+        else
+        {
+            p = SkipJsonValue(p);
+        }
+
+        p = p ? NextJsonItem(p, '}', isLast) : NULL;
+    }
+
+    if (!p)
+    {
+        return NULL;
+    }
+
+    // Empty object
+    p = isLast ? p : p + 1;
+
+    // Tile sizes after the first one are not used
+    for (p = SkipJsonWhitespace(p); p && *p == ','; p = SkipJsonWhitespace(p))
+    {
+        p = SkipJsonValue(p + 1);
+    }
+
+    return (p && *p == ']') ? p + 1 : NULL;
+}
+
+ImageLoaderTileTree::ImageLoaderTileTree()
+{
+    m_Layout = TTL_DEEP_ZOOM;
+    m_TileFormat[0] = L'\0';
+    m_ImageWidth = 0;
+    m_ImageHeight = 0;
+    m_TileWidth = 0;
+    m_TileHeight = 0;
+    m_TileOverlap = 0;
+    m_IsIiifWidthHeight = FALSE;
+    m_OpenResult = S_OK;
+}
+
+ImageLoaderTileTree::~ImageLoaderTileTree()
+{
+    ReleaseLevels();
+}
+
+HRESULT ImageLoaderTileTree::Initialize(__in_z const WCHAR *pFilePath, __in const TileTreeLayoutType &layout)
+{
+    m_Layout = layout;
+
+    HRESULT hr = m_FilePath.Set(pFilePath);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_LevelLock.Initialize();
+    IF_FAILED_RETURN(hr);
+
+    return CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&m_spImagingFactory);
+}
+
+//-----------------------------------------------------------------------------
+// Tile trees are recognized by the name of their descriptor
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::DetectLayout(__in_z const WCHAR *pFilePath, __out TileTreeLayoutType &layout)
+{
+    WCHAR pFileName[MAX_PATH] = L"";
+    WCHAR pExtension[MAX_PATH] = L"";
+
+    UINT error = _wsplitpath_s(pFilePath, NULL, 0, NULL, 0, pFileName, MAX_PATH, pExtension, MAX_PATH);
+    if (error != 0)
+    {
+        return S_FALSE;
+    }
+
+    if (_wcsicmp(pExtension, L".dzi") == 0)
+    {
+        layout = TTL_DEEP_ZOOM;
+        return S_OK;
+    }
+
+    if (_wcsicmp(pFileName, L"ImageProperties") == 0 && _wcsicmp(pExtension, L".xml") == 0)
+    {
+        layout = TTL_ZOOMIFY;
+        return S_OK;
+    }
+
+    if (_wcsicmp(pFileName, L"info") == 0 && _wcsicmp(pExtension, L".json") == 0)
+    {
+        layout = TTL_IIIF;
+        return S_OK;
+    }
+
+    return S_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// Read the descriptor and lay out the levels, the tiles are only touched when
+// they are got. IIIF trees are probed for the form of the tile size once.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::Open()
+{
+    ReleaseLevels();
+
+    HRESULT hr = ReadDescriptor();
+
+    if (SUCCEEDED(hr) && m_Layout == TTL_IIIF)
+    {
+        ImageTileMetadata *pTile = NULL;
+        hr = GetTileMetadata(m_Levels.Length() - 1, 0, 0, &pTile);
+
+        WCHAR tilePath[MAX_PATH] = L"";
+        if (SUCCEEDED(hr))
+        {
+            hr = GetIiifTilePath(*pTile, FALSE, MAX_PATH, tilePath);
+        }
+
+        // A tree with the tiles missing fails once they are got, like the other layouts
+        if (SUCCEEDED(hr) && GetFileAttributes(tilePath) == INVALID_FILE_ATTRIBUTES && SUCCEEDED(GetIiifTilePath(*pTile, TRUE, MAX_PATH, tilePath)))
+        {
+            m_IsIiifWidthHeight = (GetFileAttributes(tilePath) != INVALID_FILE_ATTRIBUTES);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        ReleaseLevels();
+    }
+
+    m_OpenResult = hr;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Opening a tile tree is reading its descriptor, so it runs right away and
+// the event is set before returning
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::OpenAsync(__in_opt HANDLE hOpenedEvent, __in_opt HANDLE hOverviewEvent)
+{
+    Open();
+
+    // The tile tree has no overview, its levels are all there once it is open
+    if (hOverviewEvent)
+    {
+        SetEvent(hOverviewEvent);
+    }
+
+    if (hOpenedEvent)
+    {
+        SetEvent(hOpenedEvent);
+    }
+
+    return S_OK;
+}
+
+HRESULT ImageLoaderTileTree::CancelOpen()
+{
+    return S_FALSE;
+}
+
+HRESULT ImageLoaderTileTree::GetOpenProgress(__out PyramidOpenProgress &progress)
+{
+    progress = PyramidOpenProgress();
+    return S_OK;
+}
+
+HRESULT ImageLoaderTileTree::GetOpenResult()
+{
+    return m_OpenResult;
+}
+
+UINT ImageLoaderTileTree::GetFirstAvailableLevel()
+{
+    return (m_OpenResult == S_OK) ? 0 : m_Levels.Length();
+}
+
+HRESULT ImageLoaderTileTree::Destroy()
+{
+    m_ImageHeight = 0;
+    m_ImageWidth = 0;
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Read the descriptor of the tile tree, the path of the tiles is relative to it
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::ReadDescriptor()
+{
+    WCHAR pDrive[5] = L"";
+    WCHAR pDirectory[MAX_PATH] = L"";
+    WCHAR pFileName[MAX_PATH] = L"";
+
+    UINT error = _wsplitpath_s(m_FilePath.GetBuffer(), pDrive, 5, pDirectory, MAX_PATH, pFileName, MAX_PATH, NULL, 0);
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    HRESULT hr = m_TileDirectory.Set(pDrive);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_TileDirectory.Concat(pDirectory);
+    IF_FAILED_RETURN(hr);
+
+    // Deep Zoom tiles are in the _files directory named after the descriptor
+    if (m_Layout == TTL_DEEP_ZOOM)
+    {
+        hr = m_TileDirectory.Concat(pFileName);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_TileDirectory.Concat(L"_files\\");
+        IF_FAILED_RETURN(hr);
+    }
+
+    Vector<CHAR> text;
+    hr = ReadTextFile(m_FilePath.GetBuffer(), MAX_DESCRIPTOR_SIZE, text);
+    IF_FAILED_RETURN(hr);
+
+    switch (m_Layout)
+    {
+    case TTL_DEEP_ZOOM:
+        return ReadDeepZoomDescriptor(text.Ptr());
+
+    case TTL_ZOOMIFY:
+        return ReadZoomifyDescriptor(text.Ptr());
+
+    case TTL_IIIF:
+        return ReadIiifDescriptor(text.Ptr());
+
+    default:
+        return E_INVALIDARG;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Deep Zoom levels halve the size rounding up down to 1x1, the levels of more
+// than one tile are loaded, finest first
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::ReadDeepZoomDescriptor(__in_z const CHAR *pText)
+{
+    CHAR format[ARRAYSIZE(m_TileFormat)];
+    if (!FindXmlAttribute(pText, "Image", "TileSize", m_TileWidth) || !FindXmlAttribute(pText, "Image", "Overlap", m_TileOverlap) ||
+        !FindXmlAttribute(pText, "Image", "Format", format, ARRAYSIZE(format)) || 
+        !FindXmlAttribute(pText, "Size", "Width", m_ImageWidth) || !FindXmlAttribute(pText, "Size", "Height", m_ImageHeight))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // The format becomes the extension of the tile files
+    for (UINT i = 0; i < ARRAYSIZE(format); ++i)
+    {
+        if (format[i] != '\0' && !isalnum((UCHAR)format[i]))
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        m_TileFormat[i] = (WCHAR)format[i];
+        if (format[i] == '\0')
+        {
+            break;
+        }
+    }
+
+    m_TileHeight = m_TileWidth;
+    if (m_TileWidth == 0 || m_TileOverlap >= m_TileWidth || m_ImageWidth == 0 || m_ImageHeight == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    UINT maxLevel = 0;
+    while (((UINT64)1 << maxLevel) < max(m_ImageWidth, m_ImageHeight))
+    {
+        maxLevel++;
+    }
+
+    HRESULT hr = S_OK;
+    for (UINT level = 0; level <= maxLevel; ++level)
+    {
+        UINT width = (UINT)(((UINT64)m_ImageWidth + ((UINT64)1 << level) - 1) >> level);
+        UINT height = (UINT)(((UINT64)m_ImageHeight + ((UINT64)1 << level) - 1) >> level);
+
+        hr = AddLevel(width, height, maxLevel - level);
+        IF_FAILED_RETURN(hr);
+
+        if (width <= m_TileWidth && height <= m_TileHeight)
+        {
+            break;
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Zoomify levels halve the size rounding down until it fits one tile, zoom 0
+// is the smallest one. Tiles are numbered from the smallest level on, row by
+// row, and every ZOOMIFY_TILE_GROUP_SIZE of them share a TileGroup directory.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::ReadZoomifyDescriptor(__in_z const CHAR *pText)
+{
+    if (!FindXmlAttribute(pText, "IMAGE_PROPERTIES", "WIDTH", m_ImageWidth) || !FindXmlAttribute(pText, "IMAGE_PROPERTIES", "HEIGHT", m_ImageHeight) ||
+        !FindXmlAttribute(pText, "IMAGE_PROPERTIES", "TILESIZE", m_TileWidth))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    m_TileHeight = m_TileWidth;
+    m_TileOverlap = 0;
+    if (m_TileWidth == 0 || m_ImageWidth == 0 || m_ImageHeight == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    HRESULT hr = wcscpy_s(m_TileFormat, ARRAYSIZE(m_TileFormat), L"jpg") == 0 ? S_OK : E_FAIL;
+    IF_FAILED_RETURN(hr);
+
+    UINT width = m_ImageWidth;
+    UINT height = m_ImageHeight;
+    for (;;)
+    {
+        hr = AddLevel(width, height, 0);
+        IF_FAILED_RETURN(hr);
+
+        if (width <= m_TileWidth && height <= m_TileHeight)
+        {
+            break;
+        }
+
+        // Keep a pixel of a narrow image
+        width = max(width >> 1, 1U);
+        height = max(height >> 1, 1U);
+    }
+
+    UINT64 firstTreeTile = 0;
+    for (UINT level = m_Levels.Length(); level-- > 0; )
+    {
+        TileTreeLevel &levelLayout = m_Levels[level];
+        levelLayout.TreeLevel = m_Levels.Length() - 1 - level;
+        levelLayout.FirstTreeTile = firstTreeTile;
+
+        firstTreeTile += (UINT64)levelLayout.ColumnCount * levelLayout.RowCount;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// IIIF levels are the power of 2 scale factors of the tiles from 1 on, each
+// scaled size rounds up. Regions of the tiles are in source pixels.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::ReadIiifDescriptor(__in_z const CHAR *pText)
+{
+    const CHAR *p = SkipJsonWhitespace(pText);
+    if (*p != '{')
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    UINT scaleFactorMask = 0;
+
+    BOOL isLast = FALSE;
+    for (p = SkipJsonWhitespace(p + 1); p && *p != '}' && !isLast; )
+    {
+        CHAR key[32];
+        p = ReadJsonKey(p, key, ARRAYSIZE(key));
+        if (!p)
+        {
+            break;
+        }
+
+        if (strcmp(key, "width") == 0)
+        {
+            p = ReadJsonUint(p, m_ImageWidth);
+        }
+        else if (strcmp(key, "height") == 0)
+        {
+            p = ReadJsonUint(p, m_ImageHeight);
+        }
+        else if (strcmp(key, "tiles") == 0)
+        {
+            p = ReadIiifTiles(p, m_TileWidth, m_TileHeight, scaleFactorMask);
+        }
+        else
+        {
+            p = SkipJsonValue(p);
+        }
+
+        p = p ? NextJsonItem(p, '}', isLast) : NULL;
+    }
+
+    // Tiles are square when their height is left out
+    m_TileHeight = (m_TileHeight == 0) ? m_TileWidth : m_TileHeight;
+    m_TileOverlap = 0;
+    if (!p || m_TileWidth == 0 || m_ImageWidth == 0 || m_ImageHeight == 0 || (scaleFactorMask & 1) == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    HRESULT hr = wcscpy_s(m_TileFormat, ARRAYSIZE(m_TileFormat), L"jpg") == 0 ? S_OK : E_FAIL;
+    IF_FAILED_RETURN(hr);
+
+    for (UINT level = 0; level < 32 && (scaleFactorMask & (1U << level)); ++level)
+    {
+        UINT width = (UINT)(((UINT64)m_ImageWidth + ((UINT64)1 << level) - 1) >> level);
+        UINT height = (UINT)(((UINT64)m_ImageHeight + ((UINT64)1 << level) - 1) >> level);
+
+        hr = AddLevel(width, height, 1U << level);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Add the next smaller level, rows get their tile metadata on the first tile
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::AddLevel(__in const UINT &width, __in const UINT &height, __in const UINT &treeLevel)
+{
+    TileTreeLevel levelLayout;
+    levelLayout.ImageWidth = width;
+    levelLayout.ImageHeight = height;
+    levelLayout.ColumnCount = (UINT)(((UINT64)width + m_TileWidth - 1) / m_TileWidth);
+    levelLayout.RowCount = (UINT)(((UINT64)height + m_TileHeight - 1) / m_TileHeight);
+    levelLayout.TreeLevel = treeLevel;
+    levelLayout.FirstTreeTile = 0;
+
+    levelLayout.Rows = new ImageTileMetadata*[levelLayout.RowCount];
+    if (!levelLayout.Rows)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory(levelLayout.Rows, (SIZE_T)levelLayout.RowCount * sizeof(ImageTileMetadata*));
+
+    HRESULT hr = m_Levels.Add(levelLayout);
+    if (FAILED(hr))
+    {
+        delete[] levelLayout.Rows;
+    }
+
+    return hr;
+}
+
+void ImageLoaderTileTree::ReleaseLevels()
+{
+    for (UINT level = 0; level < m_Levels.Length(); ++level)
+    {
+        TileTreeLevel &levelLayout = m_Levels[level];
+        for (UINT row = 0; row < levelLayout.RowCount; ++row)
+        {
+            delete[] levelLayout.Rows[row];
+        }
+
+        delete[] levelLayout.Rows;
+    }
+
+    m_Levels.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Get metadata of a tile, the metadata of its row is computed on the first
+// tile of the row and stays until the levels are released
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::GetTileMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out ImageTileMetadata **ppTileMetadata)
+{
+    AutoCriticalSection lock(m_LevelLock);
+
+    TileTreeLevel &levelLayout = m_Levels[level];
+    if (!levelLayout.Rows[row])
+    {
+        ImageTileMetadata *pRow = new ImageTileMetadata[levelLayout.ColumnCount];
+        if (!pRow)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        // Tiles repeat the overlap from their neighbors, the edges of the level have none
+        for (UINT i = 0; i < levelLayout.ColumnCount; ++i)
+        {
+            ImageTileMetadata &tile = pRow[i];
+            tile.X = i * m_TileWidth;
+            tile.Y = row * m_TileHeight;
+            tile.Width = min(m_TileWidth, levelLayout.ImageWidth - tile.X);
+            tile.Height = min(m_TileHeight, levelLayout.ImageHeight - tile.Y);
+            tile.Level = level;
+            tile.Row = row;
+            tile.Column = i;
+            tile.OverlapLeft = min(m_TileOverlap, tile.X);
+            tile.OverlapTop = min(m_TileOverlap, tile.Y);
+            tile.OverlapRight = min(m_TileOverlap, levelLayout.ImageWidth - tile.X - tile.Width);
+            tile.OverlapBottom = min(m_TileOverlap, levelLayout.ImageHeight - tile.Y - tile.Height);
+        }
+
+        levelLayout.Rows[row] = pRow;
+    }
+
+    *ppTileMetadata = &levelLayout.Rows[row][column];
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Get path of the file of a tile in the layout of the tree
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::GetTilePath(__in const ImageTileMetadata &tile, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pTilePath)
+{
+    const TileTreeLevel &levelLayout = m_Levels[tile.Level];
+    INT length = -1;
+
+    switch (m_Layout)
+    {
+    case TTL_DEEP_ZOOM:
+        length = swprintf_s(pTilePath, size, L"%s%u\\%u_%u.%s", m_TileDirectory.GetBuffer(), levelLayout.TreeLevel, tile.Column, tile.Row, m_TileFormat);
+        break;
+
+    case TTL_ZOOMIFY:
+        {
+            UINT64 treeTile = levelLayout.FirstTreeTile + (UINT64)tile.Row * levelLayout.ColumnCount + tile.Column;
+            length = swprintf_s(pTilePath, size, L"%sTileGroup%I64u\\%u-%u-%u.%s", m_TileDirectory.GetBuffer(), treeTile / ZOOMIFY_TILE_GROUP_SIZE, 
+                                levelLayout.TreeLevel, tile.Column, tile.Row, m_TileFormat);
+        }
+        break;
+
+    case TTL_IIIF:
+        return GetIiifTilePath(tile, m_IsIiifWidthHeight, size, pTilePath);
+    }
+
+    return (length < 0) ? E_FAIL : S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Get path of an IIIF tile, the region is in source pixels and the size is
+// "w," as in IIIF 2 or "w,h" as in IIIF 3. A region of the whole image is
+// named full, if there is a file of that name.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::GetIiifTilePath(__in const ImageTileMetadata &tile, __in const BOOL &isWidthHeight, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pTilePath)
+{
+    UINT scaleFactor = m_Levels[tile.Level].TreeLevel;
+    UINT64 regionX = (UINT64)tile.X * scaleFactor;
+    UINT64 regionY = (UINT64)tile.Y * scaleFactor;
+    UINT64 regionWidth = min((UINT64)m_TileWidth * scaleFactor, m_ImageWidth - regionX);
+    UINT64 regionHeight = min((UINT64)m_TileHeight * scaleFactor, m_ImageHeight - regionY);
+
+    WCHAR strSize[32];
+    INT length = isWidthHeight ? swprintf_s(strSize, ARRAYSIZE(strSize), L"%u,%u", tile.Width, tile.Height) : swprintf_s(strSize, ARRAYSIZE(strSize), L"%u,", tile.Width);
+    if (length < 0)
+    {
+        return E_FAIL;
+    }
+
+    if (regionWidth == m_ImageWidth && regionHeight == m_ImageHeight)
+    {
+        length = swprintf_s(pTilePath, size, L"%sfull\\%s\\0\\default.%s", m_TileDirectory.GetBuffer(), strSize, m_TileFormat);
+        if (length >= 0 && GetFileAttributes(pTilePath) != INVALID_FILE_ATTRIBUTES)
+        {
+            return S_OK;
+        }
+    }
+
+    length = swprintf_s(pTilePath, size, L"%s%I64u,%I64u,%I64u,%I64u\\%s\\0\\default.%s", m_TileDirectory.GetBuffer(), regionX, regionY, regionWidth, regionHeight, 
+                        strSize, m_TileFormat);
+
+    return (length < 0) ? E_FAIL : S_OK;
+}
+
+UINT ImageLoaderTileTree::GetLevelCount()
+{
+    return m_Levels.Length();
+}
+
+HRESULT ImageLoaderTileTree::GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height)
+{
+    if (level >= m_Levels.Length())
+    {
+        return E_INVALIDARG;
+    }
+
+    width = m_Levels[level].ImageWidth;
+    height = m_Levels[level].ImageHeight;
+
+    return S_OK;
+}
+
+HRESULT ImageLoaderTileTree::GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount)
+{
+    if (level >= m_Levels.Length())
+    {
+        return E_INVALIDARG;
+    }
+
+    rowCount = m_Levels[level].RowCount;
+    columnCount = m_Levels[level].ColumnCount;
+
+    return S_OK;
+}
+
+HRESULT ImageLoaderTileTree::GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata)
+{
+    if ((level >= m_Levels.Length()) || (row >= m_Levels[level].RowCount) || (column >= m_Levels[level].ColumnCount))
+    {
+        return E_INVALIDARG;
+    }
+
+    ImageTileMetadata *pTile = NULL;
+    HRESULT hr = GetTileMetadata(level, row, column, &pTile);
+    IF_FAILED_RETURN(hr);
+
+    *ppTileMetadata = pTile;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Decode the file of a tile, the image holds the tile with its overlap border
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage)
+{
+    if ((level >= m_Levels.Length()) || (row >= m_Levels[level].RowCount) || (column >= m_Levels[level].ColumnCount))
+    {
+        return E_INVALIDARG;
+    }
+
+    ImageTileMetadata *pTile = NULL;
+    HRESULT hr = GetTileMetadata(level, row, column, &pTile);
+    IF_FAILED_RETURN(hr);
+
+    WCHAR tilePath[MAX_PATH] = L"";
+    hr = GetTilePath(*pTile, MAX_PATH, tilePath);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    hr = m_spImagingFactory->CreateDecoderFromFilename(tilePath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapFrameDecode> spFrame;
+    hr = spDecoder->GetFrame(0, &spFrame);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    hr = m_spImagingFactory->CreateFormatConverter(&spFormatConverter);
+    IF_FAILED_RETURN(hr);
+
+    hr = spFormatConverter->Initialize(spFrame, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom);
+    IF_FAILED_RETURN(hr);
+
+    // A tile smaller than the layout says is from another tree or damaged
+    UINT width = 0;
+    UINT height = 0;
+    hr = spFormatConverter->GetSize(&width, &height);
+    IF_FAILED_RETURN(hr);
+
+    if (width < pTile->GetImageWidth() || height < pTile->GetImageHeight())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    WICRect rect = {0, 0, (INT)pTile->GetImageWidth(), (INT)pTile->GetImageHeight()};
+    UINT rowPitch = pTile->GetImageWidth() * 4;
+
+    return DxImage::CreateInstance(ppImage, rect, 88, rowPitch, spFormatConverter); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+}
+
+//-----------------------------------------------------------------------------
+// Nothing is generated for a tile tree
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::GetGenerationStatistics(__out PyramidGenerationStatistics &statistics)
+{
+    statistics = PyramidGenerationStatistics();
+    return S_OK;
+}
+
+HRESULT ImageLoaderTileTree::BuildShard(__in const UINT &shardIndex, __in const UINT &shardCount)
+{
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
+
+HRESULT ImageLoaderTileTree::MergeShards(__in const UINT &shardCount)
+{
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
+
+HRESULT ImageLoaderTileTree::UpdateDirtyRect(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height)
+{
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
+
+//-----------------------------------------------------------------------------
+// Get every tile image of a level and add up the sizes of the tile files
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderTileTree::BenchmarkLevelDecode(__in const UINT &level, __out DOUBLE &averageMilliseconds, __out UINT64 &cbStored)
+{
+    averageMilliseconds = 0;
+    cbStored = 0;
+
+    if (level >= m_Levels.Length())
+    {
+        return E_INVALIDARG;
+    }
+
+    const TileTreeLevel &levelLayout = m_Levels[level];
+
+    StageTimer decodeTimer;
+    HRESULT hr = S_OK;
+
+    for (UINT row = 0; row < levelLayout.RowCount; ++row)
+    {
+        for (UINT column = 0; column < levelLayout.ColumnCount; ++column)
+        {
+            SmartPtr<IDxImage> spImage;
+            decodeTimer.Start();
+            hr = GetLevelRowColumnImage(level, row, column, &spImage);
+            decodeTimer.Stop();
+            IF_FAILED_RETURN(hr);
+
+            ImageTileMetadata *pTile = NULL;
+            hr = GetTileMetadata(level, row, column, &pTile);
+            IF_FAILED_RETURN(hr);
+
+            WCHAR tilePath[MAX_PATH] = L"";
+            hr = GetTilePath(*pTile, MAX_PATH, tilePath);
+            IF_FAILED_RETURN(hr);
+
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (!GetFileAttributesEx(tilePath, GetFileExInfoStandard, &attributes))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            cbStored += ((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        }
+    }
+
+    averageMilliseconds = decodeTimer.GetSeconds() * 1000.0 / ((UINT64)levelLayout.ColumnCount * levelLayout.RowCount);
+
+    return hr;
+}
@@ -0,0 +1,135 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+// Tile trees generated by other toolchains
+enum TileTreeLayoutType
+{
+    // <name>.dzi with the tiles in <name>_files\<level>\<column>_<row>.<format>, level 0 is 1x1
+    TTL_DEEP_ZOOM = 0,
+
+    // ImageProperties.xml with the tiles in TileGroup<n>\<zoom>-<column>-<row>.jpg, 256 tiles a group
+    TTL_ZOOMIFY = 1,
+
+    // IIIF level 0 static tiles, info.json with the tiles in <x>,<y>,<w>,<h>\<w>,\0\default.jpg
+    TTL_IIIF = 2,
+};
+
+//-----------------------------------------------------------------------------
+// Image loader over a tile tree generated by another toolchain. Open reads
+// just the descriptor of the tree, tile metadata is computed from the layout
+// for each row on its first tile and tiles are decoded from their files,
+// nothing is generated or written next to the tree.
+//-----------------------------------------------------------------------------
+class ImageLoaderTileTree : public ImplementSmartObject
+    <
+        ImageLoaderTileTree, 
+        ClassFlags<CF_ALIGNED_MEMORY>,
+        IImageLoader
+    >
+{ 
+    // Largest descriptor read, they are a few hundred bytes
+    static const UINT MAX_DESCRIPTOR_SIZE = 1024 * 1024;
+
+    // Tiles in each TileGroup directory of a Zoomify tree
+    static const UINT ZOOMIFY_TILE_GROUP_SIZE = 256;
+
+    struct TileTreeLevel
+    {
+        UINT ImageWidth;
+        UINT ImageHeight;
+        UINT ColumnCount;
+        UINT RowCount;
+
+        // Level of the tile tree, the Deep Zoom level, Zoomify zoom or IIIF scale factor
+        UINT TreeLevel;
+
+        // Zoomify index of the first tile of the level, counted from the smallest level
+        UINT64 FirstTreeTile;
+
+        // Tile metadata of each row, NULL until a tile of the row is asked for
+        ImageTileMetadata** Rows;
+    };
+
+    TileTreeLayoutType m_Layout;
+    String m_FilePath;
+
+    // Directory of the tiles with the trailing backslash, the Deep Zoom one is the _files directory
+    String m_TileDirectory;
+
+    // Extension of the Deep Zoom tiles, the other layouts are jpg
+    WCHAR m_TileFormat[16];
+
+    UINT m_ImageWidth;
+    UINT m_ImageHeight;
+    UINT m_TileWidth;
+    UINT m_TileHeight;
+    UINT m_TileOverlap;
+
+    // IIIF v3 tiles name their size w,h instead of w,
+    BOOL m_IsIiifWidthHeight;
+
+    HRESULT m_OpenResult;
+
+    CriticalSection m_LevelLock;
+    Vector<TileTreeLevel> m_Levels;
+
+    SmartPtr<IWICImagingFactory> m_spImagingFactory;
+
+    HRESULT ReadDescriptor();
+    HRESULT ReadDeepZoomDescriptor(__in_z const CHAR *pText);
+    HRESULT ReadZoomifyDescriptor(__in_z const CHAR *pText);
+    HRESULT ReadIiifDescriptor(__in_z const CHAR *pText);
+    HRESULT AddLevel(__in const UINT &width, __in const UINT &height, __in const UINT &treeLevel);
+    void    ReleaseLevels();
+
+    HRESULT GetTileMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out ImageTileMetadata **ppTileMetadata);
+    HRESULT GetTilePath(__in const ImageTileMetadata &tile, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pTilePath);
+    HRESULT GetIiifTilePath(__in const ImageTileMetadata &tile, __in const BOOL &isWidthHeight, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pTilePath);
+
+public:
+    ImageLoaderTileTree();
+    ~ImageLoaderTileTree();
+
+    HRESULT Initialize(__in_z const WCHAR *pFilePath, __in const TileTreeLayoutType &layout);
+
+    // Layout of the tile tree of a .dzi, ImageProperties.xml or info.json path, S_FALSE for other paths
+    static HRESULT DetectLayout(__in_z const WCHAR *pFilePath, __out TileTreeLayoutType &layout);
+
+    HRESULT Open();
+    HRESULT OpenAsync(__in_opt HANDLE hOpenedEvent, __in_opt HANDLE hOverviewEvent);
+    HRESULT CancelOpen();
+    HRESULT GetOpenProgress(__out PyramidOpenProgress &progress);
+    HRESULT GetOpenResult();
+    UINT    GetFirstAvailableLevel();
+    HRESULT Destroy();
+
+    UINT    GetLevelCount();
+    HRESULT GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height);
+    HRESULT GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount);
+    HRESULT GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata);
+    HRESULT GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage);
+    HRESULT GetGenerationStatistics(__out PyramidGenerationStatistics &statistics);
+    HRESULT BuildShard(__in const UINT &shardIndex, __in const UINT &shardCount);
+    HRESULT MergeShards(__in const UINT &shardCount);
+    HRESULT UpdateDirtyRect(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height);
+    HRESULT BenchmarkLevelDecode(__in const UINT &level, __out DOUBLE &averageMilliseconds, __out UINT64 &cbStored);
+};
@@ -19,13 +19,39 @@
 
 
 #include "stdafx.h"
+#include <psapi.h>
 #include "DxImage.h"
+#include "LevelBufferRing.h"
+#include "TileContainer.h"
+#include "TileDeduplicator.h"
+#include "BlockCompression.h"
+#include "Lz4Codec.h"
+#include "PixelBufferPool.h"
+#include "TileEncoderPool.h"
+#include "ImageLoaderTileTree.h"
+#include "PyramidManifest.h"
+#include "ReductionKernels.h"
+#include "LevelReducer.h"
+#include "TileRowCopy.h"
+#include "ScratchFile.h"
+#include "WorkStealingPool.h"
 #include "ImageLoaderWIC.h"
 
 ImageLoaderWIC::ImageLoaderWIC()
 {
     m_ImageHeight = 0;
     m_ImageWidth = 0;
+    m_pTileLocations = NULL;
+    m_OpenState = OPEN_IDLE;
+    m_OpenResult = S_OK;
+    m_hOpenedEvent = NULL;
+    m_OpenStartTicks.QuadPart = 0;
+    m_DecodedPixelCount = 0;
+    m_CompletedTileCount = 0;
+    m_OpenTileCount = 0;
+    m_OverviewLevel = 0;
+    m_hOverviewEvent = NULL;
+    m_SourceFrameCount = 0;
 }
 
 ImageLoaderWIC::~ImageLoaderWIC()
@@ -34,12 +60,32 @@ ImageLoaderWIC::~ImageLoaderWIC()
 
 HRESULT ImageLoaderWIC::Destroy()
 { 
+    // The open running in the background still uses the levels
+    if (CancelOpen() == S_OK)
+    {
+        m_OpenOperation.WaitForFinish();
+    }
+
     m_ImageHeight = 0;
     m_ImageWidth = 0;
 
     return S_OK;
 }
 
+// Files of the pyramid next to the level directories
+static const WCHAR MANIFEST_FILE_NAME[] = L"pyramid.manifest";
+static const WCHAR TILE_CONTAINER_FILE_NAME[] = L"tiles.pack";
+static const WCHAR SCRATCH_FILE_NAME[] = L"generation.scratch";
+static const WCHAR SEAM_FILE_PREFIX[] = L"seam_";
+
+// Extensions of tile files of the codecs with their own format, source codec tiles take the extension of the source
+static const WCHAR LZ4_TILE_EXTENSION[] = L".lz4";
+static const WCHAR JPEG_TILE_EXTENSION[] = L".jpg";
+static const WCHAR PNG_TILE_EXTENSION[] = L".png";
+
+// Pixel buffers of decoded tiles kept for the next tiles, the renderer releases an image once its texture is created
+static const UINT MAX_FREE_PIXEL_BUFFERS = 8;
+
 //-----------------------------------------------------------------------------
 // Calculates the average of two rgb32 pixels
 //-----------------------------------------------------------------------------
@@ -57,40 +103,204 @@ inline static UINT32 avg(const UINT32 a[2], const UINT32 b[2])
 }
 
 //-----------------------------------------------------------------------------
-// Calculates the average of two rows of rgb32 pixels
+// Span of a tile along one axis of a level, the area it covers and the
+// overlap border before and after it, clipped at the edges of the level
+//-----------------------------------------------------------------------------
+inline static void GetTileSpan(__in const UINT &index, __in const UINT &extent, __in const UINT &tileSize, __in const UINT &overlap, 
+                               __out UINT &before, __out UINT &size, __out UINT &after)
+{
+    UINT start = index * tileSize;
+    size = min(tileSize, extent - start);
+    before = (index > 0) ? overlap : 0;
+    after = min(overlap, extent - start - size);
+}
+
+//-----------------------------------------------------------------------------
+// Bytes of a line of rgb32 pixels with the 32 bytes aligned stride of LevelBuffer
+//-----------------------------------------------------------------------------
+inline static UINT GetCbStride(__in const UINT &width)
+{
+    return ((width * 4 + 31) / 32) * 32;
+}
+
+//-----------------------------------------------------------------------------
+// Decode rows of the source to a strip, line by line when the strip is over
+// the 4 GB a single CopyPixels call can fill
+//-----------------------------------------------------------------------------
+static HRESULT CopyStripPixels(__in IWICBitmapSource *pSource, __in const WICRect &rect, __in LevelBuffer &strip)
+{
+    UINT64 cbRect = (UINT64)rect.Height * strip.CbStride;
+    if (cbRect <= UINT_MAX)
+    {
+        return pSource->CopyPixels(&rect, strip.CbStride, (UINT)cbRect, strip.BasePtr);
+    }
+
+    HRESULT hr = S_OK;
+    WICRect lineRect = {rect.X, rect.Y, rect.Width, 1};
+    for (INT line = 0; line < rect.Height; ++line, ++lineRect.Y)
+    {
+        hr = pSource->CopyPixels(&lineRect, strip.CbStride, strip.CbStride, strip.BasePtr + (SIZE_T)line * strip.CbStride);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Box reduce an overview level to the next one, the pixels of the source
+// level past twice the size of the target are dropped like in the pyramid
+//-----------------------------------------------------------------------------
+static HRESULT ReduceOverviewLevel(__in IWICBitmap *pSource, __in IWICBitmap *pTarget)
+{
+    UINT sourceWidth = 0, sourceHeight = 0, width = 0, height = 0;
+    HRESULT hr = pSource->GetSize(&sourceWidth, &sourceHeight);
+    IF_FAILED_RETURN(hr);
+
+    hr = pTarget->GetSize(&width, &height);
+    IF_FAILED_RETURN(hr);
+
+    WICRect sourceRect = {0, 0, (INT)sourceWidth, (INT)sourceHeight};
+    SmartPtr<IWICBitmapLock> spSourceLock;
+    hr = pSource->Lock(&sourceRect, WICBitmapLockRead, &spSourceLock);
+    IF_FAILED_RETURN(hr);
+
+    WICRect targetRect = {0, 0, (INT)width, (INT)height};
+    SmartPtr<IWICBitmapLock> spTargetLock;
+    hr = pTarget->Lock(&targetRect, WICBitmapLockWrite, &spTargetLock);
+    IF_FAILED_RETURN(hr);
+
+    UINT cbSource = 0, cbSourceStride = 0, cbTarget = 0, cbTargetStride = 0;
+    BYTE *pSourcePixels = NULL, *pTargetPixels = NULL;
+    hr = spSourceLock->GetDataPointer(&cbSource, &pSourcePixels);
+    IF_FAILED_RETURN(hr);
+
+    hr = spSourceLock->GetStride(&cbSourceStride);
+    IF_FAILED_RETURN(hr);
+
+    hr = spTargetLock->GetDataPointer(&cbTarget, &pTargetPixels);
+    IF_FAILED_RETURN(hr);
+
+    hr = spTargetLock->GetStride(&cbTargetStride);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        const UINT32 *pLine0 = reinterpret_cast<const UINT32*>(pSourcePixels + (SIZE_T)(2 * y) * cbSourceStride);
+        const UINT32 *pLine1 = reinterpret_cast<const UINT32*>(pSourcePixels + (SIZE_T)(2 * y + 1) * cbSourceStride);
+        UINT32 *pTargetLine = reinterpret_cast<UINT32*>(pTargetPixels + (SIZE_T)y * cbTargetStride);
+
+        for (UINT x = 0; x < width; ++x)
+        {
+            pTargetLine[x] = avg(pLine0 + 2 * x, pLine1 + 2 * x);
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Bytes of the tile buffers of all columns of a level with the given height
 //-----------------------------------------------------------------------------
-inline static void Average2Rows(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+inline static UINT64 GetCbTileBand(__in const UINT &width, __in const UINT &tileSize, __in const UINT &overlap, __in const UINT &lineCount)
 {
-    __m128i w1, w2, avgLeft, avgRight;
+    UINT64 cbBand = 0;
+    for (UINT column = 0; column * tileSize < width; ++column)
+    {
+        UINT before = 0, size = 0, after = 0;
+        GetTileSpan(column, width, tileSize, overlap, before, size, after);
+
+        cbBand += (UINT64)GetCbStride(before + size + after) * lineCount;
+    }
 
-    const __m128i* pSrcRow1 = (__m128i*)pSrcImgRow1;
-    const __m128i* pSrcRow2 = (__m128i*)pSrcImgRow2;
-    __m128i* pDstRow = (__m128i*)pDstImgRow;
+    return cbBand;
+}
 
-    for (UINT cnt = widthInPages; cnt > 0; --cnt)
+//-----------------------------------------------------------------------------
+// Interleave bits of a tile column and row, tiles sorted by the code are in
+// Z order and the children of every parent are next to each other
+//-----------------------------------------------------------------------------
+inline static UINT64 GetMortonCode(__in const UINT &column, __in const UINT &row)
+{
+    UINT64 code = 0;
+    for (UINT bit = 0; bit < 32; ++bit)
     {
-        w1 = pSrcRow1[0]; pSrcRow1++; // _mm_loadu_si128(
-        w2 = pSrcRow2[0]; pSrcRow2++;
+        code |= ((UINT64)((column >> bit) & 1) << (2 * bit)) | ((UINT64)((row >> bit) & 1) << (2 * bit + 1));
+    }
+
+    return code;
+}
+
+// Tile job ordered by the Morton code of its origin on level 0
+struct TileJobOrder
+{
+    UINT64 Code;
+    UINT TileIndex;
+};
+
+static int __cdecl CompareTileJobOrder(__in const void *pA, __in const void *pB)
+{
+    UINT64 a = reinterpret_cast<const TileJobOrder*>(pA)->Code;
+    UINT64 b = reinterpret_cast<const TileJobOrder*>(pB)->Code;
 
-        avgLeft  = _mm_avg_epu8(w1, w2);
-           
-        w1 =  pSrcRow1[0]; pSrcRow1++;
-        w2 =  pSrcRow2[0]; pSrcRow2++;
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+//-----------------------------------------------------------------------------
+// First level 0 tile row of a shard, rows are split evenly between shards
+//-----------------------------------------------------------------------------
+inline static UINT GetShardFirstBaseRow(__in const UINT &shard, __in const UINT &baseRowCount, __in const UINT &shardCount)
+{
+    return (UINT)((UINT64)baseRowCount * shard / shardCount);
+}
+
+inline static UINT GetShardOfBaseRow(__in const UINT &baseRow, __in const UINT &baseRowCount, __in const UINT &shardCount)
+{
+    UINT shard = shardCount - 1;
+    while (GetShardFirstBaseRow(shard, baseRowCount, shardCount) > baseRow)
+    {
+        shard--;
+    }
 
-        avgRight = _mm_avg_epu8(w1, w2);
+    return shard;
+}
 
-        __m128i sumLeft = _mm_unpacklo_epi32(avgLeft, avgRight);
-        __m128i sumRight = _mm_unpackhi_epi32(avgLeft, avgRight);
+//-----------------------------------------------------------------------------
+// Whether the frame may be a reduced resolution image of the first one. Only
+// TIFF says so, in bit 0 of its NewSubfileType tag, frames of the formats
+// without the tag are taken for reduced images by their size alone.
+//-----------------------------------------------------------------------------
+static BOOL IsReducedImageFrame(__in IWICBitmapFrameDecode *pFrame)
+{
+    SmartPtr<IWICMetadataQueryReader> spQueryReader;
+    if (FAILED(pFrame->GetMetadataQueryReader(&spQueryReader)))
+    {
+        return TRUE;
+    }
 
-        __m128i shuffle1 = _mm_unpacklo_epi32(sumLeft, sumRight);
-        __m128i shuffle2 = _mm_unpackhi_epi32(sumLeft, sumRight);
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    if (FAILED(spQueryReader->GetMetadataByName(L"/ifd/{ushort=254}", &value)))
+    {
+        return TRUE;
+    }
 
-        pDstRow[0] = _mm_avg_epu8(shuffle1, shuffle2); //_mm_storeu_si128(
-        pDstRow++;
+    // 1 == FILETYPE_REDUCEDIMAGE
+    BOOL isReduced = TRUE;
+    if (value.vt == VT_UI4)
+    {
+        isReduced = (value.ulVal & 1) != 0;
+    }
+    else if (value.vt == VT_UI2)
+    {
+        isReduced = (value.uiVal & 1) != 0;
     }
+
+    PropVariantClear(&value);
+
+    return isReduced;
 }
 
-HRESULT ImageLoaderWIC::Get32bppBGRFrameConverter(__in IWICBitmapDecoder *spDecoder,  __in const UINT &nFrame, __deref_out IWICFormatConverter **ppFormatConverter)
+HRESULT ImageLoaderWIC::Get32bppBGRFrameConverter(__in IWICImagingFactory *pImagingFactory, __in IWICBitmapDecoder *spDecoder,  __in const UINT &nFrame, __deref_out IWICFormatConverter **ppFormatConverter)
 { 
     UINT nCount = 0;
     
@@ -114,7 +324,7 @@ HRESULT ImageLoaderWIC::Get32bppBGRFrameConverter(__in IWICBitmapDecoder *spDeco
 
     // Convert the format of the image frame to 32bppBGR
     SmartPtr<IWICFormatConverter> spFrameConverter;
-    hr = m_spImagingFactory->CreateFormatConverter(&spFrameConverter);
+    hr = pImagingFactory->CreateFormatConverter(&spFrameConverter);
     IF_FAILED_RETURN(hr);
 
     hr = spFrameConverter->Initialize(
@@ -136,177 +346,544 @@ HRESULT ImageLoaderWIC::Get32bppBGRFrameConverter(__in IWICBitmapDecoder *spDeco
 //-----------------------------------------------------------------------------
 HRESULT ImageLoaderWIC::Open()
 {
-    UINT nFrame = 0;
+    // Claimed like OpenAsync does, so two opens never run at once
+    if (!ClaimOpenState(OPEN_RUNNING))
+    {
+        return E_ILLEGAL_METHOD_CALL;
+    }
 
-    // Create a decoder for the given image file
-    SmartPtr<IWICBitmapDecoder> spDecoder;
-    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
-    IF_FAILED_RETURN(hr);
+    m_OpenResult = E_PENDING;
+    ResetOpenProgress();
 
-    SmartPtr<IWICFormatConverter> spFormatConverter;
-    hr = Get32bppBGRFrameConverter(spDecoder, nFrame, &spFormatConverter);
-    IF_FAILED_RETURN(hr);
+    HRESULT hr = OpenPyramid();
+    ReleaseOverview();
+    InterlockedExchange(&m_OpenResult, hr);
+    InterlockedExchange(&m_OpenState, OPEN_IDLE);
 
-    WICPixelFormatGUID pixelFormat;
-    hr = spFormatConverter->GetPixelFormat(&pixelFormat);
-    IF_FAILED_RETURN(hr);
+    return hr;
+}
 
-    GUID containerFormat;
-    hr = spDecoder->GetContainerFormat(&containerFormat);
-    IF_FAILED_RETURN(hr);
+//-----------------------------------------------------------------------------
+// Start the open on a background thread, the opened event is set once it
+// finished and the overview event once the overview levels are published
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::OpenAsync(__in_opt HANDLE hOpenedEvent, __in_opt HANDLE hOverviewEvent)
+{
+    if (!ClaimOpenState(OPEN_RUNNING))
+    {
+        return E_ILLEGAL_METHOD_CALL;
+    }
 
-    hr = spFormatConverter->GetSize(&m_ImageWidth, &m_ImageHeight);
-    IF_FAILED_RETURN(hr);
+    m_hOpenedEvent = hOpenedEvent;
+    m_hOverviewEvent = hOverviewEvent;
+    m_OpenResult = E_PENDING;
+    ResetOpenProgress();
 
-    DEBUG_TIMER_START(L"Deep zoom pyramid generation");
-        hr = GenerateDeepZoomPyramid(spFormatConverter, TILE_SIZE, containerFormat, pixelFormat);
-    DEBUG_TIMER_STOP;
+    HRESULT hr = m_OpenOperation.Start(this);
+    if (FAILED(hr))
+    {
+        m_hOpenedEvent = NULL;
+        m_hOverviewEvent = NULL;
+        InterlockedExchange(&m_OpenResult, hr);
+        InterlockedExchange(&m_OpenState, OPEN_IDLE);
+    }
 
     return hr;
 }
 
+void ImageLoaderWIC::Invoke()
+{
+    // The thread joins the apartment of the encoder and tile threads, those initialize COM on their own
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenPyramid();
+        CoUninitialize();
+    }
+
+    // The result is in place before the waiters wake up, GetOpenResult and GetFirstAvailableLevel
+    // go by it and not by the state
+    HANDLE hOpenedEvent = m_hOpenedEvent;
+    HANDLE hOverviewEvent = m_hOverviewEvent;
+    m_hOpenedEvent = NULL;
+    m_hOverviewEvent = NULL;
+    ReleaseOverview();
+    InterlockedExchange(&m_OpenResult, hr);
+
+    // Set on every way out, an open that reused the manifest, failed or was cancelled
+    // published no overview and the waiters would keep waiting for it
+    if (hOverviewEvent)
+    {
+        SetEvent(hOverviewEvent);
+    }
+
+    if (hOpenedEvent)
+    {
+        SetEvent(hOpenedEvent);
+    }
+
+    // Last, once the state is idle another open or Destroy may claim the loader and this thread
+    // must not touch it anymore
+    InterlockedExchange(&m_OpenState, OPEN_IDLE);
+}
+
 //-----------------------------------------------------------------------------
-// Saves the bitmap to given file path
+// Claim the idle loader for an open or an update. An open in the background
+// that already has its result is only leaving Invoke, it is waited for
+// instead of failing.
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::SaveBitmapToFile(__in const WCHAR* pFilePath, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap)
+BOOL ImageLoaderWIC::ClaimOpenState(__in const LONG &state)
 {
-    SmartPtr<IWICStream> spStream;
-    HRESULT hr = m_spImagingFactory->CreateStream(&spStream);
-    IF_FAILED_RETURN(hr);
+    if (InterlockedCompareExchange(&m_OpenState, state, OPEN_IDLE) == OPEN_IDLE)
+    {
+        return TRUE;
+    }
 
-    hr = spStream->InitializeFromFilename(pFilePath, GENERIC_WRITE);
-    IF_FAILED_RETURN(hr);
+    if (m_OpenResult == E_PENDING)
+    {
+        return FALSE;
+    }
 
-    SmartPtr<IWICBitmapEncoder> spEncoder;
-    hr = m_spImagingFactory->CreateEncoder(containerFormat, NULL, &spEncoder);
-    IF_FAILED_RETURN(hr);
+    m_OpenOperation.WaitForFinish();
 
-    hr = spEncoder->Initialize(spStream, WICBitmapEncoderNoCache);
-    IF_FAILED_RETURN(hr);
+    return InterlockedCompareExchange(&m_OpenState, state, OPEN_IDLE) == OPEN_IDLE;
+}
 
-    SmartPtr<IWICBitmapFrameEncode> spFrameEncode;
-    hr = spEncoder->CreateNewFrame(&spFrameEncode, NULL);
-    IF_FAILED_RETURN(hr);
+//-----------------------------------------------------------------------------
+// Ask the open running in the background to stop, S_FALSE when none runs.
+// The generation stops at the next strip or tile and the open fails with
+// ERROR_CANCELLED.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::CancelOpen()
+{
+    LONG state = InterlockedCompareExchange(&m_OpenState, OPEN_CANCELLING, OPEN_RUNNING);
 
-    hr = spFrameEncode->Initialize(NULL);
-    IF_FAILED_RETURN(hr);
+    return (state == OPEN_RUNNING || state == OPEN_CANCELLING) ? S_OK : S_FALSE;
+}
 
-    // Get size
-    UINT width, height;
-    SmartPtr<IWICBitmap> spBitmap(pBitmap);
-    hr = spBitmap->GetSize(&width, &height);
-    IF_FAILED_RETURN(hr);
+HRESULT ImageLoaderWIC::GetOpenResult()
+{
+    // E_PENDING from the start of an open until its result is in
+    return m_OpenResult;
+}
 
-    // Set image parameters
-    hr = spFrameEncode->SetSize(width, height);
-    IF_FAILED_RETURN(hr);
+UINT ImageLoaderWIC::GetFirstAvailableLevel()
+{
+    if (m_OpenResult != E_PENDING)
+    {
+        return (m_OpenResult == S_OK) ? 0 : m_Levels.Length();
+    }
 
-    WICPixelFormatGUID pixelFormat = *pPixelFormat;
-    hr = spFrameEncode->SetPixelFormat(&pixelFormat);
-    IF_FAILED_RETURN(hr);
+    AutoCriticalSection lock(m_OverviewLock);
+    return (m_OverviewLevels.Length() > 0) ? m_OverviewLevel : m_Levels.Length();
+}
 
-    // Write
-    hr = spFrameEncode->WriteSource(spBitmap, NULL);
-    IF_FAILED_RETURN(hr);
+HRESULT ImageLoaderWIC::GetOpenProgress(__out PyramidOpenProgress &progress)
+{
+    LARGE_INTEGER ticks, frequency;
+    QueryPerformanceCounter(&ticks);
+    QueryPerformanceFrequency(&frequency);
+
+    // Read the 64 bit counter in one piece also on x86
+    UINT64 decodedPixelCount = (UINT64)InterlockedCompareExchange64(&m_DecodedPixelCount, 0, 0);
+    UINT imageWidth = m_ImageWidth;
+
+    progress.RowCount = m_ImageHeight;
+    progress.DecodedRowCount = (imageWidth > 0) ? (UINT)min(decodedPixelCount / imageWidth, (UINT64)progress.RowCount) : 0;
+    progress.TileCount = m_OpenTileCount;
+    progress.CompletedTileCount = (UINT)m_CompletedTileCount;
+    progress.ElapsedSeconds = (DOUBLE)(ticks.QuadPart - m_OpenStartTicks.QuadPart) / (DOUBLE)frequency.QuadPart;
+    progress.MegapixelsPerSecond = 0;
+    progress.TilesPerSecond = 0;
+
+    if (progress.ElapsedSeconds > 0)
+    {
+        progress.MegapixelsPerSecond = decodedPixelCount / 1e6 / progress.ElapsedSeconds;
+        progress.TilesPerSecond = progress.CompletedTileCount / progress.ElapsedSeconds;
+    }
 
-    hr = spFrameEncode->Commit();
-    IF_FAILED_RETURN(hr);
+    return S_OK;
+}
 
-    hr = spEncoder->Commit();
-    IF_FAILED_RETURN(hr);
+void ImageLoaderWIC::ResetOpenProgress()
+{
+    QueryPerformanceCounter(&m_OpenStartTicks);
+    InterlockedExchange64(&m_DecodedPixelCount, 0);
+    InterlockedExchange(&m_CompletedTileCount, 0);
+    m_OpenTileCount = 0;
+    m_Statistics.OverviewSeconds = 0;
+}
 
-    return hr;
+void ImageLoaderWIC::ReleaseOverview()
+{
+    AutoCriticalSection lock(m_OverviewLock);
+    m_OverviewLevels.Clear();
+}
+
+void ImageLoaderWIC::SignalOverview()
+{
+    if (m_hOverviewEvent)
+    {
+        SetEvent(m_hOverviewEvent);
+    }
 }
 
 //-----------------------------------------------------------------------------
-// Get level directory path
+// Open the pyramid from the manifest, or generate it
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GetLevelPath(__in const UINT &level, __in const UINT &size, __deref_out_ecount_z(length + 1) WCHAR *pLevelPath)
+HRESULT ImageLoaderWIC::OpenPyramid()
 {
-    String levelPath;
-    HRESULT hr = levelPath.Set(m_UltraZoomDirectory.GetBuffer());
+    // Reuse the pyramid generated by a previous run, if the source did not change since. Whether a supplied
+    // source changed is not known, its pyramid is always generated again.
+    PyramidManifest::SourceIdentity source;
+    HRESULT hr = GetSourceIdentity(source);
     IF_FAILED_RETURN(hr);
 
-    WCHAR strLevel[MAX_PATH];
-    UINT error = _itow_s(level, strLevel, MAX_PATH, 10);
-    if (error != 0)
+    if (!m_spSource)
     {
-        return E_FAIL;
+        hr = OpenFromManifest(source);
+        if (hr == S_OK)
+        {
+            return hr;
+        }
     }
 
-    hr = levelPath.Concat(strLevel);
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    WICPixelFormatGUID pixelFormat;
+    GUID containerFormat;
+    hr = OpenSource(&spFormatConverter, containerFormat, pixelFormat);
     IF_FAILED_RETURN(hr);
 
-    error = wcscpy_s(pLevelPath, size, levelPath.GetBuffer());
-    if (error != 0)
-    {
-        return E_FAIL;
-    }
+    DEBUG_TIMER_START(L"Deep zoom pyramid generation");
+        hr = GenerateDeepZoomPyramid(spFormatConverter, m_Options.TileSize, containerFormat, pixelFormat);
+    DEBUG_TIMER_STOP;
+    IF_FAILED_RETURN(hr);
+
+    // The pyramid is complete and usable even if the manifest can't be written,
+    // it is just generated again next time
+    SaveManifest(source, containerFormat, pixelFormat);
 
     return hr;
 }
 
 //-----------------------------------------------------------------------------
-// Get tile file path from level, column and row
+// Create a 32bppBGR converter of the source frame, read its size and formats
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GetTilePath(__in const UINT &level, __in const UINT &column,__in const UINT &row, __in const UINT &size, __deref_out_ecount_z(length + 1) WCHAR *pTilePath)
+HRESULT ImageLoaderWIC::OpenSource(__deref_out IWICFormatConverter **ppFormatConverter, __out GUID &containerFormat, __out WICPixelFormatGUID &pixelFormat)
 {
-    WCHAR levelPath[MAX_PATH] = L"";
-    HRESULT hr = GetLevelPath(level, MAX_PATH, levelPath);
-    IF_FAILED_RETURN(hr);
-
-    String tilePath;
-    hr = tilePath.Set(levelPath);
-    IF_FAILED_RETURN(hr);
+    UINT nFrame = 0;
 
-    WCHAR strColumn[MAX_PATH];
-    UINT error = _itow_s(column, strColumn, MAX_PATH, 10);
-    if (error != 0)
+    // A supplied source has a single frame and no container, the tiles need a codec of their own
+    if (m_spSource)
     {
-        return E_FAIL;
-    }
+        SmartPtr<IWICFormatConverter> spSourceConverter;
+        HRESULT hr = GetSuppliedSourceConverter(m_spImagingFactory, &spSourceConverter);
+        IF_FAILED_RETURN(hr);
 
-    WCHAR strRow[MAX_PATH];
-    error = _itow_s(row, strRow, MAX_PATH, 10);
-    if (error != 0)
-    {
-        return E_FAIL;
+        hr = spSourceConverter->GetPixelFormat(&pixelFormat);
+        IF_FAILED_RETURN(hr);
+
+        hr = spSourceConverter->GetSize(&m_ImageWidth, &m_ImageHeight);
+        IF_FAILED_RETURN(hr);
+
+        containerFormat = GUID_NULL;
+        m_SourceFrameCount = 1;
+
+        return spSourceConverter.CopyTo(ppFormatConverter);
     }
 
-    hr = tilePath.Concat(L"\\");
+    // Create a decoder for the given image file
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
     IF_FAILED_RETURN(hr);
 
-    hr = tilePath.Concat(strColumn);
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    hr = Get32bppBGRFrameConverter(m_spImagingFactory, spDecoder, nFrame, &spFormatConverter);
     IF_FAILED_RETURN(hr);
 
-    hr = tilePath.Concat(L"_");
+    hr = spFormatConverter->GetPixelFormat(&pixelFormat);
     IF_FAILED_RETURN(hr);
 
-    hr = tilePath.Concat(strRow);
+    hr = spDecoder->GetContainerFormat(&containerFormat);
     IF_FAILED_RETURN(hr);
 
-    hr = tilePath.Concat(m_FileExtension.GetBuffer());
+    hr = spDecoder->GetFrameCount(&m_SourceFrameCount);
     IF_FAILED_RETURN(hr);
 
-    error = wcscpy_s(pTilePath, size, tilePath.GetBuffer());
-    if (error != 0)
-    {
-        return E_FAIL;
-    }
+    hr = spFormatConverter->GetSize(&m_ImageWidth, &m_ImageHeight);
+    IF_FAILED_RETURN(hr);
 
-    return hr;
+    return spFormatConverter.CopyTo(ppFormatConverter);
 }
 
 //-----------------------------------------------------------------------------
-// Get the maximum level
+// Create a 32bppBGR converter of the supplied source, every thread decoding
+// tiles has its own
 //-----------------------------------------------------------------------------
-UINT ImageLoaderWIC::GetMaximumLevel(__in const UINT &width, __in const UINT &height, __in const UINT &minTileSize)
+HRESULT ImageLoaderWIC::GetSuppliedSourceConverter(__in IWICImagingFactory *pImagingFactory, __deref_out IWICFormatConverter **ppFormatConverter)
 {
-    _ASSERT(width != 0 && height != 0);
-    _ASSERT(minTileSize > 1);
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    HRESULT hr = pImagingFactory->CreateFormatConverter(&spFormatConverter);
+    IF_FAILED_RETURN(hr);
 
-    UINT maxLength = max(width, height);
-    /*UINT numTiles = maxLength / minTileSize;
+    hr = spFormatConverter->Initialize(m_spSource, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom);
+    IF_FAILED_RETURN(hr);
+
+    return spFormatConverter.CopyTo(ppFormatConverter);
+}
+
+//-----------------------------------------------------------------------------
+// Identity of the source file recorded in the manifest, a supplied source has
+// none and its manifest is never reused
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetSourceIdentity(__out PyramidManifest::SourceIdentity &source)
+{
+    if (m_spSource)
+    {
+        ZeroMemory(&source, sizeof(source));
+        return S_OK;
+    }
+
+    return PyramidManifest::GetSourceIdentity(m_FilePath.GetBuffer(), source);
+}
+
+//-----------------------------------------------------------------------------
+// Get path of a file in the pyramid directory
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetPyramidFilePath(__in_z const WCHAR *pFileName, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pFilePath)
+{
+    String filePath;
+    HRESULT hr = filePath.Set(m_UltraZoomDirectory.GetBuffer());
+    IF_FAILED_RETURN(hr);
+
+    hr = filePath.Concat(pFileName);
+    IF_FAILED_RETURN(hr);
+
+    UINT error = wcscpy_s(pFilePath, size, filePath.GetBuffer());
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Map the index of an up to date pyramid and serve levels and tiles from it,
+// returns S_FALSE when the pyramid has to be generated
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::OpenFromManifest(__in const PyramidManifest::SourceIdentity &source)
+{
+    WCHAR manifestPath[MAX_PATH] = L"";
+    HRESULT hr = GetPyramidFilePath(MANIFEST_FILE_NAME, MAX_PATH, manifestPath);
+    IF_FAILED_RETURN(hr);
+
+    ReleaseLevels();
+
+    hr = m_Manifest.Map(manifestPath);
+    if (FAILED(hr) || !m_Manifest.IsUpToDate(source, m_Options.TileSize, m_Options))
+    {
+        m_Manifest.Unmap();
+        return S_FALSE;
+    }
+
+    if (m_Options.TileStorage == TST_PACKED)
+    {
+        WCHAR containerPath[MAX_PATH] = L"";
+        hr = GetPyramidFilePath(TILE_CONTAINER_FILE_NAME, MAX_PATH, containerPath);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_TileContainer.Open(containerPath);
+        if (FAILED(hr))
+        {
+            m_Manifest.Unmap();
+            return S_FALSE;
+        }
+
+        m_pTileLocations = m_Manifest.GetTileLocations();
+
+        // Raw tiles are served from the mapping, if there is enough address space for it
+        if (IsMappedTileCodec(m_Options.TileCodec))
+        {
+            m_TileContainer.Map();
+        }
+    }
+
+    m_ImageWidth = m_Manifest.GetHeader().ImageWidth;
+    m_ImageHeight = m_Manifest.GetHeader().ImageHeight;
+
+    hr = m_Levels.SetSize(m_Manifest.GetLevelCount());
+    IF_FAILED_RETURN(hr);
+
+    for (UINT level = 0; level < m_Manifest.GetLevelCount(); ++level)
+    {
+        const PyramidManifest::Level &levelLayout = m_Manifest.GetLevel(level);
+        m_Levels[level].InitializeMapped(levelLayout.Width, levelLayout.Height, levelLayout.ColumnCount, levelLayout.RowCount, levelLayout.FirstTile, levelLayout.SourceFrame, 
+                                         m_Manifest.GetLevelTiles(level));
+    }
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Release metadata of all levels, unmap the pyramid index and close the tiles
+//-----------------------------------------------------------------------------
+void ImageLoaderWIC::ReleaseLevels()
+{
+    m_Levels.Clear();
+    m_Manifest.Unmap();
+
+    m_TileContainer.Close();
+    m_TileLocations.Clear();
+    m_pTileLocations = NULL;
+
+    AutoCriticalSection lock(m_EmbeddedLock);
+    m_EmbeddedSources.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Write manifest of the generated pyramid
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::SaveManifest(__in const PyramidManifest::SourceIdentity &source, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat)
+{
+    PyramidManifest manifest;
+    HRESULT hr = manifest.Initialize(source, containerFormat, pixelFormat, m_Options.TileSize, m_ImageWidth, m_ImageHeight, m_Levels.Length(), m_Options);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT level = 0; level < m_Levels.Length(); ++level)
+    {
+        hr = manifest.SetLevel(level, m_Levels[level].ImageWidth, m_Levels[level].ImageHeight, m_Levels[level].ColumnCount, m_Levels[level].RowCount, 
+                               m_Levels[level].SourceFrame, m_Levels[level].Tiles);
+        IF_FAILED_RETURN(hr);
+    }
+
+    manifest.SetTileLocations(m_pTileLocations);
+
+    WCHAR manifestPath[MAX_PATH] = L"";
+    hr = GetPyramidFilePath(MANIFEST_FILE_NAME, MAX_PATH, manifestPath);
+    IF_FAILED_RETURN(hr);
+
+    return manifest.Save(manifestPath);
+}
+
+//-----------------------------------------------------------------------------
+// Saves the bitmap to given file path
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::SaveBitmapToFile(__in const WCHAR* pFilePath, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap)
+{
+    return ::SaveBitmapToFile(m_spImagingFactory, pFilePath, containerFormat, pPixelFormat, pBitmap, TileEncoderOptions(m_Options));
+}
+
+//-----------------------------------------------------------------------------
+// Get level directory path
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetLevelPath(__in const UINT &level, __in const UINT &size, __deref_out_ecount_z(length + 1) WCHAR *pLevelPath)
+{
+    String levelPath;
+    HRESULT hr = levelPath.Set(m_UltraZoomDirectory.GetBuffer());
+    IF_FAILED_RETURN(hr);
+
+    WCHAR strLevel[MAX_PATH];
+    UINT error = _itow_s(level, strLevel, MAX_PATH, 10);
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    hr = levelPath.Concat(strLevel);
+    IF_FAILED_RETURN(hr);
+
+    error = wcscpy_s(pLevelPath, size, levelPath.GetBuffer());
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get extension of the tile files of the tile codec
+//-----------------------------------------------------------------------------
+const WCHAR* ImageLoaderWIC::GetTileExtension()
+{
+    switch (m_Options.TileCodec)
+    {
+    case TCT_LZ4:
+        return LZ4_TILE_EXTENSION;
+
+    case TCT_JPEG:
+        return JPEG_TILE_EXTENSION;
+
+    case TCT_PNG:
+        return PNG_TILE_EXTENSION;
+
+    default:
+        return m_FileExtension.GetBuffer();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Get tile file path from level, column and row
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetTilePath(__in const UINT &level, __in const UINT &column,__in const UINT &row, __in const UINT &size, __deref_out_ecount_z(length + 1) WCHAR *pTilePath)
+{
+    WCHAR levelPath[MAX_PATH] = L"";
+    HRESULT hr = GetLevelPath(level, MAX_PATH, levelPath);
+    IF_FAILED_RETURN(hr);
+
+    String tilePath;
+    hr = tilePath.Set(levelPath);
+    IF_FAILED_RETURN(hr);
+
+    WCHAR strColumn[MAX_PATH];
+    UINT error = _itow_s(column, strColumn, MAX_PATH, 10);
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    WCHAR strRow[MAX_PATH];
+    error = _itow_s(row, strRow, MAX_PATH, 10);
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    hr = tilePath.Concat(L"\\");
+    IF_FAILED_RETURN(hr);
+
+    hr = tilePath.Concat(strColumn);
+    IF_FAILED_RETURN(hr);
+
+    hr = tilePath.Concat(L"_");
+    IF_FAILED_RETURN(hr);
+
+    hr = tilePath.Concat(strRow);
+    IF_FAILED_RETURN(hr);
+
+    hr = tilePath.Concat(GetTileExtension());
+    IF_FAILED_RETURN(hr);
+
+    error = wcscpy_s(pTilePath, size, tilePath.GetBuffer());
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get the maximum level
+//-----------------------------------------------------------------------------
+UINT ImageLoaderWIC::GetMaximumLevel(__in const UINT &width, __in const UINT &height, __in const UINT &minTileSize)
+{
+    _ASSERT(width != 0 && height != 0);
+    _ASSERT(minTileSize > 1);
+
+    UINT maxLength = max(width, height);
+    /*UINT numTiles = maxLength / minTileSize;
 
     return (UINT)floor(log(numTiles) / log(2));*/
 
@@ -341,386 +918,2690 @@ HRESULT ProcessChunk(__deref_in_bcount(size) const BYTE* pBuffer, __in const UIN
 }
 
 //-----------------------------------------------------------------------------
-// Generate deep zoom structure in image path
+// Validate the options, remove the previous pyramid and initialize metadata
+// of all levels, their directories and locations of the packed tiles
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GenerateDeepZoomPyramid(__in IWICFormatConverter *pFormatConverter, __in const UINT &tileSize, __in const GUID &containerGuid, __in const WICPixelFormatGUID &pixelFormat)
+HRESULT ImageLoaderWIC::PreparePyramid(__in const UINT &tileSize)
 {
     // Create directory for ultrazoom data structure, if it does not already exist
     HRESULT hr = CreateDir(m_UltraZoomDirectory.GetBuffer());
     IF_FAILED_RETURN(hr);
 
+    // Raw and block compressed tiles only make sense mapped from the tile container
+    if (IsMappedTileCodec(m_Options.TileCodec) && m_Options.TileStorage != TST_PACKED)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (m_Options.JpegQuality < 1 || m_Options.JpegQuality > 100 || m_Options.PngFilter > PFT_ADAPTIVE)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Overlap border of a tile has to stay within its neighbor
+    if (!IsSupportedTileSize(tileSize) || m_Options.TileOverlap * 2 >= tileSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Sources are decoded with WICRect and UINT strides, sizes and offsets past that are 64 bit
+    if (m_ImageWidth > MAX_IMAGE_WIDTH || m_ImageHeight > INT_MAX)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    // Manifest of the previous pyramid is no longer valid, it is written again when generation succeeds
+    WCHAR manifestPath[MAX_PATH] = L"";
+    hr = GetPyramidFilePath(MANIFEST_FILE_NAME, MAX_PATH, manifestPath);
+    IF_FAILED_RETURN(hr);
+
+    WCHAR containerPath[MAX_PATH] = L"";
+    hr = GetPyramidFilePath(TILE_CONTAINER_FILE_NAME, MAX_PATH, containerPath);
+    IF_FAILED_RETURN(hr);
 
-    UINT levelCount = GetMaximumLevel(m_ImageWidth, m_ImageHeight, tileSize);
-    levelCount++;
+    // Levels are generated again, the previous index and tiles are no longer needed
+    ReleaseLevels();
+    DeleteFile(manifestPath);
+    DeleteFile(containerPath);
 
-    m_Levels.SetSize(levelCount);
+    BOOL isPacked = (m_Options.TileStorage == TST_PACKED);
+    if (isPacked)
+    {
+        hr = m_TileContainer.Create(containerPath);
+        IF_FAILED_RETURN(hr);
+    }
 
+    UINT levelCount = GetMaximumLevel(m_ImageWidth, m_ImageHeight, tileSize) + 1;
 
-    Vector<LevelBuffer> levelBuffers;
-    levelBuffers.SetSize(levelCount);
+    hr = m_Levels.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
 
     UINT width = m_ImageWidth;
     UINT height = m_ImageHeight;
- 
-    Vector<LevelBuffer> levelTileBuffers;
-    hr = levelTileBuffers.SetSize(((UINT)width / tileSize) * levelCount);
+
+    UINT64 tileCount = 0;
+    for (UINT level = 0; level < levelCount; level++)
+    {
+        // Create directory for each level, packed tiles all go to the container
+        //
+        if (!isPacked)
+        {
+            WCHAR levelPath[MAX_PATH] = L"";
+            hr = GetLevelPath(level, MAX_PATH, levelPath);
+            IF_FAILED_RETURN(hr);
+
+            hr = CreateDir(levelPath);
+            IF_FAILED_RETURN(hr);
+        }
+
+        INT rowCount = height / tileSize;
+        UINT lastTileHeight = height % tileSize;
+        rowCount = (lastTileHeight == 0) ? rowCount : rowCount + 1;
+
+        UINT columnCount = width / tileSize;
+        UINT lastTileWidth = width % tileSize;
+        columnCount = (lastTileWidth == 0) ? columnCount : columnCount + 1;
+
+        // Initialize tile metadata for each level
+        //
+        // Tiles of all levels are indexed with 32 bits in the pyramid index
+        if (tileCount + (UINT64)columnCount * rowCount > UINT_MAX)
+        {
+            return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        }
+
+        hr = m_Levels[level].Initialize(width, height, columnCount, rowCount, (UINT)tileCount);
+        IF_FAILED_RETURN(hr);
+
+        tileCount += (UINT64)columnCount * rowCount;
+
+        width >>= 1;
+        height >>= 1;
+    }
+
+    // Encoders fill the location of each packed tile once it is written
+    //
+    if (isPacked)
+    {
+        hr = m_TileLocations.SetSize((UINT)tileCount);
+        IF_FAILED_RETURN(hr);
+
+        ZeroMemory(m_TileLocations.Ptr(), (SIZE_T)tileCount * sizeof(TileLocation));
+        m_pTileLocations = m_TileLocations.Ptr();
+    }
+
+    m_OpenTileCount = (UINT)tileCount;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Whether levels can be read from reduced resolution frames of the source,
+// the levels between them are reduced from their own children only
+//-----------------------------------------------------------------------------
+BOOL ImageLoaderWIC::CanUseEmbeddedLevels() const
+{
+    return m_Options.UseEmbeddedLevels && m_SourceFrameCount > 1 && m_Options.ReductionFilter == RFT_BOX && m_Options.TileOverlap == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Find the levels the source holds as reduced resolution frames, like the
+// pages of a pyramid TIFF. A frame matches a level when it is the same size
+// or one pixel larger, for writers rounding the halved size up. Level 0 is
+// always built, only the levels above it are served from their frames.
+//
+// Frames a TIFF marks as other than reduced images, masks or further pages,
+// are skipped. The reduced frames have to get smaller from one to the next,
+// the frames from the first one that doesn't are taken for other images.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::MatchEmbeddedLevels()
+{
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
     IF_FAILED_RETURN(hr);
 
-    Vector<UINT> levelColumnCount;
-    hr = levelColumnCount.SetSize(levelCount);
-    IF_FAILED_RETURN(hr);
+    UINT previousWidth = m_ImageWidth;
+    UINT previousHeight = m_ImageHeight;
+    for (UINT frame = 1; frame < m_SourceFrameCount; ++frame)
+    {
+        SmartPtr<IWICBitmapFrameDecode> spFrame;
+        hr = spDecoder->GetFrame(frame, &spFrame);
+        IF_FAILED_RETURN(hr);
+
+        if (!IsReducedImageFrame(spFrame))
+        {
+            continue;
+        }
+
+        UINT width = 0;
+        UINT height = 0;
+        hr = spFrame->GetSize(&width, &height);
+        IF_FAILED_RETURN(hr);
+
+        if (width >= previousWidth || height >= previousHeight)
+        {
+            break;
+        }
+
+        previousWidth = width;
+        previousHeight = height;
+
+        for (UINT level = 1; level < m_Levels.Length(); ++level)
+        {
+            ImageLevelMetadata &levelMetadata = m_Levels[level];
+            if (levelMetadata.IsEmbedded() || width < levelMetadata.ImageWidth || height < levelMetadata.ImageHeight || 
+                width > levelMetadata.ImageWidth + 1 || height > levelMetadata.ImageHeight + 1)
+            {
+                continue;
+            }
+
+            // Tiles of the level are not built
+            levelMetadata.SourceFrame = frame;
+            m_OpenTileCount -= levelMetadata.ColumnCount * levelMetadata.RowCount;
+            break;
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Read the top levels from the source before the full build and publish them.
+// The first overview level is the largest one within MAX_OVERVIEW_SIZE, read
+// by DecodeOverview, the levels after it are box reductions of the one before.
+// The full build fills the tile metadata again with the same spans once it
+// gets to the tiles. Without a cheap read of the source nothing is published
+// and the overview event is set right away.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::PublishOverview(__in IWICBitmapSource *pSource, __in const UINT &tileSize)
+{
+    UINT levelCount = m_Levels.Length();
+    UINT overviewLevel = 0;
+    while (overviewLevel < levelCount - 1 && max(m_Levels[overviewLevel].ImageWidth, m_Levels[overviewLevel].ImageHeight) > MAX_OVERVIEW_SIZE)
+    {
+        overviewLevel++;
+    }
+
+    // Sources this small are built about as quickly as their overview
+    if (overviewLevel == 0)
+    {
+        SignalOverview();
+        return S_OK;
+    }
+
+    Vector<SmartPtr<IWICBitmap>> overviewLevels;
+    HRESULT hr = overviewLevels.SetSize(levelCount - overviewLevel);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT level = overviewLevel; level < levelCount; level++)
+    {
+        ImageLevelMetadata &levelMetadata = m_Levels[level];
+        SmartPtr<IWICBitmap> &spLevel = overviewLevels[level - overviewLevel];
+
+        hr = m_spImagingFactory->CreateBitmap(levelMetadata.ImageWidth, levelMetadata.ImageHeight, GUID_WICPixelFormat32bppBGR, WICBitmapCacheOnLoad, &spLevel);
+        IF_FAILED_RETURN(hr);
+
+        hr = (level == overviewLevel) ? DecodeOverview(pSource, overviewLevel, spLevel) : ReduceOverviewLevel(overviewLevels[level - overviewLevel - 1], spLevel);
+        IF_FAILED_RETURN(hr);
+
+        // Reading the source for the overview would decode all of it, as slow as the full build
+        if (hr == S_FALSE)
+        {
+            SignalOverview();
+            return S_OK;
+        }
+
+        // Overview tiles are plain BGRX pixels
+        for (UINT row = 0; row < levelMetadata.RowCount; ++row)
+        {
+            for (UINT column = 0; column < levelMetadata.ColumnCount; ++column)
+            {
+                ImageTileMetadata &tile = levelMetadata.Tiles[row * levelMetadata.ColumnCount + column];
+                GetTileSpan(column, levelMetadata.ImageWidth, tileSize, m_Options.TileOverlap, tile.OverlapLeft, tile.Width, tile.OverlapRight);
+                GetTileSpan(row, levelMetadata.ImageHeight, tileSize, m_Options.TileOverlap, tile.OverlapTop, tile.Height, tile.OverlapBottom);
+                tile.X = column * tileSize;
+                tile.Y = row * tileSize;
+                tile.Level = level;
+                tile.Row = row;
+                tile.Column = column;
+                tile.Flags = 0;
+            }
+        }
+    }
+
+    {
+        AutoCriticalSection lock(m_OverviewLock);
+        overviewLevels.DetachTo(m_OverviewLevels);
+        m_OverviewLevel = overviewLevel;
+    }
+
+    LARGE_INTEGER ticks, frequency;
+    QueryPerformanceCounter(&ticks);
+    QueryPerformanceFrequency(&frequency);
+    m_Statistics.OverviewSeconds = (DOUBLE)(ticks.QuadPart - m_OpenStartTicks.QuadPart) / (DOUBLE)frequency.QuadPart;
+
+    SignalOverview();
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Sample the first overview level, nearest pixels of a decode scaled by the
+// decoder when it has one, otherwise of a source found by OpenOverviewSource.
+// S_FALSE when there is neither, most decoders decode every line up to the
+// ones the overview samples and the sampling would cost a full decode.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::DecodeOverview(__in IWICBitmapSource *pSource, __in const UINT &overviewLevel, __in IWICBitmap *pOverview)
+{
+    UINT width = 0, height = 0;
+    HRESULT hr = pOverview->GetSize(&width, &height);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapSourceTransform> spTransform;
+    SmartPtr<IWICBitmapSource> spOverviewSource;
+    UINT sourceWidth = 0;
+    UINT sourceHeight = 0;
+    WICPixelFormatGUID sourceFormat = GUID_WICPixelFormat32bppBGR;
+    if (OpenScaledSource(width, height, &spTransform, sourceWidth, sourceHeight, sourceFormat) != S_OK)
+    {
+        spTransform.Release();
+        sourceFormat = GUID_WICPixelFormat32bppBGR;
+
+        hr = OpenOverviewSource(pSource, overviewLevel, width, height, &spOverviewSource, sourceWidth, sourceHeight);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+    }
+
+    UINT cbPixel = (sourceFormat == GUID_WICPixelFormat24bppBGR) ? 3 : 4;
+    UINT cbLine = GetCbStride(sourceWidth);
+
+    Vector<BYTE> line;
+    hr = line.SetSize(cbLine);
+    IF_FAILED_RETURN(hr);
+
+    WICRect rect = {0, 0, (INT)width, (INT)height};
+    SmartPtr<IWICBitmapLock> spLock;
+    hr = pOverview->Lock(&rect, WICBitmapLockWrite, &spLock);
+    IF_FAILED_RETURN(hr);
+
+    UINT cbOverview = 0, cbStride = 0;
+    BYTE *pPixels = NULL;
+    hr = spLock->GetDataPointer(&cbOverview, &pPixels);
+    IF_FAILED_RETURN(hr);
+
+    hr = spLock->GetStride(&cbStride);
+    IF_FAILED_RETURN(hr);
+
+    WICRect lineRect = {0, 0, (INT)sourceWidth, 1};
+    for (UINT y = 0; y < height; ++y)
+    {
+        if (IsOpenCancelled())
+        {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+
+        // Centers of the overview pixels
+        lineRect.Y = (INT)(((UINT64)y * 2 + 1) * sourceHeight / (2 * (UINT64)height));
+        if (spTransform)
+        {
+            hr = spTransform->CopyPixels(&lineRect, sourceWidth, sourceHeight, &sourceFormat, WICBitmapTransformRotate0, cbLine, cbLine, line.Ptr());
+        }
+        else
+        {
+            hr = spOverviewSource->CopyPixels(&lineRect, cbLine, cbLine, line.Ptr());
+        }
+        IF_FAILED_RETURN(hr);
+
+        UINT32 *pTarget = reinterpret_cast<UINT32*>(pPixels + (SIZE_T)y * cbStride);
+        for (UINT x = 0; x < width; ++x)
+        {
+            const BYTE *pSourcePixel = line.Ptr() + (SIZE_T)(((UINT64)x * 2 + 1) * sourceWidth / (2 * (UINT64)width)) * cbPixel;
+            pTarget[x] = pSourcePixel[0] | (pSourcePixel[1] << 8) | (pSourcePixel[2] << 16) | 0xFF000000;
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Find a source the first overview level can be sampled from without decoding
+// the whole image: a supplied source, which computes any line on its own, the
+// reduced resolution frame of the finest embedded level within the overview,
+// or a thumbnail the source holds at least as large as the overview. S_FALSE
+// when there is none.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::OpenOverviewSource(__in IWICBitmapSource *pSource, __in const UINT &overviewLevel, __in const UINT &width, __in const UINT &height, 
+                                           __deref_out IWICBitmapSource **ppOverviewSource, __out UINT &sourceWidth, __out UINT &sourceHeight)
+{
+    if (m_spSource)
+    {
+        sourceWidth = m_ImageWidth;
+        sourceHeight = m_ImageHeight;
+        return SmartPtr<IWICBitmapSource>(pSource).CopyTo(ppOverviewSource);
+    }
+
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+    IF_FAILED_RETURN(hr);
+
+    // Reduced resolution frames are decoded on their own
+    for (UINT level = overviewLevel; level > 0; --level)
+    {
+        if (!m_Levels[level].IsEmbedded())
+        {
+            continue;
+        }
+
+        SmartPtr<IWICFormatConverter> spFrameConverter;
+        hr = Get32bppBGRFrameConverter(m_spImagingFactory, spDecoder, m_Levels[level].SourceFrame, &spFrameConverter);
+        IF_FAILED_RETURN(hr);
+
+        hr = spFrameConverter->GetSize(&sourceWidth, &sourceHeight);
+        IF_FAILED_RETURN(hr);
+
+        return spFrameConverter.CopyTo(ppOverviewSource);
+    }
+
+    SmartPtr<IWICBitmapFrameDecode> spFrame;
+    hr = spDecoder->GetFrame(0, &spFrame);
+    IF_FAILED_RETURN(hr);
+
+    // Most decoders have no thumbnail, the ones of photos are often smaller than the overview
+    SmartPtr<IWICBitmapSource> spThumbnail;
+    if (FAILED(spFrame->GetThumbnail(&spThumbnail)) || FAILED(spThumbnail->GetSize(&sourceWidth, &sourceHeight)) || sourceWidth < width || sourceHeight < height)
+    {
+        return S_FALSE;
+    }
+
+    SmartPtr<IWICFormatConverter> spThumbnailConverter;
+    hr = m_spImagingFactory->CreateFormatConverter(&spThumbnailConverter);
+    IF_FAILED_RETURN(hr);
+
+    hr = spThumbnailConverter->Initialize(spThumbnail, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom);
+    IF_FAILED_RETURN(hr);
+
+    return spThumbnailConverter.CopyTo(ppOverviewSource);
+}
+
+//-----------------------------------------------------------------------------
+// Open the source once more for a decode scaled by the decoder, S_FALSE when
+// it has none down to a size between the overview and the source, or not in
+// a BGR format
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::OpenScaledSource(__in const UINT &width, __in const UINT &height, __deref_out IWICBitmapSourceTransform **ppTransform, 
+                                         __out UINT &scaledWidth, __out UINT &scaledHeight, __out WICPixelFormatGUID &scaledFormat)
+{
+    if (m_spSource)
+    {
+        return S_FALSE;
+    }
+
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapFrameDecode> spFrame;
+    hr = spDecoder->GetFrame(0, &spFrame);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapSourceTransform> spTransform;
+    if (FAILED(spFrame.As(&spTransform)))
+    {
+        return S_FALSE;
+    }
+
+    scaledWidth = width;
+    scaledHeight = height;
+    hr = spTransform->GetClosestSize(&scaledWidth, &scaledHeight);
+    IF_FAILED_RETURN(hr);
+
+    if (scaledWidth < width || scaledHeight < height || scaledWidth >= m_ImageWidth)
+    {
+        return S_FALSE;
+    }
+
+    scaledFormat = GUID_WICPixelFormat32bppBGR;
+    hr = spTransform->GetClosestPixelFormat(&scaledFormat);
+    IF_FAILED_RETURN(hr);
+
+    if (scaledFormat != GUID_WICPixelFormat32bppBGR && scaledFormat != GUID_WICPixelFormat32bppBGRA && scaledFormat != GUID_WICPixelFormat24bppBGR)
+    {
+        return S_FALSE;
+    }
+
+    return spTransform.CopyTo(ppTransform);
+}
+
+//-----------------------------------------------------------------------------
+// Generate deep zoom structure in image path
+//
+// The generation runs as a three stage pipeline. The calling thread decodes
+// CHUNK_HEIGHT strips of the source into a ring of recycled level buffers,
+// the downsample thread runs the Average2Rows cascade over them and fills tile
+// buffers, and finished tiles are encoded and written by the encoder pool.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GenerateDeepZoomPyramid(__in IWICFormatConverter *pFormatConverter, __in const UINT &tileSize, __in const GUID &containerGuid, __in const WICPixelFormatGUID &pixelFormat)
+{
+    if (m_Options.BuildMode == PBM_TILE_PARALLEL)
+    {
+        return GenerateTileParallelPyramid(tileSize, containerGuid, pixelFormat, 0, 1, FALSE, m_Options.ProgressiveOverview ? pFormatConverter : NULL);
+    }
+
+    StageTimer totalTimer;
+    totalTimer.Start();
+
+    HRESULT hr = PreparePyramid(tileSize);
+    IF_FAILED_RETURN(hr);
+
+    // Only the tile parallel build skips the levels embedded in the source. It takes over only when a
+    // frame serves a level, it prepares the pyramid again and matches the same frames.
+    if (CanUseEmbeddedLevels())
+    {
+        hr = MatchEmbeddedLevels();
+        IF_FAILED_RETURN(hr);
+
+        for (UINT level = 1; level < m_Levels.Length(); ++level)
+        {
+            if (m_Levels[level].IsEmbedded())
+            {
+                return GenerateTileParallelPyramid(tileSize, containerGuid, pixelFormat, 0, 1, FALSE, m_Options.ProgressiveOverview ? pFormatConverter : NULL);
+            }
+        }
+    }
+
+    if (m_Options.ProgressiveOverview)
+    {
+        hr = PublishOverview(pFormatConverter, tileSize);
+        IF_FAILED_RETURN(hr);
+    }
+
+    BOOL isPacked = (m_Options.TileStorage == TST_PACKED);
+
+    WCHAR scratchPath[MAX_PATH] = L"";
+    hr = GetPyramidFilePath(SCRATCH_FILE_NAME, MAX_PATH, scratchPath);
+    IF_FAILED_RETURN(hr);
+
+    PyramidGenerationContext context;
+    context.pLoader = this;
+    context.TileSize = tileSize;
+    context.TileOverlap = m_Options.TileOverlap;
+    context.CopyTileRow = GetCopyTileRowProc(tileSize);
+    context.LevelCount = m_Levels.Length();
+    context.Average2Rows = m_Options.LinearLightReduction ? GetAverage2RowsLinearKernel() : GetAverage2RowsKernel();
+
+    UINT levelCount = context.LevelCount;
+
+    hr = context.LevelBuffers.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.Reducers.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    // One tile buffer per column of every level
+    UINT tileBufferCount = 0;
+    for (UINT level = 0; level < levelCount; level++)
+    {
+        tileBufferCount += m_Levels[level].ColumnCount;
+    }
+
+    hr = context.LevelTileBuffers.SetSize(tileBufferCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.LevelFirstTileBuffer.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.LevelColumnCount.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.LevelRowCount.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.LevelLineCount.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.LevelSpilled.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.TileSpillOffset.SetSize(tileBufferCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.TileSpilledLines.SetSize(tileBufferCount);
+    IF_FAILED_RETURN(hr);
+
+    UINT threadCount = (m_Options.EncoderThreadCount == 0) ? TileEncoderPool::GetDefaultThreadCount() : m_Options.EncoderThreadCount;
+    UINT maxTileSize = tileSize + 2 * context.TileOverlap;
+    UINT cbMaxTileSize = GetCbStride(maxTileSize) * maxTileSize;
+
+    // Levels over the memory budget need the scratch file and a buffer to read their tiles back to
+    //
+    PlanMemoryBudget(context, threadCount, cbMaxTileSize);
+
+    UINT spilledLevelCount = 0;
+    for (UINT level = 0; level < levelCount; level++)
+    {
+        spilledLevelCount += context.LevelSpilled[level] ? 1 : 0;
+    }
+
+    if (spilledLevelCount > 0)
+    {
+        hr = context.Scratch.Create(scratchPath);
+        IF_FAILED_RETURN(hr);
+
+        hr = context.SpillTileBuffer.Initialize(maxTileSize, maxTileSize, 4);
+        IF_FAILED_RETURN(hr);
+    }
+
+    UINT lastColumn = 0;
+    UINT64 cbScratch = 0;
+    for (UINT level = 0; level < levelCount; level++)
+    {
+        UINT width = m_Levels[level].ImageWidth;
+        UINT height = m_Levels[level].ImageHeight;
+
+        // Level 0 rows come from the strip ring, the other levels keep the last two reduced rows
+        if (level > 0)
+        {
+            hr = context.LevelBuffers[level].Initialize(width, 2, 4);
+            IF_FAILED_RETURN(hr);
+        }
+
+        if (level < levelCount - 1)
+        {
+            hr = context.Reducers[level].Initialize(m_Options.ReductionFilter, context.Average2Rows, m_Options.LinearLightReduction, width, height);
+            IF_FAILED_RETURN(hr);
+        }
+
+        UINT columnCount = m_Levels[level].ColumnCount;
+        context.LevelColumnCount[level] = columnCount;
+
+        // Initialize tile buffers, tall enough for the overlap border above and below a row of tiles,
+        // spilled levels only keep a band and get a slot of the full height in the scratch file
+        //
+        context.LevelFirstTileBuffer[level] = lastColumn;
+        for (UINT column = 0; column < columnCount; ++column)
+        {
+            UINT overlapLeft = 0, tileWidth = 0, overlapRight = 0;
+            GetTileSpan(column, width, tileSize, context.TileOverlap, overlapLeft, tileWidth, overlapRight);
+
+            LevelBuffer &tileBuffer = context.LevelTileBuffers[lastColumn];
+            hr = tileBuffer.Initialize(overlapLeft + tileWidth + overlapRight, context.LevelSpilled[level] ? SPILL_BAND_HEIGHT : maxTileSize, 4);
+            IF_FAILED_RETURN(hr);
+
+            context.TileSpillOffset[lastColumn] = cbScratch;
+            context.TileSpilledLines[lastColumn] = 0;
+            if (context.LevelSpilled[level])
+            {
+                cbScratch += (UINT64)tileBuffer.CbStride * maxTileSize;
+            }
+
+            lastColumn++;
+        }
+
+        context.LevelRowCount[level] = 0;
+        context.LevelLineCount[level] = 0;
+    }
+
+    // Decoded strips waiting for the downsample stage
+    //
+    hr = context.StripRing.Initialize(max(2, m_Options.StripQueueLength), m_ImageWidth, CHUNK_HEIGHT, 4);
+    IF_FAILED_RETURN(hr);
+
+    // Finished tiles are encoded and written by the pool, while the downsample stage keeps going
+    //
+    if (m_Options.DeduplicateTiles)
+    {
+        hr = context.Deduplicator.Initialize();
+        IF_FAILED_RETURN(hr);
+    }
+
+    hr = context.EncoderPool.Initialize(threadCount, m_Options.EncoderQueueLength, cbMaxTileSize, containerGuid, pixelFormat, m_Options.TileCodec, TileEncoderOptions(m_Options), 
+                                        isPacked ? &m_TileContainer : NULL, m_Options.DeduplicateTiles ? &context.Deduplicator : NULL);
+    IF_FAILED_RETURN(hr);
+
+    context.ChunksCount = (m_ImageHeight + CHUNK_HEIGHT - 1) / CHUNK_HEIGHT;
+    UINT lastChunkHeight = m_ImageHeight % CHUNK_HEIGHT;
+    lastChunkHeight = (lastChunkHeight == 0) ? CHUNK_HEIGHT : lastChunkHeight;
+
+    HANDLE hDownsampleThread = CreateThread(NULL, 0, &ImageLoaderWIC::DownsampleThreadProc, &context, 0, NULL);
+    if (!hDownsampleThread)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Decode stage
+    //
+    StageTimer decodeTimer;
+    StageTimer decodeStallTimer;
+    WICRect chunkRect = {0, 0, (INT)m_ImageWidth, CHUNK_HEIGHT};
+
+    for (UINT chunk = 0; chunk < context.ChunksCount; ++chunk)
+    {
+        if (chunk == context.ChunksCount - 1)
+        {
+            chunkRect.Height = lastChunkHeight;
+        }
+
+        if (IsOpenCancelled())
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            break;
+        }
+
+        LevelBuffer *pStrip = NULL;
+        decodeStallTimer.Start();
+        hr = context.StripRing.AcquireFree(&pStrip);
+        decodeStallTimer.Stop();
+        IF_FAILED_BREAK(hr);
+
+        decodeTimer.Start();
+        hr = CopyStripPixels(pFormatConverter, chunkRect, *pStrip);
+        decodeTimer.Stop();
+        IF_FAILED_BREAK(hr);
+
+        InterlockedExchangeAdd64(&m_DecodedPixelCount, (LONGLONG)chunkRect.Height * m_ImageWidth);
+
+        // Number of decoded lines is passed to the downsample stage in CurrentLine
+        pStrip->CurrentLine = chunkRect.Height;
+        context.StripRing.PushFilled(pStrip);
+
+        chunkRect.Y += CHUNK_HEIGHT;
+    }
+
+    context.StripRing.Close(hr);
+
+    WaitForSingleObject(hDownsampleThread, INFINITE);
+    CloseHandle(hDownsampleThread);
+
+    HRESULT encodeResult = context.EncoderPool.WaitForCompletion();
+    totalTimer.Stop();
+
+    m_Statistics.TotalSeconds = totalTimer.GetSeconds();
+    m_Statistics.DecodeSeconds = decodeTimer.GetSeconds();
+    m_Statistics.DecodeStallSeconds = decodeStallTimer.GetSeconds();
+    m_Statistics.DownsampleSeconds = context.DownsampleTimer.GetSeconds() - context.EncoderPool.GetSubmitStallSeconds();
+    m_Statistics.DownsampleStallSeconds = context.EncoderPool.GetSubmitStallSeconds();
+    m_Statistics.DownsampleStarveSeconds = context.DownsampleStallTimer.GetSeconds();
+    m_Statistics.EncodeSeconds = context.EncoderPool.GetEncodeSeconds();
+    m_Statistics.EncoderThreadCount = threadCount;
+    m_Statistics.SpilledLevelCount = spilledLevelCount;
+    m_Statistics.SpilledBytes = context.Scratch.GetCbWritten();
+    m_Statistics.DuplicateTileCount = context.Deduplicator.GetDuplicateCount();
+    m_Statistics.SolidColorTileCount = context.SolidColorTileCount;
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters)))
+    {
+        m_Statistics.PeakWorkingSetBytes = memoryCounters.PeakWorkingSetSize;
+    }
+
+    // E_ABORT from the ring means the downsample stage failed and has the real cause
+    if (FAILED(hr) && hr != E_ABORT)
+    {
+        return hr;
+    }
+
+    hr = context.DownsampleResult;
+    IF_FAILED_RETURN(hr);
+
+    IF_FAILED_RETURN(encodeResult);
+
+    if (IsMappedTileCodec(m_Options.TileCodec))
+    {
+        m_TileContainer.Map();
+    }
+
+    return encodeResult;
+}
+
+//-----------------------------------------------------------------------------
+// Pick the levels whose tile buffers go through the scratch file, widest
+// first, until the estimated buffers of the generation fit in the budget
+//-----------------------------------------------------------------------------
+void ImageLoaderWIC::PlanMemoryBudget(__in PyramidGenerationContext &context, __in const UINT &threadCount, __in const UINT &cbMaxTileSize)
+{
+    for (UINT level = 0; level < context.LevelCount; level++)
+    {
+        context.LevelSpilled[level] = FALSE;
+    }
+
+    if (m_Options.MemoryBudgetMegabytes == 0)
+    {
+        return;
+    }
+
+    UINT bandHeight = context.TileSize + 2 * context.TileOverlap;
+
+    // Decoded strips, encoder jobs and the buffer spilled tiles are read back to
+    UINT64 cbTotal = (UINT64)max(2, m_Options.StripQueueLength) * GetCbStride(m_ImageWidth) * CHUNK_HEIGHT +
+                     (UINT64)(TileEncoderPool::GetJobCount(threadCount, m_Options.EncoderQueueLength) + 1) * cbMaxTileSize;
+
+    // Reduced lines, reducer and full tile buffers of each level
+    for (UINT level = 0; level < context.LevelCount; level++)
+    {
+        UINT width = m_ImageWidth >> level;
+        cbTotal += 2 * (UINT64)GetCbStride(width) + LevelReducer::GetCbWorkingSet(m_Options.ReductionFilter, width) + 
+                   GetCbTileBand(width, context.TileSize, context.TileOverlap, bandHeight);
+    }
+
+    UINT64 cbBudget = (UINT64)m_Options.MemoryBudgetMegabytes << 20;
+    for (UINT level = 0; level < context.LevelCount && cbTotal > cbBudget; level++)
+    {
+        UINT width = m_ImageWidth >> level;
+        cbTotal -= GetCbTileBand(width, context.TileSize, context.TileOverlap, bandHeight) - 
+                   GetCbTileBand(width, context.TileSize, context.TileOverlap, SPILL_BAND_HEIGHT);
+
+        context.LevelSpilled[level] = TRUE;
+    }
+}
+
+DWORD WINAPI ImageLoaderWIC::DownsampleThreadProc(__in LPVOID lpParameter)
+{
+    PyramidGenerationContext *pContext = reinterpret_cast<PyramidGenerationContext*>(lpParameter);
+    pContext->DownsampleResult = pContext->pLoader->DownsampleStage(*pContext);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Downsample stage, consumes decoded strips in order until the ring is closed
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::DownsampleStage(__in PyramidGenerationContext &context)
+{
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        LevelBuffer *pStrip = NULL;
+        context.DownsampleStallTimer.Start();
+        hr = context.StripRing.AcquireFilled(&pStrip);
+        context.DownsampleStallTimer.Stop();
+
+        if (hr == S_FALSE)
+        {
+            hr = S_OK;
+            break;
+        }
+        IF_FAILED_BREAK(hr);
+
+        context.DownsampleTimer.Start();
+        hr = DownsampleStrip(context, *pStrip);
+        context.DownsampleTimer.Stop();
+
+        context.StripRing.Recycle(pStrip);
+        IF_FAILED_BREAK(hr);
+    }
+
+    // Unblock the decode stage
+    if (FAILED(hr))
+    {
+        context.StripRing.Abort();
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Push lines of one decoded strip through all levels
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::DownsampleStrip(__in PyramidGenerationContext &context, __in LevelBuffer &strip)
+{
+    HRESULT hr = S_OK;
+
+    // Strips have an even height, so both rows of a box filter pair are always in the same strip
+    UINT lineCount = strip.CurrentLine;
+    for (UINT line = 0; line < lineCount; ++line)
+    {
+        hr = PushLevelLine(context, 0, strip.BasePtr + (SIZE_T)line * strip.CbStride);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Copy a line of a level to its tile buffers and reduce it to the next level,
+// every reduced line is pushed to the next level right away
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::PushLevelLine(__in PyramidGenerationContext &context, __in const UINT &level, __in const BYTE *pLine)
+{
+    HRESULT hr = S_OK;
+
+    // Copy pixels to tile buffers, each tile starts its overlap border before its column
+    //
+    UINT firstColumn = context.LevelFirstTileBuffer[level];
+    for (UINT column = 0; column < context.LevelColumnCount[level]; ++column)
+    {
+        LevelBuffer &tileBuffer = context.LevelTileBuffers[firstColumn + column];
+        UINT firstPixel = column * context.TileSize - ((column > 0) ? context.TileOverlap : 0);
+
+        context.CopyTileRow(tileBuffer.CurrentPtr, pLine + (SIZE_T)firstPixel * 4, tileBuffer.Width);
+
+        tileBuffer.CurrentLine++;
+        tileBuffer.CurrentPtr += tileBuffer.CbStride;
+
+        if (context.LevelSpilled[level] && tileBuffer.CurrentLine == tileBuffer.Height)
+        {
+            hr = FlushTileBand(context, firstColumn + column);
+            IF_FAILED_RETURN(hr);
+        }
+    }
+
+    context.LevelLineCount[level]++;
+
+    // Save images when the line completes a row of tiles including its overlap border below,
+    // a short last row can end on the same line as the row before it
+    //
+    while (context.LevelRowCount[level] < m_Levels[level].RowCount && 
+           context.LevelLineCount[level] == min((context.LevelRowCount[level] + 1) * context.TileSize + context.TileOverlap, m_Levels[level].ImageHeight))
+    {
+        hr = SubmitTileRow(context, level);
+        IF_FAILED_RETURN(hr);
+    }
+
+    if (level == context.LevelCount - 1)
+    {
+        return hr;
+    }
+
+    // Reduced lines alternate between the two lines of the next level buffer,
+    // so the box filter finds the previous line still there
+    //
+    LevelReducer &reducer = context.Reducers[level];
+    LevelBuffer &nextLevelBuffer = context.LevelBuffers[level + 1];
+
+    reducer.PushRow(pLine);
+    while (reducer.CanEmitRow())
+    {
+        BYTE *pReducedLine = nextLevelBuffer.BasePtr + (SIZE_T)(reducer.GetNextRow() % 2) * nextLevelBuffer.CbStride;
+        reducer.EmitRow(pReducedLine);
+
+        hr = PushLevelLine(context, level + 1, pReducedLine);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Fill metadata of the current row of tiles of a level and submit the tiles
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::SubmitTileRow(__in PyramidGenerationContext &context, __in const UINT &level)
+{
+    HRESULT hr = S_OK;
+    UINT row = context.LevelRowCount[level];
+    UINT firstColumn = context.LevelFirstTileBuffer[level];
+
+    UINT overlapTop = 0, tileHeight = 0, overlapBottom = 0;
+    GetTileSpan(row, m_Levels[level].ImageHeight, context.TileSize, context.TileOverlap, overlapTop, tileHeight, overlapBottom);
+
+    // Lines from here on are in the overlap border above the next row of tiles
+    UINT firstCarriedLine = overlapTop + tileHeight - context.TileOverlap;
+
+    BOOL isSpilled = context.LevelSpilled[level];
+
+    for (UINT column = 0; column < context.LevelColumnCount[level]; ++column)
+    {
+        UINT tileBufferIndex = firstColumn + column;
+        LevelBuffer &tileBuffer = context.LevelTileBuffers[tileBufferIndex];
+        _ASSERT((tileBuffer.CurrentLine * tileBuffer.CbStride) <= tileBuffer.CbSize);
+
+        const BYTE *pPixels = tileBuffer.BasePtr;
+        UINT lineCount = tileBuffer.CurrentLine;
+
+        // Spilled tiles are read back whole from the scratch file
+        //
+        if (isSpilled)
+        {
+            hr = FlushTileBand(context, tileBufferIndex);
+            IF_FAILED_RETURN(hr);
+
+            lineCount = context.TileSpilledLines[tileBufferIndex];
+            pPixels = context.SpillTileBuffer.BasePtr;
+
+            hr = context.Scratch.Read(context.TileSpillOffset[tileBufferIndex], context.SpillTileBuffer.BasePtr, lineCount * tileBuffer.CbStride);
+            IF_FAILED_RETURN(hr);
+        }
+        _ASSERT(lineCount == overlapTop + tileHeight + overlapBottom);
+
+        // Fill the tile metadata
+        //
+        UINT index = m_Levels[level].ColumnCount * row + column;
+        ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+        GetTileSpan(column, m_Levels[level].ImageWidth, context.TileSize, context.TileOverlap, tile.OverlapLeft, tile.Width, tile.OverlapRight);
+        tile.X = column * context.TileSize;
+        tile.Y = row * context.TileSize;
+        tile.Height = tileHeight;
+        tile.OverlapTop = overlapTop;
+        tile.OverlapBottom = overlapBottom;
+        tile.Level = level;
+        tile.Row = row;
+        tile.Column = column;
+        tile.Flags = IsBlockCompressedCodec(m_Options.TileCodec) ? ITF_BLOCK_COMPRESSED : 0;
+
+        // Tiles of a single color are only recorded in the metadata
+        //
+        if (m_Options.DetectSolidColorTiles && IsSolidColorTile(pPixels, tileBuffer.Width, lineCount, tileBuffer.CbStride, tile.SolidColor))
+        {
+            tile.Flags = ITF_SOLID_COLOR;
+            context.SolidColorTileCount++;
+        }
+        else
+        {
+            // Get tile file path, or the slot for the packed tile location, and hand the tile over to the encoders
+            //
+            WCHAR tilePath[MAX_PATH] = L"";
+            TileLocation *pLocation = NULL;
+            if (m_pTileLocations)
+            {
+                pLocation = &m_TileLocations[m_Levels[level].FirstTile + index];
+            }
+            else
+            {
+                hr = GetTilePath(level, column, row, MAX_PATH, tilePath); 
+                IF_FAILED_RETURN(hr);
+            }
+
+            hr = context.EncoderPool.Submit(pPixels, tileBuffer.Width, lineCount, tileBuffer.CbStride, pLocation ? NULL : tilePath, pLocation);
+            IF_FAILED_RETURN(hr);
+        }
+
+        InterlockedIncrement(&m_CompletedTileCount);
+
+        // Move the lines shared with the next row of tiles to the top of the buffer, or of the scratch slot
+        //
+        UINT carriedLines = (row + 1 < m_Levels[level].RowCount) ? lineCount - firstCarriedLine : 0;
+        if (isSpilled)
+        {
+            if (carriedLines > 0)
+            {
+                hr = context.Scratch.Write(context.TileSpillOffset[tileBufferIndex], pPixels + firstCarriedLine * tileBuffer.CbStride, carriedLines * tileBuffer.CbStride);
+                IF_FAILED_RETURN(hr);
+            }
+
+            context.TileSpilledLines[tileBufferIndex] = carriedLines;
+            continue;
+        }
+
+        if (carriedLines > 0)
+        {
+            memmove(tileBuffer.BasePtr, tileBuffer.BasePtr + firstCarriedLine * tileBuffer.CbStride, carriedLines * tileBuffer.CbStride);
+        }
+
+        tileBuffer.CurrentLine = carriedLines;
+        tileBuffer.CurrentPtr = tileBuffer.BasePtr + carriedLines * tileBuffer.CbStride;
+    }
+
+    context.LevelRowCount[level]++;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Append the band of lines in a spilled tile buffer to its scratch file slot
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::FlushTileBand(__in PyramidGenerationContext &context, __in const UINT &tileBuffer)
+{
+    LevelBuffer &band = context.LevelTileBuffers[tileBuffer];
+    if (band.CurrentLine == 0)
+    {
+        return S_OK;
+    }
+
+    UINT64 offset = context.TileSpillOffset[tileBuffer] + (UINT64)context.TileSpilledLines[tileBuffer] * band.CbStride;
+    HRESULT hr = context.Scratch.Write(offset, band.BasePtr, band.CurrentLine * band.CbStride);
+    IF_FAILED_RETURN(hr);
+
+    context.TileSpilledLines[tileBuffer] += band.CurrentLine;
+
+    band.CurrentLine = 0;
+    band.CurrentPtr = band.BasePtr;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Generate deep zoom structure with tile jobs on a work stealing pool
+//
+// Workers decode the level 0 tiles they take with their own decoder of the
+// source, so the source has to allow cheap random access to any rectangle.
+// A tile of a higher level is queued once its last child is done and reduced
+// from the pixels its children kept, which are freed right after. Level 0
+// tiles are queued in Z order, so siblings finish close to each other and
+// only a few tiles per worker wait for their parent.
+//
+// A shard of a sharded build runs only the tiles that depend on its band of
+// level 0 tile rows alone. Its tiles whose parent spans more bands are kept
+// in seam files, the merge reads them back and runs the remaining tiles.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GenerateTileParallelPyramid(__in const UINT &tileSize, __in const GUID &containerGuid, __in const WICPixelFormatGUID &pixelFormat, 
+                                                    __in const UINT &shardIndex, __in const UINT &shardCount, __in const BOOL &isMerge, __in_opt IWICBitmapSource *pOverviewSource)
+{
+    TileParallelContext context;
+    context.TotalTimer.Start();
+
+    // Tiles are reduced from their own children only, wider filters and the overlap border need pixels of the neighbors
+    if (m_Options.ReductionFilter != RFT_BOX || m_Options.TileOverlap != 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Shards run in separate processes, they can't append to one tile container
+    if (shardIndex >= shardCount || (shardCount > 1 && m_Options.TileStorage != TST_FILES))
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = PreparePyramid(tileSize);
+    IF_FAILED_RETURN(hr);
+
+    // Shards each build a band of every level, so only a whole build reads levels from the source
+    if (shardCount == 1 && !isMerge && CanUseEmbeddedLevels())
+    {
+        hr = MatchEmbeddedLevels();
+        IF_FAILED_RETURN(hr);
+    }
+
+    // Fill metadata of all tiles, the merge writes it for the tiles of the shards too
+    //
+    for (UINT level = 0; level < m_Levels.Length(); level++)
+    {
+        ImageLevelMetadata &levelMetadata = m_Levels[level];
+        for (UINT row = 0; row < levelMetadata.RowCount; ++row)
+        {
+            for (UINT column = 0; column < levelMetadata.ColumnCount; ++column)
+            {
+                // Tiles of this mode have no overlap border
+                ImageTileMetadata &tile = levelMetadata.Tiles[row * levelMetadata.ColumnCount + column];
+                tile.X = column * tileSize;
+                tile.Y = row * tileSize;
+                tile.Width = min(tileSize, levelMetadata.ImageWidth - tile.X);
+                tile.Height = min(tileSize, levelMetadata.ImageHeight - tile.Y);
+                tile.Level = level;
+                tile.Row = row;
+                tile.Column = column;
+            }
+        }
+    }
+
+    if (pOverviewSource)
+    {
+        hr = PublishOverview(pOverviewSource, tileSize);
+        IF_FAILED_RETURN(hr);
+    }
+
+    context.pLoader = this;
+    context.TileSize = tileSize;
+    context.ShardIndex = shardIndex;
+    context.ShardCount = shardCount;
+    context.IsMerge = isMerge;
+    context.DetectSolidColor = m_Options.DetectSolidColorTiles && (shardCount == 1 || isMerge);
+    context.ContainerFormat = containerGuid;
+    context.PixelFormat = pixelFormat;
+
+    hr = RunTileJobs(context);
+    IF_FAILED_RETURN(hr);
+
+    // Seam tiles are only needed again when the merge has to be repeated
+    for (UINT i = 0; i < context.SeamTiles.Length(); ++i)
+    {
+        WCHAR seamPath[MAX_PATH] = L"";
+        if (SUCCEEDED(GetSeamTilePath(context.SeamTiles[i], MAX_PATH, seamPath)))
+        {
+            DeleteFile(seamPath);
+        }
+    }
+
+    if (IsMappedTileCodec(m_Options.TileCodec))
+    {
+        m_TileContainer.Map();
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Run the tiles of a tile parallel generation or update on the pool, then
+// fill the generation statistics. The tile metadata has to be filled.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::RunTileJobs(__in TileParallelContext &context)
+{
+    UINT levelCount = m_Levels.Length();
+    UINT tileCount = m_Levels[levelCount - 1].FirstTile + m_Levels[levelCount - 1].ColumnCount * m_Levels[levelCount - 1].RowCount;
+    UINT threadCount = (m_Options.EncoderThreadCount == 0) ? TileEncoderPool::GetDefaultThreadCount() : m_Options.EncoderThreadCount;
+
+    context.Average2Rows = m_Options.LinearLightReduction ? GetAverage2RowsLinearKernel() : GetAverage2RowsKernel();
+
+    HRESULT hr = context.Pool.Initialize(threadCount, &ImageLoaderWIC::TileJobProc, &ImageLoaderWIC::TileWorkerExitProc, &context);
+    IF_FAILED_RETURN(hr);
+
+    if (m_Options.DeduplicateTiles)
+    {
+        hr = context.Deduplicator.Initialize();
+        IF_FAILED_RETURN(hr);
+    }
+
+    hr = context.WorkerFactories.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.WorkerSources.SetSize(threadCount * levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.DecodeTimers.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.ReduceTimers.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.EncodeTimers.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.TilePixels.SetSize(tileCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = context.PendingChildren.SetSize(tileCount);
+    IF_FAILED_RETURN(hr);
+
+    ZeroMemory(context.TilePixels.Ptr(), (SIZE_T)tileCount * sizeof(BYTE*));
+    ZeroMemory(context.PendingChildren.Ptr(), (SIZE_T)tileCount * sizeof(LONG));
+
+    // Every tile of this run above level 0 waits for its up to four children, tiles of embedded levels are decoded instead
+    //
+    for (UINT level = 1; level < levelCount; level++)
+    {
+        const ImageLevelMetadata &levelMetadata = m_Levels[level];
+        const ImageLevelMetadata &childLevel = m_Levels[level - 1];
+        if (levelMetadata.IsEmbedded())
+        {
+            continue;
+        }
+
+        TileRange range;
+        GetRunTileRange(context, level, range);
+
+        for (UINT row = range.FirstRow; row < range.RowEnd; ++row)
+        {
+            for (UINT column = range.FirstColumn; column < range.ColumnEnd; ++column)
+            {
+                if (IsTileInRun(context, level, column, row))
+                {
+                    UINT childColumnCount = min(2, childLevel.ColumnCount - 2 * column);
+                    UINT childRowCount = min(2, childLevel.RowCount - 2 * row);
+                    context.PendingChildren[levelMetadata.FirstTile + row * levelMetadata.ColumnCount + column] = childColumnCount * childRowCount;
+                }
+            }
+        }
+    }
+
+    // The merge starts from the seam tiles of the shards, the update from the unchanged tiles
+    hr = (context.IsMerge || context.IsUpdate) ? LoadChildrenOutsideRun(context) : S_OK;
+
+    if (SUCCEEDED(hr))
+    {
+        hr = QueueReadyTiles(context);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = context.Pool.Run();
+    }
+
+    // Only tiles whose parent never ran after a failure are left
+    for (UINT i = 0; i < tileCount; ++i)
+    {
+        _aligned_free(context.TilePixels[i]);
+    }
+
+    context.TotalTimer.Stop();
+
+    m_Statistics.TotalSeconds = context.TotalTimer.GetSeconds();
+    m_Statistics.DecodeSeconds = 0;
+    m_Statistics.DownsampleSeconds = 0;
+    m_Statistics.EncodeSeconds = 0;
+    for (UINT worker = 0; worker < threadCount; ++worker)
+    {
+        m_Statistics.DecodeSeconds += context.DecodeTimers[worker].GetSeconds();
+        m_Statistics.DownsampleSeconds += context.ReduceTimers[worker].GetSeconds();
+        m_Statistics.EncodeSeconds += context.EncodeTimers[worker].GetSeconds();
+    }
+    m_Statistics.EncoderThreadCount = threadCount;
+    m_Statistics.StolenTileJobCount = context.Pool.GetStolenJobCount();
+    m_Statistics.DuplicateTileCount = context.Deduplicator.GetDuplicateCount();
+    m_Statistics.SolidColorTileCount = (UINT)context.SolidColorTileCount;
+    m_Statistics.EmbeddedLevelCount = 0;
+    for (UINT level = 0; level < levelCount; ++level)
+    {
+        m_Statistics.EmbeddedLevelCount += m_Levels[level].IsEmbedded() ? 1 : 0;
+    }
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = {0};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters)))
+    {
+        m_Statistics.PeakWorkingSetBytes = memoryCounters.PeakWorkingSetSize;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Whether this run builds a tile. A shard builds the rows that depend on its
+// band of level 0 rows alone, the merge the others. The update builds tiles
+// over the dirty level 0 tiles.
+//-----------------------------------------------------------------------------
+BOOL ImageLoaderWIC::IsTileInRun(__in const TileParallelContext &context, __in const UINT &level, __in const UINT &column, __in const UINT &row)
+{
+    if (context.IsUpdate)
+    {
+        return (column >= (context.DirtyTiles.FirstColumn >> level)) && (column <= ((context.DirtyTiles.ColumnEnd - 1) >> level)) &&
+               (row >= (context.DirtyTiles.FirstRow >> level)) && (row <= ((context.DirtyTiles.RowEnd - 1) >> level));
+    }
+
+    UINT baseRowCount = m_Levels[0].RowCount;
+    UINT firstShard = GetShardOfBaseRow(row << level, baseRowCount, context.ShardCount);
+    UINT lastShard = GetShardOfBaseRow(min((row + 1) << level, baseRowCount) - 1, baseRowCount, context.ShardCount);
+
+    if (context.IsMerge)
+    {
+        return firstShard != lastShard;
+    }
+
+    return firstShard == context.ShardIndex && lastShard == context.ShardIndex;
+}
+
+//-----------------------------------------------------------------------------
+// Whether a tile is reduced into a tile of the next level, the odd last column
+// or line of a level has no parent and embedded levels are not reduced
+//-----------------------------------------------------------------------------
+BOOL ImageLoaderWIC::IsReducedIntoParent(__in const UINT &level, __in const UINT &column, __in const UINT &row)
+{
+    if (level + 1 >= m_Levels.Length())
+    {
+        return FALSE;
+    }
+
+    const ImageLevelMetadata &parentLevel = m_Levels[level + 1];
+    return !parentLevel.IsEmbedded() && column / 2 < parentLevel.ColumnCount && row / 2 < parentLevel.RowCount;
+}
+
+//-----------------------------------------------------------------------------
+// Get tiles of a level holding all tiles of this run, the update visits only
+// the tiles over the dirty rectangle, so its cost follows the changed area
+//-----------------------------------------------------------------------------
+void ImageLoaderWIC::GetRunTileRange(__in const TileParallelContext &context, __in const UINT &level, __out TileRange &range)
+{
+    if (context.IsUpdate)
+    {
+        range.FirstColumn = context.DirtyTiles.FirstColumn >> level;
+        range.FirstRow = context.DirtyTiles.FirstRow >> level;
+        range.ColumnEnd = min(((context.DirtyTiles.ColumnEnd - 1) >> level) + 1, m_Levels[level].ColumnCount);
+        range.RowEnd = min(((context.DirtyTiles.RowEnd - 1) >> level) + 1, m_Levels[level].RowCount);
+        return;
+    }
+
+    range.FirstColumn = 0;
+    range.FirstRow = 0;
+    range.ColumnEnd = m_Levels[level].ColumnCount;
+    range.RowEnd = m_Levels[level].RowCount;
+}
+
+//-----------------------------------------------------------------------------
+// Queue the tiles of this run that wait for no children, in Z order of their
+// origin. Every worker gets a contiguous run of it.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::QueueReadyTiles(__in TileParallelContext &context)
+{
+    HRESULT hr = S_OK;
+
+    Vector<TileJobOrder> order;
+    for (UINT level = 0; level < m_Levels.Length(); level++)
+    {
+        const ImageLevelMetadata &levelMetadata = m_Levels[level];
+
+        TileRange range;
+        GetRunTileRange(context, level, range);
+
+        for (UINT row = range.FirstRow; row < range.RowEnd; ++row)
+        {
+            for (UINT column = range.FirstColumn; column < range.ColumnEnd; ++column)
+            {
+                // Tiles of embedded levels are only decoded for a parent to reduce
+                if (levelMetadata.IsEmbedded() && !IsReducedIntoParent(level, column, row))
+                {
+                    continue;
+                }
+
+                TileJobOrder job = {GetMortonCode(column << level, row << level), levelMetadata.FirstTile + row * levelMetadata.ColumnCount + column};
+                if (IsTileInRun(context, level, column, row) && context.PendingChildren[job.TileIndex] == 0)
+                {
+                    hr = order.Add(job);
+                    IF_FAILED_RETURN(hr);
+                }
+            }
+        }
+    }
+
+    qsort(order.Ptr(), order.Length(), sizeof(TileJobOrder), &CompareTileJobOrder);
+
+    UINT threadCount = context.Pool.GetThreadCount();
+    for (UINT worker = 0; worker < threadCount; ++worker)
+    {
+        UINT first = (UINT)((UINT64)order.Length() * worker / threadCount);
+        UINT last = (UINT)((UINT64)order.Length() * (worker + 1) / threadCount);
+
+        // Workers take their own jobs last in first out, the run is pushed backwards to be taken in Z order
+        for (UINT i = last; i > first; --i)
+        {
+            hr = context.Pool.Push(worker, order[i - 1].TileIndex);
+            IF_FAILED_RETURN(hr);
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Read the children of the tiles of this run that the run does not build,
+// the merge reads the seam tiles the shards kept for the tiles across their
+// bands, the update decodes the unchanged tiles of the pyramid
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::LoadChildrenOutsideRun(__in TileParallelContext &context)
+{
+    HRESULT hr = S_OK;
+
+    for (UINT level = 1; level < m_Levels.Length(); level++)
+    {
+        const ImageLevelMetadata &levelMetadata = m_Levels[level];
+        const ImageLevelMetadata &childLevel = m_Levels[level - 1];
+        if (levelMetadata.IsEmbedded())
+        {
+            continue;
+        }
+
+        TileRange range;
+        GetRunTileRange(context, level, range);
+
+        for (UINT row = range.FirstRow; row < range.RowEnd; ++row)
+        {
+            for (UINT column = range.FirstColumn; column < range.ColumnEnd; ++column)
+            {
+                if (!IsTileInRun(context, level, column, row))
+                {
+                    continue;
+                }
+
+                UINT tileIndex = levelMetadata.FirstTile + row * levelMetadata.ColumnCount + column;
+
+                for (UINT childRow = row * 2; childRow < min(row * 2 + 2, childLevel.RowCount); ++childRow)
+                {
+                    for (UINT childColumn = column * 2; childColumn < min(column * 2 + 2, childLevel.ColumnCount); ++childColumn)
+                    {
+                        // Children built by this run itself
+                        if (IsTileInRun(context, level - 1, childColumn, childRow))
+                        {
+                            continue;
+                        }
+
+                        UINT childIndex = childRow * childLevel.ColumnCount + childColumn;
+                        const ImageTileMetadata &child = childLevel.Tiles[childIndex];
+                        UINT cbChildStride = GetCbStride(child.Width);
+
+                        if (context.IsMerge)
+                        {
+                            hr = context.SeamTiles.Add(childLevel.FirstTile + childIndex);
+                            IF_FAILED_RETURN(hr);
+
+                            hr = ReadSeamTile(childLevel.FirstTile + childIndex, cbChildStride * child.Height, &context.TilePixels[childLevel.FirstTile + childIndex]);
+                        }
+                        else
+                        {
+                            hr = ReadTilePixels(level - 1, childIndex, cbChildStride, &context.TilePixels[childLevel.FirstTile + childIndex]);
+                        }
+                        IF_FAILED_RETURN(hr);
+
+                        context.PendingChildren[tileIndex]--;
+                    }
+                }
+            }
+        }
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get path of the file keeping pixels of a tile on the seam between shards
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetSeamTilePath(__in const UINT &tileIndex, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pSeamPath)
+{
+    WCHAR strIndex[MAX_PATH];
+    UINT error = _itow_s(tileIndex, strIndex, MAX_PATH, 10);
+    if (error != 0)
+    {
+        return E_FAIL;
+    }
+
+    String fileName;
+    HRESULT hr = fileName.Set(SEAM_FILE_PREFIX);
+    IF_FAILED_RETURN(hr);
+
+    hr = fileName.Concat(strIndex);
+    IF_FAILED_RETURN(hr);
+
+    hr = fileName.Concat(L".raw");
+    IF_FAILED_RETURN(hr);
+
+    return GetPyramidFilePath(fileName.GetBuffer(), size, pSeamPath);
+}
+
+//-----------------------------------------------------------------------------
+// Write pixels of a seam tile, with the stride they are reduced from
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::WriteSeamTile(__in const UINT &tileIndex, __in_bcount(cbPixels) const BYTE *pPixels, __in const UINT &cbPixels)
+{
+    WCHAR seamPath[MAX_PATH] = L"";
+    HRESULT hr = GetSeamTilePath(tileIndex, MAX_PATH, seamPath);
+    IF_FAILED_RETURN(hr);
+
+    HANDLE hFile = CreateFile(seamPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DWORD cbWritten = 0;
+    if (!WriteFile(hFile, pPixels, cbPixels, &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (cbWritten != cbPixels)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    }
+
+    CloseHandle(hFile);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Read pixels of a seam tile written by a shard
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::ReadSeamTile(__in const UINT &tileIndex, __in const UINT &cbPixels, __deref_out BYTE **ppPixels)
+{
+    WCHAR seamPath[MAX_PATH] = L"";
+    HRESULT hr = GetSeamTilePath(tileIndex, MAX_PATH, seamPath);
+    IF_FAILED_RETURN(hr);
+
+    HANDLE hFile = CreateFile(seamPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    BYTE *pPixels = reinterpret_cast<BYTE*>(_aligned_malloc(cbPixels, 16));
+    if (!pPixels)
+    {
+        CloseHandle(hFile);
+        return E_OUTOFMEMORY;
+    }
+
+    DWORD cbRead = 0;
+    if (!ReadFile(hFile, pPixels, cbPixels, &cbRead, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (cbRead != cbPixels)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    CloseHandle(hFile);
+
+    if (FAILED(hr))
+    {
+        _aligned_free(pPixels);
+        return hr;
+    }
+
+    *ppPixels = pPixels;
+
+    return hr;
+}
+
+HRESULT ImageLoaderWIC::TileJobProc(__in LPVOID pContext, __in const UINT &worker, __in const UINT &job)
+{
+    TileParallelContext *pTileContext = reinterpret_cast<TileParallelContext*>(pContext);
+    return pTileContext->pLoader->BuildTile(*pTileContext, worker, job);
+}
+
+void ImageLoaderWIC::TileWorkerExitProc(__in LPVOID pContext, __in const UINT &worker)
+{
+    // Release the decoder and factory on the worker thread, before it leaves the apartment
+    TileParallelContext *pTileContext = reinterpret_cast<TileParallelContext*>(pContext);
+    UINT levelCount = pTileContext->pLoader->m_Levels.Length();
+    for (UINT level = 0; level < levelCount; ++level)
+    {
+        pTileContext->WorkerSources[worker * levelCount + level] = NULL;
+    }
+    pTileContext->WorkerFactories[worker] = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Decode or reduce one tile, encode it and keep its pixels for the parent,
+// the last child the parent waits for queues it on the same worker
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::BuildTile(__in TileParallelContext &context, __in const UINT &worker, __in const UINT &tileIndex)
+{
+    if (IsOpenCancelled())
+    {
+        return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+
+    HRESULT hr = S_OK;
+
+    if (!context.WorkerFactories[worker])
+    {
+        hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&context.WorkerFactories[worker]);
+        IF_FAILED_RETURN(hr);
+    }
+
+    UINT level = 0;
+    while (tileIndex >= m_Levels[level].FirstTile + m_Levels[level].ColumnCount * m_Levels[level].RowCount)
+    {
+        level++;
+    }
+
+    const ImageLevelMetadata &levelMetadata = m_Levels[level];
+    UINT index = tileIndex - levelMetadata.FirstTile;
+    UINT row = index / levelMetadata.ColumnCount;
+    UINT column = index % levelMetadata.ColumnCount;
+    ImageTileMetadata &tile = levelMetadata.Tiles[index];
+
+    UINT cbStride = GetCbStride(tile.Width);
+    BYTE *pPixels = reinterpret_cast<BYTE*>(_aligned_malloc((SIZE_T)cbStride * tile.Height, 16));
+    if (!pPixels)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Tiles of embedded levels are served from their frame of the source, they are decoded for the parent only
+    BOOL isStored = !levelMetadata.IsEmbedded();
+
+    if (!isStored)
+    {
+        hr = DecodeTile(context, worker, tile, cbStride, pPixels);
+    }
+    else if (level == 0)
+    {
+        hr = DecodeTile(context, worker, tile, cbStride, pPixels);
+        InterlockedExchangeAdd64(&m_DecodedPixelCount, (LONGLONG)tile.Width * tile.Height);
+    }
+    else
+    {
+        context.ReduceTimers[worker].Start();
+        ReduceTile(context, tile, cbStride, pPixels);
+        context.ReduceTimers[worker].Stop();
+    }
+
+    // Tiles of a single color are only recorded in the metadata, their pixels still go to the parent
+    //
+    tile.Flags = (isStored && IsBlockCompressedCodec(m_Options.TileCodec)) ? ITF_BLOCK_COMPRESSED : 0;
+    if (SUCCEEDED(hr) && isStored && context.DetectSolidColor && IsSolidColorTile(pPixels, tile.Width, tile.Height, cbStride, tile.SolidColor))
+    {
+        tile.Flags = ITF_SOLID_COLOR;
+        InterlockedIncrement(&context.SolidColorTileCount);
+
+        if (m_pTileLocations)
+        {
+            ZeroMemory(&m_TileLocations[tileIndex], sizeof(TileLocation));
+        }
+    }
+
+    // Get tile file path, or the slot for the packed tile location, and encode the tile
+    //
+    WCHAR tilePath[MAX_PATH] = L"";
+    TileLocation *pLocation = NULL;
+    if (SUCCEEDED(hr) && isStored && !tile.IsSolidColor())
+    {
+        if (m_pTileLocations)
+        {
+            pLocation = &m_TileLocations[tileIndex];
+        }
+        else
+        {
+            hr = GetTilePath(level, column, row, MAX_PATH, tilePath);
+        }
+    }
+
+    if (SUCCEEDED(hr) && isStored && !tile.IsSolidColor())
+    {
+        context.EncodeTimers[worker].Start();
+        hr = EncodeTile(context.WorkerFactories[worker], m_Options.TileCodec, TileEncoderOptions(m_Options), pLocation ? &m_TileContainer : NULL, context.ContainerFormat, 
+                        context.PixelFormat, pPixels, tile.Width, tile.Height, cbStride, pLocation ? NULL : tilePath, pLocation, m_Options.DeduplicateTiles ? &context.Deduplicator : NULL);
+        context.EncodeTimers[worker].Stop();
+    }
+
+    if (FAILED(hr))
+    {
+        _aligned_free(pPixels);
+        return hr;
+    }
+
+    if (isStored)
+    {
+        InterlockedIncrement(&m_CompletedTileCount);
+    }
+
+    UINT parentColumn = column / 2;
+    UINT parentRow = row / 2;
+    if (IsReducedIntoParent(level, column, row))
+    {
+        const ImageLevelMetadata &parentLevel = m_Levels[level + 1];
+        UINT parentIndex = parentLevel.FirstTile + parentRow * parentLevel.ColumnCount + parentColumn;
+
+        // The merge builds a parent across bands of shards from the seam tile
+        if (!IsTileInRun(context, level + 1, parentColumn, parentRow))
+        {
+            hr = WriteSeamTile(tileIndex, pPixels, cbStride * tile.Height);
+            _aligned_free(pPixels);
+
+            return hr;
+        }
+
+        context.TilePixels[tileIndex] = pPixels;
+        if (InterlockedDecrement(&context.PendingChildren[parentIndex]) == 0)
+        {
+            hr = context.Pool.Push(worker, parentIndex);
+        }
+
+        return hr;
+    }
+
+    _aligned_free(pPixels);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Decode a level 0 tile, or a tile of an embedded level from its frame, with
+// the decoder of the worker
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::DecodeTile(__in TileParallelContext &context, __in const UINT &worker, __in const ImageTileMetadata &tile, __in const UINT &cbStride, __out BYTE *pPixels)
+{
+    HRESULT hr = S_OK;
+
+    const ImageLevelMetadata &levelMetadata = m_Levels[tile.Level];
+    SmartPtr<IWICFormatConverter> &spSource = context.WorkerSources[worker * m_Levels.Length() + tile.Level];
+
+    if (!spSource && m_spSource)
+    {
+        hr = GetSuppliedSourceConverter(context.WorkerFactories[worker], &spSource);
+        IF_FAILED_RETURN(hr);
+    }
+    else if (!spSource)
+    {
+        SmartPtr<IWICBitmapDecoder> spDecoder;
+        hr = context.WorkerFactories[worker]->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+        IF_FAILED_RETURN(hr);
+
+        hr = Get32bppBGRFrameConverter(context.WorkerFactories[worker], spDecoder, levelMetadata.IsEmbedded() ? levelMetadata.SourceFrame : 0, &spSource);
+        IF_FAILED_RETURN(hr);
+    }
+
+    WICRect rect = {(INT)tile.X, (INT)tile.Y, (INT)tile.Width, (INT)tile.Height};
+
+    context.DecodeTimers[worker].Start();
+    hr = spSource->CopyPixels(&rect, cbStride, cbStride * tile.Height, pPixels);
+    context.DecodeTimers[worker].Stop();
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Reduce a tile from the kept pixels of its children with the box filter,
+// each child fills a quarter of the tile and its pixels are freed after
+//-----------------------------------------------------------------------------
+void ImageLoaderWIC::ReduceTile(__in TileParallelContext &context, __in const ImageTileMetadata &tile, __in const UINT &cbStride, __out BYTE *pPixels)
+{
+    const ImageLevelMetadata &childLevel = m_Levels[tile.Level - 1];
+    UINT halfTileSize = context.TileSize / 2;
+
+    for (UINT dy = 0; dy < 2; ++dy)
+    {
+        for (UINT dx = 0; dx < 2; ++dx)
+        {
+            UINT childColumn = tile.Column * 2 + dx;
+            UINT childRow = tile.Row * 2 + dy;
+            if (childColumn >= childLevel.ColumnCount || childRow >= childLevel.RowCount)
+            {
+                continue;
+            }
+
+            UINT childIndex = childLevel.FirstTile + childRow * childLevel.ColumnCount + childColumn;
+            const ImageTileMetadata &child = childLevel.Tiles[childIndex - childLevel.FirstTile];
+            BYTE *pChildPixels = context.TilePixels[childIndex];
+            context.TilePixels[childIndex] = NULL;
+
+            // Odd last column and line of the child level are dropped, like in the strip scan
+            UINT cbChildStride = GetCbStride(child.Width);
+            UINT pageCount = (child.Width / 2 + 3) / 4;
+            BYTE *pQuarter = pPixels + (SIZE_T)dy * halfTileSize * cbStride + (SIZE_T)dx * halfTileSize * 4;
+
+            for (UINT line = 0; line < child.Height / 2; ++line)
+            {
+                const BYTE *pChildRow = pChildPixels + (SIZE_T)line * 2 * cbChildStride;
+                context.Average2Rows(pChildRow, pChildRow + cbChildStride, pQuarter + (SIZE_T)line * cbStride, pageCount);
+            }
+
+            _aligned_free(pChildPixels);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Save bitmap rectangular segment to file
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::SaveBitmapRectToFile(__in IWICBitmap *pBitmap, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in const WICRect &rect, __in const WCHAR *pTilePath)
+{
+    SmartPtr<IWICBitmap> spBitmap(pBitmap);
+
+    SmartPtr<IWICBitmapLock> bitmapLock;
+    HRESULT hr = spBitmap->Lock(&rect, WICBitmapLockRead, &bitmapLock);
+    IF_FAILED_RETURN(hr);
+
+    UINT cbBufferSize = 0;
+    BYTE *ptr = NULL;
+    hr = bitmapLock->GetDataPointer(&cbBufferSize, &ptr);
+    IF_FAILED_RETURN(hr);
+
+    UINT stride = 0; 
+    bitmapLock->GetStride(&stride);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmap> spNewBitmap;
+    hr = m_spImagingFactory->CreateBitmapFromMemory(rect.Width, rect.Height, *pPixelFormat, stride, cbBufferSize, ptr, &spNewBitmap);
+    IF_FAILED_RETURN(hr);
+
+    return SaveBitmapToFile(pTilePath, containerFormat, pPixelFormat, spNewBitmap);
+}
+
+//-----------------------------------------------------------------------------
+// Build one shard of a pyramid split between processes sharing the pyramid
+// directory, every shard builds the tiles of its band of level 0 tile rows
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::BuildShard(__in const UINT &shardIndex, __in const UINT &shardCount)
+{
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    WICPixelFormatGUID pixelFormat;
+    GUID containerFormat;
+    HRESULT hr = OpenSource(&spFormatConverter, containerFormat, pixelFormat);
+    IF_FAILED_RETURN(hr);
+
+    return GenerateTileParallelPyramid(m_Options.TileSize, containerFormat, pixelFormat, shardIndex, shardCount, FALSE, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Complete a sharded pyramid once all its shards are built, the tiles across
+// the bands of the shards are built from the seam tiles and the manifest is
+// written, then the image opens from it
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::MergeShards(__in const UINT &shardCount)
+{
+    PyramidManifest::SourceIdentity source;
+    HRESULT hr = GetSourceIdentity(source);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    WICPixelFormatGUID pixelFormat;
+    GUID containerFormat;
+    hr = OpenSource(&spFormatConverter, containerFormat, pixelFormat);
+    IF_FAILED_RETURN(hr);
+
+    hr = GenerateTileParallelPyramid(m_Options.TileSize, containerFormat, pixelFormat, 0, shardCount, TRUE, NULL);
+    IF_FAILED_RETURN(hr);
+
+    // Unlike a pyramid generated by Open, the shards are not found again without the manifest
+    return SaveManifest(source, containerFormat, pixelFormat);
+}
+
+//-----------------------------------------------------------------------------
+// Update the pyramid after a rectangle of the source changed. The level 0
+// tiles over the rectangle are decoded again and their parents in every
+// level reduced again, the other children of those parents are decoded from
+// the pyramid. Packed tiles are appended again, the space of the replaced
+// ones is reclaimed by the next full generation.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::UpdateDirtyRect(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height)
+{
+    // The levels are only complete once an open finished, and no open or other update may start
+    // while they change
+    if (!ClaimOpenState(OPEN_UPDATING))
+    {
+        return E_ILLEGAL_METHOD_CALL;
+    }
+
+    HRESULT hr = UpdatePyramid(x, y, width, height);
+    InterlockedExchange(&m_OpenState, OPEN_IDLE);
+
+    return hr;
+}
+
+HRESULT ImageLoaderWIC::UpdatePyramid(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height)
+{
+    TileParallelContext context;
+    context.TotalTimer.Start();
+
+    if (m_Levels.Length() == 0 || FAILED(m_OpenResult))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
+    }
+
+    // Tiles are reduced from their own children only, like in the tile parallel generation
+    if (m_Options.ReductionFilter != RFT_BOX || m_Options.TileOverlap != 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Unchanged children are read back from their tiles, tiles of a lossy codec would lose quality
+    // in their parents with every update
+    if (IsBlockCompressedCodec(m_Options.TileCodec) || m_Options.TileCodec == TCT_JPEG)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    if (width == 0 || height == 0 || (UINT64)x + width > m_ImageWidth || (UINT64)y + height > m_ImageHeight)
+    {
+        return E_INVALIDARG;
+    }
+
+    PyramidManifest::SourceIdentity source;
+    HRESULT hr = GetSourceIdentity(source);
+    IF_FAILED_RETURN(hr);
+
+    // A source of another size needs a new pyramid
+    UINT imageWidth = m_ImageWidth;
+    UINT imageHeight = m_ImageHeight;
+
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    WICPixelFormatGUID pixelFormat;
+    GUID containerFormat;
+    hr = OpenSource(&spFormatConverter, containerFormat, pixelFormat);
+    IF_FAILED_RETURN(hr);
+
+    if (m_ImageWidth != imageWidth || m_ImageHeight != imageHeight)
+    {
+        m_ImageWidth = imageWidth;
+        m_ImageHeight = imageHeight;
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // Source codec tiles of a JPEG are lossy too
+    if (m_Options.TileCodec == TCT_SOURCE && containerFormat == GUID_ContainerFormatJpeg)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    // Embedded levels are read again from the changed source
+    {
+        AutoCriticalSection lock(m_EmbeddedLock);
+        m_EmbeddedSources.Clear();
+    }
+
+    // Tile readers wait while the locations move and the container is reopened, they go on reading
+    // the unchanged tiles while the update runs
+    {
+        AutoExclusiveLock lock(m_TileContainerLock);
+
+        hr = DetachTileLocations();
+        IF_FAILED_RETURN(hr);
+
+        if (m_pTileLocations)
+        {
+            WCHAR containerPath[MAX_PATH] = L"";
+            hr = GetPyramidFilePath(TILE_CONTAINER_FILE_NAME, MAX_PATH, containerPath);
+            IF_FAILED_RETURN(hr);
+
+            hr = m_TileContainer.OpenForAppend(containerPath);
+            IF_FAILED_RETURN(hr);
+        }
+    }
+
+    UINT tileSize = m_Options.TileSize;
+
+    context.pLoader = this;
+    context.TileSize = tileSize;
+    context.IsUpdate = TRUE;
+    context.DetectSolidColor = m_Options.DetectSolidColorTiles;
+    context.DirtyTiles.FirstColumn = x / tileSize;
+    context.DirtyTiles.FirstRow = y / tileSize;
+    context.DirtyTiles.ColumnEnd = (x + width - 1) / tileSize + 1;
+    context.DirtyTiles.RowEnd = (y + height - 1) / tileSize + 1;
+    context.ContainerFormat = containerFormat;
+    context.PixelFormat = pixelFormat;
+
+    hr = RunTileJobs(context);
+    IF_FAILED_RETURN(hr);
+
+    // The pyramid is usable even if the manifest can't be written, like after Open. The tiles of
+    // a mapped manifest were changed in place, the file is written in place too.
+    if (m_Manifest.IsMapped())
+    {
+        m_Manifest.SaveMapped(source, m_pTileLocations);
+    }
+    else
+    {
+        SaveManifest(source, containerFormat, pixelFormat);
+    }
+
+    // The container was closed for the appending, raw tiles are served from a new mapping
+    if (IsMappedTileCodec(m_Options.TileCodec))
+    {
+        AutoExclusiveLock lock(m_TileContainerLock);
+
+        hr = m_TileContainer.Map();
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get timing of the last pyramid generation
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetGenerationStatistics(__out PyramidGenerationStatistics &statistics)
+{
+    statistics = m_Statistics;
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Get every tile image of a level like the renderer does and add up the bytes
+// its tiles are stored in, tiles of a single color take none
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::BenchmarkLevelDecode(__in const UINT &level, __out DOUBLE &averageMilliseconds, __out UINT64 &cbStored)
+{
+    averageMilliseconds = 0;
+    cbStored = 0;
+
+    if (level >= m_Levels.Length())
+    {
+        return E_INVALIDARG;
+    }
+
+    const ImageLevelMetadata &levelMetadata = m_Levels[level];
+    UINT tileCount = levelMetadata.ColumnCount * levelMetadata.RowCount;
+
+    StageTimer decodeTimer;
+    HRESULT hr = S_OK;
+
+    for (UINT index = 0; index < tileCount; ++index)
+    {
+        const ImageTileMetadata &tile = levelMetadata.Tiles[index];
+
+        SmartPtr<IDxImage> spImage;
+        decodeTimer.Start();
+        hr = GetLevelRowColumnImage(level, tile.Row, tile.Column, &spImage);
+        decodeTimer.Stop();
+        IF_FAILED_RETURN(hr);
+
+        if (tile.IsSolidColor() || levelMetadata.IsEmbedded())
+        {
+            continue;
+        }
+
+        if (m_pTileLocations)
+        {
+            cbStored += m_pTileLocations[levelMetadata.FirstTile + index].Length;
+            continue;
+        }
+
+        WCHAR tilePath[MAX_PATH] = L"";
+        hr = GetTilePath(level, tile.Column, tile.Row, MAX_PATH, tilePath);
+        IF_FAILED_RETURN(hr);
+
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesEx(tilePath, GetFileExInfoStandard, &attributes))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        cbStored += ((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    }
+
+    averageMilliseconds = decodeTimer.GetSeconds() * 1000.0 / tileCount;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get number of levels
+//-----------------------------------------------------------------------------
+UINT ImageLoaderWIC::GetLevelCount()
+{
+    return m_Levels.Length();
+}
+
+//-----------------------------------------------------------------------------
+// Get size of the level
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height)
+{
+    if (level > m_Levels.Length() - 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    width = m_Levels[level].ImageWidth;
+    height = m_Levels[level].ImageHeight;
+    
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Get level row and column count
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount)
+{
+    if (level > m_Levels.Length() - 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    rowCount = m_Levels[level].RowCount;
+    columnCount = m_Levels[level].ColumnCount;
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Get tile metadata
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata)
+{
+    if ((level > m_Levels.Length() - 1) || (row > m_Levels[level].RowCount - 1) || (column > m_Levels[level].ColumnCount - 1))
+    {
+        return E_INVALIDARG;
+    }
+
+    UINT index = m_Levels[level].ColumnCount * row + column;
+    *ppTileMetadata = &(m_Levels[level].Tiles[index]);
+
+    return S_OK;
+}
+
+
+HRESULT ImageLoaderWIC::Initialize(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions *pOptions)
+{
+    if (!pOptions)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_Options = *pOptions;
+
+    // 0xb000 == D3D_FEATURE_LEVEL_11_0, the first level with BC7 textures
+    if (m_Options.TileCodec == TCT_BC7 && m_Options.RendererFeatureLevel != 0 && m_Options.RendererFeatureLevel < 0xb000)
+    {
+        m_Options.TileCodec = TCT_BC1;
+    }
+
+    return Initialize(pFilePath);
+}
+
+HRESULT ImageLoaderWIC::Initialize(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions *pOptions, __in IWICBitmapSource *pSource)
+{
+    // Tiles in the container format of the source need a source with a container
+    if (!pSource || !pOptions || pOptions->TileCodec == TCT_SOURCE)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_spSource = pSource;
+
+    return Initialize(pFilePath, pOptions);
+}
+
+HRESULT ImageLoaderWIC::Initialize(__in_z const WCHAR *pFilePath)
+{
+    HRESULT hr = m_FilePath.Set(pFilePath);
+
+    if (SUCCEEDED(hr))
+    {
+        WCHAR pDrive[5] = L"";
+        WCHAR pDirectory[MAX_PATH] = L"";
+        WCHAR pFileName[MAX_PATH] = L"";
+        WCHAR pExtension[30] = L"";
+
+        UINT error = _wsplitpath_s(m_FilePath.GetBuffer(), pDrive, 5, pDirectory, MAX_PATH, pFileName, MAX_PATH, pExtension, 30); 
+        if (error != 0)
+        {
+            return E_FAIL;
+        }
+
+        hr = m_UltraZoomDirectory.Concat(pDrive);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_UltraZoomDirectory.Concat(pDirectory);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_UltraZoomDirectory.Concat(pFileName);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_UltraZoomDirectory.Concat(L"_dzfiles\\");
+        IF_FAILED_RETURN(hr);
+
+        hr = m_FileExtension.Set(pExtension);
+        IF_FAILED_RETURN(hr);
+
+        // Decoded tile images all fit the buffer of a tile with the overlap border on both sides
+        UINT tileImageSize = m_Options.TileSize + 2 * m_Options.TileOverlap;
+        hr = m_PixelBufferPool.Initialize(tileImageSize * tileImageSize * 4, MAX_FREE_PIXEL_BUFFERS);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_OverviewLock.Initialize();
+        IF_FAILED_RETURN(hr);
+
+        hr = m_EmbeddedLock.Initialize();
+        IF_FAILED_RETURN(hr);
+
+        hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&m_spImagingFactory);
+    }
+
+    return hr;
+}
+
+HRESULT ImageLoaderWIC::GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage)
+{
+    if ((level > m_Levels.Length() - 1) || (row > m_Levels[level].RowCount - 1) || (column > m_Levels[level].ColumnCount - 1))
+    {
+        return E_INVALIDARG;
+    }
+
+    UINT index = m_Levels[level].ColumnCount * row + column;
+
+    // Top levels come from the overview until the open finished
+    HRESULT hr = GetOverviewTileImage(level, index, ppImage);
+    if (hr != S_FALSE)
+    {
+        return hr;
+    }
+
+    // An update may move the tile locations and reopen the container
+    AutoSharedLock lock(m_TileContainerLock);
+
+    if (m_Levels[level].Tiles[index].IsSolidColor())
+    {
+        return GetSolidColorTileImage(level, index, ppImage);
+    }
+
+    if (m_Levels[level].IsEmbedded())
+    {
+        return GetEmbeddedTileImage(level, index, ppImage);
+    }
+
+    if (m_pTileLocations && IsMappedTileCodec(m_Options.TileCodec))
+    {
+        return GetRawTileImage(level, index, ppImage);
+    }
+
+    if (m_Options.TileCodec == TCT_LZ4)
+    {
+        return GetLz4TileImage(level, index, ppImage);
+    }
+
+    UINT nFrame = 0;
+    hr = S_OK;
+
+    // Create a decoder for the packed tile or the tile file
+    SmartPtr<IWICBitmapDecoder> spDecoder;
+    if (m_pTileLocations)
+    {
+        hr = ReadPackedTile(level, index, &spDecoder);
+        IF_FAILED_RETURN(hr);
+    }
+    else
+    {
+        WCHAR tilePath[MAX_PATH] = L"";
+        hr = GetTilePath(level, column, row, MAX_PATH, tilePath);
+        IF_FAILED_RETURN(hr);
+
+        hr = m_spImagingFactory->CreateDecoderFromFilename(tilePath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+        IF_FAILED_RETURN(hr);
+    }
+
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    hr = Get32bppBGRFrameConverter(m_spImagingFactory, spDecoder, nFrame, &spFormatConverter);
+    IF_FAILED_RETURN(hr);
+
+    // Encoded tiles hold the overlap border too
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+    WICRect rect = {0, 0, (INT)tile.GetImageWidth(), (INT)tile.GetImageHeight()};
+    UINT rowPitch = (tile.GetImageWidth() * 32 + 7) / 8;
+
+    return DxImage::CreateInstance(ppImage, rect, 88, rowPitch, spFormatConverter); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+}
+
+//-----------------------------------------------------------------------------
+// Copy the tile locations of a mapped manifest, so the encoders of an update
+// can write the locations of the tiles they append. The tiles of the levels
+// stay where they are, the renderer holds pointers to them, and are changed
+// in the copy on write view.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::DetachTileLocations()
+{
+    if (!m_pTileLocations || m_pTileLocations == m_TileLocations.Ptr())
+    {
+        return S_OK;
+    }
+
+    UINT levelCount = m_Levels.Length();
+    UINT tileCount = m_Levels[levelCount - 1].FirstTile + m_Levels[levelCount - 1].ColumnCount * m_Levels[levelCount - 1].RowCount;
+
+    HRESULT hr = m_TileLocations.SetSize(tileCount);
+    IF_FAILED_RETURN(hr);
+
+    // The mapped locations stay valid for readers until the pointer moves to the copy
+    memcpy(m_TileLocations.Ptr(), m_pTileLocations, (SIZE_T)tileCount * sizeof(TileLocation));
+    m_pTileLocations = m_TileLocations.Ptr();
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Decode a tile of the pyramid to pixels with the given stride
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::ReadTilePixels(__in const UINT &level, __in const UINT &index, __in const UINT &cbStride, __deref_out BYTE **ppPixels)
+{
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+
+    BYTE *pPixels = reinterpret_cast<BYTE*>(_aligned_malloc((SIZE_T)cbStride * tile.Height, 16));
+    if (!pPixels)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = S_OK;
 
-    Vector<UINT> levelRowCount;
-    hr = levelRowCount.SetSize(levelCount);
-    IF_FAILED_RETURN(hr);
+    if (tile.IsSolidColor())
+    {
+        FillSolidColorTile(pPixels, tile.Width, tile.Height, cbStride, tile.SolidColor);
+    }
+    else if (m_Levels[level].IsEmbedded())
+    {
+        AutoCriticalSection lock(m_EmbeddedLock);
 
-    UINT lastColumn = 0;
-    for (UINT level = 0; level < levelCount; level++)
+        SmartPtr<IWICFormatConverter> spSource;
+        hr = GetEmbeddedSource(level, &spSource);
+
+        if (SUCCEEDED(hr))
+        {
+            WICRect rect = {(INT)tile.X, (INT)tile.Y, (INT)tile.Width, (INT)tile.Height};
+            hr = spSource->CopyPixels(&rect, cbStride, cbStride * tile.Height, pPixels);
+        }
+    }
+    else if (m_pTileLocations && m_Options.TileCodec == TCT_RAW)
     {
-        if (level == 0)
+        // Raw tiles are written with the stride they are reduced with
+        const TileLocation &location = m_pTileLocations[m_Levels[level].FirstTile + index];
+        if (location.RowPitch != cbStride || location.Length != cbStride * tile.Height)
         {
-            hr = levelBuffers[level].Initialize(width, CHUNK_HEIGHT, 4);
-            IF_FAILED_RETURN(hr);
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
         else
         {
-            hr = levelBuffers[level].Initialize(width, 2, 4);
-            IF_FAILED_RETURN(hr);
+            hr = m_TileContainer.Read(location, pPixels);
         }
+    }
+    else if (m_Options.TileCodec == TCT_LZ4)
+    {
+        Vector<BYTE> tileData;
+        hr = ReadLz4Tile(level, index, tileData);
 
-        WCHAR levelPath[MAX_PATH] = L"";
-        hr = GetLevelPath(level, MAX_PATH, levelPath);
-        IF_FAILED_RETURN(hr);
-
-        // Create directory for each level
-        //
-        hr = CreateDir(levelPath);
-        IF_FAILED_RETURN(hr);
-
-        INT rowCount = height / tileSize;
-        UINT lastTileHeight = height % tileSize;
-        rowCount = (lastTileHeight == 0) ? rowCount : rowCount + 1;
-
-        UINT columnCount = width / tileSize;
-        UINT lastTileWidth = width % tileSize;
-        columnCount = (lastTileWidth == 0) ? columnCount : columnCount + 1;
-        levelColumnCount[level] = columnCount;
-
-        // Initialize tile buffers
-        //
-        UINT stride = 0;
-        for (UINT column = 0; column < columnCount; ++column)
+        if (SUCCEEDED(hr))
         {
-            UINT tileWidth = (column == columnCount - 1 && lastTileWidth != 0) ? lastTileWidth : tileSize;
-            hr = levelTileBuffers[lastColumn].Initialize(tileWidth, tileSize, 4);
-            IF_FAILED_RETURN(hr);
+            hr = DecompressLz4Tile(tileData.Ptr(), tileData.Length(), tile.Width, tile.Height, pPixels, cbStride);
+        }
+    }
+    else
+    {
+        SmartPtr<IWICBitmapDecoder> spDecoder;
+        if (m_pTileLocations)
+        {
+            hr = ReadPackedTile(level, index, &spDecoder);
+        }
+        else
+        {
+            WCHAR tilePath[MAX_PATH] = L"";
+            hr = GetTilePath(level, tile.Column, tile.Row, MAX_PATH, tilePath);
 
-            stride += levelTileBuffers[lastColumn].CbStride;
-            lastColumn++;
+            if (SUCCEEDED(hr))
+            {
+                hr = m_spImagingFactory->CreateDecoderFromFilename(tilePath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
+            }
         }
-        _ASSERT(stride == levelBuffers[level].CbStride);
 
-        levelRowCount[level] = 0;
+        SmartPtr<IWICFormatConverter> spFormatConverter;
+        if (SUCCEEDED(hr))
+        {
+            hr = Get32bppBGRFrameConverter(m_spImagingFactory, spDecoder, 0, &spFormatConverter);
+        }
 
-        // Initialize tile metadata for each level
-        //
-        hr = m_Levels[level].Initialize(width, height, columnCount, rowCount);
-        IF_FAILED_RETURN(hr);
+        if (SUCCEEDED(hr))
+        {
+            WICRect rect = {0, 0, (INT)tile.Width, (INT)tile.Height};
+            hr = spFormatConverter->CopyPixels(&rect, cbStride, cbStride * tile.Height, pPixels);
+        }
+    }
 
-        width >>= 1;
-        height >>= 1;
+    if (FAILED(hr))
+    {
+        _aligned_free(pPixels);
+        return hr;
     }
 
+    *ppPixels = pPixels;
 
-    UINT chunksCount = m_ImageHeight / CHUNK_HEIGHT;
-    UINT lastChunkHeight = m_ImageHeight % CHUNK_HEIGHT;
-    lastChunkHeight = (lastChunkHeight == 0) ? CHUNK_HEIGHT : lastChunkHeight;
-    WICRect chunkRect = {0, 0, m_ImageWidth, CHUNK_HEIGHT};
+    return hr;
+}
 
-    BOOL isLastChunk = FALSE;
-    for (UINT chunk = 0; chunk < chunksCount; ++chunk)
+//-----------------------------------------------------------------------------
+// Read an encoded tile from the tile container with one positioned read and
+// create a decoder over it, the decoder keeps its own copy of the bytes
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::ReadPackedTile(__in const UINT &level, __in const UINT &index, __deref_out IWICBitmapDecoder **ppDecoder)
+{
+    const TileLocation &location = m_pTileLocations[m_Levels[level].FirstTile + index];
+    if (location.Length == 0)
     {
-        if (chunk == chunksCount - 1)
-        {
-            chunkRect.Height = lastChunkHeight;
-            isLastChunk = TRUE;
-        }
-
-        _ASSERT((levelBuffers[0].CurrentLine == 0) && (levelBuffers[0].CurrentPtr == levelBuffers[0].BasePtr));
-
-        hr = pFormatConverter->CopyPixels(&chunkRect, levelBuffers[0].CbStride, levelBuffers[0].CbSize, levelBuffers[0].CurrentPtr);
-        IF_FAILED_RETURN(hr);
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
 
-        for (INT line = 0; line < chunkRect.Height; ++line)
-        {
-            BOOL isLastRow = isLastChunk && line == chunkRect.Height - 1;
+    SmartPtr<IStream> spStream;
+    HRESULT hr = CreateStreamOnHGlobal(NULL, TRUE, &spStream);
+    IF_FAILED_RETURN(hr);
 
-            UINT lastLevelColumn = 0;
-            for (UINT level = 0; level < levelCount; ++level) 
-            {
-                // Copy pixels to tile buffers
-                //
-                UINT lastColumn = lastLevelColumn;
-                for (UINT column = 0; column < levelColumnCount[level]; ++column)
-                {
-                    
-                    UINT error = memcpy_s(levelTileBuffers[lastColumn].CurrentPtr,
-                                          levelTileBuffers[lastColumn].CbStride,
-                                          levelBuffers[level].CurrentPtr,
-                                          levelTileBuffers[lastColumn].CbStride);
-                    if (error != 0)
-                    {
-                        return E_FAIL;
-                    }
+    ULARGE_INTEGER cbStream;
+    cbStream.QuadPart = location.Length;
+    hr = spStream->SetSize(cbStream);
+    IF_FAILED_RETURN(hr);
 
-                    levelTileBuffers[lastColumn].CurrentLine++;           
-                    levelBuffers[level].CurrentPtr += levelTileBuffers[lastColumn].CbStride;                    
-                    levelTileBuffers[lastColumn].CurrentPtr += levelTileBuffers[lastColumn].CbStride;
-                    lastColumn++;    
-                }
-                levelBuffers[level].CurrentLine++;
+    HGLOBAL hGlobal = NULL;
+    hr = GetHGlobalFromStream(spStream, &hGlobal);
+    IF_FAILED_RETURN(hr);
 
-                _ASSERT(levelBuffers[level].CurrentPtr - ((levelBuffers[level].CurrentLine) * levelBuffers[level].CbStride) == levelBuffers[level].BasePtr);
+    BYTE *pData = reinterpret_cast<BYTE*>(GlobalLock(hGlobal));
+    if (!pData)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-                BOOL isLineEven = (levelBuffers[level].CurrentLine % 2 == 0);
-                
-                // Do scaling each 2 rows
-                //
-                if (isLineEven)
-                {
-                    if (level < levelCount - 1)
-                    {
-                        BYTE* srcRow2 = levelBuffers[level].CurrentPtr - levelBuffers[level].CbStride; 
-                        BYTE* srcRow1 = srcRow2 - levelBuffers[level].CbStride;
-                        BYTE* destRow = levelBuffers[level + 1].CurrentPtr;
-  
-                        Average2Rows(srcRow1, srcRow2, destRow, levelBuffers[level].PageOf32BytesCount);
-                    }
+    hr = m_TileContainer.Read(location, pData);
+    GlobalUnlock(hGlobal);
+    IF_FAILED_RETURN(hr);
 
-                    // We have buffers with just 2 lines, so after each scaling set pointer to zero position
-                    //
-                    if (level > 0)
-                    {
-                        levelBuffers[level].CurrentPtr = levelBuffers[level].BasePtr;
-                        levelBuffers[level].CurrentLine = 0;
-                    }
-                }
+    return m_spImagingFactory->CreateDecoderFromStream(spStream, NULL, WICDecodeMetadataCacheOnDemand, ppDecoder);
+}
 
-                // Save images when buffers have enought data or in case of last row
-                //
-                lastColumn = lastLevelColumn;
+//-----------------------------------------------------------------------------
+// Read the bytes of an LZ4 tile from the tile container or its tile file
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::ReadLz4Tile(__in const UINT &level, __in const UINT &index, __out Vector<BYTE> &tileData)
+{
+    if (m_pTileLocations)
+    {
+        const TileLocation &location = m_pTileLocations[m_Levels[level].FirstTile + index];
+        if (location.Length == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
 
-                if (levelTileBuffers[lastColumn].CurrentLine == levelTileBuffers[lastColumn].Height || isLastRow)
-                {
-                    UINT row = levelRowCount[level];
+        HRESULT hr = tileData.SetSize(location.Length);
+        IF_FAILED_RETURN(hr);
 
-                    for (UINT column = 0; column < levelColumnCount[level]; ++column)
-                    {
-                        _ASSERT((levelTileBuffers[lastColumn].CurrentLine * levelTileBuffers[lastColumn].CbStride) <= levelTileBuffers[lastColumn].CbSize);
+        return m_TileContainer.Read(location, tileData.Ptr());
+    }
 
-                        SmartPtr<IWICBitmap> spBitmap;
-                        hr = m_spImagingFactory->CreateBitmapFromMemory(levelTileBuffers[lastColumn].Width, levelTileBuffers[lastColumn].CurrentLine, 
-                                                                        pixelFormat, levelTileBuffers[lastColumn].CbStride, 
-                                                                        levelTileBuffers[lastColumn].CurrentLine * levelTileBuffers[lastColumn].CbStride,
-                                                                        levelTileBuffers[lastColumn].BasePtr, &spBitmap);
-                        IF_FAILED_RETURN(hr);
-                  
-                        // Fill the tile metadata
-                        //
-                        UINT index = m_Levels[level].ColumnCount * row + column;
-                        m_Levels[level].Tiles[index].X = column * levelTileBuffers[0].Width;
-                        m_Levels[level].Tiles[index].Y = row * levelTileBuffers[0].Height;
-                        m_Levels[level].Tiles[index].Height = levelTileBuffers[lastColumn].CurrentLine;
-                        m_Levels[level].Tiles[index].Width = levelTileBuffers[lastColumn].Width;
-                        m_Levels[level].Tiles[index].Level = level;
-                        m_Levels[level].Tiles[index].Row = row;
-                        m_Levels[level].Tiles[index].Column = column;
-
-                        // Get tile file path and save
-                        //
-                        hr = GetTilePath(level, column, levelRowCount[level], MAX_PATH, m_Levels[level].Tiles[index].TilePath); 
-                        IF_FAILED_RETURN(hr);
-                        hr = SaveBitmapToFile(m_Levels[level].Tiles[index].TilePath, containerGuid, &pixelFormat, spBitmap);
-                        IF_FAILED_RETURN(hr);
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
 
-                        // Set pointer of each buffer to zero position
-                        //
-                        levelTileBuffers[lastColumn].CurrentLine = 0;
-                        levelTileBuffers[lastColumn].CurrentPtr = levelTileBuffers[lastColumn].BasePtr;
-                        lastColumn++;
-                    }
+    WCHAR tilePath[MAX_PATH] = L"";
+    HRESULT hr = GetTilePath(level, tile.Column, tile.Row, MAX_PATH, tilePath);
+    IF_FAILED_RETURN(hr);
 
-                    levelRowCount[level]++;
-                    levelBuffers[level].CurrentLine = 0;
-                    levelBuffers[level].CurrentPtr = levelBuffers[level].BasePtr;
-                }
+    HANDLE hFile = CreateFile(tilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-                lastLevelColumn += levelColumnCount[level];
-                
-                if (!isLineEven && !isLastRow)
-                {
-                    break;
-                }
-            }
-        }
+    LARGE_INTEGER cbFile;
+    if (!GetFileSizeEx(hFile, &cbFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (cbFile.QuadPart > GetLz4TileBound(tile.GetImageWidth(), tile.GetImageHeight()))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    else
+    {
+        hr = tileData.SetSize((UINT)cbFile.QuadPart);
+    }
 
-        levelBuffers[0].CurrentLine = 0;
-        levelBuffers[0].CurrentPtr = levelBuffers[0].BasePtr;
-        chunkRect.Y += CHUNK_HEIGHT;
+    DWORD cbRead = 0;
+    if (SUCCEEDED(hr) && !ReadFile(hFile, tileData.Ptr(), tileData.Length(), &cbRead, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (SUCCEEDED(hr) && cbRead != tileData.Length())
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
     }
 
+    CloseHandle(hFile);
+
     return hr;
 }
 
 //-----------------------------------------------------------------------------
-// Save bitmap rectangular segment to file
+// Get an LZ4 tile, decoded straight into a pixel buffer of the pool. The
+// image keeps the loader alive until it gives the buffer back.
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::SaveBitmapRectToFile(__in IWICBitmap *pBitmap, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in const WICRect &rect, __in const WCHAR *pTilePath)
+HRESULT ImageLoaderWIC::GetLz4TileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage)
 {
-    SmartPtr<IWICBitmap> spBitmap(pBitmap);
-
-    SmartPtr<IWICBitmapLock> bitmapLock;
-    HRESULT hr = spBitmap->Lock(&rect, WICBitmapLockRead, &bitmapLock);
-    IF_FAILED_RETURN(hr);
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
 
-    UINT cbBufferSize = 0;
-    BYTE *ptr = NULL;
-    hr = bitmapLock->GetDataPointer(&cbBufferSize, &ptr);
-    IF_FAILED_RETURN(hr);
-
-    UINT stride = 0; 
-    bitmapLock->GetStride(&stride);
+    Vector<BYTE> tileData;
+    HRESULT hr = ReadLz4Tile(level, index, tileData);
     IF_FAILED_RETURN(hr);
 
-    SmartPtr<IWICBitmap> spNewBitmap;
-    hr = m_spImagingFactory->CreateBitmapFromMemory(rect.Width, rect.Height, *pPixelFormat, stride, cbBufferSize, ptr, &spNewBitmap);
-    IF_FAILED_RETURN(hr);
+    WICRect rect = {0, 0, (INT)tile.GetImageWidth(), (INT)tile.GetImageHeight()};
 
-    return SaveBitmapToFile(pTilePath, containerFormat, pPixelFormat, spNewBitmap);
+    return DxImage::CreateInstance(ppImage, rect, tileData.Ptr(), tileData.Length(), &m_PixelBufferPool, static_cast<IImageLoader*>(this));
 }
 
 //-----------------------------------------------------------------------------
-// Get number of levels
+// Get a raw or block compressed tile without decoding. The image points into
+// the mapped tile container and keeps the loader alive, it stays valid until
+// the loader is opened again. Without the mapping the tile is read and copied.
+// Block compressed images are padded to whole blocks, their row pitch is the
+// pitch of a row of blocks.
 //-----------------------------------------------------------------------------
-UINT ImageLoaderWIC::GetLevelCount()
+HRESULT ImageLoaderWIC::GetRawTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage)
 {
-    return m_Levels.Length();
-}
+    const TileLocation &location = m_pTileLocations[m_Levels[level].FirstTile + index];
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
 
-//-----------------------------------------------------------------------------
-// Get size of the level
-//-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height)
-{
-    if (level > m_Levels.Length() - 1)
+    UINT format = 88; // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+    UINT minRowPitch = tile.GetImageWidth() * 4;
+    UINT minLength = location.RowPitch * tile.GetImageHeight();
+    if (IsBlockCompressedCodec(m_Options.TileCodec))
     {
-        return E_INVALIDARG;
+        format = GetBlockCompressedFormat(m_Options.TileCodec);
+        GetBlockCompressedSize(m_Options.TileCodec, tile.GetImageWidth(), tile.GetImageHeight(), minRowPitch, minLength);
     }
 
-    width = m_Levels[level].ImageWidth;
-    height = m_Levels[level].ImageHeight;
-    
-    return S_OK;
+    if (location.RowPitch < minRowPitch || location.Length < minLength)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    WICRect rect = {0, 0, (INT)tile.GetTextureWidth(), (INT)tile.GetTextureHeight()};
+
+    const BYTE *pMappedTile = m_TileContainer.GetMappedTile(location);
+    if (pMappedTile)
+    {
+        return DxImage::CreateInstance(ppImage, rect, format, location.RowPitch, pMappedTile, static_cast<IImageLoader*>(this));
+    }
+
+    BYTE *pBuffer = reinterpret_cast<BYTE*>(malloc(location.Length));
+    if (!pBuffer)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = m_TileContainer.Read(location, pBuffer);
+    if (SUCCEEDED(hr))
+    {
+        hr = DxImage::CreateInstance(ppImage, rect, format, location.RowPitch, pBuffer, static_cast<IUnknown*>(NULL));
+    }
+
+    free(pBuffer);
+
+    return hr;
 }
 
 //-----------------------------------------------------------------------------
-// Get level row and column count
+// Get a tile of a single color, the renderer makes do with the color in the
+// tile metadata, other callers get the whole tile image
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount)
+HRESULT ImageLoaderWIC::GetSolidColorTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage)
 {
-    if (level > m_Levels.Length() - 1)
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+
+    WICRect rect = {0, 0, (INT)tile.GetImageWidth(), (INT)tile.GetImageHeight()};
+    UINT rowPitch = tile.GetImageWidth() * 4;
+
+    BYTE *pBuffer = reinterpret_cast<BYTE*>(malloc((SIZE_T)rowPitch * tile.GetImageHeight()));
+    if (!pBuffer)
     {
-        return E_INVALIDARG;
+        return E_OUTOFMEMORY;
     }
 
-    rowCount = m_Levels[level].RowCount;
-    columnCount = m_Levels[level].ColumnCount;
+    FillSolidColorTile(pBuffer, tile.GetImageWidth(), tile.GetImageHeight(), rowPitch, tile.SolidColor);
 
-    return S_OK;
+    HRESULT hr = DxImage::CreateInstance(ppImage, rect, 88, rowPitch, pBuffer, static_cast<IUnknown*>(NULL)); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+
+    free(pBuffer);
+
+    return hr;
 }
 
 //-----------------------------------------------------------------------------
-// Get tile metadata
+// Get a tile of a published overview level, S_FALSE when the level is not
+// served from the overview
 //-----------------------------------------------------------------------------
-HRESULT ImageLoaderWIC::GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata)
+HRESULT ImageLoaderWIC::GetOverviewTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage)
 {
-    if ((level > m_Levels.Length() - 1) || (row > m_Levels[level].RowCount - 1) || (column > m_Levels[level].ColumnCount - 1))
+    SmartPtr<IWICBitmap> spLevel;
     {
-        return E_INVALIDARG;
+        AutoCriticalSection lock(m_OverviewLock);
+        if (m_OverviewLevels.Length() == 0 || level < m_OverviewLevel)
+        {
+            return S_FALSE;
+        }
+
+        spLevel = m_OverviewLevels[level - m_OverviewLevel];
     }
 
-    UINT index = m_Levels[level].ColumnCount * row + column;
-    *ppTileMetadata = &(m_Levels[level].Tiles[index]);
+    SmartPtr<IWICFormatConverter> spFormatConverter;
+    HRESULT hr = m_spImagingFactory->CreateFormatConverter(&spFormatConverter);
+    IF_FAILED_RETURN(hr);
 
-    return S_OK;
-}
+    hr = spFormatConverter->Initialize(spLevel, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom);
+    IF_FAILED_RETURN(hr);
 
+    // The tile image with its overlap border is copied out of the level
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+    WICRect rect = {(INT)(tile.X - tile.OverlapLeft), (INT)(tile.Y - tile.OverlapTop), (INT)tile.GetImageWidth(), (INT)tile.GetImageHeight()};
+    UINT rowPitch = tile.GetImageWidth() * 4;
 
-HRESULT ImageLoaderWIC::Initialize(__in_z const WCHAR *pFilePath)
+    return DxImage::CreateInstance(ppImage, rect, 88, rowPitch, spFormatConverter); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+}
+
+//-----------------------------------------------------------------------------
+// Get the decoder of the source frame of an embedded level, created with the
+// first tile read from the level. The caller holds m_EmbeddedLock.
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetEmbeddedSource(__in const UINT &level, __deref_out IWICFormatConverter **ppSource)
 {
-    HRESULT hr = m_FilePath.Set(pFilePath);
+    HRESULT hr = S_OK;
 
-    if (SUCCEEDED(hr))
+    if (m_EmbeddedSources.Length() != m_Levels.Length())
     {
-        WCHAR pDrive[5] = L"";
-        WCHAR pDirectory[MAX_PATH] = L"";
-        WCHAR pFileName[MAX_PATH] = L"";
-        WCHAR pExtension[30] = L"";
-
-        UINT error = _wsplitpath_s(m_FilePath.GetBuffer(), pDrive, 5, pDirectory, MAX_PATH, pFileName, MAX_PATH, pExtension, 30); 
-        if (error != 0)
-        {
-            return E_FAIL;
-        }
+        m_EmbeddedSources.Clear();
 
-        hr = m_UltraZoomDirectory.Concat(pDrive);
+        hr = m_EmbeddedSources.SetSize(m_Levels.Length());
         IF_FAILED_RETURN(hr);
+    }
 
-        hr = m_UltraZoomDirectory.Concat(pDirectory);
+    if (!m_EmbeddedSources[level])
+    {
+        SmartPtr<IWICBitmapDecoder> spDecoder;
+        hr = m_spImagingFactory->CreateDecoderFromFilename(m_FilePath.GetBuffer(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
         IF_FAILED_RETURN(hr);
 
-        hr = m_UltraZoomDirectory.Concat(pFileName);
+        hr = Get32bppBGRFrameConverter(m_spImagingFactory, spDecoder, m_Levels[level].SourceFrame, &m_EmbeddedSources[level]);
         IF_FAILED_RETURN(hr);
+    }
 
-        hr = m_UltraZoomDirectory.Concat(L"_dzfiles\\");
-        IF_FAILED_RETURN(hr);
+    return m_EmbeddedSources[level].CopyTo(ppSource);
+}
 
-        hr = m_FileExtension.Set(pExtension);
-        IF_FAILED_RETURN(hr);
+//-----------------------------------------------------------------------------
+// Get a tile of an embedded level from its frame of the source, tiles of the
+// level share the decoder so they are read one at a time
+//-----------------------------------------------------------------------------
+HRESULT ImageLoaderWIC::GetEmbeddedTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage)
+{
+    AutoCriticalSection lock(m_EmbeddedLock);
 
-        hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&m_spImagingFactory);
-    }
+    SmartPtr<IWICFormatConverter> spSource;
+    HRESULT hr = GetEmbeddedSource(level, &spSource);
+    IF_FAILED_RETURN(hr);
 
-    return hr;
+    // Embedded levels are only used without the overlap border
+    const ImageTileMetadata &tile = m_Levels[level].Tiles[index];
+    WICRect rect = {(INT)tile.X, (INT)tile.Y, (INT)tile.Width, (INT)tile.Height};
+    UINT rowPitch = tile.Width * 4;
+
+    return DxImage::CreateInstance(ppImage, rect, 88, rowPitch, spSource); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
 }
 
-HRESULT ImageLoaderWIC::GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage)
+HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __deref_out IImageLoader **ppResult)
 {
-    if ((level > m_Levels.Length() - 1) || (row > m_Levels[level].RowCount - 1) || (column > m_Levels[level].ColumnCount - 1))
+    TileTreeLayoutType layout;
+    if (ImageLoaderTileTree::DetectLayout(pFilePath, layout) == S_OK)
     {
-        return E_INVALIDARG;
+        return ImageLoaderTileTree::CreateInstance(ppResult, pFilePath, layout);
     }
 
-    UINT index = m_Levels[level].ColumnCount * row + column;
-
-    UINT nFrame = 0;
-
-    // Create a decoder for the given image file
-    SmartPtr<IWICBitmapDecoder> spDecoder;
-    HRESULT hr = m_spImagingFactory->CreateDecoderFromFilename(m_Levels[level].Tiles[index].TilePath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &spDecoder);
-    IF_FAILED_RETURN(hr);
-
-    SmartPtr<IWICFormatConverter> spFormatConverter;
-    hr = Get32bppBGRFrameConverter(spDecoder, nFrame, &spFormatConverter);
-    IF_FAILED_RETURN(hr);
+    return ImageLoaderWIC::CreateInstance(ppResult, pFilePath);
+}
 
-    WICRect rect = {0, 0, m_Levels[level].Tiles[index].Width, m_Levels[level].Tiles[index].Height};
-    UINT rowPitch = (m_Levels[level].Tiles[index].Width * 32 + 7) / 8;
+HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions &options, __deref_out IImageLoader **ppResult)
+{
+    // Nothing is generated for a tile tree, so the options do not apply to it
+    TileTreeLayoutType layout;
+    if (ImageLoaderTileTree::DetectLayout(pFilePath, layout) == S_OK)
+    {
+        return ImageLoaderTileTree::CreateInstance(ppResult, pFilePath, layout);
+    }
 
-    return DxImage::CreateInstance(ppImage, rect, 88, rowPitch, spFormatConverter); // 88 == DXGI_FORMAT_B8G8R8X8_UNORM
+    return ImageLoaderWIC::CreateInstance(ppResult, pFilePath, &options);
 }
 
-HRESULT CreateImageLoader(__in_z const WCHAR *pFilePath, __deref_out IImageLoader **ppResult)
+HRESULT CreateImageLoader(__in IWICBitmapSource *pSource, __in_z const WCHAR *pFilePath, __in const ImageLoaderOptions &options, __deref_out IImageLoader **ppResult)
 {
-    return ImageLoaderWIC::CreateInstance(ppResult, pFilePath);
+    return ImageLoaderWIC::CreateInstance(ppResult, pFilePath, &options, pSource);
 }
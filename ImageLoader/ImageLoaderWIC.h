@@ -28,105 +28,322 @@ class ImageLoaderWIC : public ImplementSmartObject
     >
 { 
     static const UINT CHUNK_HEIGHT = 16;
-    
-    // Has to be multiple of CHUNK_HEIGHT;
-    static const UINT TILE_SIZE = CHUNK_HEIGHT * 64;
-
-
-    struct LevelBuffer
-    {
-        BYTE* BasePtr;
-        BYTE* CurrentPtr;
-        UINT CurrentLine;
-        UINT CbStride;
-    
-        UINT Width;
-        UINT Height;
-        UINT CbSize;
-        UINT PageOf32BytesCount;
 
-        LevelBuffer() : BasePtr(NULL), CurrentPtr(NULL), CurrentLine(0), CbStride(0), PageOf32BytesCount(0), Width(0), Height(0), CbSize(0) {};
-        HRESULT Initialize(__in const UINT &width, __in const UINT &height, __in const UINT &cbPixelSize)
-        {
-            CurrentLine = 0;
-
-            Height = height;
-            Width = width;
+    // Lines of a spilled tile buffer kept in memory before they are flushed to the scratch file
+    static const UINT SPILL_BAND_HEIGHT = 32;
 
-            PageOf32BytesCount = (width * cbPixelSize + 31) / 32;
-            CbStride = PageOf32BytesCount * 32;
-            CbSize = CbStride * height;
+    // Widest source whose line stride still fits in the UINT strides of WIC
+    static const UINT MAX_IMAGE_WIDTH = (0xFFFFFFFF - 31) / 4;
 
-            BasePtr = reinterpret_cast<BYTE*>(_aligned_malloc(CbSize, 16));
-            if (!BasePtr)
-            {
-                return E_OUTOFMEMORY;
-            }
+    // States of the open running in the background, or of an update of the opened pyramid
+    static const LONG OPEN_IDLE = 0;
+    static const LONG OPEN_RUNNING = 1;
+    static const LONG OPEN_CANCELLING = 2;
+    static const LONG OPEN_UPDATING = 3;
 
-            CurrentPtr = BasePtr;
+    // Largest side of the first overview level, bounds the time to first pixel
+    static const UINT MAX_OVERVIEW_SIZE = 1024;
 
-            return S_OK;
-        }
-
-        ~LevelBuffer()
-        {
-            _aligned_free(BasePtr);
-        }
-    };
-
-    // Structure just for internal storage of level metadata
+    // Structure just for internal storage of level metadata, tiles are either
+    // owned or point to the mapped pyramid index
     struct ImageLevelMetadata
     {
         UINT ImageWidth;
         UINT ImageHeight;
         UINT ColumnCount;
         UINT RowCount;
+        UINT FirstTile;
         ImageTileMetadata* Tiles;
+        BOOL OwnsTiles;
 
-        ImageLevelMetadata() : ImageWidth(0), ImageHeight(0), ColumnCount(0), RowCount(0), Tiles(NULL) {};
+        // Frame of the source an embedded level is read from
+        UINT SourceFrame;
+
+        ImageLevelMetadata() : ImageWidth(0), ImageHeight(0), ColumnCount(0), RowCount(0), FirstTile(0), Tiles(NULL), OwnsTiles(FALSE), SourceFrame(PyramidManifest::NO_SOURCE_FRAME) {};
         
         ImageLevelMetadata(UINT width, UINT height, UINT columnCount, UINT rowCount) 
-            : ImageWidth(width), ImageHeight(height), ColumnCount(columnCount), RowCount(rowCount), Tiles(NULL) {};
+            : ImageWidth(width), ImageHeight(height), ColumnCount(columnCount), RowCount(rowCount), FirstTile(0), Tiles(NULL), OwnsTiles(FALSE), 
+              SourceFrame(PyramidManifest::NO_SOURCE_FRAME) {};
         
         ~ImageLevelMetadata()
         {
-            delete[] Tiles;
+            ReleaseTiles();
+        }
+
+        void ReleaseTiles()
+        {
+            if (OwnsTiles)
+            {
+                delete[] Tiles;
+            }
+
+            Tiles = NULL;
+            OwnsTiles = FALSE;
         }
 
-        HRESULT Initialize(__in const UINT &width, __in const UINT &height, __in const UINT &columnCount, __in const UINT &rowCount)
+        HRESULT Initialize(__in const UINT &width, __in const UINT &height, __in const UINT &columnCount, __in const UINT &rowCount, __in const UINT &firstTile)
         {
             ImageWidth = width;
             ImageHeight = height;
             ColumnCount = columnCount;
             RowCount = rowCount;
+            FirstTile = firstTile;
+            SourceFrame = PyramidManifest::NO_SOURCE_FRAME;
 
-            Tiles = new ImageTileMetadata[columnCount * rowCount];
+            ReleaseTiles();
+            Tiles = new ImageTileMetadata[(SIZE_T)columnCount * rowCount];
             if (!Tiles)
             {
                 return E_OUTOFMEMORY;
             }
+            OwnsTiles = TRUE;
 
             return S_OK;
         }
+
+        void InitializeMapped(__in const UINT &width, __in const UINT &height, __in const UINT &columnCount, __in const UINT &rowCount, __in const UINT &firstTile, __in const UINT &sourceFrame, 
+                              __in ImageTileMetadata *pTiles)
+        {
+            ImageWidth = width;
+            ImageHeight = height;
+            ColumnCount = columnCount;
+            RowCount = rowCount;
+            FirstTile = firstTile;
+            SourceFrame = sourceFrame;
+
+            ReleaseTiles();
+            Tiles = pTiles;
+        }
+
+        // Tiles of an embedded level are read from its frame of the source and not stored
+        BOOL IsEmbedded() const { return SourceFrame != PyramidManifest::NO_SOURCE_FRAME; };
+    };
+
+    // State of one pyramid generation shared by the decode and downsample stages
+    struct PyramidGenerationContext
+    {
+        ImageLoaderWIC* pLoader;
+        UINT LevelCount;
+        UINT TileSize;
+        UINT TileOverlap;
+        UINT ChunksCount;
+
+        // Widest reduction kernel of this processor, or the linear light one
+        Average2RowsProc Average2Rows;
+
+        // Row copy specialized for the tile size
+        CopyTileRowProc CopyTileRow;
+
+        Vector<LevelBuffer> LevelBuffers;
+        Vector<LevelReducer> Reducers;
+        Vector<LevelBuffer> LevelTileBuffers;
+        Vector<UINT> LevelFirstTileBuffer;
+        Vector<UINT> LevelColumnCount;
+        Vector<UINT> LevelRowCount;
+        Vector<UINT> LevelLineCount;
+
+        // Levels over the memory budget keep a short band of lines in their tile buffers and flush it to the
+        // slot of the tile buffer in the scratch file, the whole tile is read back when it is submitted
+        Vector<BOOL> LevelSpilled;
+        Vector<UINT64> TileSpillOffset;
+        Vector<UINT> TileSpilledLines;
+        LevelBuffer SpillTileBuffer;
+        ScratchFile Scratch;
+
+        LevelBufferRing StripRing;
+
+        // Declared before the pool, its encoders use it until the pool is gone
+        TileDeduplicator Deduplicator;
+        TileEncoderPool EncoderPool;
+
+        StageTimer DownsampleTimer;
+        StageTimer DownsampleStallTimer;
+        HRESULT DownsampleResult;
+
+        // Tiles only recorded as a color, counted by the downsample stage
+        UINT SolidColorTileCount;
+
+        PyramidGenerationContext() : pLoader(NULL), LevelCount(0), TileSize(0), TileOverlap(0), ChunksCount(0), Average2Rows(NULL), CopyTileRow(NULL), DownsampleResult(S_OK), 
+                                     SolidColorTileCount(0) {};
+    };
+
+    // Tiles of a level from the first column and row up to the end column and row
+    struct TileRange
+    {
+        UINT FirstColumn;
+        UINT FirstRow;
+        UINT ColumnEnd;
+        UINT RowEnd;
+    };
+
+    // State of one tile parallel generation shared by the workers of the pool, jobs are global tile indices
+    struct TileParallelContext
+    {
+        ImageLoaderWIC* pLoader;
+        UINT TileSize;
+
+        // Shard of a sharded build, or the merge of its shards, a single shard builds the whole pyramid
+        UINT ShardIndex;
+        UINT ShardCount;
+        BOOL IsMerge;
+
+        // Update of the tiles over the dirty level 0 tiles, the other children are read from the pyramid
+        BOOL IsUpdate;
+        TileRange DirtyTiles;
+
+        // Shards leave the metadata to the merge, so only runs writing the manifest record solid color tiles
+        BOOL DetectSolidColor;
+        volatile LONG SolidColorTileCount;
+
+        GUID ContainerFormat;
+        WICPixelFormatGUID PixelFormat;
+        Average2RowsProc Average2Rows;
+
+        TileDeduplicator Deduplicator;
+        WorkStealingPool Pool;
+
+        // Imaging factory of each worker, and its decoder of the source frame of each level at worker * level count + level,
+        // created on the first job needing them
+        Vector<SmartPtr<IWICImagingFactory>> WorkerFactories;
+        Vector<SmartPtr<IWICFormatConverter>> WorkerSources;
+        Vector<StageTimer> DecodeTimers;
+        Vector<StageTimer> ReduceTimers;
+        Vector<StageTimer> EncodeTimers;
+
+        // Pixels of finished tiles until their parent is reduced, and children each parent still waits for
+        Vector<BYTE*> TilePixels;
+        Vector<LONG> PendingChildren;
+
+        // Tiles the merge read from the seam files of the shards
+        Vector<UINT> SeamTiles;
+
+        StageTimer TotalTimer;
+
+        TileParallelContext() : pLoader(NULL), TileSize(0), ShardIndex(0), ShardCount(1), IsMerge(FALSE), IsUpdate(FALSE), DetectSolidColor(FALSE), SolidColorTileCount(0), ContainerFormat(GUID_NULL), PixelFormat(GUID_NULL), Average2Rows(NULL) 
+        {
+            ZeroMemory(&DirtyTiles, sizeof(DirtyTiles));
+        };
     };
 
     UINT m_ImageWidth;
     UINT m_ImageHeight;
     Vector<ImageLevelMetadata> m_Levels;
 
+    // Index of a previously generated pyramid, m_Levels point to it when mapped
+    PyramidManifest m_Manifest;
+
+    // Packed tiles and their locations, either generated or in the mapped index. Tile readers share the
+    // lock, an update takes it alone while it moves the locations or reopens the container.
+    TileContainer m_TileContainer;
+    Vector<TileLocation> m_TileLocations;
+    const TileLocation* m_pTileLocations;
+    ReaderWriterLock m_TileContainerLock;
+
+    // Buffers of the LZ4 tile images handed out
+    PixelBufferPool m_PixelBufferPool;
+
     String m_FilePath;
     String m_UltraZoomDirectory;
+
+    // Source supplied instead of decoding the file, the file path then only names the pyramid
+    SmartPtr<IWICBitmapSource> m_spSource;
     String m_FileExtension;
+
+    ImageLoaderOptions m_Options;
+    PyramidGenerationStatistics m_Statistics;
+
+    // Open running in the background and its progress, counters are updated by the generation threads
+    AsyncOperation<ImageLoaderWIC> m_OpenOperation;
+    volatile LONG m_OpenState;
+    volatile LONG m_OpenResult;
+    HANDLE m_hOpenedEvent;
+    LARGE_INTEGER m_OpenStartTicks;
+    volatile LONGLONG m_DecodedPixelCount;
+    volatile LONG m_CompletedTileCount;
+    UINT m_OpenTileCount;
+
+    // Top levels read quickly from the source, served until the open finished
+    CriticalSection m_OverviewLock;
+    Vector<SmartPtr<IWICBitmap>> m_OverviewLevels;
+    UINT m_OverviewLevel;
+    HANDLE m_hOverviewEvent;
+
+    // Frames of the source and the decoders of the embedded levels serving their tiles, by level
+    UINT m_SourceFrameCount;
+    CriticalSection m_EmbeddedLock;
+    Vector<SmartPtr<IWICFormatConverter>> m_EmbeddedSources;
  
     SmartPtr<IWICImagingFactory> m_spImagingFactory;
 
     HRESULT SaveBitmapToFile(__in const WCHAR* pFilePath, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap);
-    HRESULT Get32bppBGRFrameConverter(__in IWICBitmapDecoder *spDecoder,  __in const UINT &frame, __deref_out IWICFormatConverter **ppFormatConverter);
+    HRESULT OpenSource(__deref_out IWICFormatConverter **ppFormatConverter, __out GUID &containerFormat, __out WICPixelFormatGUID &pixelFormat);
+    HRESULT GetSourceIdentity(__out PyramidManifest::SourceIdentity &source);
+    HRESULT GetSuppliedSourceConverter(__in IWICImagingFactory *pImagingFactory, __deref_out IWICFormatConverter **ppFormatConverter);
+    HRESULT Get32bppBGRFrameConverter(__in IWICImagingFactory *pImagingFactory, __in IWICBitmapDecoder *spDecoder,  __in const UINT &frame, __deref_out IWICFormatConverter **ppFormatConverter);
     
+    const WCHAR* GetTileExtension();
     HRESULT GetTilePath(__in const UINT &level, __in const UINT &column,__in const UINT &row, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pTilePath);
     HRESULT GetLevelPath(__in const UINT &level, __in const UINT &size, __deref_out_ecount_z(length + 1) WCHAR *pLevelPath);
+    HRESULT GetPyramidFilePath(__in_z const WCHAR *pFileName, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pFilePath);
+
+    HRESULT OpenPyramid();
+    void    ResetOpenProgress();
+    void    ReleaseOverview();
+    BOOL    ClaimOpenState(__in const LONG &state);
+    void    SignalOverview();
+    BOOL    IsOpenCancelled() const { return m_OpenState == OPEN_CANCELLING; };
+
+    void    ReleaseLevels();
+    HRESULT OpenFromManifest(__in const PyramidManifest::SourceIdentity &source);
+    HRESULT SaveManifest(__in const PyramidManifest::SourceIdentity &source, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat);
 
     HRESULT GenerateDeepZoomPyramid(__in IWICFormatConverter *pFormatConverter, __in const UINT &tileSize, __in const GUID &containerGuid, __in const WICPixelFormatGUID &pixelFormat);
+    HRESULT PreparePyramid(__in const UINT &tileSize);
+    BOOL    CanUseEmbeddedLevels() const;
+    HRESULT MatchEmbeddedLevels();
+    HRESULT PublishOverview(__in IWICBitmapSource *pSource, __in const UINT &tileSize);
+    HRESULT DecodeOverview(__in IWICBitmapSource *pSource, __in const UINT &overviewLevel, __in IWICBitmap *pOverview);
+    HRESULT OpenOverviewSource(__in IWICBitmapSource *pSource, __in const UINT &overviewLevel, __in const UINT &width, __in const UINT &height, 
+                               __deref_out IWICBitmapSource **ppOverviewSource, __out UINT &sourceWidth, __out UINT &sourceHeight);
+    HRESULT OpenScaledSource(__in const UINT &width, __in const UINT &height, __deref_out IWICBitmapSourceTransform **ppTransform, 
+                             __out UINT &scaledWidth, __out UINT &scaledHeight, __out WICPixelFormatGUID &scaledFormat);
+    void    PlanMemoryBudget(__in PyramidGenerationContext &context, __in const UINT &threadCount, __in const UINT &cbMaxTileSize);
+    HRESULT DownsampleStage(__in PyramidGenerationContext &context);
+    HRESULT DownsampleStrip(__in PyramidGenerationContext &context, __in LevelBuffer &strip);
+    HRESULT PushLevelLine(__in PyramidGenerationContext &context, __in const UINT &level, __in const BYTE *pLine);
+    HRESULT SubmitTileRow(__in PyramidGenerationContext &context, __in const UINT &level);
+    HRESULT FlushTileBand(__in PyramidGenerationContext &context, __in const UINT &tileBuffer);
+    static DWORD WINAPI DownsampleThreadProc(__in LPVOID lpParameter);
+
+    HRESULT GenerateTileParallelPyramid(__in const UINT &tileSize, __in const GUID &containerGuid, __in const WICPixelFormatGUID &pixelFormat, 
+                                        __in const UINT &shardIndex, __in const UINT &shardCount, __in const BOOL &isMerge, __in_opt IWICBitmapSource *pOverviewSource);
+    HRESULT RunTileJobs(__in TileParallelContext &context);
+    BOOL    IsTileInRun(__in const TileParallelContext &context, __in const UINT &level, __in const UINT &column, __in const UINT &row);
+    BOOL    IsReducedIntoParent(__in const UINT &level, __in const UINT &column, __in const UINT &row);
+    void    GetRunTileRange(__in const TileParallelContext &context, __in const UINT &level, __out TileRange &range);
+    HRESULT QueueReadyTiles(__in TileParallelContext &context);
+    HRESULT LoadChildrenOutsideRun(__in TileParallelContext &context);
+    HRESULT GetSeamTilePath(__in const UINT &tileIndex, __in const UINT &size, __deref_out_ecount_z(size + 1) WCHAR *pSeamPath);
+    HRESULT WriteSeamTile(__in const UINT &tileIndex, __in_bcount(cbPixels) const BYTE *pPixels, __in const UINT &cbPixels);
+    HRESULT ReadSeamTile(__in const UINT &tileIndex, __in const UINT &cbPixels, __deref_out BYTE **ppPixels);
+    HRESULT BuildTile(__in TileParallelContext &context, __in const UINT &worker, __in const UINT &tileIndex);
+    HRESULT DecodeTile(__in TileParallelContext &context, __in const UINT &worker, __in const ImageTileMetadata &tile, __in const UINT &cbStride, __out BYTE *pPixels);
+    void    ReduceTile(__in TileParallelContext &context, __in const ImageTileMetadata &tile, __in const UINT &cbStride, __out BYTE *pPixels);
+    static HRESULT TileJobProc(__in LPVOID pContext, __in const UINT &worker, __in const UINT &job);
+    static void TileWorkerExitProc(__in LPVOID pContext, __in const UINT &worker);
+
+    HRESULT DetachTileLocations();
+    HRESULT UpdatePyramid(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height);
+    HRESULT ReadTilePixels(__in const UINT &level, __in const UINT &index, __in const UINT &cbStride, __deref_out BYTE **ppPixels);
+    HRESULT ReadPackedTile(__in const UINT &level, __in const UINT &index, __deref_out IWICBitmapDecoder **ppDecoder);
+    HRESULT ReadLz4Tile(__in const UINT &level, __in const UINT &index, __out Vector<BYTE> &tileData);
+    HRESULT GetLz4TileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage);
+    HRESULT GetRawTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage);
+    HRESULT GetSolidColorTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage);
+    HRESULT GetOverviewTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage);
+    HRESULT GetEmbeddedSource(__in const UINT &level, __deref_out IWICFormatConverter **ppSource);
+    HRESULT GetEmbeddedTileImage(__in const UINT &level, __in const UINT &index, __out IDxImage** ppImage);
+
     HRESULT SaveBitmapRectToFile(__in IWICBitmap *pBitmap, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in const WICRect &rect, __in const WCHAR *pTilePath);
     UINT    GetMaximumLevel(__in const UINT &width, __in const UINT &height, __in const UINT &minTileSize);
 
@@ -135,13 +352,28 @@ public:
     ~ImageLoaderWIC();
 
     HRESULT Initialize(__in_z const WCHAR *pFilePath);
+    HRESULT Initialize(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions *pOptions);
+    HRESULT Initialize(__in_z const WCHAR *pFilePath, __in const ImageLoaderOptions *pOptions, __in IWICBitmapSource *pSource);
 
     HRESULT Open();
+    HRESULT OpenAsync(__in_opt HANDLE hOpenedEvent, __in_opt HANDLE hOverviewEvent);
+    HRESULT CancelOpen();
+    HRESULT GetOpenProgress(__out PyramidOpenProgress &progress);
+    HRESULT GetOpenResult();
+    UINT    GetFirstAvailableLevel();
     HRESULT Destroy();
 
+    // Body of the background open, run by m_OpenOperation
+    void    Invoke();
+
     UINT    GetLevelCount();
     HRESULT GetLevelSize(__in const UINT &level, __out UINT &width, __out UINT &height);
     HRESULT GetLevelRowColumnCount(__in const UINT &level, __out UINT &rowCount, __out UINT &columnCount);
     HRESULT GetLevelRowColumnMetadata(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out const ImageTileMetadata** ppTileMetadata);
     HRESULT GetLevelRowColumnImage(__in const UINT &level, __in const UINT &row, __in const UINT &column, __out IDxImage** ppImage);
+    HRESULT GetGenerationStatistics(__out PyramidGenerationStatistics &statistics);
+    HRESULT BuildShard(__in const UINT &shardIndex, __in const UINT &shardCount);
+    HRESULT MergeShards(__in const UINT &shardCount);
+    HRESULT UpdateDirtyRect(__in const UINT &x, __in const UINT &y, __in const UINT &width, __in const UINT &height);
+    HRESULT BenchmarkLevelDecode(__in const UINT &level, __out DOUBLE &averageMilliseconds, __out UINT64 &cbStored);
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Buffer of image rows with 32 bytes aligned stride
+//-----------------------------------------------------------------------------
+struct LevelBuffer
+{
+    BYTE* BasePtr;
+    BYTE* CurrentPtr;
+    UINT CurrentLine;
+    UINT CbStride;
+
+    UINT Width;
+    UINT Height;
+    SIZE_T CbSize;
+    UINT PageOf32BytesCount;
+
+    LevelBuffer() : BasePtr(NULL), CurrentPtr(NULL), CurrentLine(0), CbStride(0), PageOf32BytesCount(0), Width(0), Height(0), CbSize(0) {};
+    HRESULT Initialize(__in const UINT &width, __in const UINT &height, __in const UINT &cbPixelSize)
+    {
+        CurrentLine = 0;
+
+        Height = height;
+        Width = width;
+
+        // Strides are passed to WIC as UINT, the whole buffer has to fit in the address space
+        UINT64 pageCount = ((UINT64)width * cbPixelSize + 31) / 32;
+        UINT64 cbSize = pageCount * 32 * height;
+        if (pageCount * 32 > UINT_MAX || cbSize > (SIZE_T)-1)
+        {
+            return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        }
+
+        PageOf32BytesCount = (UINT)pageCount;
+        CbStride = PageOf32BytesCount * 32;
+        CbSize = (SIZE_T)cbSize;
+
+        BasePtr = reinterpret_cast<BYTE*>(_aligned_malloc(CbSize, 16));
+        if (!BasePtr)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        CurrentPtr = BasePtr;
+
+        return S_OK;
+    }
+
+    ~LevelBuffer()
+    {
+        _aligned_free(BasePtr);
+    }
+};
@@ -0,0 +1,188 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "LevelBufferRing.h"
+
+LevelBufferRing::LevelBufferRing()
+{
+    m_FilledHead = 0;
+    m_FilledCount = 0;
+    m_hFreeSemaphore = NULL;
+    m_hFilledSemaphore = NULL;
+    m_Closed = FALSE;
+    m_Aborted = FALSE;
+    m_CloseResult = S_OK;
+}
+
+LevelBufferRing::~LevelBufferRing()
+{
+    if (m_hFreeSemaphore)
+    {
+        CloseHandle(m_hFreeSemaphore);
+    }
+
+    if (m_hFilledSemaphore)
+    {
+        CloseHandle(m_hFilledSemaphore);
+    }
+}
+
+HRESULT LevelBufferRing::Initialize(__in const UINT &bufferCount, __in const UINT &width, __in const UINT &height, __in const UINT &cbPixelSize)
+{
+    if (bufferCount == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_Lock.Initialize();
+    IF_FAILED_RETURN(hr);
+
+    hr = m_Buffers.SetSize(bufferCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_FreeBuffers.SetSize(bufferCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_FilledBuffers.SetSize(bufferCount);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT i = 0; i < bufferCount; ++i)
+    {
+        hr = m_Buffers[i].Initialize(width, height, cbPixelSize);
+        IF_FAILED_RETURN(hr);
+
+        m_FreeBuffers[i] = i;
+    }
+
+    // One extra count on each side for waking up the other stage on close or abort
+    m_hFreeSemaphore = CreateSemaphore(NULL, bufferCount, bufferCount + 1, NULL);
+    if (!m_hFreeSemaphore)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_hFilledSemaphore = CreateSemaphore(NULL, 0, bufferCount + 1, NULL);
+    if (!m_hFilledSemaphore)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Wait for a buffer the consumer has finished with
+//-----------------------------------------------------------------------------
+HRESULT LevelBufferRing::AcquireFree(__deref_out LevelBuffer **ppBuffer)
+{
+    if (WaitForSingleObject(m_hFreeSemaphore, INFINITE) != WAIT_OBJECT_0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    AutoCriticalSection lock(m_Lock);
+    if (m_Aborted)
+    {
+        return E_ABORT;
+    }
+
+    _ASSERT(m_FreeBuffers.Length() > 0);
+
+    LevelBuffer *pBuffer = &m_Buffers[m_FreeBuffers.PopLast()];
+    pBuffer->CurrentLine = 0;
+    pBuffer->CurrentPtr = pBuffer->BasePtr;
+    *ppBuffer = pBuffer;
+
+    return S_OK;
+}
+
+void LevelBufferRing::PushFilled(__in LevelBuffer *pBuffer)
+{
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_FilledBuffers[(m_FilledHead + m_FilledCount) % m_FilledBuffers.Length()] = (UINT)(pBuffer - m_Buffers.Ptr());
+        m_FilledCount++;
+    }
+    ReleaseSemaphore(m_hFilledSemaphore, 1, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Producer has finished, a failure is reported to the consumer immediately
+//-----------------------------------------------------------------------------
+void LevelBufferRing::Close(__in const HRESULT &hr)
+{
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_Closed = TRUE;
+        m_CloseResult = hr;
+    }
+    ReleaseSemaphore(m_hFilledSemaphore, 1, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Wait for the next filled buffer in producer order
+//-----------------------------------------------------------------------------
+HRESULT LevelBufferRing::AcquireFilled(__deref_out LevelBuffer **ppBuffer)
+{
+    if (WaitForSingleObject(m_hFilledSemaphore, INFINITE) != WAIT_OBJECT_0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    AutoCriticalSection lock(m_Lock);
+    if (m_Closed && FAILED(m_CloseResult))
+    {
+        return m_CloseResult;
+    }
+
+    if (m_FilledCount == 0)
+    {
+        _ASSERT(m_Closed);
+        return S_FALSE;
+    }
+
+    *ppBuffer = &m_Buffers[m_FilledBuffers[m_FilledHead]];
+    m_FilledHead = (m_FilledHead + 1) % m_FilledBuffers.Length();
+    m_FilledCount--;
+
+    return S_OK;
+}
+
+void LevelBufferRing::Recycle(__in LevelBuffer *pBuffer)
+{
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_FreeBuffers.Add((UINT)(pBuffer - m_Buffers.Ptr()));
+    }
+    ReleaseSemaphore(m_hFreeSemaphore, 1, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Consumer has failed, the producer gets E_ABORT from AcquireFree
+//-----------------------------------------------------------------------------
+void LevelBufferRing::Abort()
+{
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_Aborted = TRUE;
+    }
+    ReleaseSemaphore(m_hFreeSemaphore, 1, NULL);
+}
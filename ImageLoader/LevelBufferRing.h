@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "LevelBuffer.h"
+
+//-----------------------------------------------------------------------------
+// Fixed ring of recycled level buffers connecting two pipeline stages.
+// The producer fills free buffers and pushes them, the consumer pops filled
+// buffers in the same order and recycles them when done.
+//-----------------------------------------------------------------------------
+class LevelBufferRing
+{
+    Vector<LevelBuffer> m_Buffers;
+
+    // Indices to m_Buffers, free buffers are kept as a stack, filled ones as a ring
+    Vector<UINT> m_FreeBuffers;
+    Vector<UINT> m_FilledBuffers;
+    UINT m_FilledHead;
+    UINT m_FilledCount;
+
+    CriticalSection m_Lock;
+    HANDLE m_hFreeSemaphore;
+    HANDLE m_hFilledSemaphore;
+
+    BOOL m_Closed;
+    BOOL m_Aborted;
+    HRESULT m_CloseResult;
+
+public:
+    LevelBufferRing();
+    ~LevelBufferRing();
+
+    HRESULT Initialize(__in const UINT &bufferCount, __in const UINT &width, __in const UINT &height, __in const UINT &cbPixelSize);
+
+    // Producer side
+    HRESULT AcquireFree(__deref_out LevelBuffer **ppBuffer);
+    void    PushFilled(__in LevelBuffer *pBuffer);
+    void    Close(__in const HRESULT &hr);
+
+    // Consumer side, AcquireFilled returns S_FALSE when the producer closed the ring and all buffers were consumed
+    HRESULT AcquireFilled(__deref_out LevelBuffer **ppBuffer);
+    void    Recycle(__in LevelBuffer *pBuffer);
+    void    Abort();
+};
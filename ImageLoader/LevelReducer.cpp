@@ -0,0 +1,360 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <math.h>
+#include <emmintrin.h>
+#include "LevelReducer.h"
+
+//-----------------------------------------------------------------------------
+// Expand a rgb32 pixel to four floats
+//-----------------------------------------------------------------------------
+inline static __m128 PixelToFloat(__in const UINT32 &pixel)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+
+    return _mm_cvtepi32_ps(channels);
+}
+
+//-----------------------------------------------------------------------------
+// Round four floats to a rgb32 pixel, saturating to 0-255
+//-----------------------------------------------------------------------------
+inline static UINT32 FloatToPixel(__in const __m128 &value)
+{
+    __m128i channels = _mm_cvtps_epi32(value);
+    channels = _mm_packs_epi32(channels, channels);
+    channels = _mm_packus_epi16(channels, channels);
+
+    return (UINT32)_mm_cvtsi128_si32(channels);
+}
+
+LevelReducer::LevelReducer()
+{
+    m_Filter = RFT_BOX;
+    m_SrcWidth = 0;
+    m_SrcHeight = 0;
+    m_DstWidth = 0;
+    m_DstHeight = 0;
+    m_RowsPushed = 0;
+    m_RowsEmitted = 0;
+    m_pfnAverage2Rows = NULL;
+    m_PageCount = 0;
+    m_pRows[0] = NULL;
+    m_pRows[1] = NULL;
+    m_TapCount = 0;
+    m_pSourceRow = NULL;
+    m_pHistory = NULL;
+    m_pLinearLight = NULL;
+}
+
+LevelReducer::~LevelReducer()
+{
+    _aligned_free(m_pSourceRow);
+    _aligned_free(m_pHistory);
+}
+
+//-----------------------------------------------------------------------------
+// Expand a source pixel to floats, through the linear light table if enabled
+//-----------------------------------------------------------------------------
+inline __m128 LevelReducer::ExpandPixel(__in const UINT32 &pixel) const
+{
+    if (!m_pLinearLight)
+    {
+        return PixelToFloat(pixel);
+    }
+
+    const FLOAT *pToLinear = m_pLinearLight->ToLinearFloat;
+    return _mm_setr_ps(pToLinear[pixel & 0xFF], pToLinear[(pixel >> 8) & 0xFF], pToLinear[(pixel >> 16) & 0xFF], 255.0f);
+}
+
+//-----------------------------------------------------------------------------
+// Convert filtered floats back to a pixel
+//-----------------------------------------------------------------------------
+inline UINT32 LevelReducer::ReducePixel(__in const __m128 &value) const
+{
+    if (!m_pLinearLight)
+    {
+        return FloatToPixel(value);
+    }
+
+    // Scale 0-255 linear light to the table index, saturating like FloatToPixel
+    static const FLOAT LINEAR_SCALE = (FLOAT)LinearLightTables::LINEAR_MAX / 255.0f;
+    __m128 scaled = _mm_min_ps(_mm_max_ps(_mm_mul_ps(value, _mm_set1_ps(LINEAR_SCALE)), _mm_setzero_ps()), _mm_set1_ps((FLOAT)LinearLightTables::LINEAR_MAX));
+
+    __m128i indexes = _mm_cvtps_epi32(scaled);
+
+    const BYTE *pFromLinear = m_pLinearLight->FromLinear;
+    UINT32 blue = pFromLinear[_mm_cvtsi128_si32(indexes)];
+    UINT32 green = pFromLinear[_mm_cvtsi128_si32(_mm_srli_si128(indexes, 4))];
+    UINT32 red = pFromLinear[_mm_cvtsi128_si32(_mm_srli_si128(indexes, 8))];
+    return blue | (green << 8) | (red << 16) | 0xFF000000UL;
+}
+
+//-----------------------------------------------------------------------------
+// Filter value at distance x, measured in pixels of the reduced level
+//-----------------------------------------------------------------------------
+FLOAT LevelReducer::GetFilterWeight(__in const ReductionFilterType &filter, __in const FLOAT &x)
+{
+    static const DOUBLE PI = 3.14159265358979323846;
+
+    DOUBLE ax = fabs((DOUBLE)x);
+
+    switch (filter)
+    {
+    case RFT_BILINEAR:
+        return (FLOAT)max(0.0, 1.0 - ax);
+
+    case RFT_MITCHELL:
+        // Mitchell-Netravali with B = C = 1/3
+        if (ax < 1.0)
+        {
+            return (FLOAT)((7.0 * ax * ax * ax - 12.0 * ax * ax + 16.0 / 3.0) / 6.0);
+        }
+        if (ax < 2.0)
+        {
+            return (FLOAT)((-7.0 / 3.0 * ax * ax * ax + 12.0 * ax * ax - 20.0 * ax + 32.0 / 3.0) / 6.0);
+        }
+        return 0;
+
+    case RFT_LANCZOS3:
+        if (ax < 1e-6)
+        {
+            return 1;
+        }
+        if (ax < 3.0)
+        {
+            return (FLOAT)(3.0 * sin(PI * ax) * sin(PI * ax / 3.0) / (PI * PI * ax * ax));
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Number of source pixels under the filter in each direction, 0 for the box
+//-----------------------------------------------------------------------------
+UINT LevelReducer::GetTapCount(__in const ReductionFilterType &filter)
+{
+    switch (filter)
+    {
+    case RFT_BILINEAR:
+        return 4;
+    case RFT_MITCHELL:
+        return 8;
+    case RFT_LANCZOS3:
+        return 12;
+    default:
+        return 0;
+    }
+}
+
+UINT64 LevelReducer::GetCbWorkingSet(__in const ReductionFilterType &filter, __in const UINT &srcWidth)
+{
+    UINT64 tapCount = GetTapCount(filter);
+    UINT64 dstWidth = max(1, srcWidth >> 1);
+
+    return (tapCount == 0) ? 0 : ((srcWidth + tapCount) + dstWidth * tapCount) * 4 * sizeof(FLOAT);
+}
+
+HRESULT LevelReducer::Initialize(__in const ReductionFilterType &filter, __in Average2RowsProc pfnAverage2Rows, __in const BOOL &linearLight, __in const UINT &srcWidth, __in const UINT &srcHeight)
+{
+    m_Filter = filter;
+    m_SrcWidth = srcWidth;
+    m_SrcHeight = srcHeight;
+    m_DstWidth = srcWidth >> 1;
+    m_DstHeight = srcHeight >> 1;
+    m_RowsPushed = 0;
+    m_RowsEmitted = 0;
+    m_pLinearLight = linearLight ? &GetLinearLightTables() : NULL;
+
+    if (m_Filter == RFT_BOX)
+    {
+        if (!pfnAverage2Rows)
+        {
+            return E_INVALIDARG;
+        }
+
+        // Each page gives 4 reduced pixels, stay within the stride of the reduced row
+        m_pfnAverage2Rows = pfnAverage2Rows;
+        m_PageCount = (m_DstWidth + 3) / 4;
+
+        return S_OK;
+    }
+
+    m_TapCount = GetTapCount(m_Filter);
+    if (m_TapCount == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Taps of reduced pixel i are source pixels 2i - k + 1 to 2i + k centered at 2i + 0.5
+    UINT k = m_TapCount / 2;
+    FLOAT sum = 0;
+    for (UINT tap = 0; tap < m_TapCount; ++tap)
+    {
+        FLOAT distance = ((FLOAT)tap - ((FLOAT)k - 0.5f)) / 2.0f;
+        m_Weights[tap] = GetFilterWeight(m_Filter, distance);
+        sum += m_Weights[tap];
+    }
+
+    for (UINT tap = 0; tap < m_TapCount; ++tap)
+    {
+        m_Weights[tap] /= sum;
+    }
+
+    // Source row with k - 1 replicated pixels on the left and k on the right
+    _aligned_free(m_pSourceRow);
+    m_pSourceRow = reinterpret_cast<FLOAT*>(_aligned_malloc(((SIZE_T)m_SrcWidth + m_TapCount) * 4 * sizeof(FLOAT), 16));
+    if (!m_pSourceRow)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // The last m_TapCount horizontally reduced rows, indexed by source row
+    _aligned_free(m_pHistory);
+    m_pHistory = reinterpret_cast<FLOAT*>(_aligned_malloc((SIZE_T)max(1, m_DstWidth) * m_TapCount * 4 * sizeof(FLOAT), 16));
+    if (!m_pHistory)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Push the next row of the source level
+//-----------------------------------------------------------------------------
+void LevelReducer::PushRow(__in const BYTE *pSrcRow)
+{
+    if (m_Filter == RFT_BOX)
+    {
+        m_pRows[m_RowsPushed % 2] = pSrcRow;
+        m_RowsPushed++;
+        return;
+    }
+
+    const UINT32 *pSrcPixels = reinterpret_cast<const UINT32*>(pSrcRow);
+    UINT k = m_TapCount / 2;
+
+    // Expand to floats once, with clamped edges, so the taps need no bounds checks
+    FLOAT *pExpanded = m_pSourceRow;
+    __m128 edge = ExpandPixel(pSrcPixels[0]);
+    for (UINT x = 0; x < k - 1; ++x, pExpanded += 4)
+    {
+        _mm_store_ps(pExpanded, edge);
+    }
+
+    for (UINT x = 0; x < m_SrcWidth; ++x, pExpanded += 4)
+    {
+        _mm_store_ps(pExpanded, ExpandPixel(pSrcPixels[x]));
+    }
+
+    edge = ExpandPixel(pSrcPixels[m_SrcWidth - 1]);
+    for (UINT x = 0; x < k; ++x, pExpanded += 4)
+    {
+        _mm_store_ps(pExpanded, edge);
+    }
+
+    __m128 weights[MAX_TAP_COUNT];
+    for (UINT tap = 0; tap < m_TapCount; ++tap)
+    {
+        weights[tap] = _mm_set1_ps(m_Weights[tap]);
+    }
+
+    // Horizontal pass, expanded pixel 2i is the first tap of reduced pixel i
+    FLOAT *pReduced = m_pHistory + (SIZE_T)(m_RowsPushed % m_TapCount) * m_DstWidth * 4;
+    for (UINT i = 0; i < m_DstWidth; ++i)
+    {
+        const FLOAT *pTaps = m_pSourceRow + (SIZE_T)i * 2 * 4;
+
+        __m128 sum = _mm_setzero_ps();
+        for (UINT tap = 0; tap < m_TapCount; ++tap)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(weights[tap], _mm_load_ps(pTaps + tap * 4)));
+        }
+
+        _mm_store_ps(pReduced + (SIZE_T)i * 4, sum);
+    }
+
+    m_RowsPushed++;
+}
+
+//-----------------------------------------------------------------------------
+// Check all source rows under the filter of the next reduced row were pushed
+//-----------------------------------------------------------------------------
+BOOL LevelReducer::CanEmitRow() const
+{
+    if (m_RowsEmitted >= m_DstHeight)
+    {
+        return FALSE;
+    }
+
+    if (m_Filter == RFT_BOX)
+    {
+        return m_RowsPushed >= 2 * m_RowsEmitted + 2;
+    }
+
+    UINT lastSourceRow = min(2 * m_RowsEmitted + m_TapCount / 2, m_SrcHeight - 1);
+    return m_RowsPushed > lastSourceRow;
+}
+
+//-----------------------------------------------------------------------------
+// Write the next row of the reduced level
+//-----------------------------------------------------------------------------
+void LevelReducer::EmitRow(__out BYTE *pDstRow)
+{
+    _ASSERT(CanEmitRow());
+
+    if (m_Filter == RFT_BOX)
+    {
+        m_pfnAverage2Rows(m_pRows[0], m_pRows[1], pDstRow, m_PageCount);
+        m_RowsEmitted++;
+        return;
+    }
+
+    // Rows under the filter, clamped to the level and found in the ring
+    __m128 weights[MAX_TAP_COUNT];
+    const FLOAT *pRows[MAX_TAP_COUNT];
+    INT firstSourceRow = 2 * (INT)m_RowsEmitted - (INT)(m_TapCount / 2) + 1;
+    for (UINT tap = 0; tap < m_TapCount; ++tap)
+    {
+        INT sourceRow = min(max(firstSourceRow + (INT)tap, 0), (INT)m_SrcHeight - 1);
+        pRows[tap] = m_pHistory + (SIZE_T)(sourceRow % m_TapCount) * m_DstWidth * 4;
+        weights[tap] = _mm_set1_ps(m_Weights[tap]);
+    }
+
+    // Vertical pass
+    UINT32 *pDstPixels = reinterpret_cast<UINT32*>(pDstRow);
+    for (UINT i = 0; i < m_DstWidth; ++i)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (UINT tap = 0; tap < m_TapCount; ++tap)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(weights[tap], _mm_load_ps(pRows[tap] + (SIZE_T)i * 4)));
+        }
+
+        pDstPixels[i] = ReducePixel(sum);
+    }
+
+    m_RowsEmitted++;
+}
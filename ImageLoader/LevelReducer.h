@@ -0,0 +1,86 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "ReductionKernels.h"
+
+//-----------------------------------------------------------------------------
+// Streaming 2:1 reduction of one pyramid level into the next one. Rows of the
+// level are pushed in order and rows of the next level are emitted as soon
+// as all source rows under the filter are available, so only a few rows of
+// each level are kept in memory.
+//
+// The box filter averages row pairs in place with the Average2Rows kernel.
+// The other filters are separable, each pushed row is reduced horizontally
+// into a ring of float rows and emitted rows are reduced vertically from it.
+// Source rows and columns are clamped at the edges of the level. In linear
+// light mode the float filters convert through the sRGB tables, the box
+// filter gets the linear light Average2Rows kernel from the caller.
+//-----------------------------------------------------------------------------
+class LevelReducer
+{
+    static const UINT MAX_TAP_COUNT = 12;
+
+    ReductionFilterType m_Filter;
+
+    UINT m_SrcWidth;
+    UINT m_SrcHeight;
+    UINT m_DstWidth;
+    UINT m_DstHeight;
+
+    UINT m_RowsPushed;
+    UINT m_RowsEmitted;
+
+    // Box filter, rows of a pair have to stay valid until the pair is emitted
+    Average2RowsProc m_pfnAverage2Rows;
+    UINT m_PageCount;
+    const BYTE* m_pRows[2];
+
+    // Separable filters
+    UINT m_TapCount;
+    FLOAT m_Weights[MAX_TAP_COUNT];
+    FLOAT* m_pSourceRow;
+    FLOAT* m_pHistory;
+
+    // Tables of the linear light reduction, NULL when reducing sRGB values directly
+    const LinearLightTables* m_pLinearLight;
+
+    __m128 ExpandPixel(__in const UINT32 &pixel) const;
+    UINT32 ReducePixel(__in const __m128 &value) const;
+
+    static FLOAT GetFilterWeight(__in const ReductionFilterType &filter, __in const FLOAT &x);
+    static UINT  GetTapCount(__in const ReductionFilterType &filter);
+
+public:
+    LevelReducer();
+    ~LevelReducer();
+
+    HRESULT Initialize(__in const ReductionFilterType &filter, __in Average2RowsProc pfnAverage2Rows, __in const BOOL &linearLight, __in const UINT &srcWidth, __in const UINT &srcHeight);
+
+    void PushRow(__in const BYTE *pSrcRow);
+
+    BOOL CanEmitRow() const;
+    UINT GetNextRow() const { return m_RowsEmitted; };
+    void EmitRow(__out BYTE *pDstRow);
+
+    // Bytes allocated by a reducer of the given filter and source width
+    static UINT64 GetCbWorkingSet(__in const ReductionFilterType &filter, __in const UINT &srcWidth);
+};
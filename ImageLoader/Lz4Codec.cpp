@@ -0,0 +1,382 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <intrin.h>
+#include "Lz4Codec.h"
+
+// Matches are at least 4 bytes, the last 5 bytes of a block are literals and no match starts in its last 12 bytes
+static const UINT MIN_MATCH = 4;
+static const UINT LAST_LITERALS = 5;
+static const UINT MATCH_FIND_LIMIT = 12;
+static const UINT MAX_OFFSET = 0xFFFF;
+
+// Lengths of 15 in the token continue in the following bytes
+static const UINT TOKEN_LENGTH_MASK = 0xF;
+static const UINT MAX_LENGTH = 0x7FFFFFFF;
+
+static const UINT HASH_BITS = 12;
+static const UINT SKIP_TRIGGER = 6;
+
+inline static UINT32 Read32(__in const BYTE *p)
+{
+    UINT32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline static UINT HashSequence(__in const UINT32 &sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static BYTE* WriteLength(__out BYTE *pOutput, __in UINT length)
+{
+    while (length >= 0xFF)
+    {
+        *pOutput++ = 0xFF;
+        length -= 0xFF;
+    }
+    *pOutput++ = (BYTE)length;
+
+    return pOutput;
+}
+
+static BYTE* WriteLiterals(__out BYTE *pOutput, __in const BYTE *pLiterals, __in const UINT &literalLength, __in const UINT &matchToken)
+{
+    *pOutput++ = (BYTE)((min(literalLength, TOKEN_LENGTH_MASK) << 4) | matchToken);
+    if (literalLength >= TOKEN_LENGTH_MASK)
+    {
+        pOutput = WriteLength(pOutput, literalLength - TOKEN_LENGTH_MASK);
+    }
+
+    memcpy(pOutput, pLiterals, literalLength);
+
+    return pOutput + literalLength;
+}
+
+//-----------------------------------------------------------------------------
+// Length of the match past its first bytes, compared 4 bytes at a time
+//-----------------------------------------------------------------------------
+static const BYTE* FindMatchEnd(__in const BYTE *pInput, __in const BYTE *pMatch, __in const BYTE *pLimit)
+{
+    while (pInput + sizeof(UINT32) <= pLimit)
+    {
+        UINT32 difference = Read32(pInput) ^ Read32(pMatch);
+        if (difference)
+        {
+            unsigned long firstDifferentBit;
+            _BitScanForward(&firstDifferentBit, difference);
+            return pInput + firstDifferentBit / 8;
+        }
+
+        pInput += sizeof(UINT32);
+        pMatch += sizeof(UINT32);
+    }
+
+    while (pInput < pLimit && *pInput == *pMatch)
+    {
+        ++pInput;
+        ++pMatch;
+    }
+
+    return pInput;
+}
+
+//-----------------------------------------------------------------------------
+// Compress to one LZ4 block, greedy matching against the last position of
+// every hashed 4 bytes. Returns the size of the block.
+//-----------------------------------------------------------------------------
+static UINT CompressLz4Block(__in_bcount(cbSource) const BYTE *pSource, __in const UINT &cbSource, __out BYTE *pOutput)
+{
+    UINT32 positions[1 << HASH_BITS];
+    ZeroMemory(positions, sizeof(positions));
+
+    const BYTE *pInput = pSource;
+    const BYTE *pAnchor = pSource;
+    const BYTE *pEnd = pSource + cbSource;
+    BYTE *pOut = pOutput;
+
+    if (cbSource > MATCH_FIND_LIMIT)
+    {
+        const BYTE *pMatchFindLimit = pEnd - MATCH_FIND_LIMIT;
+        const BYTE *pMatchLimit = pEnd - LAST_LITERALS;
+
+        while (pInput < pMatchFindLimit)
+        {
+            UINT32 sequence = Read32(pInput);
+            UINT hash = HashSequence(sequence);
+            const BYTE *pMatch = pSource + positions[hash];
+            positions[hash] = (UINT32)(pInput - pSource);
+
+            if (pMatch >= pInput || (UINT)(pInput - pMatch) > MAX_OFFSET || Read32(pMatch) != sequence)
+            {
+                // Step further the longer nothing matched, so incompressible data is skipped quickly
+                pInput += 1 + ((pInput - pAnchor) >> SKIP_TRIGGER);
+                continue;
+            }
+
+            while (pInput > pAnchor && pMatch > pSource && pInput[-1] == pMatch[-1])
+            {
+                --pInput;
+                --pMatch;
+            }
+
+            const BYTE *pMatchEnd = FindMatchEnd(pInput + MIN_MATCH, pMatch + MIN_MATCH, pMatchLimit);
+            UINT matchLength = (UINT)(pMatchEnd - pInput) - MIN_MATCH;
+            UINT offset = (UINT)(pInput - pMatch);
+
+            pOut = WriteLiterals(pOut, pAnchor, (UINT)(pInput - pAnchor), min(matchLength, TOKEN_LENGTH_MASK));
+            *pOut++ = (BYTE)offset;
+            *pOut++ = (BYTE)(offset >> 8);
+            if (matchLength >= TOKEN_LENGTH_MASK)
+            {
+                pOut = WriteLength(pOut, matchLength - TOKEN_LENGTH_MASK);
+            }
+
+            pInput = pMatchEnd;
+            pAnchor = pInput;
+
+            // Bytes just before the end of a match often start the next one
+            if (pInput < pMatchFindLimit)
+            {
+                positions[HashSequence(Read32(pInput - 2))] = (UINT32)(pInput - 2 - pSource);
+            }
+        }
+    }
+
+    pOut = WriteLiterals(pOut, pAnchor, (UINT)(pEnd - pAnchor), 0);
+
+    return (UINT)(pOut - pOutput);
+}
+
+static BOOL ReadLength(__inout const BYTE *&pInput, __in const BYTE *pEnd, __inout UINT &length)
+{
+    BYTE value = 0;
+    do
+    {
+        if (pInput >= pEnd || length > MAX_LENGTH)
+        {
+            return FALSE;
+        }
+
+        value = *pInput++;
+        length += value;
+    }
+    while (value == 0xFF);
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Decompress one LZ4 block, it has to fill the output exactly. Literals and
+// matches are copied in whole words while there is room for the last copy
+// to overrun them, the next sequence writes over the overrun.
+//-----------------------------------------------------------------------------
+static BOOL DecompressLz4Block(__in_bcount(cbSource) const BYTE *pSource, __in const UINT &cbSource, __out_bcount(cbOutput) BYTE *pOutput, __in const UINT &cbOutput)
+{
+    const BYTE *pInput = pSource;
+    const BYTE *pEnd = pSource + cbSource;
+    BYTE *pOut = pOutput;
+    BYTE *pOutEnd = pOutput + cbOutput;
+
+    for (;;)
+    {
+        if (pInput >= pEnd)
+        {
+            return FALSE;
+        }
+
+        UINT token = *pInput++;
+
+        UINT literalLength = token >> 4;
+        if (literalLength == TOKEN_LENGTH_MASK && !ReadLength(pInput, pEnd, literalLength))
+        {
+            return FALSE;
+        }
+
+        if ((SIZE_T)(pEnd - pInput) < literalLength || (SIZE_T)(pOutEnd - pOut) < literalLength)
+        {
+            return FALSE;
+        }
+
+        // Literals are copied 16 bytes at a time while the last copy can overrun both buffers
+        if ((SIZE_T)(pEnd - pInput) >= literalLength + 2 * sizeof(UINT64) && (SIZE_T)(pOutEnd - pOut) >= literalLength + 2 * sizeof(UINT64))
+        {
+            for (UINT copied = 0; copied < literalLength; copied += 2 * sizeof(UINT64))
+            {
+                memcpy(pOut + copied, pInput + copied, 2 * sizeof(UINT64));
+            }
+        }
+        else
+        {
+            memcpy(pOut, pInput, literalLength);
+        }
+
+        pInput += literalLength;
+        pOut += literalLength;
+
+        // Block ends with literals
+        if (pInput == pEnd)
+        {
+            return pOut == pOutEnd;
+        }
+
+        if (pEnd - pInput < 2)
+        {
+            return FALSE;
+        }
+
+        UINT offset = pInput[0] | (pInput[1] << 8);
+        pInput += 2;
+
+        UINT matchLength = token & TOKEN_LENGTH_MASK;
+        if (matchLength == TOKEN_LENGTH_MASK && !ReadLength(pInput, pEnd, matchLength))
+        {
+            return FALSE;
+        }
+        matchLength += MIN_MATCH;
+
+        if (offset == 0 || offset > (SIZE_T)(pOut - pOutput) || (SIZE_T)(pOutEnd - pOut) < matchLength)
+        {
+            return FALSE;
+        }
+
+        const BYTE *pMatch = pOut - offset;
+        BYTE *pMatchEnd = pOut + matchLength;
+
+        if (offset < sizeof(UINT64))
+        {
+            // A pattern shorter than a word, runs of one color. Everything from the match on repeats
+            // the pattern, so it is copied after itself doubling each time.
+            while (pOut < pMatchEnd)
+            {
+                SIZE_T cbCopy = min((SIZE_T)(pOut - pMatch), (SIZE_T)(pMatchEnd - pOut));
+                memcpy(pOut, pMatch, cbCopy);
+                pOut += cbCopy;
+            }
+        }
+        else if (pOutEnd - pMatchEnd >= sizeof(UINT64))
+        {
+            while (pOut < pMatchEnd)
+            {
+                memcpy(pOut, pMatch, sizeof(UINT64));
+                pOut += sizeof(UINT64);
+                pMatch += sizeof(UINT64);
+            }
+        }
+        else
+        {
+            while (pOut < pMatchEnd)
+            {
+                *pOut++ = *pMatch++;
+            }
+        }
+
+        pOut = pMatchEnd;
+    }
+}
+
+UINT GetLz4TileBound(__in const UINT &width, __in const UINT &height)
+{
+    UINT cbPixels = width * 4 * height;
+
+    return sizeof(Lz4TileHeader) + cbPixels + cbPixels / 0xFF + 16;
+}
+
+HRESULT CompressLz4Tile(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                        __out BYTE *pTileData, __out UINT &cbTileData)
+{
+    UINT cbRow = width * 4;
+    const BYTE *pSource = pPixelData;
+    BYTE *pPacked = NULL;
+
+    // Matches refer back within one contiguous block, rows with stride padding are packed first
+    if (cbStride != cbRow && height > 1)
+    {
+        pPacked = reinterpret_cast<BYTE*>(_aligned_malloc(cbRow * height, 16));
+        if (!pPacked)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        for (UINT y = 0; y < height; ++y)
+        {
+            memcpy(pPacked + y * cbRow, pPixelData + (SIZE_T)y * cbStride, cbRow);
+        }
+        pSource = pPacked;
+    }
+
+    Lz4TileHeader header;
+    header.Magic = LZ4_TILE_MAGIC;
+    header.Width = width;
+    header.Height = height;
+    header.CompressedSize = CompressLz4Block(pSource, cbRow * height, pTileData + sizeof(Lz4TileHeader));
+
+    memcpy(pTileData, &header, sizeof(header));
+    cbTileData = sizeof(Lz4TileHeader) + header.CompressedSize;
+
+    _aligned_free(pPacked);
+
+    return S_OK;
+}
+
+HRESULT DecompressLz4Tile(__in_bcount(cbTileData) const BYTE *pTileData, __in const UINT &cbTileData, __in const UINT &width, __in const UINT &height, 
+                          __out BYTE *pPixelData, __in const UINT &cbStride)
+{
+    Lz4TileHeader header;
+    if (cbTileData < sizeof(header))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    memcpy(&header, pTileData, sizeof(header));
+    if (header.Magic != LZ4_TILE_MAGIC || header.Width != width || header.Height != height || header.CompressedSize > cbTileData - sizeof(header))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    const BYTE *pBlock = pTileData + sizeof(header);
+    UINT cbRow = width * 4;
+
+    if (cbStride == cbRow || height == 1)
+    {
+        return DecompressLz4Block(pBlock, header.CompressedSize, pPixelData, cbRow * height) ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    BYTE *pPacked = reinterpret_cast<BYTE*>(_aligned_malloc(cbRow * height, 16));
+    if (!pPacked)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT hr = DecompressLz4Block(pBlock, header.CompressedSize, pPacked, cbRow * height) ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    if (SUCCEEDED(hr))
+    {
+        for (UINT y = 0; y < height; ++y)
+        {
+            memcpy(pPixelData + (SIZE_T)y * cbStride, pPacked + y * cbRow, cbRow);
+        }
+    }
+
+    _aligned_free(pPacked);
+
+    return hr;
+}
@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Tiles of BGRX pixels compressed to the LZ4 block format, a small header
+// followed by one LZ4 block of the tile rows without the stride padding.
+// LZ4 finds repeats of 4 bytes with a hash table and keeps the rest as
+// literals, decoding is little more than copying, so a tile decodes at
+// several GB/s on one thread instead of going through a WIC decoder.
+//-----------------------------------------------------------------------------
+
+static const UINT32 LZ4_TILE_MAGIC = 0x344C5A44; // 'DZL4'
+
+struct Lz4TileHeader
+{
+    UINT32 Magic;
+    UINT32 Width;
+    UINT32 Height;
+
+    // Size of the LZ4 block following the header
+    UINT32 CompressedSize;
+};
+
+// Largest size of a compressed tile of the given size, header included
+UINT GetLz4TileBound(__in const UINT &width, __in const UINT &height);
+
+// Compress tile pixels to a buffer of GetLz4TileBound bytes
+HRESULT CompressLz4Tile(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                        __out BYTE *pTileData, __out UINT &cbTileData);
+
+// Decompress a tile of the given size to pixels with the stride, a malformed tile fails with ERROR_INVALID_DATA
+HRESULT DecompressLz4Tile(__in_bcount(cbTileData) const BYTE *pTileData, __in const UINT &cbTileData, __in const UINT &width, __in const UINT &height, 
+                          __out BYTE *pPixelData, __in const UINT &cbStride);
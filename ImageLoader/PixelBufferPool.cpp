@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "PixelBufferPool.h"
+
+PixelBufferPool::PixelBufferPool()
+{
+    m_CbBuffer = 0;
+    m_MaxFreeBuffers = 0;
+}
+
+PixelBufferPool::~PixelBufferPool()
+{
+    for (UINT i = 0; i < m_FreeBuffers.Length(); ++i)
+    {
+        _aligned_free(m_FreeBuffers[i]);
+    }
+}
+
+HRESULT PixelBufferPool::Initialize(__in const UINT &cbBuffer, __in const UINT &maxFreeBuffers)
+{
+    HRESULT hr = m_Lock.Initialize();
+    IF_FAILED_RETURN(hr);
+
+    hr = m_FreeBuffers.Allocate(maxFreeBuffers);
+    IF_FAILED_RETURN(hr);
+
+    m_CbBuffer = cbBuffer;
+    m_MaxFreeBuffers = maxFreeBuffers;
+
+    return hr;
+}
+
+BYTE* PixelBufferPool::Acquire(__in const UINT &cbSize, __out UINT &cbBuffer)
+{
+    if (cbSize <= m_CbBuffer)
+    {
+        cbBuffer = m_CbBuffer;
+
+        AutoCriticalSection lock(m_Lock);
+        if (m_FreeBuffers.Length() > 0)
+        {
+            return m_FreeBuffers.PopLast();
+        }
+    }
+    else
+    {
+        cbBuffer = cbSize;
+    }
+
+    return reinterpret_cast<BYTE*>(_aligned_malloc(cbBuffer, 16));
+}
+
+void PixelBufferPool::Return(__in BYTE *pBuffer, __in const UINT &cbBuffer)
+{
+    if (cbBuffer == m_CbBuffer)
+    {
+        AutoCriticalSection lock(m_Lock);
+        if (m_FreeBuffers.Length() < m_MaxFreeBuffers && SUCCEEDED(m_FreeBuffers.Add(pBuffer)))
+        {
+            return;
+        }
+    }
+
+    _aligned_free(pBuffer);
+}
@@ -0,0 +1,47 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Free list of pixel buffers for tile images. Panning decodes a stream of
+// tiles of the same size, reusing their buffers saves allocating and
+// faulting in fresh pages for every one. Buffers are handed out from any
+// thread and come back when the images holding them are released.
+//-----------------------------------------------------------------------------
+class PixelBufferPool
+{
+    CriticalSection m_Lock;
+    Vector<BYTE*> m_FreeBuffers;
+
+    // Size of the pooled buffers, bigger requests are allocated and freed as usual
+    UINT m_CbBuffer;
+    UINT m_MaxFreeBuffers;
+
+public:
+    PixelBufferPool();
+    ~PixelBufferPool();
+
+    HRESULT Initialize(__in const UINT &cbBuffer, __in const UINT &maxFreeBuffers);
+
+    // Get a buffer of at least the size, cbBuffer is the size to return it with
+    BYTE* Acquire(__in const UINT &cbSize, __out UINT &cbBuffer);
+    void Return(__in BYTE *pBuffer, __in const UINT &cbBuffer);
+};
@@ -0,0 +1,507 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "PyramidManifest.h"
+
+// Sampling of the source for the content fingerprint
+static const UINT FINGERPRINT_EDGE_SIZE = 64 * 1024;
+static const UINT FINGERPRINT_BLOCK_SIZE = 4 * 1024;
+static const UINT FINGERPRINT_BLOCK_COUNT = 16;
+
+//-----------------------------------------------------------------------------
+// 64 bit FNV-1a hash of a buffer
+//-----------------------------------------------------------------------------
+inline static UINT64 HashBytes(__in UINT64 hash, __in_bcount(size) const BYTE *pBuffer, __in const UINT &size)
+{
+    for (UINT i = 0; i < size; ++i)
+    {
+        hash ^= pBuffer[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Encoder settings recorded in the header, settings of the codecs not used
+// by the pyramid are zero, so changing them doesn't outdate it
+//-----------------------------------------------------------------------------
+inline static UINT32 GetJpegQuality(__in const ImageLoaderOptions &options)
+{
+    return (options.TileCodec == TCT_JPEG) ? options.JpegQuality : 0;
+}
+
+inline static UINT32 GetPngFilter(__in const ImageLoaderOptions &options)
+{
+    return (options.TileCodec == TCT_PNG) ? (UINT32)options.PngFilter : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Read size bytes at offset, short reads at the end of file are fine
+//-----------------------------------------------------------------------------
+static HRESULT ReadAt(__in HANDLE hFile, __in const UINT64 &offset, __out_bcount(size) BYTE *pBuffer, __in const UINT &size, __out UINT &cbRead)
+{
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD read = 0;
+    if (!ReadFile(hFile, pBuffer, size, &read, &overlapped))
+    {
+        DWORD error = GetLastError();
+        if (error != ERROR_HANDLE_EOF)
+        {
+            return HRESULT_FROM_WIN32(error);
+        }
+    }
+
+    cbRead = read;
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Write size bytes at the file pointer, tables of huge pyramids can be over
+// the 4 GB a single WriteFile call takes
+//-----------------------------------------------------------------------------
+static HRESULT WriteAll(__in HANDLE hFile, __in_bcount(size) const void *pData, __in const UINT64 &size)
+{
+    static const UINT64 MAX_WRITE_SIZE = 1 << 30;
+
+    const BYTE *pBytes = reinterpret_cast<const BYTE*>(pData);
+    for (UINT64 offset = 0; offset < size; )
+    {
+        DWORD cbWrite = (DWORD)min(MAX_WRITE_SIZE, size - offset);
+        DWORD cbWritten = 0;
+        if (!WriteFile(hFile, pBytes + offset, cbWrite, &cbWritten, NULL))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (cbWritten == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+        }
+
+        offset += cbWritten;
+    }
+
+    return S_OK;
+}
+
+// Tile records and locations are part of the file format
+C_ASSERT(sizeof(ImageTileMetadata) == 13 * sizeof(UINT32));
+C_ASSERT(sizeof(TileLocation) == 2 * sizeof(UINT64));
+
+PyramidManifest::PyramidManifest()
+{
+    ZeroMemory(&m_Header, sizeof(m_Header));
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+    m_pView = NULL;
+    m_pLevels = NULL;
+    m_pTiles = NULL;
+    m_pTileLocations = NULL;
+    m_pTileLocationsToSave = NULL;
+}
+
+PyramidManifest::~PyramidManifest()
+{
+    Unmap();
+}
+
+//-----------------------------------------------------------------------------
+// Get size, modification time and a content fingerprint of the source file.
+// The fingerprint hashes the beginning, the end and evenly spaced blocks of
+// the file, so it is cheap even for files of many gigabytes.
+//-----------------------------------------------------------------------------
+HRESULT PyramidManifest::GetSourceIdentity(__in_z const WCHAR *pFilePath, __out SourceIdentity &source)
+{
+    HANDLE hFile = CreateFile(pFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(hFile, &info))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    BYTE* pBuffer = NULL;
+    if (SUCCEEDED(hr))
+    {
+        source.FileSize = ((UINT64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        source.LastWriteTime = info.ftLastWriteTime;
+
+        pBuffer = reinterpret_cast<BYTE*>(malloc(FINGERPRINT_EDGE_SIZE));
+        hr = pBuffer ? S_OK : E_OUTOFMEMORY;
+    }
+
+    UINT64 hash = HashBytes(0xCBF29CE484222325ULL, reinterpret_cast<const BYTE*>(&source.FileSize), sizeof(source.FileSize));
+    UINT cbRead = 0;
+
+    // Beginning and end of the file
+    if (SUCCEEDED(hr))
+    {
+        hr = ReadAt(hFile, 0, pBuffer, FINGERPRINT_EDGE_SIZE, cbRead);
+        hash = HashBytes(hash, pBuffer, cbRead);
+    }
+
+    if (SUCCEEDED(hr) && source.FileSize > FINGERPRINT_EDGE_SIZE)
+    {
+        hr = ReadAt(hFile, source.FileSize - FINGERPRINT_EDGE_SIZE, pBuffer, FINGERPRINT_EDGE_SIZE, cbRead);
+        hash = HashBytes(hash, pBuffer, cbRead);
+    }
+
+    // Blocks spread over the rest of the file
+    for (UINT block = 1; SUCCEEDED(hr) && block <= FINGERPRINT_BLOCK_COUNT && source.FileSize > 2 * FINGERPRINT_EDGE_SIZE; ++block)
+    {
+        UINT64 offset = (source.FileSize / (FINGERPRINT_BLOCK_COUNT + 1)) * block;
+        hr = ReadAt(hFile, offset, pBuffer, FINGERPRINT_BLOCK_SIZE, cbRead);
+        hash = HashBytes(hash, pBuffer, cbRead);
+    }
+
+    source.Fingerprint = hash;
+
+    free(pBuffer);
+    CloseHandle(hFile);
+
+    return hr;
+}
+
+HRESULT PyramidManifest::Initialize(__in const SourceIdentity &source, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, 
+                                    __in const UINT &tileSize, __in const UINT &imageWidth, __in const UINT &imageHeight, __in const UINT &levelCount, 
+                                    __in const ImageLoaderOptions &options)
+{
+    Unmap();
+    m_pTileLocationsToSave = NULL;
+
+    ZeroMemory(&m_Header, sizeof(m_Header));
+    m_Header.Magic = MAGIC;
+    m_Header.Version = VERSION;
+    m_Header.Source = source;
+    m_Header.ContainerFormat = containerFormat;
+    m_Header.PixelFormat = pixelFormat;
+    m_Header.TileSize = tileSize;
+    m_Header.ImageWidth = imageWidth;
+    m_Header.ImageHeight = imageHeight;
+    m_Header.LevelCount = levelCount;
+    m_Header.TileStorage = options.TileStorage;
+    m_Header.TileCodec = options.TileCodec;
+    m_Header.JpegQuality = GetJpegQuality(options);
+    m_Header.PngFilter = GetPngFilter(options);
+    m_Header.ReductionFilter = options.ReductionFilter;
+    m_Header.LinearLightReduction = options.LinearLightReduction ? TRUE : FALSE;
+    m_Header.TileOverlap = options.TileOverlap;
+    m_Header.UseEmbeddedLevels = options.UseEmbeddedLevels ? TRUE : FALSE;
+
+    HRESULT hr = m_Levels.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_LevelTiles.SetSize(levelCount);
+    IF_FAILED_RETURN(hr);
+
+    ZeroMemory(m_Levels.Ptr(), levelCount * sizeof(Level));
+    m_pLevels = m_Levels.Ptr();
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Set layout and tiles of a level to be written, levels have to be set in order
+//-----------------------------------------------------------------------------
+HRESULT PyramidManifest::SetLevel(__in const UINT &level, __in const UINT &width, __in const UINT &height, __in const UINT &columnCount, __in const UINT &rowCount, 
+                                  __in const UINT &sourceFrame, __in const ImageTileMetadata *pTiles)
+{
+    if (level >= m_Levels.Length() || !pTiles)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_Levels[level].Width = width;
+    m_Levels[level].Height = height;
+    m_Levels[level].ColumnCount = columnCount;
+    m_Levels[level].RowCount = rowCount;
+    m_Levels[level].FirstTile = (level == 0) ? 0 : m_Levels[level - 1].FirstTile + m_Levels[level - 1].ColumnCount * m_Levels[level - 1].RowCount;
+    m_Levels[level].SourceFrame = sourceFrame;
+    m_LevelTiles[level] = pTiles;
+
+    m_Header.TileCount = m_Levels[level].FirstTile + columnCount * rowCount;
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Check the manifest was generated from the same source with the same settings,
+// options not affecting the content of the pyramid are not compared
+//-----------------------------------------------------------------------------
+BOOL PyramidManifest::IsUpToDate(__in const SourceIdentity &source, __in const UINT &tileSize, __in const ImageLoaderOptions &options) const
+{
+    return m_Header.Magic == MAGIC &&
+           m_Header.Version == VERSION &&
+           m_Header.TileSize == tileSize &&
+           m_Header.TileStorage == (UINT32)options.TileStorage &&
+           m_Header.TileCodec == (UINT32)options.TileCodec &&
+           m_Header.JpegQuality == GetJpegQuality(options) &&
+           m_Header.PngFilter == GetPngFilter(options) &&
+           m_Header.ReductionFilter == (UINT32)options.ReductionFilter &&
+           m_Header.LinearLightReduction == (options.LinearLightReduction ? TRUE : FALSE) &&
+           m_Header.TileOverlap == options.TileOverlap &&
+           m_Header.UseEmbeddedLevels == (options.UseEmbeddedLevels ? TRUE : FALSE) &&
+           m_Header.Source.FileSize == source.FileSize &&
+           CompareFileTime(&m_Header.Source.LastWriteTime, &source.LastWriteTime) == 0 &&
+           m_Header.Source.Fingerprint == source.Fingerprint;
+}
+
+//-----------------------------------------------------------------------------
+// Map the index file, levels and tiles are served directly from the view
+//-----------------------------------------------------------------------------
+HRESULT PyramidManifest::Map(__in_z const WCHAR *pManifestPath)
+{
+    Unmap();
+
+    // Shared for writing, an update of the pyramid writes the tiles it changed in the view back to the file
+    m_hFile = CreateFile(pManifestPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_hFile, &fileSize))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Unmap();
+        return hr;
+    }
+
+    if (fileSize.QuadPart < sizeof(Header))
+    {
+        Unmap();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (m_hMapping)
+    {
+        m_pView = reinterpret_cast<BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0));
+    }
+
+    if (!m_pView)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Unmap();
+        return hr;
+    }
+
+    m_Header = *reinterpret_cast<const Header*>(m_pView);
+
+    // Validate the header against the size of the file before touching any level
+    UINT64 cbExpected = sizeof(Header) + (UINT64)m_Header.LevelCount * sizeof(Level) + (UINT64)m_Header.TileCount * sizeof(ImageTileMetadata);
+    if (m_Header.TileStorage == TST_PACKED)
+    {
+        cbExpected = GetTileLocationsOffset() + (UINT64)m_Header.TileCount * sizeof(TileLocation);
+    }
+
+    if (m_Header.Magic != MAGIC || m_Header.Version != VERSION || m_Header.LevelCount == 0 || cbExpected != (UINT64)fileSize.QuadPart)
+    {
+        Unmap();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    m_pLevels = reinterpret_cast<Level*>(m_pView + sizeof(Header));
+    m_pTiles = reinterpret_cast<ImageTileMetadata*>(m_pView + sizeof(Header) + m_Header.LevelCount * sizeof(Level));
+    if (m_Header.TileStorage == TST_PACKED)
+    {
+        m_pTileLocations = reinterpret_cast<const TileLocation*>(m_pView + GetTileLocationsOffset());
+    }
+
+    for (UINT level = 0; level < m_Header.LevelCount; ++level)
+    {
+        if ((UINT64)m_pLevels[level].FirstTile + (UINT64)m_pLevels[level].ColumnCount * m_pLevels[level].RowCount > m_Header.TileCount)
+        {
+            Unmap();
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Write the tiles of the mapped index, changed in the copy on write view,
+// back to its file with the new source and tile locations. The layout stays
+// the same, so the file is written in place and the view stays valid. The
+// header is written last, after it was cleared, so an interrupted write
+// leaves an index that is never reused.
+//-----------------------------------------------------------------------------
+HRESULT PyramidManifest::SaveMapped(__in const SourceIdentity &source, __in_opt const TileLocation *pTileLocations)
+{
+    if (!m_pView || (m_Header.TileStorage == TST_PACKED && !pTileLocations))
+    {
+        return E_UNEXPECTED;
+    }
+
+    HANDLE hFile = ReOpenFile(m_hFile, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Header header = m_Header;
+    header.Source = source;
+
+    Header clearedHeader;
+    ZeroMemory(&clearedHeader, sizeof(clearedHeader));
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = 0;
+    HRESULT hr = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAll(hFile, &clearedHeader, sizeof(clearedHeader));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        offset.QuadPart = sizeof(Header) + (UINT64)m_Header.LevelCount * sizeof(Level);
+        hr = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAll(hFile, m_pTiles, (UINT64)m_Header.TileCount * sizeof(ImageTileMetadata));
+    }
+
+    if (SUCCEEDED(hr) && m_Header.TileStorage == TST_PACKED)
+    {
+        offset.QuadPart = GetTileLocationsOffset();
+        hr = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteAll(hFile, pTileLocations, (UINT64)m_Header.TileCount * sizeof(TileLocation));
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        offset.QuadPart = 0;
+        hr = SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAll(hFile, &header, sizeof(header));
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        m_Header = header;
+    }
+
+    return hr;
+}
+
+void PyramidManifest::Unmap()
+{
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+        m_pView = NULL;
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_pLevels = m_Levels.Ptr();
+    m_pTiles = NULL;
+    m_pTileLocations = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Offset of the tile location table, aligned to 8 bytes after the tiles
+//-----------------------------------------------------------------------------
+UINT64 PyramidManifest::GetTileLocationsOffset() const
+{
+    UINT64 cbHeaderLevelsTiles = sizeof(Header) + (UINT64)m_Header.LevelCount * sizeof(Level) + (UINT64)m_Header.TileCount * sizeof(ImageTileMetadata);
+    return (cbHeaderLevelsTiles + 7) & ~7ULL;
+}
+
+HRESULT PyramidManifest::Save(__in_z const WCHAR *pManifestPath)
+{
+    if (m_Header.TileStorage == TST_PACKED && !m_pTileLocationsToSave)
+    {
+        return E_UNEXPECTED;
+    }
+
+    HANDLE hFile = CreateFile(pManifestPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = WriteAll(hFile, &m_Header, sizeof(m_Header));
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteAll(hFile, m_Levels.Ptr(), (UINT64)m_Levels.Length() * sizeof(Level));
+    }
+
+    for (UINT level = 0; SUCCEEDED(hr) && level < m_Levels.Length(); ++level)
+    {
+        UINT64 cbTiles = (UINT64)m_Levels[level].ColumnCount * m_Levels[level].RowCount * sizeof(ImageTileMetadata);
+        hr = WriteAll(hFile, m_LevelTiles[level], cbTiles);
+    }
+
+    if (SUCCEEDED(hr) && m_Header.TileStorage == TST_PACKED)
+    {
+        static const BYTE padding[8] = {0};
+        UINT64 cbWrittenSoFar = sizeof(Header) + (UINT64)m_Header.LevelCount * sizeof(Level) + (UINT64)m_Header.TileCount * sizeof(ImageTileMetadata);
+
+        hr = WriteAll(hFile, padding, GetTileLocationsOffset() - cbWrittenSoFar);
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteAll(hFile, m_pTileLocationsToSave, (UINT64)m_Header.TileCount * sizeof(TileLocation));
+        }
+    }
+
+    CloseHandle(hFile);
+
+    // Never leave a partially written manifest behind
+    if (FAILED(hr))
+    {
+        DeleteFile(pManifestPath);
+    }
+
+    return hr;
+}
@@ -0,0 +1,135 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "TileContainer.h"
+
+//-----------------------------------------------------------------------------
+// Manifest and tile index written next to the tiles at the end of pyramid
+// generation. It identifies the source the pyramid was generated from and
+// holds the level layout and metadata of every tile, so an unchanged source
+// is opened by mapping this file, without touching the source image.
+//
+// File layout: Header | Level[LevelCount] | ImageTileMetadata[TileCount],
+// tiles of each level are stored in row major order starting at FirstTile.
+// Pyramids packed in a tile container are followed by the 8 byte aligned
+// TileLocation[TileCount] table in the same order.
+//-----------------------------------------------------------------------------
+class PyramidManifest
+{
+public:
+    static const UINT32 MAGIC = 0x4D505A44; // "DZPM"
+    static const UINT32 VERSION = 10;
+
+    // Source frame of a level built from the levels below it
+    static const UINT32 NO_SOURCE_FRAME = 0xFFFFFFFF;
+
+    struct SourceIdentity
+    {
+        UINT64 FileSize;
+        FILETIME LastWriteTime;
+        UINT64 Fingerprint;
+    };
+
+    struct Header
+    {
+        UINT32 Magic;
+        UINT32 Version;
+        SourceIdentity Source;
+        GUID ContainerFormat;
+        WICPixelFormatGUID PixelFormat;
+        UINT32 TileSize;
+        UINT32 ImageWidth;
+        UINT32 ImageHeight;
+        UINT32 LevelCount;
+        UINT32 TileCount;
+        UINT32 TileStorage;
+        UINT32 TileCodec;
+        UINT32 JpegQuality;
+        UINT32 PngFilter;
+        UINT32 ReductionFilter;
+        UINT32 LinearLightReduction;
+        UINT32 TileOverlap;
+        UINT32 UseEmbeddedLevels;
+    };
+
+    struct Level
+    {
+        UINT32 Width;
+        UINT32 Height;
+        UINT32 ColumnCount;
+        UINT32 RowCount;
+        UINT32 FirstTile;
+
+        // Frame of the source the level is read from, its tiles are not stored
+        UINT32 SourceFrame;
+    };
+
+private:
+    Header m_Header;
+
+    // Levels being written
+    Vector<Level> m_Levels;
+    Vector<const ImageTileMetadata*> m_LevelTiles;
+    const TileLocation* m_pTileLocationsToSave;
+
+    // Mapped index
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    BYTE* m_pView;
+
+    Level* m_pLevels;
+    ImageTileMetadata* m_pTiles;
+    const TileLocation* m_pTileLocations;
+
+    UINT64 GetTileLocationsOffset() const;
+
+public:
+    PyramidManifest();
+    ~PyramidManifest();
+
+    HRESULT Initialize(__in const SourceIdentity &source, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, 
+                       __in const UINT &tileSize, __in const UINT &imageWidth, __in const UINT &imageHeight, __in const UINT &levelCount, 
+                       __in const ImageLoaderOptions &options);
+    HRESULT SetLevel(__in const UINT &level, __in const UINT &width, __in const UINT &height, __in const UINT &columnCount, __in const UINT &rowCount, 
+                     __in const UINT &sourceFrame, __in const ImageTileMetadata *pTiles);
+    void    SetTileLocations(__in const TileLocation *pTileLocations) { m_pTileLocationsToSave = pTileLocations; };
+    HRESULT Save(__in_z const WCHAR *pManifestPath);
+
+    HRESULT Map(__in_z const WCHAR *pManifestPath);
+    HRESULT SaveMapped(__in const SourceIdentity &source, __in_opt const TileLocation *pTileLocations);
+    void    Unmap();
+
+    BOOL IsUpToDate(__in const SourceIdentity &source, __in const UINT &tileSize, __in const ImageLoaderOptions &options) const;
+
+    BOOL IsMapped() const { return m_pView != NULL; };
+    const Header& GetHeader() const { return m_Header; };
+    UINT GetLevelCount() const { return m_Header.LevelCount; };
+    const Level& GetLevel(__in const UINT &level) const { return m_pLevels[level]; };
+
+    // Tiles of a mapped level, the view is copy on write so callers may hold non-const pointers
+    ImageTileMetadata* GetLevelTiles(__in const UINT &level) const { return m_pTiles + m_pLevels[level].FirstTile; };
+
+    // Locations of all tiles in the tile container of a mapped packed pyramid, indexed like the tiles
+    const TileLocation* GetTileLocations() const { return m_pTileLocations; };
+
+    static HRESULT GetSourceIdentity(__in_z const WCHAR *pFilePath, __out SourceIdentity &source);
+};
@@ -0,0 +1,554 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include <math.h>
+#include "ReductionKernels.h"
+
+// AVX-512 intrinsics need Visual Studio 2017 or newer
+#if _MSC_VER >= 1910
+#define REDUCTION_KERNELS_AVX512
+#endif
+
+//-----------------------------------------------------------------------------
+// Calculates the average of two rgb32 pixels per channel, rounding up like
+// _mm_avg_epu8 does, so the scalar kernel matches the vector ones exactly
+//-----------------------------------------------------------------------------
+inline static UINT32 AvgRoundUp(UINT32 a, UINT32 b)
+{
+    return (a | b) - (((a ^ b) & 0xfefefefeUL) >> 1);
+}
+
+//-----------------------------------------------------------------------------
+// Scalar kernel, 8 source pixels of each row per page
+//-----------------------------------------------------------------------------
+static void Average2RowsScalar(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    const UINT32* pSrcRow1 = reinterpret_cast<const UINT32*>(pSrcImgRow1);
+    const UINT32* pSrcRow2 = reinterpret_cast<const UINT32*>(pSrcImgRow2);
+    UINT32* pDstRow = reinterpret_cast<UINT32*>(pDstImgRow);
+
+    for (UINT cnt = widthInPages * 4; cnt > 0; --cnt)
+    {
+        UINT32 left = AvgRoundUp(pSrcRow1[0], pSrcRow2[0]);
+        UINT32 right = AvgRoundUp(pSrcRow1[1], pSrcRow2[1]);
+
+        pDstRow[0] = AvgRoundUp(left, right);
+
+        pSrcRow1 += 2;
+        pSrcRow2 += 2;
+        pDstRow++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// SSE2 kernel, one page per iteration, rows have to be 16 byte aligned
+//-----------------------------------------------------------------------------
+static void Average2RowsSSE2(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    __m128i w1, w2, avgLeft, avgRight;
+
+    const __m128i* pSrcRow1 = (__m128i*)pSrcImgRow1;
+    const __m128i* pSrcRow2 = (__m128i*)pSrcImgRow2;
+    __m128i* pDstRow = (__m128i*)pDstImgRow;
+
+    for (UINT cnt = widthInPages; cnt > 0; --cnt)
+    {
+        w1 = pSrcRow1[0]; pSrcRow1++; // _mm_loadu_si128(
+        w2 = pSrcRow2[0]; pSrcRow2++;
+
+        avgLeft  = _mm_avg_epu8(w1, w2);
+           
+        w1 =  pSrcRow1[0]; pSrcRow1++;
+        w2 =  pSrcRow2[0]; pSrcRow2++;
+
+        avgRight = _mm_avg_epu8(w1, w2);
+
+        __m128i sumLeft = _mm_unpacklo_epi32(avgLeft, avgRight);
+        __m128i sumRight = _mm_unpackhi_epi32(avgLeft, avgRight);
+
+        __m128i shuffle1 = _mm_unpacklo_epi32(sumLeft, sumRight);
+        __m128i shuffle2 = _mm_unpackhi_epi32(sumLeft, sumRight);
+
+        pDstRow[0] = _mm_avg_epu8(shuffle1, shuffle2); //_mm_storeu_si128(
+        pDstRow++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 kernel, two pages per iteration, an odd page is left to SSE2
+//-----------------------------------------------------------------------------
+static void Average2RowsAVX2(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    for (UINT cnt = widthInPages / 2; cnt > 0; --cnt)
+    {
+        // Pixels 0-7 and 8-15 averaged vertically
+        __m256i avgLeft = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)pSrcImgRow1), _mm256_loadu_si256((const __m256i*)pSrcImgRow2));
+        __m256i avgRight = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(pSrcImgRow1 + 32)), _mm256_loadu_si256((const __m256i*)(pSrcImgRow2 + 32)));
+
+        // Even and odd pixels of each 128 bit lane
+        __m256 even = _mm256_shuffle_ps(_mm256_castsi256_ps(avgLeft), _mm256_castsi256_ps(avgRight), _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 odd = _mm256_shuffle_ps(_mm256_castsi256_ps(avgLeft), _mm256_castsi256_ps(avgRight), _MM_SHUFFLE(3, 1, 3, 1));
+
+        // Lanes hold 0-3 8-11 | 4-7 12-15 of the result, put them back in order
+        __m256i result = _mm256_avg_epu8(_mm256_castps_si256(even), _mm256_castps_si256(odd));
+        result = _mm256_permute4x64_epi64(result, _MM_SHUFFLE(3, 1, 2, 0));
+
+        _mm256_storeu_si256((__m256i*)pDstImgRow, result);
+
+        pSrcImgRow1 += 64;
+        pSrcImgRow2 += 64;
+        pDstImgRow += 32;
+    }
+
+    // Avoid the AVX to SSE transition penalty in the caller
+    _mm256_zeroupper();
+
+    if (widthInPages & 1)
+    {
+        Average2RowsSSE2(pSrcImgRow1, pSrcImgRow2, pDstImgRow, 1);
+    }
+}
+
+#ifdef REDUCTION_KERNELS_AVX512
+
+//-----------------------------------------------------------------------------
+// AVX-512 kernel, four pages per iteration, the rest is left to AVX2
+//-----------------------------------------------------------------------------
+static void Average2RowsAVX512(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    const __m512i evenIndex = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i oddIndex = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+
+    for (UINT cnt = widthInPages / 4; cnt > 0; --cnt)
+    {
+        __m512i avgLeft = _mm512_avg_epu8(_mm512_loadu_si512(pSrcImgRow1), _mm512_loadu_si512(pSrcImgRow2));
+        __m512i avgRight = _mm512_avg_epu8(_mm512_loadu_si512(pSrcImgRow1 + 64), _mm512_loadu_si512(pSrcImgRow2 + 64));
+
+        // Permute across both registers, so the result is already in order
+        __m512i even = _mm512_permutex2var_epi32(avgLeft, evenIndex, avgRight);
+        __m512i odd = _mm512_permutex2var_epi32(avgLeft, oddIndex, avgRight);
+
+        _mm512_storeu_si512(pDstImgRow, _mm512_avg_epu8(even, odd));
+
+        pSrcImgRow1 += 128;
+        pSrcImgRow2 += 128;
+        pDstImgRow += 64;
+    }
+
+    Average2RowsAVX2(pSrcImgRow1, pSrcImgRow2, pDstImgRow, widthInPages & 3);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Linear light values of the blue, green and red channel of a rgb32 pixel in
+// the 16 bit lanes of a 64 bit integer
+//-----------------------------------------------------------------------------
+inline static UINT64 PixelToLinear(__in const LinearLightTables &tables, __in const UINT32 &pixel)
+{
+    return tables.ToLinear[0][pixel & 0xFF] | tables.ToLinear[1][(pixel >> 8) & 0xFF] | tables.ToLinear[2][(pixel >> 16) & 0xFF];
+}
+
+//-----------------------------------------------------------------------------
+// Linear light kernel. The 4 source pixels are looked up, summed and rounded
+// in 16 bit lanes of one register and looked up back to sRGB.
+//-----------------------------------------------------------------------------
+static void Average2RowsLinear(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    static const UINT64 ROUNDING = 0x0000000200020002ULL;
+
+    const LinearLightTables &tables = GetLinearLightTables();
+    const UINT32* pSrcRow1 = reinterpret_cast<const UINT32*>(pSrcImgRow1);
+    const UINT32* pSrcRow2 = reinterpret_cast<const UINT32*>(pSrcImgRow2);
+    UINT32* pDstRow = reinterpret_cast<UINT32*>(pDstImgRow);
+
+    for (UINT cnt = widthInPages * 4; cnt > 0; --cnt)
+    {
+        UINT64 sum = PixelToLinear(tables, pSrcRow1[0]) + PixelToLinear(tables, pSrcRow1[1]) + 
+                     PixelToLinear(tables, pSrcRow2[0]) + PixelToLinear(tables, pSrcRow2[1]) + ROUNDING;
+
+        pDstRow[0] = (UINT32)tables.FromLinear[(sum >> 2) & LinearLightTables::LINEAR_MAX] |
+                     ((UINT32)tables.FromLinear[(sum >> 18) & LinearLightTables::LINEAR_MAX] << 8) |
+                     ((UINT32)tables.FromLinear[(sum >> 34) & LinearLightTables::LINEAR_MAX] << 16) |
+                     0xFF000000UL;
+
+        pSrcRow1 += 2;
+        pSrcRow2 += 2;
+        pDstRow++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Linear light of one channel of 8 rgb32 pixels, gathered from the table
+//-----------------------------------------------------------------------------
+inline static __m256i GatherLinear(__in const LinearLightTables &tables, __in const __m256i &pixels, __in const __m128i &shift)
+{
+    __m256i index = _mm256_and_si256(_mm256_srl_epi32(pixels, shift), _mm256_set1_epi32(0xFF));
+    return _mm256_i32gather_epi32(reinterpret_cast<const int*>(tables.ToLinear32), index, 4);
+}
+
+//-----------------------------------------------------------------------------
+// One channel of 8 result pixels from 16 pixels of each row. The horizontal
+// add leaves the middle two 64 bit quarters swapped, the caller reorders them.
+//-----------------------------------------------------------------------------
+inline static __m256i AverageChannelLinear(__in const LinearLightTables &tables, __in const __m256i &row1Left, __in const __m256i &row1Right, 
+                                           __in const __m256i &row2Left, __in const __m256i &row2Right, __in const int &channel)
+{
+    const __m128i shift = _mm_cvtsi32_si128(channel * 8);
+
+    __m256i left = _mm256_add_epi32(GatherLinear(tables, row1Left, shift), GatherLinear(tables, row2Left, shift));
+    __m256i right = _mm256_add_epi32(GatherLinear(tables, row1Right, shift), GatherLinear(tables, row2Right, shift));
+
+    // Rounded like the scalar kernel
+    __m256i sum = _mm256_add_epi32(_mm256_hadd_epi32(left, right), _mm256_set1_epi32(2));
+    __m256i index = _mm256_srli_epi32(sum, 2);
+
+    __m256i value = _mm256_i32gather_epi32(reinterpret_cast<const int*>(tables.FromLinear), index, 1);
+    return _mm256_sll_epi32(_mm256_and_si256(value, _mm256_set1_epi32(0xFF)), shift);
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 linear light kernel, two pages per iteration with gathers from the
+// same tables, so the output matches the scalar one. An odd page is left to
+// the scalar kernel.
+//-----------------------------------------------------------------------------
+static void Average2RowsLinearAVX2(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages)
+{
+    const LinearLightTables &tables = GetLinearLightTables();
+    const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+
+    for (UINT cnt = widthInPages / 2; cnt > 0; --cnt)
+    {
+        __m256i row1Left = _mm256_loadu_si256((const __m256i*)pSrcImgRow1);
+        __m256i row1Right = _mm256_loadu_si256((const __m256i*)(pSrcImgRow1 + 32));
+        __m256i row2Left = _mm256_loadu_si256((const __m256i*)pSrcImgRow2);
+        __m256i row2Right = _mm256_loadu_si256((const __m256i*)(pSrcImgRow2 + 32));
+
+        __m256i result = _mm256_or_si256(AverageChannelLinear(tables, row1Left, row1Right, row2Left, row2Right, 0), alpha);
+        result = _mm256_or_si256(result, AverageChannelLinear(tables, row1Left, row1Right, row2Left, row2Right, 1));
+        result = _mm256_or_si256(result, AverageChannelLinear(tables, row1Left, row1Right, row2Left, row2Right, 2));
+
+        // The horizontal add works within 128 bit lanes, put the pixels back in order
+        _mm256_storeu_si256((__m256i*)pDstImgRow, _mm256_permute4x64_epi64(result, _MM_SHUFFLE(3, 1, 2, 0)));
+
+        pSrcImgRow1 += 64;
+        pSrcImgRow2 += 64;
+        pDstImgRow += 32;
+    }
+
+    // Avoid the AVX to SSE transition penalty in the caller
+    _mm256_zeroupper();
+
+    if (widthInPages & 1)
+    {
+        Average2RowsLinear(pSrcImgRow1, pSrcImgRow2, pDstImgRow, 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Build the sRGB transfer function tables
+//-----------------------------------------------------------------------------
+static void BuildLinearLightTables(__out LinearLightTables &tables)
+{
+    for (UINT value = 0; value < 256; ++value)
+    {
+        DOUBLE c = value / 255.0;
+        DOUBLE linear = (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+
+        UINT64 quantized = (UINT64)(linear * LinearLightTables::LINEAR_MAX + 0.5);
+        tables.ToLinear[0][value] = quantized;
+        tables.ToLinear[1][value] = quantized << 16;
+        tables.ToLinear[2][value] = quantized << 32;
+        tables.ToLinear32[value] = (UINT32)quantized;
+        tables.ToLinearFloat[value] = (FLOAT)(linear * 255.0);
+    }
+
+    for (UINT value = 0; value <= LinearLightTables::LINEAR_MAX; ++value)
+    {
+        DOUBLE linear = (DOUBLE)value / LinearLightTables::LINEAR_MAX;
+        DOUBLE c = (linear <= 0.0031308) ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+
+        tables.FromLinear[value] = (BYTE)min(255.0, max(0.0, c * 255.0 + 0.5));
+    }
+}
+
+const LinearLightTables& GetLinearLightTables()
+{
+    // Building is idempotent, racing threads just write the same values
+    static LinearLightTables s_Tables;
+    static volatile LONG s_IsBuilt = FALSE;
+
+    if (!s_IsBuilt)
+    {
+        BuildLinearLightTables(s_Tables);
+        MemoryBarrier();
+        s_IsBuilt = TRUE;
+    }
+
+    return s_Tables;
+}
+
+//-----------------------------------------------------------------------------
+// Detect the widest kernel usable on this processor. Wide registers have to
+// be enabled by the OS as well, which XGETBV reports.
+//-----------------------------------------------------------------------------
+static ReductionKernelType DetectReductionKernel()
+{
+    int info[4] = {0};
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    BOOL hasSSE2 = (info[3] & (1 << 26)) != 0;
+    BOOL hasOSXSave = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+
+    UINT64 xcr0 = hasOSXSave ? _xgetbv(0) : 0;
+    BOOL hasYmmState = (xcr0 & 0x06) == 0x06;
+    BOOL hasZmmState = (xcr0 & 0xE6) == 0xE6;
+
+    BOOL hasAVX2 = FALSE;
+    BOOL hasAVX512BW = FALSE;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        hasAVX2 = (info[1] & (1 << 5)) != 0;
+        hasAVX512BW = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+    }
+
+#ifdef REDUCTION_KERNELS_AVX512
+    if (hasAVX512BW && hasAVX2 && hasZmmState)
+    {
+        return RKT_AVX512;
+    }
+#endif
+
+    if (hasAVX2 && hasYmmState)
+    {
+        return RKT_AVX2;
+    }
+
+    return hasSSE2 ? RKT_SSE2 : RKT_SCALAR;
+}
+
+static ReductionKernelType GetSupportedReductionKernel()
+{
+    // Detection is idempotent, racing threads just store the same value
+    static volatile LONG s_SupportedKernel = -1;
+
+    if (s_SupportedKernel < 0)
+    {
+        s_SupportedKernel = DetectReductionKernel();
+    }
+
+    return (ReductionKernelType)s_SupportedKernel;
+}
+
+Average2RowsProc GetAverage2RowsKernel(__in const ReductionKernelType &kernel)
+{
+    if (kernel > GetSupportedReductionKernel())
+    {
+        return NULL;
+    }
+
+    switch (kernel)
+    {
+    case RKT_SCALAR:
+        return &Average2RowsScalar;
+    case RKT_SSE2:
+        return &Average2RowsSSE2;
+    case RKT_AVX2:
+        return &Average2RowsAVX2;
+#ifdef REDUCTION_KERNELS_AVX512
+    case RKT_AVX512:
+        return &Average2RowsAVX512;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+Average2RowsProc GetAverage2RowsKernel()
+{
+    return GetAverage2RowsKernel(GetSupportedReductionKernel());
+}
+
+Average2RowsProc GetAverage2RowsLinearKernel()
+{
+    // Make sure the tables exist before the kernel runs on another thread
+    GetLinearLightTables();
+
+    return (GetSupportedReductionKernel() >= RKT_AVX2) ? &Average2RowsLinearAVX2 : &Average2RowsLinear;
+}
+
+//-----------------------------------------------------------------------------
+// Fill a buffer with pseudo random bytes
+//-----------------------------------------------------------------------------
+static void FillRandom(__out_bcount(size) BYTE *pBuffer, __in const UINT &size, __inout UINT32 &seed)
+{
+    for (UINT i = 0; i < size; ++i)
+    {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        pBuffer[i] = (BYTE)seed;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Compare output of a kernel with the one of a reference kernel over random
+// rows of all widths, S_FALSE when it differs
+//-----------------------------------------------------------------------------
+static HRESULT VerifyAverage2Rows(__in Average2RowsProc pfnReference, __in Average2RowsProc pfnKernel)
+{
+    static const UINT MAX_PAGES = 67;
+    static const UINT GUARD_SIZE = 64;
+    static const BYTE GUARD_VALUE = 0xCD;
+
+    UINT cbRow = MAX_PAGES * 32;
+    UINT cbResult = cbRow / 2 + GUARD_SIZE;
+
+    BYTE *pRow1 = reinterpret_cast<BYTE*>(_aligned_malloc(cbRow, 16));
+    BYTE *pRow2 = reinterpret_cast<BYTE*>(_aligned_malloc(cbRow, 16));
+    BYTE *pExpected = reinterpret_cast<BYTE*>(_aligned_malloc(cbResult, 16));
+    BYTE *pResult = reinterpret_cast<BYTE*>(_aligned_malloc(cbResult, 16));
+
+    HRESULT hr = (pRow1 && pRow2 && pExpected && pResult) ? S_OK : E_OUTOFMEMORY;
+
+    UINT32 seed = 0x2545F491;
+    for (UINT widthInPages = 1; hr == S_OK && widthInPages <= MAX_PAGES; ++widthInPages)
+    {
+        FillRandom(pRow1, cbRow, seed);
+        FillRandom(pRow2, cbRow, seed);
+        memset(pExpected, GUARD_VALUE, cbResult);
+        memset(pResult, GUARD_VALUE, cbResult);
+
+        pfnReference(pRow1, pRow2, pExpected, widthInPages);
+        pfnKernel(pRow1, pRow2, pResult, widthInPages);
+
+        // Bytes past the row have to stay untouched too
+        if (memcmp(pExpected, pResult, cbResult) != 0)
+        {
+            hr = S_FALSE;
+        }
+    }
+
+    _aligned_free(pRow1);
+    _aligned_free(pRow2);
+    _aligned_free(pExpected);
+    _aligned_free(pResult);
+
+    return hr;
+}
+
+HRESULT VerifyReductionKernel(__in const ReductionKernelType &kernel)
+{
+    Average2RowsProc pfnKernel = GetAverage2RowsKernel(kernel);
+    if (!pfnKernel)
+    {
+        return E_NOTIMPL;
+    }
+
+    return VerifyAverage2Rows(&Average2RowsScalar, pfnKernel);
+}
+
+//-----------------------------------------------------------------------------
+// Measure throughput of an Average2Rows kernel
+//-----------------------------------------------------------------------------
+static HRESULT BenchmarkAverage2Rows(__in Average2RowsProc pfnKernel, __out DOUBLE &gigabytesPerSecond)
+{
+    // 8192 pixels wide rows, the source fits in the last level cache of a
+    // typical processor, so the kernel and not the memory is measured
+    static const UINT WIDTH_IN_PAGES = 1024;
+    static const UINT ROW_COUNT = 128;
+    static const UINT REPEAT_COUNT = 64;
+
+    gigabytesPerSecond = 0;
+
+    UINT cbSrcStride = WIDTH_IN_PAGES * 32;
+    UINT cbDstStride = cbSrcStride / 2;
+
+    BYTE *pSource = reinterpret_cast<BYTE*>(_aligned_malloc(cbSrcStride * ROW_COUNT, 16));
+    BYTE *pDestination = reinterpret_cast<BYTE*>(_aligned_malloc(cbDstStride * ROW_COUNT / 2, 16));
+    if (!pSource || !pDestination)
+    {
+        _aligned_free(pSource);
+        _aligned_free(pDestination);
+        return E_OUTOFMEMORY;
+    }
+
+    UINT32 seed = 0x2545F491;
+    FillRandom(pSource, cbSrcStride * ROW_COUNT, seed);
+
+    // Warm up caches before measuring
+    for (UINT row = 0; row < ROW_COUNT; row += 2)
+    {
+        pfnKernel(pSource + row * cbSrcStride, pSource + (row + 1) * cbSrcStride, pDestination + (row / 2) * cbDstStride, WIDTH_IN_PAGES);
+    }
+
+    StageTimer timer;
+    timer.Start();
+
+    for (UINT repeat = 0; repeat < REPEAT_COUNT; ++repeat)
+    {
+        for (UINT row = 0; row < ROW_COUNT; row += 2)
+        {
+            pfnKernel(pSource + row * cbSrcStride, pSource + (row + 1) * cbSrcStride, pDestination + (row / 2) * cbDstStride, WIDTH_IN_PAGES);
+        }
+    }
+
+    timer.Stop();
+
+    DOUBLE bytes = (DOUBLE)cbSrcStride * ROW_COUNT * REPEAT_COUNT;
+    gigabytesPerSecond = (timer.GetSeconds() > 0) ? bytes / timer.GetSeconds() / (1024.0 * 1024.0 * 1024.0) : 0;
+
+    _aligned_free(pSource);
+    _aligned_free(pDestination);
+
+    return S_OK;
+}
+
+HRESULT BenchmarkReductionKernel(__in const ReductionKernelType &kernel, __out DOUBLE &gigabytesPerSecond)
+{
+    gigabytesPerSecond = 0;
+
+    Average2RowsProc pfnKernel = GetAverage2RowsKernel(kernel);
+    if (!pfnKernel)
+    {
+        return E_NOTIMPL;
+    }
+
+    return BenchmarkAverage2Rows(pfnKernel, gigabytesPerSecond);
+}
+
+HRESULT BenchmarkLinearLightReduction(__out DOUBLE &gigabytesPerSecond)
+{
+    return BenchmarkAverage2Rows(GetAverage2RowsLinearKernel(), gigabytesPerSecond);
+}
+
+HRESULT VerifyLinearLightReduction()
+{
+    GetLinearLightTables();
+
+    return VerifyAverage2Rows(&Average2RowsLinear, GetAverage2RowsLinearKernel());
+}
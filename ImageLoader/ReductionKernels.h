@@ -0,0 +1,61 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+// Reduces two rows of rgb32 pixels to one row of half width with a 2x2 box
+// filter, widthInPages is the number of 32 byte source pages in a row
+typedef void (*Average2RowsProc)(__in const BYTE* pSrcImgRow1, __in const BYTE* pSrcImgRow2, __out BYTE* pDstImgRow, __in const UINT &widthInPages);
+
+//-----------------------------------------------------------------------------
+// Get the widest Average2Rows variant supported by the processor and the OS,
+// detected once with CPUID. All variants produce identical output.
+//-----------------------------------------------------------------------------
+Average2RowsProc GetAverage2RowsKernel();
+
+// Get a particular variant, NULL when the processor or the compiler lacks it
+Average2RowsProc GetAverage2RowsKernel(__in const ReductionKernelType &kernel);
+
+//-----------------------------------------------------------------------------
+// Tables converting sRGB channels to linear light and back, built once
+//-----------------------------------------------------------------------------
+struct LinearLightTables
+{
+    // Precision of linear light values, 4 of them still sum up in 16 bits
+    static const UINT LINEAR_BITS = 14;
+    static const UINT LINEAR_MAX = (1 << LINEAR_BITS) - 1;
+
+    // Channel value to linear light, shifted to the 16 bit lane of the blue, green and red channel
+    UINT64 ToLinear[3][256];
+
+    // Channel value to linear light in a 32 bit lane, for gathers
+    UINT32 ToLinear32[256];
+
+    // Channel value to linear light scaled to 0-255 for the float filters
+    FLOAT ToLinearFloat[256];
+
+    // Linear light to channel value, 3 more bytes so a 32 bit gather of the last value stays within the table
+    BYTE FromLinear[LINEAR_MAX + 1 + 3];
+};
+
+const LinearLightTables& GetLinearLightTables();
+
+// Get the widest Average2Rows variant averaging in linear light, the AVX2 one when the processor has it
+Average2RowsProc GetAverage2RowsLinearKernel();
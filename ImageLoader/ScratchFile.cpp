@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "ScratchFile.h"
+
+ScratchFile::ScratchFile()
+{
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_CbWritten = 0;
+}
+
+ScratchFile::~ScratchFile()
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------
+// Create the file, kept in the file cache as long as there is memory for it
+//-----------------------------------------------------------------------------
+HRESULT ScratchFile::Create(__in_z const WCHAR *pFilePath)
+{
+    Close();
+
+    m_hFile = CreateFile(pFilePath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_CbWritten = 0;
+
+    return S_OK;
+}
+
+void ScratchFile::Close()
+{
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+HRESULT ScratchFile::Write(__in const UINT64 &offset, __in_bcount(cbData) const BYTE *pData, __in const UINT &cbData)
+{
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD cbWritten = 0;
+    if (!WriteFile(m_hFile, pData, cbData, &cbWritten, &overlapped))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (cbWritten != cbData)
+    {
+        return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    }
+
+    m_CbWritten += cbData;
+
+    return S_OK;
+}
+
+HRESULT ScratchFile::Read(__in const UINT64 &offset, __out_bcount(cbData) BYTE *pBuffer, __in const UINT &cbData)
+{
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD cbRead = 0;
+    if (!ReadFile(m_hFile, pBuffer, cbData, &cbRead, &overlapped))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return (cbRead == cbData) ? S_OK : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+}
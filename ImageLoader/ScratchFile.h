@@ -0,0 +1,47 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Temporary file for data that does not fit in the memory budget of the
+// pyramid generation, written and read back at fixed offsets. The file is
+// deleted when it is closed, also when the process ends.
+//-----------------------------------------------------------------------------
+class ScratchFile
+{
+    HANDLE m_hFile;
+    UINT64 m_CbWritten;
+
+public:
+    ScratchFile();
+    ~ScratchFile();
+
+    HRESULT Create(__in_z const WCHAR *pFilePath);
+    void    Close();
+
+    BOOL    IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; };
+
+    HRESULT Write(__in const UINT64 &offset, __in_bcount(cbData) const BYTE *pData, __in const UINT &cbData);
+    HRESULT Read(__in const UINT64 &offset, __out_bcount(cbData) BYTE *pBuffer, __in const UINT &cbData);
+
+    // Total number of bytes written since the file was created
+    UINT64  GetCbWritten() const { return m_CbWritten; };
+};
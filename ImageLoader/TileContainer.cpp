@@ -0,0 +1,213 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "TileContainer.h"
+
+TileContainer::TileContainer()
+{
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_CbSize = 0;
+    m_hMapping = NULL;
+    m_pView = NULL;
+}
+
+TileContainer::~TileContainer()
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------
+// Create an empty container for writing
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::Create(__in_z const WCHAR *pFilePath)
+{
+    Close();
+
+    m_hFile = CreateFile(pFilePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_CbSize = 0;
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Open an existing container for reading
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::Open(__in_z const WCHAR *pFilePath)
+{
+    return OpenExisting(pFilePath, GENERIC_READ);
+}
+
+//-----------------------------------------------------------------------------
+// Open an existing container for reading and appending more tiles after
+// the ones it holds
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::OpenForAppend(__in_z const WCHAR *pFilePath)
+{
+    return OpenExisting(pFilePath, GENERIC_READ | GENERIC_WRITE);
+}
+
+HRESULT TileContainer::OpenExisting(__in_z const WCHAR *pFilePath, __in const DWORD &desiredAccess)
+{
+    Close();
+
+    m_hFile = CreateFile(pFilePath, desiredAccess, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_hFile, &fileSize))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    m_CbSize = fileSize.QuadPart;
+
+    return S_OK;
+}
+
+void TileContainer::Close()
+{
+    Unmap();
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_CbSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reserve space at the end of the container and write the data there,
+// can be called from multiple threads
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::Append(__in_bcount(cbData) const BYTE *pData, __in const UINT &cbData, __out TileLocation &location)
+{
+    LONGLONG offset = InterlockedExchangeAdd64(&m_CbSize, cbData);
+
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD cbWritten = 0;
+    if (!WriteFile(m_hFile, pData, cbData, &cbWritten, &overlapped))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (cbWritten != cbData)
+    {
+        return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    }
+
+    location.Offset = (UINT64)offset;
+    location.Length = cbData;
+    location.RowPitch = 0;
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Read a tile with one positioned read, can be called from multiple threads
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::Read(__in const TileLocation &location, __out_bcount(location.Length) BYTE *pBuffer)
+{
+    if (location.Offset + location.Length > (UINT64)m_CbSize)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)location.Offset;
+    overlapped.OffsetHigh = (DWORD)(location.Offset >> 32);
+
+    DWORD cbRead = 0;
+    if (!ReadFile(m_hFile, pBuffer, location.Length, &cbRead, &overlapped))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return (cbRead == location.Length) ? S_OK : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+}
+
+//-----------------------------------------------------------------------------
+// Map the whole container read only. It fails for containers bigger than the
+// free address space of 32 bit processes, callers then fall back to Read.
+//-----------------------------------------------------------------------------
+HRESULT TileContainer::Map()
+{
+    Unmap();
+
+    if (m_hFile == INVALID_HANDLE_VALUE || m_CbSize == 0)
+    {
+        return E_UNEXPECTED;
+    }
+
+    m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_hMapping)
+    {
+        m_pView = reinterpret_cast<const BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+    }
+
+    if (!m_pView)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Unmap();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+void TileContainer::Unmap()
+{
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+        m_pView = NULL;
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+}
+
+const BYTE* TileContainer::GetMappedTile(__in const TileLocation &location) const
+{
+    if (!m_pView || location.Offset + location.Length > (UINT64)m_CbSize)
+    {
+        return NULL;
+    }
+
+    return m_pView + location.Offset;
+}
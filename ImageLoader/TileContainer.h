@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+// Location of a tile in the packed tile container
+struct TileLocation
+{
+    UINT64 Offset;
+    UINT32 Length;
+
+    // Row pitch of tiles stored as raw pixels or blocks, 0 for encoded tiles
+    UINT32 RowPitch;
+};
+
+//-----------------------------------------------------------------------------
+// Single file holding encoded tiles of a whole pyramid one after another.
+// Tiles are appended concurrently by the encoder threads and read back with
+// one positioned read, the offset/length table is kept in the pyramid index.
+// A finished container can be mapped to serve raw tiles without any copy.
+//-----------------------------------------------------------------------------
+class TileContainer
+{
+    HANDLE m_hFile;
+    volatile LONGLONG m_CbSize;
+
+    HANDLE m_hMapping;
+    const BYTE* m_pView;
+
+    HRESULT OpenExisting(__in_z const WCHAR *pFilePath, __in const DWORD &desiredAccess);
+
+public:
+    TileContainer();
+    ~TileContainer();
+
+    HRESULT Create(__in_z const WCHAR *pFilePath);
+    HRESULT Open(__in_z const WCHAR *pFilePath);
+    HRESULT OpenForAppend(__in_z const WCHAR *pFilePath);
+    void    Close();
+
+    BOOL    IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; };
+
+    HRESULT Append(__in_bcount(cbData) const BYTE *pData, __in const UINT &cbData, __out TileLocation &location);
+    HRESULT Read(__in const TileLocation &location, __out_bcount(location.Length) BYTE *pBuffer);
+
+    HRESULT Map();
+    void    Unmap();
+
+    // Pointer to the tile in the mapped container, NULL when not mapped
+    const BYTE* GetMappedTile(__in const TileLocation &location) const;
+};
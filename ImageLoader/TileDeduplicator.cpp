@@ -0,0 +1,386 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <emmintrin.h>
+#include "TileDeduplicator.h"
+
+static const UINT STRIPE_SIZE = 64;
+static const UINT STRIPES_PER_SCRAMBLE = 8;
+static const UINT INITIAL_SLOT_COUNT = 1024;
+
+static const UINT32 PRIME32 = 0x9E3779B1U;
+static const UINT64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const UINT64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+
+// Keys of the stripes of a scramble block, and one more row of them to scramble with
+__declspec(align(16)) static const UINT64 HASH_KEYS[STRIPES_PER_SCRAMBLE + 1][8] =
+{
+    { 0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL, 0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL },
+    { 0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL, 0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL },
+    { 0xc3ebd33483acc5eaULL, 0xeb6313faffa081c5ULL, 0x49daf0b751dd0d17ULL, 0x9e68d429265516d3ULL, 0xfca1477d58be162bULL, 0xce31d07ad1b8f88fULL, 0x280416958f3acb45ULL, 0x7e404bbbcafbd7afULL },
+    { 0x5da11f2c9ed36a1dULL, 0x1e5d77b91b1be5ceULL, 0x4c1dc10e77e34a59ULL, 0x6c0fc1d7a42b3a8eULL, 0x2f5f63b2e4a28b73ULL, 0x8a7d3c1a2e6f4b11ULL, 0xd16b1b2bc67e84a2ULL, 0x35a1e60bc3f7d9c4ULL },
+    { 0x93c467e37db0c7a4ULL, 0xd1be3f810152cb56ULL, 0xa7c5ac472efd4a0fULL, 0x5bd1e9958f6b0e2dULL, 0x6b2fb644ecceee15ULL, 0x7f4a7c159e3779b9ULL, 0x0ad3b5dfc2b2ae35ULL, 0x165667b1d2c6e9c3ULL },
+    { 0xff51afd7ed558ccdULL, 0xc4ceb9fe1a85ec53ULL, 0x2545f4914f6cdd1dULL, 0x94d049bb133111ebULL, 0xbf58476d1ce4e5b9ULL, 0x60bee2bee120fc15ULL, 0x9fb21c651e98df25ULL, 0x1b03738712fad5c9ULL },
+    { 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL, 0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL },
+    { 0x152fecd8f70e5939ULL, 0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL, 0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL },
+    { 0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL },
+};
+
+__declspec(align(16)) static const UINT64 INITIAL_ACCUMULATORS[8] =
+{
+    0x00000000C2B2AE3DULL, 0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 
+    0x85EBCA77C2B2AE63ULL, 0x0000000085EBCA77ULL, 0x27D4EB2F165667C5ULL, 0x000000009E3779B1ULL,
+};
+
+//-----------------------------------------------------------------------------
+// Add a 64 byte stripe to the accumulators, the multiply of the keyed halves
+// of every 64 bit lane mixes the bits and the swapped data keeps all of them
+//-----------------------------------------------------------------------------
+inline static void AccumulateStripe(__inout __m128i *pAcc, __in const BYTE *pStripe, __in const UINT64 *pKeys)
+{
+    for (UINT i = 0; i < 4; ++i)
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pStripe) + i);
+        __m128i dataKey = _mm_xor_si128(data, _mm_load_si128(reinterpret_cast<const __m128i*>(pKeys) + i));
+        __m128i dataKeyHigh = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product = _mm_mul_epu32(dataKey, dataKeyHigh);
+        __m128i dataSwap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+        pAcc[i] = _mm_add_epi64(pAcc[i], _mm_add_epi64(product, dataSwap));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Scramble the accumulators, so the stripes added after land differently
+//-----------------------------------------------------------------------------
+inline static void ScrambleAccumulators(__inout __m128i *pAcc)
+{
+    const __m128i prime = _mm_set1_epi32((int)PRIME32);
+    const __m128i *pKeys = reinterpret_cast<const __m128i*>(HASH_KEYS[STRIPES_PER_SCRAMBLE]);
+
+    for (UINT i = 0; i < 4; ++i)
+    {
+        __m128i acc = _mm_xor_si128(pAcc[i], _mm_srli_epi64(pAcc[i], 47));
+        acc = _mm_xor_si128(acc, _mm_load_si128(pKeys + i));
+
+        // 64 bit lanes times the 32 bit prime
+        __m128i productLow = _mm_mul_epu32(acc, prime);
+        __m128i productHigh = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+        pAcc[i] = _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32));
+    }
+}
+
+inline static UINT64 Avalanche(__in UINT64 h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_1;
+    h ^= h >> 32;
+
+    return h;
+}
+
+TileHash HashTilePixels(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride)
+{
+    __m128i acc[4];
+    for (UINT i = 0; i < 4; ++i)
+    {
+        acc[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(INITIAL_ACCUMULATORS) + i);
+    }
+
+    UINT cbRow = width * 4;
+    UINT stripeCount = cbRow / STRIPE_SIZE;
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        const BYTE *pRow = pPixelData + (SIZE_T)y * cbStride;
+
+        for (UINT stripe = 0; stripe < stripeCount; ++stripe)
+        {
+            AccumulateStripe(acc, pRow + (SIZE_T)stripe * STRIPE_SIZE, HASH_KEYS[stripe % STRIPES_PER_SCRAMBLE]);
+
+            if (stripe % STRIPES_PER_SCRAMBLE == STRIPES_PER_SCRAMBLE - 1)
+            {
+                ScrambleAccumulators(acc);
+            }
+        }
+
+        // Last partial stripe of the row, padded with zeros
+        UINT cbTail = cbRow - stripeCount * STRIPE_SIZE;
+        if (cbTail > 0)
+        {
+            __declspec(align(16)) BYTE tail[STRIPE_SIZE] = {0};
+            memcpy(tail, pRow + (SIZE_T)stripeCount * STRIPE_SIZE, cbTail);
+
+            AccumulateStripe(acc, tail, HASH_KEYS[stripeCount % STRIPES_PER_SCRAMBLE]);
+        }
+
+        ScrambleAccumulators(acc);
+    }
+
+    __declspec(align(16)) UINT64 lanes[8];
+    for (UINT i = 0; i < 4; ++i)
+    {
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes) + i, acc[i]);
+    }
+
+    // Fold the lanes in both directions, each half of the hash depends on all of them and on the size
+    TileHash hash;
+    hash.Low = ((UINT64)width << 32 | height) * PRIME64_1;
+    hash.High = ((UINT64)height << 32 | width) * PRIME64_2;
+    for (UINT i = 0; i < 8; ++i)
+    {
+        hash.Low = (hash.Low ^ lanes[i]) * PRIME64_1;
+        hash.Low ^= hash.Low >> 29;
+        hash.High = (hash.High ^ lanes[7 - i]) * PRIME64_2;
+        hash.High ^= hash.High >> 31;
+    }
+
+    hash.Low = Avalanche(hash.Low);
+    hash.High = Avalanche(hash.High);
+
+    return hash;
+}
+
+BOOL IsSolidColorTile(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __out UINT &color)
+{
+    static const UINT32 COLOR_MASK = 0x00FFFFFF;
+
+    UINT32 first = *reinterpret_cast<const UINT32*>(pPixelData) & COLOR_MASK;
+
+    const __m128i mask = _mm_set1_epi32((int)COLOR_MASK);
+    const __m128i expected = _mm_set1_epi32((int)first);
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        const BYTE *pRow = pPixelData + (SIZE_T)y * cbStride;
+        UINT x = 0;
+
+        // 16 pixels per iteration, most tiles differ within the first few of them
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i *pBlock = reinterpret_cast<const __m128i*>(pRow + x * 4);
+            __m128i equal01 = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pBlock), mask), expected), 
+                                            _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pBlock + 1), mask), expected));
+            __m128i equal23 = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pBlock + 2), mask), expected), 
+                                            _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pBlock + 3), mask), expected));
+
+            if (_mm_movemask_epi8(_mm_and_si128(equal01, equal23)) != 0xFFFF)
+            {
+                return FALSE;
+            }
+        }
+
+        for (; x < width; ++x)
+        {
+            if ((reinterpret_cast<const UINT32*>(pRow)[x] & COLOR_MASK) != first)
+            {
+                return FALSE;
+            }
+        }
+    }
+
+    color = first | ~COLOR_MASK;
+
+    return TRUE;
+}
+
+void FillSolidColorTile(__out BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __in const UINT &color)
+{
+    for (UINT y = 0; y < height; ++y)
+    {
+        UINT32 *pRow = reinterpret_cast<UINT32*>(pPixelData + (SIZE_T)y * cbStride);
+        for (UINT x = 0; x < width; ++x)
+        {
+            pRow[x] = color;
+        }
+    }
+}
+
+TileDeduplicator::TileDeduplicator()
+{
+    m_DuplicateCount = 0;
+}
+
+HRESULT TileDeduplicator::Initialize()
+{
+    HRESULT hr = m_Lock.Initialize();
+    IF_FAILED_RETURN(hr);
+
+    hr = m_Slots.SetSize(INITIAL_SLOT_COUNT);
+    IF_FAILED_RETURN(hr);
+
+    ZeroMemory(m_Slots.Ptr(), INITIAL_SLOT_COUNT * sizeof(UINT));
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Get the slot of the entry of a tile, or the free slot to add it to
+//-----------------------------------------------------------------------------
+UINT TileDeduplicator::FindSlot(__in const TileHash &hash, __in const UINT &width, __in const UINT &height) const
+{
+    UINT mask = m_Slots.Length() - 1;
+    UINT slot = (UINT)hash.Low & mask;
+
+    while (m_Slots[slot] != 0)
+    {
+        const Entry &entry = m_Entries[m_Slots[slot] - 1];
+        if (entry.Hash.Low == hash.Low && entry.Hash.High == hash.High && entry.Width == width && entry.Height == height)
+        {
+            break;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+//-----------------------------------------------------------------------------
+// Double the slots and add all entries again, keeps them at most half full
+//-----------------------------------------------------------------------------
+HRESULT TileDeduplicator::GrowSlots()
+{
+    UINT slotCount = m_Slots.Length() * 2;
+
+    Vector<UINT> slots;
+    HRESULT hr = slots.SetSize(slotCount);
+    IF_FAILED_RETURN(hr);
+
+    ZeroMemory(slots.Ptr(), (SIZE_T)slotCount * sizeof(UINT));
+
+    for (UINT i = 0; i < m_Entries.Length(); ++i)
+    {
+        UINT slot = (UINT)m_Entries[i].Hash.Low & (slotCount - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+
+        slots[slot] = i + 1;
+    }
+
+    slots.DetachTo(m_Slots);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Store a tile as a duplicate of a stored tile with the same pixels. Without
+// one, the tile gets an entry the caller completes once it is stored.
+//-----------------------------------------------------------------------------
+HRESULT TileDeduplicator::StoreDuplicate(__in const TileHash &hash, __in const UINT &width, __in const UINT &height, __in_z_opt const WCHAR *pTilePath, 
+                                         __out_opt TileLocation *pLocation, __out UINT &entry)
+{
+    entry = NO_ENTRY;
+
+    WCHAR firstTilePath[MAX_PATH] = L"";
+    UINT firstEntry = NO_ENTRY;
+    {
+        AutoCriticalSection lock(m_Lock);
+
+        UINT slot = FindSlot(hash, width, height);
+        if (m_Slots[slot] == 0)
+        {
+            Entry newEntry = {hash, width, height, ES_ENCODING, {0, 0, 0}, 0};
+            HRESULT hr = m_Entries.Add(newEntry);
+            IF_FAILED_RETURN(hr);
+
+            m_Slots[slot] = m_Entries.Length();
+            entry = m_Entries.Length() - 1;
+
+            if (m_Entries.Length() * 2 > m_Slots.Length())
+            {
+                hr = GrowSlots();
+                IF_FAILED_RETURN(hr);
+            }
+
+            return S_FALSE;
+        }
+
+        // The first tile is still being encoded, this one is stored on its own
+        const Entry &found = m_Entries[m_Slots[slot] - 1];
+        if (found.State != ES_STORED)
+        {
+            return S_FALSE;
+        }
+
+        if (pLocation)
+        {
+            *pLocation = found.Location;
+            InterlockedIncrement(&m_DuplicateCount);
+
+            return S_OK;
+        }
+
+        UINT error = wcscpy_s(firstTilePath, MAX_PATH, m_Paths.Ptr() + found.PathOffset);
+        if (error != 0)
+        {
+            return E_FAIL;
+        }
+
+        firstEntry = m_Slots[slot] - 1;
+    }
+
+    // A file of a previous pyramid may be in the way of the link
+    DeleteFile(pTilePath);
+
+    if (!CreateHardLink(pTilePath, firstTilePath, NULL))
+    {
+        // Files have a limited number of links, the tile is stored again and links are made to it from now on
+        entry = firstEntry;
+        return S_FALSE;
+    }
+
+    InterlockedIncrement(&m_DuplicateCount);
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Record where the tile of an entry is stored, later duplicates refer to it
+//-----------------------------------------------------------------------------
+HRESULT TileDeduplicator::Complete(__in const UINT &entry, __in_z_opt const WCHAR *pTilePath, __in_opt const TileLocation *pLocation)
+{
+    AutoCriticalSection lock(m_Lock);
+
+    HRESULT hr = S_OK;
+    Entry &completed = m_Entries[entry];
+
+    if (pLocation)
+    {
+        completed.Location = *pLocation;
+    }
+    else
+    {
+        UINT pathOffset = m_Paths.Length();
+        hr = m_Paths.Add(const_cast<WCHAR*>(pTilePath), (UINT)wcslen(pTilePath) + 1);
+        IF_FAILED_RETURN(hr);
+
+        completed.PathOffset = pathOffset;
+    }
+
+    completed.State = ES_STORED;
+
+    return hr;
+}
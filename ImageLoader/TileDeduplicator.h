@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "TileContainer.h"
+
+// 128 bit hash of tile pixels, tiles with equal hashes are taken as equal
+struct TileHash
+{
+    UINT64 Low;
+    UINT64 High;
+};
+
+//-----------------------------------------------------------------------------
+// Hash pixels of a tile with SSE2, the padding past the width in each row of
+// the stride is not hashed. Rows are consumed in 64 byte stripes, each with
+// its own key, and the accumulators are scrambled every 512 bytes and at the
+// end of every row, so the hash depends on the position of every pixel.
+//-----------------------------------------------------------------------------
+TileHash HashTilePixels(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride);
+
+//-----------------------------------------------------------------------------
+// Compare all pixels of a tile with its first one with SSE2, ignoring the
+// unused fourth byte. Returns the BGRX color of a tile of a single color.
+//-----------------------------------------------------------------------------
+BOOL IsSolidColorTile(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __out UINT &color);
+
+// Fill pixels of a tile with a BGRX color
+void FillSolidColorTile(__out BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __in const UINT &color);
+
+//-----------------------------------------------------------------------------
+// Table of the tiles of one generation by the hash of their pixels, used by
+// the encoders to store every distinct tile once. A packed duplicate reuses
+// the location of the first tile in the container. A duplicate tile file is
+// a hard link to the first file with the same pixels. Tiles with the same
+// hash encoded at the same time are both stored, only the finished first one
+// is referenced.
+//-----------------------------------------------------------------------------
+class TileDeduplicator
+{
+    enum EntryState
+    {
+        ES_ENCODING = 0,
+        ES_STORED = 1,
+    };
+
+    struct Entry
+    {
+        TileHash Hash;
+        UINT Width;
+        UINT Height;
+        EntryState State;
+
+        // Where the first tile is stored, its packed location or the offset of its path in m_Paths
+        TileLocation Location;
+        UINT PathOffset;
+    };
+
+    CriticalSection m_Lock;
+
+    // Open addressing table of indices to m_Entries plus one, 0 for a free slot
+    Vector<UINT> m_Slots;
+    Vector<Entry> m_Entries;
+    Vector<WCHAR> m_Paths;
+
+    volatile LONG m_DuplicateCount;
+
+    UINT    FindSlot(__in const TileHash &hash, __in const UINT &width, __in const UINT &height) const;
+    HRESULT GrowSlots();
+
+public:
+    static const UINT NO_ENTRY = 0xFFFFFFFF;
+
+    TileDeduplicator();
+
+    HRESULT Initialize();
+
+    // Store the tile as a duplicate of a stored tile, S_FALSE when the caller has to encode it. The caller
+    // then gets the entry to complete with Complete once the tile is stored, or NO_ENTRY when there is none.
+    HRESULT StoreDuplicate(__in const TileHash &hash, __in const UINT &width, __in const UINT &height, __in_z_opt const WCHAR *pTilePath, 
+                           __out_opt TileLocation *pLocation, __out UINT &entry);
+    HRESULT Complete(__in const UINT &entry, __in_z_opt const WCHAR *pTilePath, __in_opt const TileLocation *pLocation);
+
+    // Tiles stored as a reference to another tile
+    UINT GetDuplicateCount() const { return (UINT)m_DuplicateCount; };
+};
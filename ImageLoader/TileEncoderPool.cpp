@@ -0,0 +1,627 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "TileEncoderPool.h"
+#include "BlockCompression.h"
+#include "Lz4Codec.h"
+
+TileEncoderOptions::TileEncoderOptions(__in const ImageLoaderOptions &options)
+{
+    TileCodec = options.TileCodec;
+    ImageQuality = options.JpegQuality / 100.0f;
+    PngFilter = (WICPngFilterOption)options.PngFilter;
+}
+
+const GUID& GetTileContainerFormat(__in const TileCodecType &tileCodec, __in const GUID &sourceFormat)
+{
+    switch (tileCodec)
+    {
+    case TCT_JPEG:
+        return GUID_ContainerFormatJpeg;
+
+    case TCT_PNG:
+        return GUID_ContainerFormatPng;
+
+    default:
+        return sourceFormat;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Writes the encoder options of the JPEG and PNG tile codecs to the frame
+// options, the encoder of the source format keeps its defaults
+//-----------------------------------------------------------------------------
+static HRESULT WriteEncoderOptions(__in IPropertyBag2 *pFrameOptions, __in const GUID &containerFormat, __in const TileEncoderOptions &encoderOptions)
+{
+    PROPBAG2 option = {0};
+    VARIANT value;
+    VariantInit(&value);
+
+    if (encoderOptions.TileCodec == TCT_JPEG && containerFormat == GUID_ContainerFormatJpeg)
+    {
+        option.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+        value.vt = VT_R4;
+        value.fltVal = encoderOptions.ImageQuality;
+    }
+    else if (encoderOptions.TileCodec == TCT_PNG && containerFormat == GUID_ContainerFormatPng)
+    {
+        option.pstrName = const_cast<LPOLESTR>(L"FilterOption");
+        value.vt = VT_UI1;
+        value.bVal = (BYTE)encoderOptions.PngFilter;
+    }
+    else
+    {
+        return S_OK;
+    }
+
+    return pFrameOptions->Write(1, &option, &value);
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the bitmap with the container format encoder to given stream
+//-----------------------------------------------------------------------------
+HRESULT EncodeBitmapToStream(__in IWICImagingFactory *pImagingFactory, __in IStream *pStream, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap, 
+                             __in const TileEncoderOptions &encoderOptions)
+{
+    SmartPtr<IWICBitmapEncoder> spEncoder;
+    HRESULT hr = pImagingFactory->CreateEncoder(containerFormat, NULL, &spEncoder);
+    IF_FAILED_RETURN(hr);
+
+    hr = spEncoder->Initialize(pStream, WICBitmapEncoderNoCache);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapFrameEncode> spFrameEncode;
+    SmartPtr<IPropertyBag2> spFrameOptions;
+    hr = spEncoder->CreateNewFrame(&spFrameEncode, &spFrameOptions);
+    IF_FAILED_RETURN(hr);
+
+    hr = WriteEncoderOptions(spFrameOptions, containerFormat, encoderOptions);
+    IF_FAILED_RETURN(hr);
+
+    hr = spFrameEncode->Initialize(spFrameOptions);
+    IF_FAILED_RETURN(hr);
+
+    // Get size
+    UINT width, height;
+    SmartPtr<IWICBitmap> spBitmap(pBitmap);
+    hr = spBitmap->GetSize(&width, &height);
+    IF_FAILED_RETURN(hr);
+
+    // Set image parameters
+    hr = spFrameEncode->SetSize(width, height);
+    IF_FAILED_RETURN(hr);
+
+    WICPixelFormatGUID pixelFormat = *pPixelFormat;
+    hr = spFrameEncode->SetPixelFormat(&pixelFormat);
+    IF_FAILED_RETURN(hr);
+
+    // Write
+    hr = spFrameEncode->WriteSource(spBitmap, NULL);
+    IF_FAILED_RETURN(hr);
+
+    hr = spFrameEncode->Commit();
+    IF_FAILED_RETURN(hr);
+
+    hr = spEncoder->Commit();
+    IF_FAILED_RETURN(hr);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Saves the bitmap to given file path
+//-----------------------------------------------------------------------------
+HRESULT SaveBitmapToFile(__in IWICImagingFactory *pImagingFactory, __in const WCHAR* pFilePath, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap, 
+                         __in const TileEncoderOptions &encoderOptions)
+{
+    // The file may be a hard link to the same pixels of other tiles, they keep them
+    DeleteFile(pFilePath);
+
+    SmartPtr<IWICStream> spStream;
+    HRESULT hr = pImagingFactory->CreateStream(&spStream);
+    IF_FAILED_RETURN(hr);
+
+    hr = spStream->InitializeFromFilename(pFilePath, GENERIC_WRITE);
+    IF_FAILED_RETURN(hr);
+
+    return EncodeBitmapToStream(pImagingFactory, spStream, containerFormat, pPixelFormat, pBitmap, encoderOptions);
+}
+
+//-----------------------------------------------------------------------------
+// Writes an encoded tile to given file path
+//-----------------------------------------------------------------------------
+static HRESULT SaveTileToFile(__in const WCHAR* pFilePath, __in_bcount(cbTileData) const BYTE *pTileData, __in const UINT &cbTileData)
+{
+    // The file may be a hard link to the same pixels of other tiles, they keep them
+    DeleteFile(pFilePath);
+
+    HANDLE hFile = CreateFile(pFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    DWORD cbWritten = 0;
+    if (!WriteFile(hFile, pTileData, cbTileData, &cbWritten, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (cbWritten != cbTileData)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    }
+
+    CloseHandle(hFile);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the bitmap to memory and appends it to the tile container
+//-----------------------------------------------------------------------------
+HRESULT AppendBitmapToContainer(__in IWICImagingFactory *pImagingFactory, __in TileContainer *pContainer, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap, 
+                                __in const TileEncoderOptions &encoderOptions, __out TileLocation &location)
+{
+    SmartPtr<IStream> spStream;
+    HRESULT hr = CreateStreamOnHGlobal(NULL, TRUE, &spStream);
+    IF_FAILED_RETURN(hr);
+
+    hr = EncodeBitmapToStream(pImagingFactory, spStream, containerFormat, pPixelFormat, pBitmap, encoderOptions);
+    IF_FAILED_RETURN(hr);
+
+    // Encoded size is the stream position, the global memory block may be bigger
+    LARGE_INTEGER zero = {0};
+    ULARGE_INTEGER cbEncoded;
+    hr = spStream->Seek(zero, STREAM_SEEK_CUR, &cbEncoded);
+    IF_FAILED_RETURN(hr);
+
+    HGLOBAL hGlobal = NULL;
+    hr = GetHGlobalFromStream(spStream, &hGlobal);
+    IF_FAILED_RETURN(hr);
+
+    const BYTE *pData = reinterpret_cast<const BYTE*>(GlobalLock(hGlobal));
+    if (!pData)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    hr = pContainer->Append(pData, (UINT)cbEncoded.QuadPart, location);
+    GlobalUnlock(hGlobal);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Encodes tile pixels with the tile codec and writes them to the tile path,
+// or appends them to the tile container when there is one
+//-----------------------------------------------------------------------------
+static HRESULT StoreTile(__in IWICImagingFactory *pImagingFactory, __in const TileCodecType &tileCodec, __in const TileEncoderOptions &encoderOptions, __in_opt TileContainer *pTileContainer, 
+                         __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, __in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                         __in_z_opt const WCHAR *pTilePath, __out_opt TileLocation *pLocation)
+{
+    // Raw tiles keep the stride of the tile buffer, so they can be used in place
+    if (tileCodec == TCT_RAW)
+    {
+        HRESULT hr = pTileContainer->Append(pPixelData, height * cbStride, *pLocation);
+        IF_FAILED_RETURN(hr);
+
+        pLocation->RowPitch = cbStride;
+        return hr;
+    }
+
+    // Block compressed tiles are stored as the rows of blocks uploaded to the texture
+    if (IsBlockCompressedCodec(tileCodec))
+    {
+        UINT rowPitch = 0, cbBlocks = 0;
+        GetBlockCompressedSize(tileCodec, width, height, rowPitch, cbBlocks);
+
+        BYTE *pBlocks = reinterpret_cast<BYTE*>(_aligned_malloc(cbBlocks, 16));
+        if (!pBlocks)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        CompressTileBlocks(tileCodec, pPixelData, width, height, cbStride, pBlocks, rowPitch);
+
+        HRESULT hr = pTileContainer->Append(pBlocks, cbBlocks, *pLocation);
+        _aligned_free(pBlocks);
+        IF_FAILED_RETURN(hr);
+
+        pLocation->RowPitch = rowPitch;
+        return hr;
+    }
+
+    // LZ4 tiles go to the container or to tile files like the encoded ones
+    if (tileCodec == TCT_LZ4)
+    {
+        BYTE *pTileData = reinterpret_cast<BYTE*>(_aligned_malloc(GetLz4TileBound(width, height), 16));
+        if (!pTileData)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        UINT cbTileData = 0;
+        HRESULT hr = CompressLz4Tile(pPixelData, width, height, cbStride, pTileData, cbTileData);
+        if (SUCCEEDED(hr))
+        {
+            hr = pTileContainer ? pTileContainer->Append(pTileData, cbTileData, *pLocation) : SaveTileToFile(pTilePath, pTileData, cbTileData);
+        }
+
+        _aligned_free(pTileData);
+
+        return hr;
+    }
+
+    SmartPtr<IWICBitmap> spBitmap;
+    HRESULT hr = pImagingFactory->CreateBitmapFromMemory(width, height, pixelFormat, cbStride, height * cbStride, const_cast<BYTE*>(pPixelData), &spBitmap);
+    IF_FAILED_RETURN(hr);
+
+    const GUID &tileFormat = GetTileContainerFormat(tileCodec, containerFormat);
+    if (pTileContainer)
+    {
+        return AppendBitmapToContainer(pImagingFactory, pTileContainer, tileFormat, &pixelFormat, spBitmap, encoderOptions, *pLocation);
+    }
+
+    return SaveBitmapToFile(pImagingFactory, pTilePath, tileFormat, &pixelFormat, spBitmap, encoderOptions);
+}
+
+HRESULT EncodeTile(__in IWICImagingFactory *pImagingFactory, __in const TileCodecType &tileCodec, __in const TileEncoderOptions &encoderOptions, __in_opt TileContainer *pTileContainer, 
+                   __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, __in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                   __in_z_opt const WCHAR *pTilePath, __out_opt TileLocation *pLocation, __in_opt TileDeduplicator *pDeduplicator)
+{
+    if (!pDeduplicator)
+    {
+        return StoreTile(pImagingFactory, tileCodec, encoderOptions, pTileContainer, containerFormat, pixelFormat, pPixelData, width, height, cbStride, pTilePath, pLocation);
+    }
+
+    // Tiles with the same pixels as a stored one are not encoded again
+    UINT entry = TileDeduplicator::NO_ENTRY;
+    HRESULT hr = pDeduplicator->StoreDuplicate(HashTilePixels(pPixelData, width, height, cbStride), width, height, pTilePath, pLocation, entry);
+    if (hr != S_FALSE)
+    {
+        return hr;
+    }
+
+    hr = StoreTile(pImagingFactory, tileCodec, encoderOptions, pTileContainer, containerFormat, pixelFormat, pPixelData, width, height, cbStride, pTilePath, pLocation);
+    IF_FAILED_RETURN(hr);
+
+    if (entry != TileDeduplicator::NO_ENTRY)
+    {
+        hr = pDeduplicator->Complete(entry, pTilePath, pLocation);
+    }
+
+    return hr;
+}
+
+TileEncoderPool::TileEncoderPool()
+{
+    m_pTileContainer = NULL;
+    m_pDeduplicator = NULL;
+    m_TileCodec = TCT_SOURCE;
+    m_ContainerFormat = GUID_NULL;
+    m_PixelFormat = GUID_NULL;
+    m_CbJobBufferSize = 0;
+    m_QueueHead = 0;
+    m_QueueCount = 0;
+    m_hFreeJobsSemaphore = NULL;
+    m_hQueuedJobsSemaphore = NULL;
+    m_Stopping = FALSE;
+    m_Result = S_OK;
+    m_EncodeSeconds = 0.0;
+}
+
+TileEncoderPool::~TileEncoderPool()
+{
+    WaitForCompletion();
+
+    if (m_hFreeJobsSemaphore)
+    {
+        CloseHandle(m_hFreeJobsSemaphore);
+    }
+
+    if (m_hQueuedJobsSemaphore)
+    {
+        CloseHandle(m_hQueuedJobsSemaphore);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Get number of logical processors
+//-----------------------------------------------------------------------------
+UINT TileEncoderPool::GetDefaultThreadCount()
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+
+    return max(1, systemInfo.dwNumberOfProcessors);
+}
+
+HRESULT TileEncoderPool::Initialize(__in const UINT &threadCount, __in const UINT &queueLength, __in const UINT &cbMaxTileSize, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, 
+                                    __in const TileCodecType &tileCodec, __in const TileEncoderOptions &encoderOptions, __in_opt TileContainer *pTileContainer, __in_opt TileDeduplicator *pDeduplicator)
+{
+    // Raw and block compressed tiles are only useful when they can be mapped from the container
+    if (IsMappedTileCodec(tileCodec) && !pTileContainer)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (threadCount == 0 || cbMaxTileSize == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_Lock.Initialize();
+    IF_FAILED_RETURN(hr);
+
+    m_pTileContainer = pTileContainer;
+    m_pDeduplicator = pDeduplicator;
+    m_TileCodec = tileCodec;
+    m_EncoderOptions = encoderOptions;
+    m_ContainerFormat = containerFormat;
+    m_PixelFormat = pixelFormat;
+    m_CbJobBufferSize = cbMaxTileSize;
+
+    // Every worker holds one job while encoding, the rest is waiting in the queue
+    UINT jobCount = GetJobCount(threadCount, queueLength);
+
+    hr = m_Jobs.SetSize(jobCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_FreeJobs.SetSize(jobCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_QueuedJobs.SetSize(jobCount);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT i = 0; i < jobCount; ++i)
+    {
+        m_Jobs[i].PixelData = reinterpret_cast<BYTE*>(_aligned_malloc(m_CbJobBufferSize, 16));
+        if (!m_Jobs[i].PixelData)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        m_FreeJobs[i] = i;
+    }
+
+    m_hFreeJobsSemaphore = CreateSemaphore(NULL, jobCount, jobCount, NULL);
+    if (!m_hFreeJobsSemaphore)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Queued jobs plus one wake up for each worker when stopping
+    m_hQueuedJobsSemaphore = CreateSemaphore(NULL, 0, jobCount + threadCount, NULL);
+    if (!m_hQueuedJobsSemaphore)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Reserve space up front, so a running thread is never lost on failed Add
+    hr = m_Threads.Allocate(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT i = 0; i < threadCount; ++i)
+    {
+        HANDLE hThread = CreateThread(NULL, 0, &TileEncoderPool::WorkerThreadProc, this, 0, NULL);
+        if (!hThread)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        hr = m_Threads.Add(hThread);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Remember the first failure, later jobs are skipped
+//-----------------------------------------------------------------------------
+void TileEncoderPool::SetResult(__in const HRESULT &hr)
+{
+    if (FAILED(hr))
+    {
+        InterlockedCompareExchange(&m_Result, hr, S_OK);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copy tile pixels to a free job and queue it for encoding, blocks when all
+// jobs are in use. Tiles go to the tile path, or to the tile container when
+// the pool has one, then the location is filled once the tile is written.
+//-----------------------------------------------------------------------------
+HRESULT TileEncoderPool::Submit(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __in_z_opt const WCHAR *pTilePath, __out_opt TileLocation *pLocation)
+{
+    if ((m_pTileContainer && !pLocation) || (!m_pTileContainer && !pTilePath))
+    {
+        return E_INVALIDARG;
+    }
+
+    if (m_Threads.Length() == 0)
+    {
+        return E_UNEXPECTED;
+    }
+
+    if ((height * cbStride) > m_CbJobBufferSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = m_Result;
+    IF_FAILED_RETURN(hr);
+
+    m_SubmitStallTimer.Start();
+    DWORD waitResult = WaitForSingleObject(m_hFreeJobsSemaphore, INFINITE);
+    m_SubmitStallTimer.Stop();
+
+    if (waitResult != WAIT_OBJECT_0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    UINT jobIndex;
+    {
+        AutoCriticalSection lock(m_Lock);
+        jobIndex = m_FreeJobs.PopLast();
+    }
+
+    Job &job = m_Jobs[jobIndex];
+    job.Width = width;
+    job.Height = height;
+    job.CbStride = cbStride;
+
+    job.pLocation = pLocation;
+    job.TilePath[0] = L'\0';
+
+    UINT error = memcpy_s(job.PixelData, m_CbJobBufferSize, pPixelData, height * cbStride);
+    if (error == 0 && pTilePath)
+    {
+        error = wcscpy_s(job.TilePath, MAX_PATH, pTilePath);
+    }
+
+    if (error != 0)
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_FreeJobs.Add(jobIndex);
+        ReleaseSemaphore(m_hFreeJobsSemaphore, 1, NULL);
+        return E_FAIL;
+    }
+
+    {
+        AutoCriticalSection lock(m_Lock);
+        m_QueuedJobs[(m_QueueHead + m_QueueCount) % m_QueuedJobs.Length()] = jobIndex;
+        m_QueueCount++;
+    }
+    ReleaseSemaphore(m_hQueuedJobsSemaphore, 1, NULL);
+
+    return m_Result;
+}
+
+//-----------------------------------------------------------------------------
+// Let the workers drain the queue, join them and return the first failure
+//-----------------------------------------------------------------------------
+HRESULT TileEncoderPool::WaitForCompletion()
+{
+    if (m_Threads.Length() > 0)
+    {
+        InterlockedExchange(&m_Stopping, TRUE);
+        ReleaseSemaphore(m_hQueuedJobsSemaphore, m_Threads.Length(), NULL);
+
+        for (UINT i = 0; i < m_Threads.Length(); ++i)
+        {
+            WaitForSingleObject(m_Threads[i], INFINITE);
+            CloseHandle(m_Threads[i]);
+        }
+        m_Threads.Clear();
+    }
+
+    return m_Result;
+}
+
+DWORD WINAPI TileEncoderPool::WorkerThreadProc(__in LPVOID lpParameter)
+{
+    TileEncoderPool *pPool = reinterpret_cast<TileEncoderPool*>(lpParameter);
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    pPool->SetResult(hr);
+
+    // A worker without COM still drains the queue and frees the job of every tile it drops, otherwise
+    // Submit would wait for a free job forever once all workers failed
+    HRESULT hrLoop = pPool->WorkerLoop();
+    pPool->SetResult(hrLoop);
+
+    if (SUCCEEDED(hr))
+    {
+        CoUninitialize();
+    }
+
+    return 0;
+}
+
+HRESULT TileEncoderPool::WorkerLoop()
+{
+    // Every worker has its own factory, so encoders never share state across threads
+    SmartPtr<IWICImagingFactory> spImagingFactory;
+    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&spImagingFactory);
+
+    StageTimer encodeTimer;
+    for (;;)
+    {
+        if (WaitForSingleObject(m_hQueuedJobsSemaphore, INFINITE) != WAIT_OBJECT_0)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        UINT jobIndex;
+        {
+            AutoCriticalSection lock(m_Lock);
+            if (m_QueueCount == 0)
+            {
+                // Woken up with an empty queue only when stopping
+                _ASSERT(m_Stopping);
+                break;
+            }
+
+            jobIndex = m_QueuedJobs[m_QueueHead];
+            m_QueueHead = (m_QueueHead + 1) % m_QueuedJobs.Length();
+            m_QueueCount--;
+        }
+
+        // After a failure the queue is only drained, so the producer never blocks
+        if (SUCCEEDED(hr) && SUCCEEDED(m_Result))
+        {
+            encodeTimer.Start();
+            hr = EncodeJob(spImagingFactory, m_Jobs[jobIndex]);
+            encodeTimer.Stop();
+            SetResult(hr);
+        }
+
+        {
+            AutoCriticalSection lock(m_Lock);
+            m_FreeJobs.Add(jobIndex);
+        }
+        ReleaseSemaphore(m_hFreeJobsSemaphore, 1, NULL);
+    }
+
+    AutoCriticalSection lock(m_Lock);
+    m_EncodeSeconds += encodeTimer.GetSeconds();
+
+    return hr;
+}
+
+HRESULT TileEncoderPool::EncodeJob(__in IWICImagingFactory *pImagingFactory, __in const Job &job)
+{
+    return EncodeTile(pImagingFactory, m_TileCodec, m_EncoderOptions, m_pTileContainer, m_ContainerFormat, m_PixelFormat, job.PixelData, job.Width, job.Height, job.CbStride, job.TilePath, job.pLocation, m_pDeduplicator);
+}
+
+DOUBLE TileEncoderPool::GetEncodeSeconds()
+{
+    AutoCriticalSection lock(m_Lock);
+    return m_EncodeSeconds;
+}
+
+DOUBLE TileEncoderPool::GetSubmitStallSeconds() const
+{
+    return m_SubmitStallTimer.GetSeconds();
+}
@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "TileDeduplicator.h"
+
+//-----------------------------------------------------------------------------
+// Properties of the WIC encoders writing the tiles, only the codec they were
+// given for uses them. TCT_SOURCE tiles get the defaults of the encoder, the
+// manifest records the properties of TCT_JPEG and TCT_PNG only.
+//-----------------------------------------------------------------------------
+struct TileEncoderOptions
+{
+    // Codec of the tiles the properties are for
+    TileCodecType TileCodec;
+
+    // Quality of JPEG tiles from 0.0 to 1.0
+    FLOAT ImageQuality;
+
+    // Row filter of PNG tiles
+    WICPngFilterOption PngFilter;
+
+    TileEncoderOptions() : TileCodec(TCT_SOURCE), ImageQuality(0.9f), PngFilter(WICPngFilterUnspecified) {};
+    explicit TileEncoderOptions(__in const ImageLoaderOptions &options);
+};
+
+//-----------------------------------------------------------------------------
+// Container format of the tiles encoded with WIC, TCT_SOURCE keeps the one of the source image
+//-----------------------------------------------------------------------------
+const GUID& GetTileContainerFormat(__in const TileCodecType &tileCodec, __in const GUID &sourceFormat);
+
+//-----------------------------------------------------------------------------
+// Pool of worker threads encoding and writing finished pyramid tiles.
+// The producer hands over tile pixels with Submit and keeps streaming, the
+// number of tiles waiting for an encoder is bounded by the queue length.
+//-----------------------------------------------------------------------------
+class TileEncoderPool
+{
+    struct Job
+    {
+        BYTE* PixelData;
+        UINT Width;
+        UINT Height;
+        UINT CbStride;
+        WCHAR TilePath[MAX_PATH];
+        TileLocation* pLocation;
+
+        Job() : PixelData(NULL), Width(0), Height(0), CbStride(0), pLocation(NULL) { TilePath[0] = L'\0'; };
+        ~Job()
+        {
+            _aligned_free(PixelData);
+        }
+    };
+
+    TileContainer* m_pTileContainer;
+    TileDeduplicator* m_pDeduplicator;
+    TileCodecType m_TileCodec;
+    GUID m_ContainerFormat;
+    WICPixelFormatGUID m_PixelFormat;
+    TileEncoderOptions m_EncoderOptions;
+
+    UINT m_CbJobBufferSize;
+    Vector<Job> m_Jobs;
+
+    // Indices to m_Jobs, free slots are kept as a stack, queued jobs as a ring
+    Vector<UINT> m_FreeJobs;
+    Vector<UINT> m_QueuedJobs;
+    UINT m_QueueHead;
+    UINT m_QueueCount;
+
+    CriticalSection m_Lock;
+    HANDLE m_hFreeJobsSemaphore;
+    HANDLE m_hQueuedJobsSemaphore;
+
+    Vector<HANDLE> m_Threads;
+    volatile LONG m_Stopping;
+    volatile LONG m_Result;
+
+    // Encoding time summed over all workers and time the producer waited for a free job
+    DOUBLE m_EncodeSeconds;
+    StageTimer m_SubmitStallTimer;
+
+    static DWORD WINAPI WorkerThreadProc(__in LPVOID lpParameter);
+    HRESULT WorkerLoop();
+    HRESULT EncodeJob(__in IWICImagingFactory *pImagingFactory, __in const Job &job);
+    void SetResult(__in const HRESULT &hr);
+
+public:
+    TileEncoderPool();
+    ~TileEncoderPool();
+
+    HRESULT Initialize(__in const UINT &threadCount, __in const UINT &queueLength, __in const UINT &cbMaxTileSize, __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, 
+                       __in const TileCodecType &tileCodec, __in const TileEncoderOptions &encoderOptions, __in_opt TileContainer *pTileContainer, __in_opt TileDeduplicator *pDeduplicator);
+
+    HRESULT Submit(__in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, __in_z_opt const WCHAR *pTilePath, __out_opt TileLocation *pLocation);
+    HRESULT WaitForCompletion();
+
+    DOUBLE GetEncodeSeconds();
+    DOUBLE GetSubmitStallSeconds() const;
+
+    static UINT GetDefaultThreadCount();
+
+    // Number of job buffers allocated by a pool with the given threads and queue
+    static UINT GetJobCount(__in const UINT &threadCount, __in const UINT &queueLength) { return threadCount + max(1, queueLength); };
+};
+
+//-----------------------------------------------------------------------------
+// Encodes the bitmap with the container format encoder and writes it to file
+//-----------------------------------------------------------------------------
+HRESULT SaveBitmapToFile(__in IWICImagingFactory *pImagingFactory, __in const WCHAR* pFilePath, __in const GUID &containerFormat, __in const WICPixelFormatGUID *pPixelFormat, __in IWICBitmap *pBitmap, 
+                         __in const TileEncoderOptions &encoderOptions);
+
+//-----------------------------------------------------------------------------
+// Encodes tile pixels with the tile codec and writes them to the tile path,
+// or appends them to the tile container when there is one. With a
+// deduplicator, a tile with the pixels of a stored one refers to it instead.
+// The container format is the one of the source image.
+//-----------------------------------------------------------------------------
+HRESULT EncodeTile(__in IWICImagingFactory *pImagingFactory, __in const TileCodecType &tileCodec, __in const TileEncoderOptions &encoderOptions, __in_opt TileContainer *pTileContainer, 
+                   __in const GUID &containerFormat, __in const WICPixelFormatGUID &pixelFormat, __in const BYTE *pPixelData, __in const UINT &width, __in const UINT &height, __in const UINT &cbStride, 
+                   __in_z_opt const WCHAR *pTilePath, __out_opt TileLocation *pLocation, __in_opt TileDeduplicator *pDeduplicator);
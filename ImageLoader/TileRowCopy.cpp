@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include <emmintrin.h>
+#include "TileRowCopy.h"
+
+//-----------------------------------------------------------------------------
+// Copy of any width
+//-----------------------------------------------------------------------------
+static void CopyTileRow(__out BYTE* pDstRow, __in const BYTE* pSrcRow, __in const UINT &width)
+{
+    memcpy(pDstRow, pSrcRow, width * 4);
+}
+
+//-----------------------------------------------------------------------------
+// Copy specialized for one tile size. Rows at least TILE_SIZE pixels wide copy
+// a constant number of 64 byte blocks, only the overlap border is left to
+// memcpy. Source lines are not aligned when the tiles overlap.
+//-----------------------------------------------------------------------------
+template <UINT TILE_SIZE>
+static void CopyTileRow(__out BYTE* pDstRow, __in const BYTE* pSrcRow, __in const UINT &width)
+{
+    if (width < TILE_SIZE)
+    {
+        memcpy(pDstRow, pSrcRow, width * 4);
+        return;
+    }
+
+    const __m128i* pSrc = reinterpret_cast<const __m128i*>(pSrcRow);
+    __m128i* pDst = reinterpret_cast<__m128i*>(pDstRow);
+
+    for (UINT cnt = TILE_SIZE * 4 / 64; cnt > 0; --cnt)
+    {
+        __m128i w0 = _mm_loadu_si128(pSrc);
+        __m128i w1 = _mm_loadu_si128(pSrc + 1);
+        __m128i w2 = _mm_loadu_si128(pSrc + 2);
+        __m128i w3 = _mm_loadu_si128(pSrc + 3);
+
+        _mm_store_si128(pDst, w0);
+        _mm_store_si128(pDst + 1, w1);
+        _mm_store_si128(pDst + 2, w2);
+        _mm_store_si128(pDst + 3, w3);
+
+        pSrc += 4;
+        pDst += 4;
+    }
+
+    memcpy(pDst, pSrc, (width - TILE_SIZE) * 4);
+}
+
+CopyTileRowProc GetCopyTileRowProc(__in const UINT &tileSize)
+{
+    switch (tileSize)
+    {
+    case 256:
+        return &CopyTileRow<256>;
+    case 512:
+        return &CopyTileRow<512>;
+    case 1024:
+        return &CopyTileRow<1024>;
+    case 2048:
+        return &CopyTileRow<2048>;
+    default:
+        return &CopyTileRow;
+    }
+}
+
+BOOL IsSupportedTileSize(__in const UINT &tileSize)
+{
+    return tileSize == 256 || tileSize == 512 || tileSize == 1024 || tileSize == 2048;
+}
@@ -0,0 +1,34 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+// Copies width rgb32 pixels of a level line to a tile buffer line, the
+// destination has to be 16 byte aligned
+typedef void (*CopyTileRowProc)(__out BYTE* pDstRow, __in const BYTE* pSrcRow, __in const UINT &width);
+
+//-----------------------------------------------------------------------------
+// Get the row copy for tiles of the given size, the supported tile sizes get a
+// variant with the copy of the full tile width unrolled at compile time
+//-----------------------------------------------------------------------------
+CopyTileRowProc GetCopyTileRowProc(__in const UINT &tileSize);
+
+// Tile sizes the pyramid can be generated with
+BOOL IsSupportedTileSize(__in const UINT &tileSize);
@@ -0,0 +1,261 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool()
+{
+    m_pfnJob = NULL;
+    m_pfnWorkerExit = NULL;
+    m_pContext = NULL;
+    m_hJobsSemaphore = NULL;
+    m_PendingJobs = 0;
+    m_StolenJobs = 0;
+    m_Stopping = FALSE;
+    m_Result = S_OK;
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    if (m_hJobsSemaphore)
+    {
+        CloseHandle(m_hJobsSemaphore);
+    }
+}
+
+HRESULT WorkStealingPool::Initialize(__in const UINT &threadCount, __in JobProc pfnJob, __in_opt WorkerExitProc pfnWorkerExit, __in LPVOID pContext)
+{
+    if (threadCount == 0 || !pfnJob)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_pfnJob = pfnJob;
+    m_pfnWorkerExit = pfnWorkerExit;
+    m_pContext = pContext;
+
+    HRESULT hr = m_Queues.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = m_WorkerStarts.SetSize(threadCount);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT i = 0; i < threadCount; ++i)
+    {
+        hr = m_Queues[i].Lock.Initialize();
+        IF_FAILED_RETURN(hr);
+
+        m_WorkerStarts[i].pPool = this;
+        m_WorkerStarts[i].Worker = i;
+    }
+
+    // Jobs pushed by running jobs are not known up front
+    m_hJobsSemaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    if (!m_hJobsSemaphore)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Remember the first failure, the remaining jobs are dropped
+//-----------------------------------------------------------------------------
+void WorkStealingPool::SetResult(__in const HRESULT &hr)
+{
+    if (FAILED(hr))
+    {
+        InterlockedCompareExchange(&m_Result, hr, S_OK);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Wake up all workers to exit
+//-----------------------------------------------------------------------------
+void WorkStealingPool::Stop()
+{
+    if (!InterlockedExchange(&m_Stopping, TRUE))
+    {
+        ReleaseSemaphore(m_hJobsSemaphore, m_Queues.Length(), NULL);
+    }
+}
+
+HRESULT WorkStealingPool::Push(__in const UINT &worker, __in const UINT &job)
+{
+    if (worker >= m_Queues.Length())
+    {
+        return E_INVALIDARG;
+    }
+
+    // Counted before it can be taken, so the pool never looks done while it is queued
+    InterlockedIncrement(&m_PendingJobs);
+
+    HRESULT hr = S_OK;
+    {
+        AutoCriticalSection lock(m_Queues[worker].Lock);
+        hr = m_Queues[worker].Jobs.Add(job);
+    }
+
+    if (FAILED(hr))
+    {
+        InterlockedDecrement(&m_PendingJobs);
+        return hr;
+    }
+
+    ReleaseSemaphore(m_hJobsSemaphore, 1, NULL);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Take the newest job of the worker, or steal the oldest job of another one
+//-----------------------------------------------------------------------------
+BOOL WorkStealingPool::TryTakeJob(__in const UINT &worker, __out UINT &job)
+{
+    UINT threadCount = m_Queues.Length();
+    for (UINT i = 0; i < threadCount; ++i)
+    {
+        WorkerQueue &queue = m_Queues[(worker + i) % threadCount];
+        AutoCriticalSection lock(queue.Lock);
+
+        if (queue.Jobs.Length() == queue.Head)
+        {
+            continue;
+        }
+
+        if (i == 0)
+        {
+            job = queue.Jobs.PopLast();
+        }
+        else
+        {
+            job = queue.Jobs[queue.Head++];
+            InterlockedIncrement(&m_StolenJobs);
+        }
+
+        if (queue.Jobs.Length() == queue.Head)
+        {
+            queue.Jobs.Reset();
+            queue.Head = 0;
+        }
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+HRESULT WorkStealingPool::Run()
+{
+    if (m_PendingJobs == 0)
+    {
+        return m_Result;
+    }
+
+    Vector<HANDLE> threads;
+    HRESULT hr = threads.Allocate(m_Queues.Length());
+    IF_FAILED_RETURN(hr);
+
+    for (UINT i = 0; i < m_Queues.Length(); ++i)
+    {
+        HANDLE hThread = CreateThread(NULL, 0, &WorkStealingPool::WorkerThreadProc, &m_WorkerStarts[i], 0, NULL);
+        if (!hThread)
+        {
+            SetResult(HRESULT_FROM_WIN32(GetLastError()));
+            Stop();
+            break;
+        }
+
+        threads.Add(hThread);
+    }
+
+    for (UINT i = 0; i < threads.Length(); ++i)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    return m_Result;
+}
+
+DWORD WINAPI WorkStealingPool::WorkerThreadProc(__in LPVOID lpParameter)
+{
+    WorkerStart *pStart = reinterpret_cast<WorkerStart*>(lpParameter);
+    WorkStealingPool *pPool = pStart->pPool;
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (SUCCEEDED(hr))
+    {
+        hr = pPool->WorkerLoop(pStart->Worker);
+
+        if (pPool->m_pfnWorkerExit)
+        {
+            pPool->m_pfnWorkerExit(pPool->m_pContext, pStart->Worker);
+        }
+        CoUninitialize();
+    }
+
+    if (FAILED(hr))
+    {
+        pPool->SetResult(hr);
+        pPool->Stop();
+    }
+
+    return 0;
+}
+
+HRESULT WorkStealingPool::WorkerLoop(__in const UINT &worker)
+{
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        if (WaitForSingleObject(m_hJobsSemaphore, INFINITE) != WAIT_OBJECT_0)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (m_Stopping)
+        {
+            break;
+        }
+
+        // Every wake up stands for one queued job, it may be in a queue searched just before it was pushed
+        UINT job = 0;
+        while (!TryTakeJob(worker, job))
+        {
+            SwitchToThread();
+        }
+
+        hr = m_pfnJob(m_pContext, worker, job);
+        IF_FAILED_RETURN(hr);
+
+        // The last job is done, wake up the others to exit
+        if (InterlockedDecrement(&m_PendingJobs) == 0)
+        {
+            Stop();
+            break;
+        }
+    }
+
+    return hr;
+}
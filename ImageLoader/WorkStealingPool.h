@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Pool of worker threads running jobs identified by a number. Every worker
+// has its own queue, it runs the jobs pushed to it last in first out and
+// steals the oldest jobs of the other workers when its queue is empty.
+// Jobs may push more jobs, Run returns once all of them are done or one
+// of them failed.
+//-----------------------------------------------------------------------------
+class WorkStealingPool
+{
+public:
+    // Runs one job on the given worker
+    typedef HRESULT (*JobProc)(__in LPVOID pContext, __in const UINT &worker, __in const UINT &job);
+
+    // Called on each worker thread before it exits, to release what the worker created
+    typedef void (*WorkerExitProc)(__in LPVOID pContext, __in const UINT &worker);
+
+private:
+    struct WorkerQueue
+    {
+        CriticalSection Lock;
+        Vector<UINT> Jobs;
+
+        // Jobs before the head were stolen
+        UINT Head;
+
+        WorkerQueue() : Head(0) {};
+    };
+
+    struct WorkerStart
+    {
+        WorkStealingPool* pPool;
+        UINT Worker;
+    };
+
+    JobProc m_pfnJob;
+    WorkerExitProc m_pfnWorkerExit;
+    LPVOID m_pContext;
+
+    Vector<WorkerQueue> m_Queues;
+    Vector<WorkerStart> m_WorkerStarts;
+
+    // Counts jobs in the queues, plus one wake up for each worker when stopping
+    HANDLE m_hJobsSemaphore;
+
+    // Jobs pushed and not finished yet
+    volatile LONG m_PendingJobs;
+    volatile LONG m_StolenJobs;
+    volatile LONG m_Stopping;
+    volatile LONG m_Result;
+
+    static DWORD WINAPI WorkerThreadProc(__in LPVOID lpParameter);
+    HRESULT WorkerLoop(__in const UINT &worker);
+    BOOL    TryTakeJob(__in const UINT &worker, __out UINT &job);
+    void    Stop();
+    void    SetResult(__in const HRESULT &hr);
+
+public:
+    WorkStealingPool();
+    ~WorkStealingPool();
+
+    HRESULT Initialize(__in const UINT &threadCount, __in JobProc pfnJob, __in_opt WorkerExitProc pfnWorkerExit, __in LPVOID pContext);
+
+    // Queue a job to a worker, before Run or from a job running on that worker
+    HRESULT Push(__in const UINT &worker, __in const UINT &job);
+
+    // Start the workers and wait until all jobs are done, returns the first failure
+    HRESULT Run();
+
+    UINT    GetThreadCount() const { return m_Queues.Length(); };
+    UINT    GetStolenJobCount() const { return (UINT)m_StolenJobs; };
+};
@@ -0,0 +1,156 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(__in FILE *pFile)
+{
+    m_pFile = pFile;
+    m_Depth = 0;
+    ZeroMemory(m_HasMembers, sizeof(m_HasMembers));
+}
+
+//-----------------------------------------------------------------------------
+// Start a member on its own line, named within objects
+//-----------------------------------------------------------------------------
+void JsonWriter::WriteName(__in_z_opt const WCHAR *pName)
+{
+    if (m_Depth == 0)
+    {
+        return;
+    }
+
+    fwprintf(m_pFile, m_HasMembers[m_Depth] ? L",\n" : L"\n");
+    m_HasMembers[m_Depth] = TRUE;
+
+    for (UINT i = 0; i < m_Depth; ++i)
+    {
+        fwprintf(m_pFile, L"  ");
+    }
+
+    if (pName)
+    {
+        WriteEscaped(pName);
+        fwprintf(m_pFile, L": ");
+    }
+}
+
+void JsonWriter::WriteEscaped(__in_z const WCHAR *pValue)
+{
+    fputwc(L'"', m_pFile);
+
+    for (const WCHAR *pChar = pValue; *pChar; ++pChar)
+    {
+        if (*pChar == L'"' || *pChar == L'\\')
+        {
+            fwprintf(m_pFile, L"\\%c", *pChar);
+        }
+        else if (*pChar < 0x20 || *pChar > 0x7E)
+        {
+            fwprintf(m_pFile, L"\\u%04X", (UINT)*pChar);
+        }
+        else
+        {
+            fputwc(*pChar, m_pFile);
+        }
+    }
+
+    fputwc(L'"', m_pFile);
+}
+
+void JsonWriter::Begin(__in_z_opt const WCHAR *pName, __in const WCHAR &bracket)
+{
+    _ASSERT(m_Depth + 1 < MAX_DEPTH);
+
+    WriteName(pName);
+    fputwc(bracket, m_pFile);
+
+    m_Depth++;
+    m_HasMembers[m_Depth] = FALSE;
+}
+
+void JsonWriter::End(__in const WCHAR &bracket)
+{
+    _ASSERT(m_Depth > 0);
+
+    BOOL hasMembers = m_HasMembers[m_Depth];
+    m_Depth--;
+
+    if (hasMembers)
+    {
+        fputwc(L'\n', m_pFile);
+        for (UINT i = 0; i < m_Depth; ++i)
+        {
+            fwprintf(m_pFile, L"  ");
+        }
+    }
+
+    fputwc(bracket, m_pFile);
+
+    if (m_Depth == 0)
+    {
+        fputwc(L'\n', m_pFile);
+    }
+}
+
+void JsonWriter::BeginObject(__in_z_opt const WCHAR *pName)
+{
+    Begin(pName, L'{');
+}
+
+void JsonWriter::EndObject()
+{
+    End(L'}');
+}
+
+void JsonWriter::BeginArray(__in_z_opt const WCHAR *pName)
+{
+    Begin(pName, L'[');
+}
+
+void JsonWriter::EndArray()
+{
+    End(L']');
+}
+
+void JsonWriter::WriteString(__in_z_opt const WCHAR *pName, __in_z const WCHAR *pValue)
+{
+    WriteName(pName);
+    WriteEscaped(pValue);
+}
+
+void JsonWriter::WriteUint(__in_z_opt const WCHAR *pName, __in const UINT64 &value)
+{
+    WriteName(pName);
+    fwprintf(m_pFile, L"%I64u", value);
+}
+
+void JsonWriter::WriteDouble(__in_z_opt const WCHAR *pName, __in const DOUBLE &value)
+{
+    WriteName(pName);
+    fwprintf(m_pFile, L"%.6f", value);
+}
+
+void JsonWriter::WriteBool(__in_z_opt const WCHAR *pName, __in const BOOL &value)
+{
+    WriteName(pName);
+    fwprintf(m_pFile, value ? L"true" : L"false");
+}
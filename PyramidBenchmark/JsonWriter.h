@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Writes indented JSON to a file, members of objects are named and array
+// elements are not. Nesting is not checked beyond MAX_DEPTH.
+//-----------------------------------------------------------------------------
+class JsonWriter
+{
+    static const UINT MAX_DEPTH = 16;
+
+    FILE *m_pFile;
+    UINT m_Depth;
+
+    // Whether the object or array at each depth already has a member, which needs a comma before the next one
+    BOOL m_HasMembers[MAX_DEPTH];
+
+    void WriteName(__in_z_opt const WCHAR *pName);
+    void WriteEscaped(__in_z const WCHAR *pValue);
+    void Begin(__in_z_opt const WCHAR *pName, __in const WCHAR &bracket);
+    void End(__in const WCHAR &bracket);
+
+public:
+    JsonWriter(__in FILE *pFile);
+
+    void BeginObject(__in_z_opt const WCHAR *pName);
+    void EndObject();
+    void BeginArray(__in_z_opt const WCHAR *pName);
+    void EndArray();
+
+    void WriteString(__in_z_opt const WCHAR *pName, __in_z const WCHAR *pValue);
+    void WriteUint(__in_z_opt const WCHAR *pName, __in const UINT64 &value);
+    void WriteDouble(__in_z_opt const WCHAR *pName, __in const DOUBLE &value);
+    void WriteBool(__in_z_opt const WCHAR *pName, __in const BOOL &value);
+};
@@ -0,0 +1,1520 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// PyramidBenchmark.cpp : Builds pyramids of synthetic sources without any UI
+// and reports the throughput and the generation statistics of every run as
+// JSON, to compare the pyramid builder across commits and options.
+//
+// Encoders write the tiles they encode, so the encode time includes writing
+// them. The peak working set is the one of the whole process, compare runs
+// of separate processes for the peak of each.
+//
+// The tiles of every level of the last run are got back like the renderer
+// does, the average time per tile and the bytes they are stored in compare
+// the decode cost and the size of the tile codecs.
+//
+// With -sparse it builds the pyramid of a procedural source of mostly one
+// color far larger than any file it could be written to, by default large
+// enough for a level 0 tile table over the 1 GB written to the manifest at
+// once, and checks the tiles on the edges and over the patches of detail.
+//
+// With -shard and -merge it builds one shard of a pyramid split between
+// processes sharing the directory, or merges the shards once all are built.
+// The source is written by the first process needing it, the pyramid is kept.
+//
+// With -dirty it builds the pyramid, changes a rectangle of the source,
+// times UpdateDirtyRect and compares every tile with a full build of the
+// changed source.
+//
+// With -kernels it checks the reduction kernels against the scalar kernel
+// instead, exits with 1 when one of them differs, and reports the cost of
+// the linear light reduction against the widest kernel.
+//
+
+#include "stdafx.h"
+#include "SyntheticSource.h"
+#include "SparseSource.h"
+#include "JsonWriter.h"
+
+// Name of an option value on the command line and in the report
+struct NamedValue
+{
+    const WCHAR *pName;
+    UINT Value;
+};
+
+static const NamedValue PATTERN_NAMES[] = 
+{
+    {L"noise", SPT_NOISE}, {L"gradient", SPT_GRADIENT}, {L"solid", SPT_SOLID}, {L"mixed", SPT_MIXED},
+};
+
+static const NamedValue CODEC_NAMES[] = 
+{
+    {L"source", TCT_SOURCE}, {L"raw", TCT_RAW}, {L"bc1", TCT_BC1}, {L"bc7", TCT_BC7}, {L"lz4", TCT_LZ4}, {L"jpeg", TCT_JPEG}, {L"png", TCT_PNG},
+};
+
+static const NamedValue STORAGE_NAMES[] = 
+{
+    {L"files", TST_FILES}, {L"packed", TST_PACKED},
+};
+
+static const NamedValue BUILD_MODE_NAMES[] = 
+{
+    {L"strip", PBM_STRIP_SCAN}, {L"tile", PBM_TILE_PARALLEL},
+};
+
+static const NamedValue FILTER_NAMES[] = 
+{
+    {L"box", RFT_BOX}, {L"bilinear", RFT_BILINEAR}, {L"mitchell", RFT_MITCHELL}, {L"lanczos3", RFT_LANCZOS3},
+};
+
+// Containers the synthetic source can be written to, the value is the index to SOURCE_CONTAINERS
+static const NamedValue SOURCE_FORMAT_NAMES[] = 
+{
+    {L"tif", 0}, {L"png", 1}, {L"jpg", 2}, {L"bmp", 3},
+};
+
+static const GUID* SOURCE_CONTAINERS[] = 
+{
+    &GUID_ContainerFormatTiff, &GUID_ContainerFormatPng, &GUID_ContainerFormatJpeg, &GUID_ContainerFormatBmp,
+};
+
+// Size and tile size of the sparse source unless given, its level 0 tile table is over INDEX_WRITE_CHUNK_SIZE
+static const UINT SPARSE_DEFAULT_SIZE = 1200000;
+static const UINT SPARSE_DEFAULT_TILE_SIZE = 256;
+
+// Bytes of the manifest written at once, the index of larger levels is written in several chunks
+static const UINT64 INDEX_WRITE_CHUNK_SIZE = 1ULL << 30;
+
+// Manifest in the pyramid directory
+static const WCHAR MANIFEST_FILE_NAME[] = L"pyramid.manifest";
+
+// Most tiles of a level got back to time the decode of the tile codec
+static const UINT64 DECODE_MAX_TILE_COUNT = 65536;
+
+static const NamedValue KERNEL_NAMES[] = 
+{
+    {L"scalar", RKT_SCALAR}, {L"sse2", RKT_SSE2}, {L"avx2", RKT_AVX2}, {L"avx512", RKT_AVX512},
+};
+
+//-----------------------------------------------------------------------------
+// Settings of the benchmark from the command line
+//-----------------------------------------------------------------------------
+struct BenchmarkSettings
+{
+    UINT Width;
+    UINT Height;
+    UINT Pattern;
+    UINT SourceFormat;
+    UINT RunCount;
+
+    // Directory of the source and its pyramid, the output file, and a label of the report like the commit
+    const WCHAR *pDirectory;
+    const WCHAR *pOutputPath;
+    const WCHAR *pLabel;
+
+    // Keep the source and the pyramid of the last run
+    BOOL KeepFiles;
+
+    // Check and time the reduction kernels instead of building pyramids
+    BOOL CheckKernels;
+
+    // Build the pyramid of the procedural sparse source instead of a written one
+    BOOL Sparse;
+
+    // Build one shard of the pyramid instead, or merge the shards with IsMerge
+    UINT ShardIndex;
+    UINT ShardCount;
+    BOOL IsMerge;
+
+    // Update the pyramid after the rectangle of the source changed instead
+    BOOL IsDirtyUpdate;
+    WICRect DirtyRect;
+
+    ImageLoaderOptions Options;
+
+    BenchmarkSettings() : Width(0), Height(0), Pattern(SPT_MIXED), SourceFormat(0), RunCount(3), pDirectory(L"."), pOutputPath(NULL), pLabel(L""), 
+                          KeepFiles(FALSE), CheckKernels(FALSE), Sparse(FALSE), ShardIndex(0), ShardCount(0), IsMerge(FALSE), IsDirtyUpdate(FALSE)
+    {
+        ZeroMemory(&DirtyRect, sizeof(DirtyRect));
+    };
+};
+
+// Result of one pyramid build
+struct BenchmarkRun
+{
+    DOUBLE WallSeconds;
+    PyramidGenerationStatistics Statistics;
+    UINT LevelCount;
+    UINT64 TileCount;
+    UINT64 FileCount;
+    UINT64 CbFiles;
+
+    BenchmarkRun() : WallSeconds(0), LevelCount(0), TileCount(0), FileCount(0), CbFiles(0) {};
+};
+
+// Tile images of one level got back from the pyramid
+struct LevelDecodeResult
+{
+    UINT Level;
+    UINT64 TileCount;
+    DOUBLE AverageMilliseconds;
+    UINT64 CbStored;
+
+    LevelDecodeResult() : Level(0), TileCount(0), AverageMilliseconds(0), CbStored(0) {};
+};
+
+// Check of the pyramid of the sparse source
+struct SparseVerification
+{
+    UINT CheckedTileCount;
+    UINT MismatchedTileCount;
+
+    // Size of the manifest, of the tile tables it has to hold, and of the level 0 table written in chunks
+    UINT64 CbManifest;
+    UINT64 CbTileTables;
+    UINT64 CbLargestTileTable;
+
+    SparseVerification() : CheckedTileCount(0), MismatchedTileCount(0), CbManifest(0), CbTileTables(0), CbLargestTileTable(0) {};
+
+    BOOL IsValid() const { return MismatchedTileCount == 0 && CbManifest >= CbTileTables; };
+};
+
+static BOOL FindValue(__in_ecount(count) const NamedValue *pValues, __in const UINT &count, __in_z const WCHAR *pName, __out UINT &value)
+{
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (_wcsicmp(pValues[i].pName, pName) == 0)
+        {
+            value = pValues[i].Value;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static const WCHAR* FindName(__in_ecount(count) const NamedValue *pValues, __in const UINT &count, __in const UINT &value)
+{
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (pValues[i].Value == value)
+        {
+            return pValues[i].pName;
+        }
+    }
+
+    return L"unknown";
+}
+
+static BOOL ParseUint(__in_z const WCHAR *pText, __out UINT &value)
+{
+    WCHAR *pEnd = NULL;
+    unsigned long parsed = wcstoul(pText, &pEnd, 10);
+    if (pEnd == pText || *pEnd != L'\0')
+    {
+        return FALSE;
+    }
+
+    value = (UINT)parsed;
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Parse the shard of a sharded build given as index/count
+//-----------------------------------------------------------------------------
+static BOOL ParseShard(__in_z const WCHAR *pText, __out UINT &shardIndex, __out UINT &shardCount)
+{
+    WCHAR *pEnd = NULL;
+    shardIndex = (UINT)wcstoul(pText, &pEnd, 10);
+    if (pEnd == pText || *pEnd != L'/')
+    {
+        return FALSE;
+    }
+
+    const WCHAR *pCount = pEnd + 1;
+    shardCount = (UINT)wcstoul(pCount, &pEnd, 10);
+
+    return pEnd != pCount && *pEnd == L'\0' && shardIndex < shardCount;
+}
+
+//-----------------------------------------------------------------------------
+// Parse a rectangle given as x,y,width,height
+//-----------------------------------------------------------------------------
+static BOOL ParseRect(__in_z const WCHAR *pText, __out WICRect &rect)
+{
+    INT *pValues[] = {&rect.X, &rect.Y, &rect.Width, &rect.Height};
+
+    const WCHAR *pNext = pText;
+    for (UINT i = 0; i < ARRAYSIZE(pValues); ++i)
+    {
+        WCHAR *pEnd = NULL;
+        unsigned long value = wcstoul(pNext, &pEnd, 10);
+        WCHAR separator = (i + 1 < ARRAYSIZE(pValues)) ? L',' : L'\0';
+        if (pEnd == pNext || *pEnd != separator || value > MAXINT)
+        {
+            return FALSE;
+        }
+
+        *pValues[i] = (INT)value;
+        pNext = pEnd + 1;
+    }
+
+    return rect.Width > 0 && rect.Height > 0;
+}
+
+static void PrintUsage()
+{
+    fwprintf(stderr, 
+        L"Usage: PyramidBenchmark [options]\n"
+        L"\n"
+        L"Source\n"
+        L"  -width <pixels>        width of the synthetic source, 16384 by default, 1200000 with -sparse\n"
+        L"  -height <pixels>       height of the synthetic source, 16384 by default, 1200000 with -sparse\n"
+        L"  -pattern <name>        noise, gradient, solid or mixed (default)\n"
+        L"  -format <name>         container of the source, tif (default, uncompressed), png, jpg or bmp\n"
+        L"  -sparse                procedural source of one color with patches of noise, never written,\n"
+        L"                         built tile parallel with solid color tiles and a lossless codec, lz4 by default\n"
+        L"\n"
+        L"Pyramid\n"
+        L"  -codec <name>          source (default), raw, bc1, bc7, lz4, jpeg or png\n"
+        L"  -storage <name>        files (default) or packed\n"
+        L"  -mode <name>           strip (default) or tile\n"
+        L"  -filter <name>         box (default), bilinear, mitchell or lanczos3\n"
+        L"  -tilesize <pixels>     256, 512, 1024 (default, 256 with -sparse) or 2048\n"
+        L"  -overlap <pixels>      overlap border of the tiles, 0 by default\n"
+        L"  -threads <count>       encoder threads, 0 (default) for one per logical processor\n"
+        L"  -budget <megabytes>    memory budget of the generation, 0 (default) for none\n"
+        L"  -solid                 detect solid color tiles\n"
+        L"  -dedup                 deduplicate tiles\n"
+        L"  -linear                reduce in linear light, slower to reduce, see -kernels\n"
+        L"  -overview              publish a progressive overview first\n"
+        L"\n"
+        L"Benchmark\n"
+        L"  -runs <count>          pyramid builds of the same source, 3 by default\n"
+        L"  -dir <path>            directory of the source and the pyramid, the current one by default\n"
+        L"  -out <path>            file of the JSON report, standard output by default\n"
+        L"  -label <text>          label of the report, like the commit benchmarked\n"
+        L"  -keep                  keep the source and the pyramid\n"
+        L"  -shard <index>/<count> build one shard of the pyramid split in count shards instead, the source\n"
+        L"                         is written once for all shards and the pyramid is kept for the merge\n"
+        L"  -merge <count>         merge the count shards built before and write the manifest\n"
+        L"  -dirty <x,y,w,h>       update the pyramid after the rectangle of the source changed instead, and\n"
+        L"                         compare it with a full build of the changed source, fails when it differs\n"
+        L"  -kernels               compare every reduction kernel with the scalar one and time it instead,\n"
+        L"                         fails when a kernel differs\n");
+}
+
+//-----------------------------------------------------------------------------
+// Parse the command line to the settings, FALSE when it is not valid
+//-----------------------------------------------------------------------------
+static BOOL ParseCommandLine(__in const int &argc, __in_ecount(argc) WCHAR *argv[], __out BenchmarkSettings &settings)
+{
+    ImageLoaderOptions &options = settings.Options;
+
+    // Defaults depending on the mode are set once all options are known
+    options.TileSize = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const WCHAR *pName = argv[i];
+        UINT value = 0;
+
+        // Switches without a value
+        if (_wcsicmp(pName, L"-solid") == 0)
+        {
+            options.DetectSolidColorTiles = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-dedup") == 0)
+        {
+            options.DeduplicateTiles = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-linear") == 0)
+        {
+            options.LinearLightReduction = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-overview") == 0)
+        {
+            options.ProgressiveOverview = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-keep") == 0)
+        {
+            settings.KeepFiles = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-kernels") == 0)
+        {
+            settings.CheckKernels = TRUE;
+            continue;
+        }
+        if (_wcsicmp(pName, L"-sparse") == 0)
+        {
+            settings.Sparse = TRUE;
+            continue;
+        }
+
+        // The rest take a value
+        if (i + 1 >= argc)
+        {
+            return FALSE;
+        }
+        const WCHAR *pValue = argv[++i];
+
+        BOOL isValid = FALSE;
+        if (_wcsicmp(pName, L"-width") == 0)
+        {
+            isValid = ParseUint(pValue, settings.Width);
+        }
+        else if (_wcsicmp(pName, L"-height") == 0)
+        {
+            isValid = ParseUint(pValue, settings.Height);
+        }
+        else if (_wcsicmp(pName, L"-pattern") == 0)
+        {
+            isValid = FindValue(PATTERN_NAMES, ARRAYSIZE(PATTERN_NAMES), pValue, settings.Pattern);
+        }
+        else if (_wcsicmp(pName, L"-format") == 0)
+        {
+            isValid = FindValue(SOURCE_FORMAT_NAMES, ARRAYSIZE(SOURCE_FORMAT_NAMES), pValue, settings.SourceFormat);
+        }
+        else if (_wcsicmp(pName, L"-codec") == 0)
+        {
+            isValid = FindValue(CODEC_NAMES, ARRAYSIZE(CODEC_NAMES), pValue, value);
+            options.TileCodec = (TileCodecType)value;
+        }
+        else if (_wcsicmp(pName, L"-storage") == 0)
+        {
+            isValid = FindValue(STORAGE_NAMES, ARRAYSIZE(STORAGE_NAMES), pValue, value);
+            options.TileStorage = (TileStorageType)value;
+        }
+        else if (_wcsicmp(pName, L"-mode") == 0)
+        {
+            isValid = FindValue(BUILD_MODE_NAMES, ARRAYSIZE(BUILD_MODE_NAMES), pValue, value);
+            options.BuildMode = (PyramidBuildMode)value;
+        }
+        else if (_wcsicmp(pName, L"-filter") == 0)
+        {
+            isValid = FindValue(FILTER_NAMES, ARRAYSIZE(FILTER_NAMES), pValue, value);
+            options.ReductionFilter = (ReductionFilterType)value;
+        }
+        else if (_wcsicmp(pName, L"-tilesize") == 0)
+        {
+            isValid = ParseUint(pValue, options.TileSize);
+        }
+        else if (_wcsicmp(pName, L"-overlap") == 0)
+        {
+            isValid = ParseUint(pValue, options.TileOverlap);
+        }
+        else if (_wcsicmp(pName, L"-threads") == 0)
+        {
+            isValid = ParseUint(pValue, options.EncoderThreadCount);
+        }
+        else if (_wcsicmp(pName, L"-budget") == 0)
+        {
+            isValid = ParseUint(pValue, options.MemoryBudgetMegabytes);
+        }
+        else if (_wcsicmp(pName, L"-runs") == 0)
+        {
+            isValid = ParseUint(pValue, settings.RunCount) && settings.RunCount > 0;
+        }
+        else if (_wcsicmp(pName, L"-dir") == 0)
+        {
+            settings.pDirectory = pValue;
+            isValid = TRUE;
+        }
+        else if (_wcsicmp(pName, L"-out") == 0)
+        {
+            settings.pOutputPath = pValue;
+            isValid = TRUE;
+        }
+        else if (_wcsicmp(pName, L"-label") == 0)
+        {
+            settings.pLabel = pValue;
+            isValid = TRUE;
+        }
+        else if (_wcsicmp(pName, L"-shard") == 0)
+        {
+            isValid = ParseShard(pValue, settings.ShardIndex, settings.ShardCount);
+        }
+        else if (_wcsicmp(pName, L"-dirty") == 0)
+        {
+            isValid = ParseRect(pValue, settings.DirtyRect);
+            settings.IsDirtyUpdate = TRUE;
+        }
+        else if (_wcsicmp(pName, L"-merge") == 0)
+        {
+            isValid = ParseUint(pValue, settings.ShardCount) && settings.ShardCount > 0;
+            settings.IsMerge = TRUE;
+        }
+
+        if (!isValid)
+        {
+            return FALSE;
+        }
+    }
+
+    UINT defaultSize = settings.Sparse ? SPARSE_DEFAULT_SIZE : 16384;
+    settings.Width = (settings.Width > 0) ? settings.Width : defaultSize;
+    settings.Height = (settings.Height > 0) ? settings.Height : defaultSize;
+
+    if (options.TileSize == 0)
+    {
+        options.TileSize = settings.Sparse ? SPARSE_DEFAULT_TILE_SIZE : ImageLoaderOptions().TileSize;
+    }
+
+    // The sparse source has no container and its tiles are compared with it pixel by pixel
+    if (settings.Sparse)
+    {
+        options.BuildMode = PBM_TILE_PARALLEL;
+        options.DetectSolidColorTiles = TRUE;
+        options.TileCodec = (options.TileCodec == TCT_SOURCE) ? TCT_LZ4 : options.TileCodec;
+
+        if (options.TileCodec == TCT_BC1 || options.TileCodec == TCT_BC7 || options.TileCodec == TCT_JPEG)
+        {
+            return FALSE;
+        }
+    }
+
+    // The changed rectangle is inverted in the written source
+    if (settings.IsDirtyUpdate && (settings.Sparse || (UINT64)settings.DirtyRect.X + settings.DirtyRect.Width > settings.Width ||
+                                   (UINT64)settings.DirtyRect.Y + settings.DirtyRect.Height > settings.Height))
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Delete a directory with everything in it, S_OK when there is none
+//-----------------------------------------------------------------------------
+static HRESULT DeleteDirectoryTree(__in_z const WCHAR *pDirectory)
+{
+    WCHAR pattern[MAX_PATH] = L"";
+    if (swprintf_s(pattern, MAX_PATH, L"%s\\*", pDirectory) < 0)
+    {
+        return E_FAIL;
+    }
+
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile(pattern, &findData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        DWORD error = GetLastError();
+        return (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? S_OK : HRESULT_FROM_WIN32(error);
+    }
+
+    HRESULT hr = S_OK;
+    do
+    {
+        if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        WCHAR path[MAX_PATH] = L"";
+        if (swprintf_s(path, MAX_PATH, L"%s\\%s", pDirectory, findData.cFileName) < 0)
+        {
+            hr = E_FAIL;
+            break;
+        }
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            hr = DeleteDirectoryTree(path);
+        }
+        else if (!DeleteFile(path))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    while (SUCCEEDED(hr) && FindNextFile(hFind, &findData));
+
+    FindClose(hFind);
+    IF_FAILED_RETURN(hr);
+
+    if (!RemoveDirectory(pDirectory))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Add up the files in a directory and its subdirectories and their bytes,
+// hard links of deduplicated tiles count like the files they link to
+//-----------------------------------------------------------------------------
+static HRESULT MeasureDirectoryTree(__in_z const WCHAR *pDirectory, __inout UINT64 &fileCount, __inout UINT64 &cbFiles)
+{
+    WCHAR pattern[MAX_PATH] = L"";
+    if (swprintf_s(pattern, MAX_PATH, L"%s\\*", pDirectory) < 0)
+    {
+        return E_FAIL;
+    }
+
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile(pattern, &findData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    do
+    {
+        if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            WCHAR path[MAX_PATH] = L"";
+            if (swprintf_s(path, MAX_PATH, L"%s\\%s", pDirectory, findData.cFileName) < 0)
+            {
+                hr = E_FAIL;
+                break;
+            }
+
+            hr = MeasureDirectoryTree(path, fileCount, cbFiles);
+        }
+        else
+        {
+            fileCount++;
+            cbFiles += ((UINT64)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+        }
+    }
+    while (SUCCEEDED(hr) && FindNextFile(hFind, &findData));
+
+    FindClose(hFind);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Build the pyramid of the source from scratch and collect its statistics,
+// from the supplied source instead of the file when there is one. The loader
+// is handed out open when asked for, destroyed otherwise.
+//-----------------------------------------------------------------------------
+static HRESULT RunPyramidBuild(__in_z const WCHAR *pSourcePath, __in_z const WCHAR *pPyramidDirectory, __in const ImageLoaderOptions &options, __in_opt IWICBitmapSource *pSource, 
+                               __out BenchmarkRun &run, __deref_opt_out IImageLoader **ppImageLoader)
+{
+    // Without the previous pyramid the loader generates everything again
+    HRESULT hr = DeleteDirectoryTree(pPyramidDirectory);
+    IF_FAILED_RETURN(hr);
+
+    LARGE_INTEGER startTicks, endTicks, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&startTicks);
+
+    SmartPtr<IImageLoader> spImageLoader;
+    hr = pSource ? CreateImageLoader(pSource, pSourcePath, options, &spImageLoader) : CreateImageLoader(pSourcePath, options, &spImageLoader);
+    IF_FAILED_RETURN(hr);
+
+    hr = spImageLoader->Open();
+    QueryPerformanceCounter(&endTicks);
+    IF_FAILED_RETURN(hr);
+
+    run.WallSeconds = (DOUBLE)(endTicks.QuadPart - startTicks.QuadPart) / (DOUBLE)frequency.QuadPart;
+
+    hr = spImageLoader->GetGenerationStatistics(run.Statistics);
+    IF_FAILED_RETURN(hr);
+
+    run.LevelCount = spImageLoader->GetLevelCount();
+    run.TileCount = 0;
+    for (UINT level = 0; level < run.LevelCount; ++level)
+    {
+        UINT rowCount = 0, columnCount = 0;
+        hr = spImageLoader->GetLevelRowColumnCount(level, rowCount, columnCount);
+        IF_FAILED_RETURN(hr);
+
+        run.TileCount += (UINT64)rowCount * columnCount;
+    }
+
+    run.FileCount = 0;
+    run.CbFiles = 0;
+    hr = MeasureDirectoryTree(pPyramidDirectory, run.FileCount, run.CbFiles);
+    if (FAILED(hr) || !ppImageLoader)
+    {
+        spImageLoader->Destroy();
+        return hr;
+    }
+
+    return spImageLoader.CopyTo(ppImageLoader);
+}
+
+//-----------------------------------------------------------------------------
+// Time getting the tile images of every level like the renderer does, with
+// the bytes the tiles take. Levels with more than DECODE_MAX_TILE_COUNT
+// tiles are left out, the lowest levels of the sparse source have billions.
+//-----------------------------------------------------------------------------
+static HRESULT MeasureLevelDecode(__in IImageLoader *pImageLoader, __inout Vector<LevelDecodeResult> &results)
+{
+    HRESULT hr = S_OK;
+
+    for (UINT level = 0; level < pImageLoader->GetLevelCount(); ++level)
+    {
+        UINT rowCount = 0, columnCount = 0;
+        hr = pImageLoader->GetLevelRowColumnCount(level, rowCount, columnCount);
+        IF_FAILED_RETURN(hr);
+
+        LevelDecodeResult result;
+        result.Level = level;
+        result.TileCount = (UINT64)rowCount * columnCount;
+        if (result.TileCount > DECODE_MAX_TILE_COUNT)
+        {
+            continue;
+        }
+
+        hr = pImageLoader->BenchmarkLevelDecode(level, result.AverageMilliseconds, result.CbStored);
+        IF_FAILED_RETURN(hr);
+
+        hr = results.Add(result);
+        IF_FAILED_RETURN(hr);
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Compare a level 0 tile with the pixels of the source under it, a solid
+// color tile with its color
+//-----------------------------------------------------------------------------
+static HRESULT CompareSourceTile(__in IImageLoader *pImageLoader, __in IWICBitmapSource *pSource, __in const UINT &row, __in const UINT &column, __out BOOL &isMatch)
+{
+    isMatch = FALSE;
+
+    const ImageTileMetadata *pTile = NULL;
+    HRESULT hr = pImageLoader->GetLevelRowColumnMetadata(0, row, column, &pTile);
+    IF_FAILED_RETURN(hr);
+
+    UINT cbStride = pTile->GetImageWidth() * 4;
+    Vector<BYTE> sourcePixels;
+    hr = sourcePixels.SetSize(cbStride * pTile->GetImageHeight());
+    IF_FAILED_RETURN(hr);
+
+    WICRect rect = {(INT)(pTile->X - pTile->OverlapLeft), (INT)(pTile->Y - pTile->OverlapTop), (INT)pTile->GetImageWidth(), (INT)pTile->GetImageHeight()};
+    hr = pSource->CopyPixels(&rect, cbStride, sourcePixels.Length(), sourcePixels.Ptr());
+    IF_FAILED_RETURN(hr);
+
+    // The unused fourth byte of the pixels is not compared
+    const UINT32 *pSourcePixels = reinterpret_cast<const UINT32*>(sourcePixels.Ptr());
+    if (pTile->IsSolidColor())
+    {
+        for (UINT i = 0; i < sourcePixels.Length() / 4; ++i)
+        {
+            if (((pSourcePixels[i] ^ pTile->SolidColor) & 0x00FFFFFF) != 0)
+            {
+                return S_OK;
+            }
+        }
+
+        isMatch = TRUE;
+        return S_OK;
+    }
+
+    SmartPtr<IDxImage> spImage;
+    hr = pImageLoader->GetLevelRowColumnImage(0, row, column, &spImage);
+    IF_FAILED_RETURN(hr);
+
+    UINT width = 0, height = 0;
+    spImage->GetSize(width, height);
+    if (width < pTile->GetImageWidth() || height < pTile->GetImageHeight())
+    {
+        return S_OK;
+    }
+
+    for (UINT y = 0; y < pTile->GetImageHeight(); ++y)
+    {
+        const UINT32 *pImageLine = reinterpret_cast<const UINT32*>(spImage->GetPixelData() + (SIZE_T)y * spImage->GetRowPitch());
+        const UINT32 *pSourceLine = pSourcePixels + (SIZE_T)y * pTile->GetImageWidth();
+        for (UINT x = 0; x < pTile->GetImageWidth(); ++x)
+        {
+            if (((pImageLine[x] ^ pSourceLine[x]) & 0x00FFFFFF) != 0)
+            {
+                return S_OK;
+            }
+        }
+    }
+
+    isMatch = TRUE;
+    return S_OK;
+}
+
+static HRESULT CompareSourceTiles(__in IImageLoader *pImageLoader, __in IWICBitmapSource *pSource, __in const UINT &firstRow, __in const UINT &rowEnd, 
+                                  __in const UINT &firstColumn, __in const UINT &columnEnd, __inout SparseVerification &verification)
+{
+    for (UINT row = firstRow; row < rowEnd; ++row)
+    {
+        for (UINT column = firstColumn; column < columnEnd; ++column)
+        {
+            BOOL isMatch = FALSE;
+            HRESULT hr = CompareSourceTile(pImageLoader, pSource, row, column, isMatch);
+            IF_FAILED_RETURN(hr);
+
+            verification.CheckedTileCount++;
+            verification.MismatchedTileCount += isMatch ? 0 : 1;
+        }
+    }
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Check the level 0 tiles along the edges of the sparse source, the last
+// ones at the largest offsets, and over its patches, and that the manifest
+// was written with all of the tile tables
+//-----------------------------------------------------------------------------
+static HRESULT VerifySparsePyramid(__in IImageLoader *pImageLoader, __in IWICBitmapSource *pSource, __in_z const WCHAR *pPyramidDirectory, __out SparseVerification &verification)
+{
+    UINT width = 0, height = 0;
+    HRESULT hr = pSource->GetSize(&width, &height);
+    IF_FAILED_RETURN(hr);
+
+    UINT rowCount = 0, columnCount = 0;
+    hr = pImageLoader->GetLevelRowColumnCount(0, rowCount, columnCount);
+    IF_FAILED_RETURN(hr);
+
+    hr = CompareSourceTiles(pImageLoader, pSource, 0, 1, 0, columnCount, verification);
+    IF_FAILED_RETURN(hr);
+
+    hr = CompareSourceTiles(pImageLoader, pSource, rowCount - 1, rowCount, 0, columnCount, verification);
+    IF_FAILED_RETURN(hr);
+
+    hr = CompareSourceTiles(pImageLoader, pSource, 0, rowCount, 0, 1, verification);
+    IF_FAILED_RETURN(hr);
+
+    hr = CompareSourceTiles(pImageLoader, pSource, 0, rowCount, columnCount - 1, columnCount, verification);
+    IF_FAILED_RETURN(hr);
+
+    // The first tile is as large as any
+    const ImageTileMetadata *pFirstTile = NULL;
+    hr = pImageLoader->GetLevelRowColumnMetadata(0, 0, 0, &pFirstTile);
+    IF_FAILED_RETURN(hr);
+
+    UINT tileWidth = pFirstTile->Width;
+    UINT tileHeight = pFirstTile->Height;
+
+    for (UINT patch = 0; patch < SPARSE_PATCH_COUNT; ++patch)
+    {
+        WICRect rect;
+        GetSparsePatch(width, height, patch, rect);
+
+        hr = CompareSourceTiles(pImageLoader, pSource, rect.Y / tileHeight, (rect.Y + rect.Height - 1) / tileHeight + 1, 
+                                rect.X / tileWidth, (rect.X + rect.Width - 1) / tileWidth + 1, verification);
+        IF_FAILED_RETURN(hr);
+    }
+
+    for (UINT level = 0; level < pImageLoader->GetLevelCount(); ++level)
+    {
+        hr = pImageLoader->GetLevelRowColumnCount(level, rowCount, columnCount);
+        IF_FAILED_RETURN(hr);
+
+        UINT64 cbTileTable = (UINT64)rowCount * columnCount * sizeof(ImageTileMetadata);
+        verification.CbTileTables += cbTileTable;
+        verification.CbLargestTileTable = max(verification.CbLargestTileTable, cbTileTable);
+    }
+
+    WCHAR manifestPath[MAX_PATH] = L"";
+    if (swprintf_s(manifestPath, MAX_PATH, L"%s\\%s", pPyramidDirectory, MANIFEST_FILE_NAME) < 0)
+    {
+        return E_FAIL;
+    }
+
+    // A manifest that could not be written leaves the size at 0 and fails the check
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetFileAttributesEx(manifestPath, GetFileExInfoStandard, &attributes))
+    {
+        verification.CbManifest = ((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    }
+
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Open the file of the report, standard output without one
+//-----------------------------------------------------------------------------
+static HRESULT OpenReport(__in const BenchmarkSettings &settings, __deref_out FILE **ppOutput)
+{
+    *ppOutput = stdout;
+    if (settings.pOutputPath && _wfopen_s(ppOutput, settings.pOutputPath, L"w") != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+    }
+
+    return S_OK;
+}
+
+static void CloseReport(__in FILE *pOutput)
+{
+    if (pOutput != stdout)
+    {
+        fclose(pOutput);
+    }
+}
+
+static void WriteReport(__in JsonWriter &writer, __in const BenchmarkSettings &settings, __in const DOUBLE &sourceSeconds, __in const Vector<BenchmarkRun> &runs, 
+                        __in const Vector<LevelDecodeResult> &levelDecodes, __in_opt const SparseVerification *pVerification)
+{
+    const ImageLoaderOptions &options = settings.Options;
+    DOUBLE megapixels = (DOUBLE)settings.Width * settings.Height / 1e6;
+
+    writer.BeginObject(NULL);
+    writer.WriteString(L"label", settings.pLabel);
+
+    writer.BeginObject(L"source");
+    writer.WriteString(L"pattern", settings.Sparse ? L"sparse" : FindName(PATTERN_NAMES, ARRAYSIZE(PATTERN_NAMES), settings.Pattern));
+    writer.WriteString(L"format", settings.Sparse ? L"procedural" : FindName(SOURCE_FORMAT_NAMES, ARRAYSIZE(SOURCE_FORMAT_NAMES), settings.SourceFormat));
+    writer.WriteUint(L"width", settings.Width);
+    writer.WriteUint(L"height", settings.Height);
+    writer.WriteDouble(L"megapixels", megapixels);
+    writer.WriteDouble(L"writeSeconds", sourceSeconds);
+    writer.EndObject();
+
+    writer.BeginObject(L"options");
+    writer.WriteString(L"codec", FindName(CODEC_NAMES, ARRAYSIZE(CODEC_NAMES), options.TileCodec));
+    writer.WriteString(L"storage", FindName(STORAGE_NAMES, ARRAYSIZE(STORAGE_NAMES), options.TileStorage));
+    writer.WriteString(L"buildMode", FindName(BUILD_MODE_NAMES, ARRAYSIZE(BUILD_MODE_NAMES), options.BuildMode));
+    writer.WriteString(L"reductionFilter", FindName(FILTER_NAMES, ARRAYSIZE(FILTER_NAMES), options.ReductionFilter));
+    writer.WriteUint(L"tileSize", options.TileSize);
+    writer.WriteUint(L"tileOverlap", options.TileOverlap);
+    writer.WriteUint(L"memoryBudgetMegabytes", options.MemoryBudgetMegabytes);
+    writer.WriteBool(L"detectSolidColorTiles", options.DetectSolidColorTiles);
+    writer.WriteBool(L"deduplicateTiles", options.DeduplicateTiles);
+    writer.WriteBool(L"linearLightReduction", options.LinearLightReduction);
+    writer.WriteBool(L"progressiveOverview", options.ProgressiveOverview);
+    writer.EndObject();
+
+    DOUBLE bestSeconds = 0;
+    writer.BeginArray(L"runs");
+    for (UINT i = 0; i < runs.Length(); ++i)
+    {
+        const BenchmarkRun &run = runs[i];
+        const PyramidGenerationStatistics &statistics = run.Statistics;
+
+        writer.BeginObject(NULL);
+        writer.WriteDouble(L"wallSeconds", run.WallSeconds);
+        writer.WriteDouble(L"megapixelsPerSecond", (run.WallSeconds > 0) ? megapixels / run.WallSeconds : 0);
+        writer.WriteDouble(L"generationSeconds", statistics.TotalSeconds);
+        writer.WriteDouble(L"overviewSeconds", statistics.OverviewSeconds);
+        writer.WriteDouble(L"decodeSeconds", statistics.DecodeSeconds);
+        writer.WriteDouble(L"reduceSeconds", statistics.DownsampleSeconds);
+        writer.WriteDouble(L"encodeSeconds", statistics.EncodeSeconds);
+        writer.WriteDouble(L"decodeStallSeconds", statistics.DecodeStallSeconds);
+        writer.WriteDouble(L"reduceStallSeconds", statistics.DownsampleStallSeconds);
+        writer.WriteDouble(L"reduceStarveSeconds", statistics.DownsampleStarveSeconds);
+        writer.WriteUint(L"encoderThreads", statistics.EncoderThreadCount);
+        writer.WriteUint(L"peakWorkingSetBytes", statistics.PeakWorkingSetBytes);
+        writer.WriteUint(L"spilledLevels", statistics.SpilledLevelCount);
+        writer.WriteUint(L"spilledBytes", statistics.SpilledBytes);
+        writer.WriteUint(L"stolenTileJobs", statistics.StolenTileJobCount);
+        writer.WriteUint(L"duplicateTiles", statistics.DuplicateTileCount);
+        writer.WriteUint(L"solidColorTiles", statistics.SolidColorTileCount);
+        writer.WriteUint(L"levels", run.LevelCount);
+        writer.WriteUint(L"tiles", run.TileCount);
+        writer.WriteUint(L"filesWritten", run.FileCount);
+        writer.WriteUint(L"bytesWritten", run.CbFiles);
+        writer.EndObject();
+
+        if (i == 0 || run.WallSeconds < bestSeconds)
+        {
+            bestSeconds = run.WallSeconds;
+        }
+    }
+    writer.EndArray();
+
+    // Fastest run, the one least disturbed by the rest of the system
+    writer.BeginObject(L"best");
+    writer.WriteDouble(L"wallSeconds", bestSeconds);
+    writer.WriteDouble(L"megapixelsPerSecond", (bestSeconds > 0) ? megapixels / bestSeconds : 0);
+    writer.EndObject();
+
+    // Getting the tiles back from the pyramid of the last run, for comparing the tile codecs
+    writer.BeginArray(L"levelDecode");
+    for (UINT i = 0; i < levelDecodes.Length(); ++i)
+    {
+        const LevelDecodeResult &result = levelDecodes[i];
+
+        writer.BeginObject(NULL);
+        writer.WriteUint(L"level", result.Level);
+        writer.WriteUint(L"tiles", result.TileCount);
+        writer.WriteDouble(L"averageMilliseconds", result.AverageMilliseconds);
+        writer.WriteUint(L"storedBytes", result.CbStored);
+        writer.WriteDouble(L"bytesPerTile", (result.TileCount > 0) ? (DOUBLE)result.CbStored / result.TileCount : 0);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    if (pVerification)
+    {
+        writer.BeginObject(L"sparse");
+        writer.WriteUint(L"checkedTiles", pVerification->CheckedTileCount);
+        writer.WriteUint(L"mismatchedTiles", pVerification->MismatchedTileCount);
+        writer.WriteUint(L"manifestBytes", pVerification->CbManifest);
+        writer.WriteUint(L"tileTableBytes", pVerification->CbTileTables);
+        writer.WriteUint(L"largestTileTableBytes", pVerification->CbLargestTileTable);
+        writer.WriteBool(L"chunkedIndexWrite", pVerification->CbLargestTileTable > INDEX_WRITE_CHUNK_SIZE);
+        writer.WriteBool(L"valid", pVerification->IsValid());
+        writer.EndObject();
+    }
+
+    writer.EndObject();
+}
+
+//-----------------------------------------------------------------------------
+// Path of the source named after its pattern and size, and of the pyramid
+// the loader puts next to it. The sparse source is never written, its path
+// only names the pyramid.
+//-----------------------------------------------------------------------------
+static HRESULT GetBenchmarkPaths(__in const BenchmarkSettings &settings, __out_ecount(MAX_PATH) WCHAR *pSourcePath, __out_ecount(MAX_PATH) WCHAR *pPyramidDirectory)
+{
+    WCHAR baseName[MAX_PATH] = L"";
+    if (swprintf_s(baseName, MAX_PATH, L"synthetic_%s_%ux%u", settings.Sparse ? L"sparse" : FindName(PATTERN_NAMES, ARRAYSIZE(PATTERN_NAMES), settings.Pattern), 
+                   settings.Width, settings.Height) < 0)
+    {
+        return E_FAIL;
+    }
+
+    if (swprintf_s(pSourcePath, MAX_PATH, L"%s\\%s.%s", settings.pDirectory, baseName, FindName(SOURCE_FORMAT_NAMES, ARRAYSIZE(SOURCE_FORMAT_NAMES), settings.SourceFormat)) < 0 ||
+        swprintf_s(pPyramidDirectory, MAX_PATH, L"%s\\%s_dzfiles", settings.pDirectory, baseName) < 0)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+static HRESULT RunBenchmark(__in const BenchmarkSettings &settings)
+{
+    WCHAR sourcePath[MAX_PATH] = L"";
+    WCHAR pyramidDirectory[MAX_PATH] = L"";
+    HRESULT hr = GetBenchmarkPaths(settings, sourcePath, pyramidDirectory);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICImagingFactory> spImagingFactory;
+    hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&spImagingFactory);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapSource> spSparseSource;
+    StageTimer sourceTimer;
+    if (settings.Sparse)
+    {
+        hr = CreateSparseSource(settings.Width, settings.Height, &spSparseSource);
+        IF_FAILED_RETURN(hr);
+    }
+    else
+    {
+        fwprintf(stderr, L"Writing %s\n", sourcePath);
+
+        sourceTimer.Start();
+        hr = WriteSyntheticSource(spImagingFactory, sourcePath, *SOURCE_CONTAINERS[settings.SourceFormat], (SyntheticPatternType)settings.Pattern, settings.Width, settings.Height, NULL);
+        sourceTimer.Stop();
+        IF_FAILED_RETURN(hr);
+    }
+
+    Vector<BenchmarkRun> runs;
+    hr = runs.SetSize(settings.RunCount);
+    IF_FAILED_RETURN(hr);
+
+    // Loader of the last run, still open for getting its tiles back and the checks of its pyramid
+    SmartPtr<IImageLoader> spImageLoader;
+    for (UINT i = 0; i < settings.RunCount; ++i)
+    {
+        fwprintf(stderr, L"Run %u of %u\n", i + 1, settings.RunCount);
+
+        BOOL isLastRun = (i + 1 == settings.RunCount);
+        hr = RunPyramidBuild(sourcePath, pyramidDirectory, settings.Options, spSparseSource, runs[i], isLastRun ? &spImageLoader : NULL);
+        IF_FAILED_RETURN(hr);
+    }
+
+    fwprintf(stderr, L"Getting the tiles back\n");
+
+    Vector<LevelDecodeResult> levelDecodes;
+    hr = MeasureLevelDecode(spImageLoader, levelDecodes);
+
+    SparseVerification verification;
+    if (SUCCEEDED(hr) && settings.Sparse)
+    {
+        fwprintf(stderr, L"Checking the pyramid of the sparse source\n");
+
+        hr = VerifySparsePyramid(spImageLoader, spSparseSource, pyramidDirectory, verification);
+    }
+
+    spImageLoader->Destroy();
+    IF_FAILED_RETURN(hr);
+
+    if (!settings.KeepFiles)
+    {
+        DeleteDirectoryTree(pyramidDirectory);
+        DeleteFile(sourcePath);
+    }
+
+    FILE *pOutput = NULL;
+    hr = OpenReport(settings, &pOutput);
+    IF_FAILED_RETURN(hr);
+
+    JsonWriter writer(pOutput);
+    WriteReport(writer, settings, sourceTimer.GetSeconds(), runs, levelDecodes, settings.Sparse ? &verification : NULL);
+    CloseReport(pOutput);
+
+    if (settings.Sparse && !verification.IsValid())
+    {
+        fwprintf(stderr, L"The pyramid of the sparse source does not match the source\n");
+        return S_FALSE;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Write the source for the shards unless another shard did already. It is
+// written to a file of this process and moved in place once complete, so no
+// shard decodes a partly written source.
+//-----------------------------------------------------------------------------
+static HRESULT WriteShardSource(__in const BenchmarkSettings &settings, __in_z const WCHAR *pSourcePath)
+{
+    if (GetFileAttributes(pSourcePath) != INVALID_FILE_ATTRIBUTES)
+    {
+        return S_OK;
+    }
+
+    WCHAR tempPath[MAX_PATH] = L"";
+    if (swprintf_s(tempPath, MAX_PATH, L"%s.%u.tmp", pSourcePath, GetCurrentProcessId()) < 0)
+    {
+        return E_FAIL;
+    }
+
+    SmartPtr<IWICImagingFactory> spImagingFactory;
+    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&spImagingFactory);
+    IF_FAILED_RETURN(hr);
+
+    fwprintf(stderr, L"Writing %s\n", pSourcePath);
+
+    hr = WriteSyntheticSource(spImagingFactory, tempPath, *SOURCE_CONTAINERS[settings.SourceFormat], (SyntheticPatternType)settings.Pattern, settings.Width, settings.Height, NULL);
+    if (SUCCEEDED(hr) && !MoveFile(tempPath, pSourcePath))
+    {
+        // Another shard got there first with the same source
+        DWORD error = GetLastError();
+        hr = (error == ERROR_ALREADY_EXISTS || error == ERROR_FILE_EXISTS) ? S_OK : HRESULT_FROM_WIN32(error);
+    }
+
+    DeleteFile(tempPath);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Build one shard of the pyramid, or merge the shards, and report its time
+//-----------------------------------------------------------------------------
+static HRESULT RunShard(__in const BenchmarkSettings &settings)
+{
+    WCHAR sourcePath[MAX_PATH] = L"";
+    WCHAR pyramidDirectory[MAX_PATH] = L"";
+    HRESULT hr = GetBenchmarkPaths(settings, sourcePath, pyramidDirectory);
+    IF_FAILED_RETURN(hr);
+
+    // Every process computes the same sparse source, a written one is shared
+    SmartPtr<IWICBitmapSource> spSparseSource;
+    if (settings.Sparse)
+    {
+        hr = CreateSparseSource(settings.Width, settings.Height, &spSparseSource);
+    }
+    else
+    {
+        hr = WriteShardSource(settings, sourcePath);
+    }
+    IF_FAILED_RETURN(hr);
+
+    if (settings.IsMerge)
+    {
+        fwprintf(stderr, L"Merging %u shards\n", settings.ShardCount);
+    }
+    else
+    {
+        fwprintf(stderr, L"Building shard %u of %u\n", settings.ShardIndex, settings.ShardCount);
+    }
+
+    StageTimer timer;
+    timer.Start();
+
+    SmartPtr<IImageLoader> spImageLoader;
+    hr = spSparseSource ? CreateImageLoader(spSparseSource, sourcePath, settings.Options, &spImageLoader) : CreateImageLoader(sourcePath, settings.Options, &spImageLoader);
+    IF_FAILED_RETURN(hr);
+
+    hr = settings.IsMerge ? spImageLoader->MergeShards(settings.ShardCount) : spImageLoader->BuildShard(settings.ShardIndex, settings.ShardCount);
+    timer.Stop();
+    IF_FAILED_RETURN(hr);
+
+    PyramidGenerationStatistics statistics;
+    hr = spImageLoader->GetGenerationStatistics(statistics);
+    IF_FAILED_RETURN(hr);
+
+    UINT64 fileCount = 0;
+    UINT64 cbFiles = 0;
+    if (settings.IsMerge)
+    {
+        hr = MeasureDirectoryTree(pyramidDirectory, fileCount, cbFiles);
+        IF_FAILED_RETURN(hr);
+    }
+
+    spImageLoader->Destroy();
+
+    FILE *pOutput = NULL;
+    hr = OpenReport(settings, &pOutput);
+    IF_FAILED_RETURN(hr);
+
+    JsonWriter writer(pOutput);
+    writer.BeginObject(NULL);
+    writer.WriteString(L"label", settings.pLabel);
+    writer.WriteString(L"step", settings.IsMerge ? L"merge" : L"shard");
+    writer.WriteUint(L"shardIndex", settings.ShardIndex);
+    writer.WriteUint(L"shardCount", settings.ShardCount);
+    writer.WriteUint(L"width", settings.Width);
+    writer.WriteUint(L"height", settings.Height);
+    writer.WriteDouble(L"wallSeconds", timer.GetSeconds());
+    writer.WriteDouble(L"decodeSeconds", statistics.DecodeSeconds);
+    writer.WriteDouble(L"reduceSeconds", statistics.DownsampleSeconds);
+    writer.WriteDouble(L"encodeSeconds", statistics.EncodeSeconds);
+    writer.WriteUint(L"stolenTileJobs", statistics.StolenTileJobCount);
+
+    // The pyramid is complete only after the merge
+    if (settings.IsMerge)
+    {
+        writer.WriteUint(L"filesWritten", fileCount);
+        writer.WriteUint(L"bytesWritten", cbFiles);
+    }
+    writer.EndObject();
+    CloseReport(pOutput);
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Compare the images of a tile of two pyramids of the same size
+//-----------------------------------------------------------------------------
+static HRESULT CompareTileImages(__in IImageLoader *pImageLoader, __in IImageLoader *pReferenceLoader, __in const UINT &level, __in const UINT &row, __in const UINT &column, 
+                                 __out BOOL &isMatch)
+{
+    isMatch = FALSE;
+
+    SmartPtr<IDxImage> spImage;
+    HRESULT hr = pImageLoader->GetLevelRowColumnImage(level, row, column, &spImage);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IDxImage> spReferenceImage;
+    hr = pReferenceLoader->GetLevelRowColumnImage(level, row, column, &spReferenceImage);
+    IF_FAILED_RETURN(hr);
+
+    UINT width = 0, height = 0, referenceWidth = 0, referenceHeight = 0;
+    spImage->GetSize(width, height);
+    spReferenceImage->GetSize(referenceWidth, referenceHeight);
+    if (width != referenceWidth || height != referenceHeight || spImage->GetFormat() != spReferenceImage->GetFormat())
+    {
+        return S_OK;
+    }
+
+    // The unused fourth byte of the pixels is not compared
+    for (UINT y = 0; y < height; ++y)
+    {
+        const UINT32 *pLine = reinterpret_cast<const UINT32*>(spImage->GetPixelData() + (SIZE_T)y * spImage->GetRowPitch());
+        const UINT32 *pReferenceLine = reinterpret_cast<const UINT32*>(spReferenceImage->GetPixelData() + (SIZE_T)y * spReferenceImage->GetRowPitch());
+        for (UINT x = 0; x < width; ++x)
+        {
+            if (((pLine[x] ^ pReferenceLine[x]) & 0x00FFFFFF) != 0)
+            {
+                return S_OK;
+            }
+        }
+    }
+
+    isMatch = TRUE;
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Build the pyramid, change a rectangle of the source and update the pyramid,
+// then compare every tile with a full build of the changed source written
+// next to it. S_FALSE when a tile differs.
+//-----------------------------------------------------------------------------
+static HRESULT RunDirtyUpdate(__in const BenchmarkSettings &settings)
+{
+    WCHAR sourcePath[MAX_PATH] = L"";
+    WCHAR pyramidDirectory[MAX_PATH] = L"";
+    HRESULT hr = GetBenchmarkPaths(settings, sourcePath, pyramidDirectory);
+    IF_FAILED_RETURN(hr);
+
+    // The reference is the changed source under another name, with its own pyramid
+    WCHAR referencePath[MAX_PATH] = L"";
+    WCHAR referenceDirectory[MAX_PATH] = L"";
+    if (swprintf_s(referencePath, MAX_PATH, L"%s\\synthetic_reference.%s", settings.pDirectory, FindName(SOURCE_FORMAT_NAMES, ARRAYSIZE(SOURCE_FORMAT_NAMES), settings.SourceFormat)) < 0 ||
+        swprintf_s(referenceDirectory, MAX_PATH, L"%s\\synthetic_reference_dzfiles", settings.pDirectory) < 0)
+    {
+        return E_FAIL;
+    }
+
+    SmartPtr<IWICImagingFactory> spImagingFactory;
+    hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&spImagingFactory);
+    IF_FAILED_RETURN(hr);
+
+    const GUID &containerFormat = *SOURCE_CONTAINERS[settings.SourceFormat];
+    SyntheticPatternType pattern = (SyntheticPatternType)settings.Pattern;
+
+    fwprintf(stderr, L"Writing %s\n", sourcePath);
+
+    hr = WriteSyntheticSource(spImagingFactory, sourcePath, containerFormat, pattern, settings.Width, settings.Height, NULL);
+    IF_FAILED_RETURN(hr);
+
+    BenchmarkRun buildRun;
+    SmartPtr<IImageLoader> spImageLoader;
+    hr = RunPyramidBuild(sourcePath, pyramidDirectory, settings.Options, NULL, buildRun, &spImageLoader);
+    IF_FAILED_RETURN(hr);
+
+    fwprintf(stderr, L"Changing the source and updating the pyramid\n");
+
+    hr = WriteSyntheticSource(spImagingFactory, sourcePath, containerFormat, pattern, settings.Width, settings.Height, &settings.DirtyRect);
+    IF_FAILED_RETURN(hr);
+
+    StageTimer updateTimer;
+    updateTimer.Start();
+    hr = spImageLoader->UpdateDirtyRect(settings.DirtyRect.X, settings.DirtyRect.Y, settings.DirtyRect.Width, settings.DirtyRect.Height);
+    updateTimer.Stop();
+    IF_FAILED_RETURN(hr);
+
+    fwprintf(stderr, L"Building the pyramid of the changed source\n");
+
+    hr = WriteSyntheticSource(spImagingFactory, referencePath, containerFormat, pattern, settings.Width, settings.Height, &settings.DirtyRect);
+    IF_FAILED_RETURN(hr);
+
+    BenchmarkRun referenceRun;
+    SmartPtr<IImageLoader> spReferenceLoader;
+    hr = RunPyramidBuild(referencePath, referenceDirectory, settings.Options, NULL, referenceRun, &spReferenceLoader);
+    IF_FAILED_RETURN(hr);
+
+    UINT checkedTileCount = 0;
+    UINT mismatchedTileCount = 0;
+    for (UINT level = 0; SUCCEEDED(hr) && level < spImageLoader->GetLevelCount(); ++level)
+    {
+        UINT rowCount = 0, columnCount = 0;
+        hr = spImageLoader->GetLevelRowColumnCount(level, rowCount, columnCount);
+
+        for (UINT row = 0; SUCCEEDED(hr) && row < rowCount; ++row)
+        {
+            for (UINT column = 0; SUCCEEDED(hr) && column < columnCount; ++column)
+            {
+                BOOL isMatch = FALSE;
+                hr = CompareTileImages(spImageLoader, spReferenceLoader, level, row, column, isMatch);
+
+                checkedTileCount++;
+                mismatchedTileCount += isMatch ? 0 : 1;
+            }
+        }
+    }
+
+    BOOL isSameLevelCount = (spImageLoader->GetLevelCount() == spReferenceLoader->GetLevelCount());
+    spImageLoader->Destroy();
+    spReferenceLoader->Destroy();
+    IF_FAILED_RETURN(hr);
+
+    if (!settings.KeepFiles)
+    {
+        DeleteDirectoryTree(pyramidDirectory);
+        DeleteDirectoryTree(referenceDirectory);
+        DeleteFile(sourcePath);
+        DeleteFile(referencePath);
+    }
+
+    FILE *pOutput = NULL;
+    hr = OpenReport(settings, &pOutput);
+    IF_FAILED_RETURN(hr);
+
+    BOOL isValid = isSameLevelCount && mismatchedTileCount == 0;
+
+    JsonWriter writer(pOutput);
+    writer.BeginObject(NULL);
+    writer.WriteString(L"label", settings.pLabel);
+    writer.WriteUint(L"width", settings.Width);
+    writer.WriteUint(L"height", settings.Height);
+    writer.WriteString(L"codec", FindName(CODEC_NAMES, ARRAYSIZE(CODEC_NAMES), settings.Options.TileCodec));
+    writer.BeginObject(L"dirtyRect");
+    writer.WriteUint(L"x", settings.DirtyRect.X);
+    writer.WriteUint(L"y", settings.DirtyRect.Y);
+    writer.WriteUint(L"width", settings.DirtyRect.Width);
+    writer.WriteUint(L"height", settings.DirtyRect.Height);
+    writer.EndObject();
+    writer.WriteDouble(L"buildSeconds", buildRun.WallSeconds);
+    writer.WriteDouble(L"updateSeconds", updateTimer.GetSeconds());
+    writer.WriteDouble(L"referenceBuildSeconds", referenceRun.WallSeconds);
+    writer.WriteUint(L"checkedTiles", checkedTileCount);
+    writer.WriteUint(L"mismatchedTiles", mismatchedTileCount);
+    writer.WriteBool(L"valid", isValid);
+    writer.EndObject();
+    CloseReport(pOutput);
+
+    if (!isValid)
+    {
+        fwprintf(stderr, L"The updated pyramid differs from the pyramid of the changed source\n");
+        return S_FALSE;
+    }
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// Compare every reduction kernel the processor supports with the scalar
+// kernel and time it, S_FALSE when a kernel differs
+//-----------------------------------------------------------------------------
+static HRESULT RunKernelChecks(__in const BenchmarkSettings &settings)
+{
+    FILE *pOutput = NULL;
+    HRESULT hr = OpenReport(settings, &pOutput);
+    IF_FAILED_RETURN(hr);
+
+    JsonWriter writer(pOutput);
+    writer.BeginObject(NULL);
+    writer.WriteString(L"label", settings.pLabel);
+
+    BOOL allMatch = TRUE;
+    DOUBLE widestGigabytesPerSecond = 0;
+    writer.BeginArray(L"kernels");
+    for (UINT kernel = RKT_SCALAR; kernel < RKT_COUNT; ++kernel)
+    {
+        fwprintf(stderr, L"Checking the %s kernel\n", FindName(KERNEL_NAMES, ARRAYSIZE(KERNEL_NAMES), kernel));
+
+        hr = VerifyReductionKernel((ReductionKernelType)kernel);
+        BOOL isSupported = (hr != E_NOTIMPL);
+        if (FAILED(hr) && isSupported)
+        {
+            break;
+        }
+
+        BOOL isMatch = (hr == S_OK);
+        allMatch = allMatch && (isMatch || !isSupported);
+
+        DOUBLE gigabytesPerSecond = 0;
+        if (isSupported)
+        {
+            hr = BenchmarkReductionKernel((ReductionKernelType)kernel, gigabytesPerSecond);
+            if (FAILED(hr))
+            {
+                break;
+            }
+
+            // Kernels go from the narrowest to the widest, the last supported one is what the reducer picks
+            widestGigabytesPerSecond = gigabytesPerSecond;
+        }
+        hr = S_OK;
+
+        writer.BeginObject(NULL);
+        writer.WriteString(L"name", FindName(KERNEL_NAMES, ARRAYSIZE(KERNEL_NAMES), kernel));
+        writer.WriteBool(L"supported", isSupported);
+        writer.WriteBool(L"matchesScalar", isMatch);
+        writer.WriteDouble(L"gigabytesPerSecond", gigabytesPerSecond);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    // The cost of LinearLightReduction is the slowdown against the kernel the box reduction uses
+    BOOL isLinearMatch = FALSE;
+    DOUBLE linearGigabytesPerSecond = 0;
+    if (SUCCEEDED(hr))
+    {
+        fwprintf(stderr, L"Checking the linear light reduction\n");
+        hr = VerifyLinearLightReduction();
+        isLinearMatch = (hr == S_OK);
+        allMatch = allMatch && isLinearMatch;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        fwprintf(stderr, L"Timing the linear light reduction\n");
+        hr = BenchmarkLinearLightReduction(linearGigabytesPerSecond);
+    }
+
+    writer.BeginObject(L"linearLight");
+    writer.WriteBool(L"matchesScalar", isLinearMatch);
+    writer.WriteDouble(L"gigabytesPerSecond", linearGigabytesPerSecond);
+    writer.WriteDouble(L"slowdownAgainstWidestKernel", (linearGigabytesPerSecond > 0) ? widestGigabytesPerSecond / linearGigabytesPerSecond : 0);
+    writer.EndObject();
+
+    writer.WriteBool(L"allMatch", allMatch);
+    writer.EndObject();
+    CloseReport(pOutput);
+
+    IF_FAILED_RETURN(hr);
+
+    if (!allMatch)
+    {
+        fwprintf(stderr, L"A reduction kernel differs from the scalar kernel\n");
+        return S_FALSE;
+    }
+
+    return hr;
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    BenchmarkSettings settings;
+    if (!ParseCommandLine(argc, argv, settings))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (SUCCEEDED(hr))
+    {
+        if (settings.CheckKernels)
+        {
+            hr = RunKernelChecks(settings);
+        }
+        else if (settings.ShardCount > 0)
+        {
+            hr = RunShard(settings);
+        }
+        else if (settings.IsDirtyUpdate)
+        {
+            hr = RunDirtyUpdate(settings);
+        }
+        else
+        {
+            hr = RunBenchmark(settings);
+        }
+        CoUninitialize();
+    }
+
+    if (FAILED(hr))
+    {
+        fwprintf(stderr, L"Benchmark failed with 0x%08X\n", hr);
+        return 1;
+    }
+
+    // A check failed, the mode reported which
+    if (hr == S_FALSE)
+    {
+        return 1;
+    }
+
+    return 0;
+}
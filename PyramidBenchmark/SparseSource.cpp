@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "SparseSource.h"
+
+// Position of each patch in eighths of the free width and height, corners first
+static const UINT PATCH_EIGHTHS[SPARSE_PATCH_COUNT][2] = 
+{
+    {0, 0}, {8, 0}, {0, 8}, {8, 8}, {4, 4}, {1, 2}, {5, 3}, {7, 6},
+};
+
+void GetSparsePatch(__in const UINT &width, __in const UINT &height, __in const UINT &patch, __out WICRect &rect)
+{
+    UINT patchWidth = min(SPARSE_PATCH_SIZE, width);
+    UINT patchHeight = min(SPARSE_PATCH_SIZE, height);
+
+    rect.X = (INT)((UINT64)(width - patchWidth) * PATCH_EIGHTHS[patch][0] / 8);
+    rect.Y = (INT)((UINT64)(height - patchHeight) * PATCH_EIGHTHS[patch][1] / 8);
+    rect.Width = (INT)patchWidth;
+    rect.Height = (INT)patchHeight;
+}
+
+//-----------------------------------------------------------------------------
+// Noise of the patches, every pixel depends on its position only
+//-----------------------------------------------------------------------------
+inline static UINT32 GetPatchPixel(__in const UINT &x, __in const UINT &y)
+{
+    UINT32 hash = (x * 0x9E3779B1U) ^ (y * 0x85EBCA77U);
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6DU;
+    hash ^= hash >> 12;
+
+    return hash & 0x00FFFFFF;
+}
+
+//-----------------------------------------------------------------------------
+// Procedural source, holds no pixels and no state changed by CopyPixels
+//-----------------------------------------------------------------------------
+class SparseSource : public ImplementSmartObject<SparseSource, IWICBitmapSource>
+{
+    UINT m_Width;
+    UINT m_Height;
+    WICRect m_Patches[SPARSE_PATCH_COUNT];
+
+public:
+    SparseSource() : m_Width(0), m_Height(0) {};
+
+    HRESULT Initialize(__in const UINT &width, __in const UINT &height)
+    {
+        if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX)
+        {
+            return E_INVALIDARG;
+        }
+
+        m_Width = width;
+        m_Height = height;
+
+        for (UINT patch = 0; patch < SPARSE_PATCH_COUNT; ++patch)
+        {
+            GetSparsePatch(width, height, patch, m_Patches[patch]);
+        }
+
+        return S_OK;
+    }
+
+    STDMETHOD(GetSize)(__out UINT *puiWidth, __out UINT *puiHeight)
+    {
+        if (!puiWidth || !puiHeight)
+        {
+            return E_INVALIDARG;
+        }
+
+        *puiWidth = m_Width;
+        *puiHeight = m_Height;
+        return S_OK;
+    }
+
+    STDMETHOD(GetPixelFormat)(__out WICPixelFormatGUID *pPixelFormat)
+    {
+        if (!pPixelFormat)
+        {
+            return E_INVALIDARG;
+        }
+
+        *pPixelFormat = GUID_WICPixelFormat32bppBGR;
+        return S_OK;
+    }
+
+    STDMETHOD(GetResolution)(__out double *pDpiX, __out double *pDpiY)
+    {
+        if (!pDpiX || !pDpiY)
+        {
+            return E_INVALIDARG;
+        }
+
+        *pDpiX = 96.0;
+        *pDpiY = 96.0;
+        return S_OK;
+    }
+
+    STDMETHOD(CopyPalette)(__in IWICPalette *pIPalette)
+    {
+        UNREFERENCED_PARAMETER(pIPalette);
+        return WINCODEC_ERR_PALETTEUNAVAILABLE;
+    }
+
+    STDMETHOD(CopyPixels)(__in_opt const WICRect *prc, __in UINT cbStride, __in UINT cbBufferSize, __out_bcount(cbBufferSize) BYTE *pbBuffer)
+    {
+        WICRect rect = {0, 0, (INT)m_Width, (INT)m_Height};
+        if (prc)
+        {
+            rect = *prc;
+        }
+
+        if (!pbBuffer || rect.X < 0 || rect.Y < 0 || rect.Width <= 0 || rect.Height <= 0 || 
+            (UINT64)rect.X + rect.Width > m_Width || (UINT64)rect.Y + rect.Height > m_Height)
+        {
+            return E_INVALIDARG;
+        }
+
+        UINT64 cbLine = (UINT64)rect.Width * 4;
+        if (cbLine > cbStride || (UINT64)cbStride * (rect.Height - 1) + cbLine > cbBufferSize)
+        {
+            return WINCODEC_ERR_INSUFFICIENTBUFFER;
+        }
+
+        for (INT line = 0; line < rect.Height; ++line)
+        {
+            UINT32 *pLine = reinterpret_cast<UINT32*>(pbBuffer + (SIZE_T)line * cbStride);
+            INT y = rect.Y + line;
+
+            for (INT x = 0; x < rect.Width; ++x)
+            {
+                pLine[x] = SPARSE_BACKGROUND_COLOR;
+            }
+
+            // Overwrite the part of the line over each patch
+            for (UINT patch = 0; patch < SPARSE_PATCH_COUNT; ++patch)
+            {
+                const WICRect &patchRect = m_Patches[patch];
+                if (y < patchRect.Y || y >= patchRect.Y + patchRect.Height)
+                {
+                    continue;
+                }
+
+                INT first = max(rect.X, patchRect.X);
+                INT end = min(rect.X + rect.Width, patchRect.X + patchRect.Width);
+                for (INT x = first; x < end; ++x)
+                {
+                    pLine[x - rect.X] = GetPatchPixel((UINT)x, (UINT)y);
+                }
+            }
+        }
+
+        return S_OK;
+    }
+};
+
+HRESULT CreateSparseSource(__in const UINT &width, __in const UINT &height, __deref_out IWICBitmapSource **ppSource)
+{
+    return SparseSource::CreateInstance(ppSource, width, height);
+}
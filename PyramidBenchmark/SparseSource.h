@@ -0,0 +1,42 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+// Side of the patches of detail the sparse source has in the corners, in the center and along the diagonal,
+// not a multiple of any tile size so that they cross tile borders
+static const UINT SPARSE_PATCH_SIZE = 384;
+static const UINT SPARSE_PATCH_COUNT = 8;
+
+// BGRX color of the sparse source outside the patches
+static const UINT32 SPARSE_BACKGROUND_COLOR = 0x003C6E9A;
+
+//-----------------------------------------------------------------------------
+// Rectangle of a patch of the sparse source, patches of a source smaller
+// than a patch are clipped to it
+//-----------------------------------------------------------------------------
+void GetSparsePatch(__in const UINT &width, __in const UINT &height, __in const UINT &patch, __out WICRect &rect);
+
+//-----------------------------------------------------------------------------
+// Create a sparse source computed on the fly, a single color with a few
+// patches of noise, so sizes far past what fits on a disk can be generated.
+// Its pixels are 32bppBGR, CopyPixels can be called by several threads.
+//-----------------------------------------------------------------------------
+HRESULT CreateSparseSource(__in const UINT &width, __in const UINT &height, __deref_out IWICBitmapSource **ppSource);
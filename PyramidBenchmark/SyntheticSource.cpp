@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "SyntheticSource.h"
+
+// Lines generated and written to the encoder at once
+static const UINT WRITE_STRIP_HEIGHT = 64;
+
+// Side of the rectangles of the solid pattern, several tiles of every tile size
+static const UINT SOLID_REGION_SIZE = 4096;
+
+//-----------------------------------------------------------------------------
+// Xorshift random number generator, cheap enough not to slow down the writing
+//-----------------------------------------------------------------------------
+inline static UINT32 NextRandom(__inout UINT32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+//-----------------------------------------------------------------------------
+// Fill a line of 24bppBGR pixels of the pattern
+//-----------------------------------------------------------------------------
+static void FillSyntheticLine(__in const SyntheticPatternType &pattern, __in const UINT &y, __in const UINT &width, __in const UINT &height, __out BYTE *pLine)
+{
+    // Mixed sources are split into three bands of the other patterns
+    SyntheticPatternType linePattern = pattern;
+    if (pattern == SPT_MIXED)
+    {
+        linePattern = (SyntheticPatternType)((UINT64)y * 3 / height);
+    }
+
+    // Seeded by the line, so lines don't depend on the lines written before
+    UINT32 state = (y + 1) * 2654435761U;
+    UINT32 regionRow = y / SOLID_REGION_SIZE;
+
+    for (UINT x = 0; x < width; ++x)
+    {
+        UINT32 color = 0;
+        switch (linePattern)
+        {
+        case SPT_NOISE:
+            color = NextRandom(state);
+            break;
+
+        case SPT_GRADIENT:
+            color = (UINT32)((UINT64)x * 255 / width) | ((UINT32)((UINT64)y * 255 / height) << 8) | ((UINT32)((UINT64)(x + (UINT64)y) * 255 / ((UINT64)width + height)) << 16);
+            break;
+
+        default:
+            color = ((x / SOLID_REGION_SIZE) * 73856093U) ^ (regionRow * 19349663U);
+            break;
+        }
+
+        pLine[0] = (BYTE)color;
+        pLine[1] = (BYTE)(color >> 8);
+        pLine[2] = (BYTE)(color >> 16);
+        pLine += 3;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Uncompressed TIFF keeps the decode of the source cheap and its time stable
+//-----------------------------------------------------------------------------
+static HRESULT WriteSourceEncoderOptions(__in IPropertyBag2 *pFrameOptions, __in const GUID &containerFormat)
+{
+    if (containerFormat != GUID_ContainerFormatTiff)
+    {
+        return S_OK;
+    }
+
+    PROPBAG2 option = {0};
+    option.pstrName = const_cast<LPOLESTR>(L"TiffCompressionMethod");
+
+    VARIANT value;
+    VariantInit(&value);
+    value.vt = VT_UI1;
+    value.bVal = WICTiffCompressionNone;
+
+    return pFrameOptions->Write(1, &option, &value);
+}
+
+//-----------------------------------------------------------------------------
+// Invert the pixels of a line in the changed rectangle
+//-----------------------------------------------------------------------------
+static void InvertChangedPixels(__in const WICRect &changedRect, __in const UINT &y, __inout BYTE *pLine)
+{
+    if ((INT)y < changedRect.Y || (INT)y >= changedRect.Y + changedRect.Height)
+    {
+        return;
+    }
+
+    for (INT x = changedRect.X; x < changedRect.X + changedRect.Width; ++x)
+    {
+        pLine[x * 3] ^= 0xFF;
+        pLine[x * 3 + 1] ^= 0xFF;
+        pLine[x * 3 + 2] ^= 0xFF;
+    }
+}
+
+HRESULT WriteSyntheticSource(__in IWICImagingFactory *pImagingFactory, __in_z const WCHAR *pFilePath, __in const GUID &containerFormat, 
+                             __in const SyntheticPatternType &pattern, __in const UINT &width, __in const UINT &height, __in_opt const WICRect *pChangedRect)
+{
+    if (width == 0 || height == 0 || pattern > SPT_MIXED)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (pChangedRect && (pChangedRect->X < 0 || pChangedRect->Y < 0 || pChangedRect->Width < 0 || pChangedRect->Height < 0 || 
+                         (UINT64)pChangedRect->X + pChangedRect->Width > width || (UINT64)pChangedRect->Y + pChangedRect->Height > height))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Strips are written with UINT strides and sizes
+    UINT64 cbStride = ((UINT64)width * 3 + 3) & ~3ULL;
+    if (cbStride * WRITE_STRIP_HEIGHT > UINT_MAX)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    SmartPtr<IWICStream> spStream;
+    HRESULT hr = pImagingFactory->CreateStream(&spStream);
+    IF_FAILED_RETURN(hr);
+
+    hr = spStream->InitializeFromFilename(pFilePath, GENERIC_WRITE);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapEncoder> spEncoder;
+    hr = pImagingFactory->CreateEncoder(containerFormat, NULL, &spEncoder);
+    IF_FAILED_RETURN(hr);
+
+    hr = spEncoder->Initialize(spStream, WICBitmapEncoderNoCache);
+    IF_FAILED_RETURN(hr);
+
+    SmartPtr<IWICBitmapFrameEncode> spFrameEncode;
+    SmartPtr<IPropertyBag2> spFrameOptions;
+    hr = spEncoder->CreateNewFrame(&spFrameEncode, &spFrameOptions);
+    IF_FAILED_RETURN(hr);
+
+    hr = WriteSourceEncoderOptions(spFrameOptions, containerFormat);
+    IF_FAILED_RETURN(hr);
+
+    hr = spFrameEncode->Initialize(spFrameOptions);
+    IF_FAILED_RETURN(hr);
+
+    hr = spFrameEncode->SetSize(width, height);
+    IF_FAILED_RETURN(hr);
+
+    // All of the supported containers take 24bppBGR as it is
+    WICPixelFormatGUID pixelFormat = GUID_WICPixelFormat24bppBGR;
+    hr = spFrameEncode->SetPixelFormat(&pixelFormat);
+    IF_FAILED_RETURN(hr);
+
+    if (pixelFormat != GUID_WICPixelFormat24bppBGR)
+    {
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    }
+
+    Vector<BYTE> strip;
+    hr = strip.SetSize((UINT)cbStride * WRITE_STRIP_HEIGHT);
+    IF_FAILED_RETURN(hr);
+
+    for (UINT y = 0; y < height; y += WRITE_STRIP_HEIGHT)
+    {
+        UINT lineCount = min(WRITE_STRIP_HEIGHT, height - y);
+        for (UINT line = 0; line < lineCount; ++line)
+        {
+            BYTE *pLine = strip.Ptr() + (SIZE_T)line * cbStride;
+            FillSyntheticLine(pattern, y + line, width, height, pLine);
+
+            if (pChangedRect)
+            {
+                InvertChangedPixels(*pChangedRect, y + line, pLine);
+            }
+        }
+
+        hr = spFrameEncode->WritePixels(lineCount, (UINT)cbStride, (UINT)cbStride * lineCount, strip.Ptr());
+        IF_FAILED_RETURN(hr);
+    }
+
+    hr = spFrameEncode->Commit();
+    IF_FAILED_RETURN(hr);
+
+    return spEncoder->Commit();
+}
@@ -0,0 +1,46 @@
+//
+// Copyright (C) 2013, Alojz Kovacik, http://kovacik.github.com
+//
+// This file is part of Deep Zoom.
+//
+// Deep Zoom is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Deep Zoom is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Deep Zoom. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+enum SyntheticPatternType
+{
+    // Random pixels, the worst case of every codec and the best of none of the tile shortcuts
+    SPT_NOISE = 0,
+
+    // Smooth gradients over the whole image, compress well and reduce to gradients again
+    SPT_GRADIENT = 1,
+
+    // Large rectangles of a single color, most tiles are solid color tiles
+    SPT_SOLID = 2,
+
+    // Horizontal bands of noise, gradients and solid rectangles
+    SPT_MIXED = 3,
+};
+
+//-----------------------------------------------------------------------------
+// Write a synthetic source image of the given size and pattern, strip by strip
+// so the size of the image is not limited by memory. Every pixel depends on
+// its position only, sources written with the same arguments are the same.
+// Pixels in the changed rectangle are inverted, for a source that changed in
+// that rectangle only.
+//-----------------------------------------------------------------------------
+HRESULT WriteSyntheticSource(__in IWICImagingFactory *pImagingFactory, __in_z const WCHAR *pFilePath, __in const GUID &containerFormat, 
+                             __in const SyntheticPatternType &pattern, __in const UINT &width, __in const UINT &height, __in_opt const WICRect *pChangedRect);
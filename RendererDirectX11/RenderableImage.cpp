@@ -28,6 +28,7 @@ const FLOAT RenderableImage::VIEWPORT_SIZE = 1024.0f;
 
 RenderableImage::RenderableImage()
 {
+    m_FirstLevel = 0;
 }
 
 RenderableImage::~RenderableImage()
@@ -80,7 +81,7 @@ HRESULT RenderableImage::GenerateTiles()
     hr = m_LevelTiles.SetSize(levelCount);
     IF_FAILED_RETURN(hr);
 
-    for (INT level = levelCount - 1; level >= 0; --level)
+    for (INT level = levelCount - 1; level >= (INT)m_FirstLevel; --level)
     {
         // Change scale and generate tiles for another level
         XMMATRIX projectionMatrix;
@@ -131,9 +132,20 @@ HRESULT RenderableImage::UpdateFromSceneObject(__in ISceneObject *pSceneObject)
         hr = spImage->GetImageLoader(&m_spImageLoader);
         IF_FAILED_RETURN(hr);
 
-        // Generate tiles only when not already generated
-        if (m_LevelTiles.Length() == 0)
+        // Generate tiles for the levels the image loader serves, the top levels of its overview first and
+        // all of them once it opened the image. The scene object changes its shape at both points.
+        UINT firstLevel = m_spImageLoader->GetFirstAvailableLevel();
+        if (m_LevelTiles.Length() == 0 || firstLevel != m_FirstLevel)
         {
+            m_LevelTiles.Clear();
+            m_FirstLevel = firstLevel;
+
+            if (firstLevel >= m_spImageLoader->GetLevelCount())
+            {
+                hr = m_spImageLoader->GetOpenResult();
+                return (hr == E_PENDING) ? S_OK : hr;
+            }
+
             hr = GenerateTiles();
         }
     }
@@ -149,15 +161,15 @@ HRESULT RenderableImage::DetermineLevelFromCamera(__deref_in ISceneObjectCamera
     HRESULT hr = E_FAIL;
 
     FLOAT minDifference = 0.0f;
-    UINT bestLevel = 0;
+    UINT bestLevel = m_FirstLevel;
 
-    for (UINT level = 0; level < m_LevelTiles.Length(); ++level)
+    for (UINT level = m_FirstLevel; level < m_LevelTiles.Length(); ++level)
     {
         FLOAT diff;
         hr = m_LevelTiles[level][0]->GetProjectedWorldToScreenDiff(pCamera, viewportWidth, viewportHeight, diff);
         IF_FAILED_RETURN(hr);
         
-        if (diff < minDifference || 0 == level)
+        if (diff < minDifference || m_FirstLevel == level)
         {
             minDifference = diff;
             bestLevel = level;
@@ -178,7 +190,7 @@ HRESULT RenderableImage::CalibrateCamera(__deref_in ISceneObjectCamera *pCamera)
 
     HRESULT hr;
 
-    UINT bestLevel = 0;
+    UINT bestLevel = m_FirstLevel;
     FLOAT screenWidth = 0, screenHeight = 0;
     hr = spCamera->GetScreenSize(screenWidth, screenHeight);
     IF_FAILED_RETURN(hr);
@@ -186,7 +198,7 @@ HRESULT RenderableImage::CalibrateCamera(__deref_in ISceneObjectCamera *pCamera)
     // Find the most suitable level, level with image width similar to screen width
     // 
     UINT width = 0, height = 0;
-    for (UINT level = 0; level < m_LevelTiles.Length(); ++level)
+    for (UINT level = m_FirstLevel; level < m_LevelTiles.Length(); ++level)
     {
         hr = m_spImageLoader->GetLevelSize(level, width, height);
         IF_FAILED_RETURN(hr);
@@ -256,6 +268,12 @@ HRESULT RenderableImage::Draw(UINT passIndex, __in IRendererHandler *pRenderer)
     UNREFERENCED_PARAMETER(passIndex);
     HRESULT hr;
 
+    // Nothing to draw until the image is open
+    if (m_LevelTiles.Length() == 0)
+    {
+        return S_OK;
+    }
+
     // Get suitable renderer
     SmartPtr<IRenderer> spRenderer;
     hr = pRenderer->QueryInterface(&spRenderer);
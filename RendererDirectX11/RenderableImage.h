@@ -31,6 +31,9 @@ private:
     static const FLOAT VIEWPORT_SIZE;
 
     Vector<Vector<SmartPtr<IRenderableTile>>> m_LevelTiles;
+
+    // Finest level with tiles, the levels below have none while only the overview of the image is open
+    UINT m_FirstLevel;
     SmartPtr<IImageLoader> m_spImageLoader;
 	SmartPtr<ISceneObject> m_spSceneObject;
 
@@ -66,25 +66,34 @@ HRESULT RenderableImageTile::InitializeVertexBuffer(__deref_in ISceneObjectCamer
     hr = vertices.SetSize(vertexCount);
     IF_FAILED_RETURN(hr);
 
+    // The quad covers the area of the tile, the overlap border around it is only sampled at the edges,
+    // nor is the padding of block compressed tiles
+    FLOAT imageWidth = (FLOAT)m_pTileMetadata->GetTextureWidth();
+    FLOAT imageHeight = (FLOAT)m_pTileMetadata->GetTextureHeight();
+    FLOAT textureLeft = m_pTileMetadata->OverlapLeft / imageWidth;
+    FLOAT textureRight = (m_pTileMetadata->OverlapLeft + m_pTileMetadata->Width) / imageWidth;
+    FLOAT textureTop = m_pTileMetadata->OverlapTop / imageHeight;
+    FLOAT textureBottom = (m_pTileMetadata->OverlapTop + m_pTileMetadata->Height) / imageHeight;
+
     XMStoreFloat3(&m_Vertices[0], XMVector3Unproject(XMLoadFloat3(&XMFLOAT3(offsetX + (FLOAT)m_pTileMetadata->X, offsetY + (FLOAT)m_pTileMetadata->Y + m_pTileMetadata->Height, 0.0f)), 
                                                      viewportX, viewportY, viewportWidth, viewportHeight, 0.0f, 1.0f, projectionMatrix, viewMatrix, *worldMatrix));
     vertices[0].Position = m_Vertices[0];
-    vertices[0].Texture = XMFLOAT2(0.0f, 1.0f);
+    vertices[0].Texture = XMFLOAT2(textureLeft, textureBottom);
 
     XMStoreFloat3(&m_Vertices[1], XMVector3Unproject(XMLoadFloat3(&XMFLOAT3(offsetX + (FLOAT)m_pTileMetadata->X, offsetY + (FLOAT)m_pTileMetadata->Y, 0.0f)), 
                                                      viewportX, viewportY, viewportWidth, viewportHeight, 0.0f, 1.0f, projectionMatrix, viewMatrix, *worldMatrix));
     vertices[1].Position = m_Vertices[1];
-    vertices[1].Texture = XMFLOAT2(0.0f, 0.0f);
+    vertices[1].Texture = XMFLOAT2(textureLeft, textureTop);
 
     XMStoreFloat3(&m_Vertices[2], XMVector3Unproject(XMLoadFloat3(&XMFLOAT3(offsetX + (FLOAT)m_pTileMetadata->X + m_pTileMetadata->Width, offsetY + (FLOAT)m_pTileMetadata->Y, 0.0f)), 
                                                      viewportX, viewportY, viewportWidth, viewportHeight, 0.0f, 1.0f, projectionMatrix, viewMatrix, *worldMatrix));
     vertices[2].Position = m_Vertices[2];
-    vertices[2].Texture = XMFLOAT2(1.0f, 0.0f);
+    vertices[2].Texture = XMFLOAT2(textureRight, textureTop);
 
     XMStoreFloat3(&m_Vertices[3], XMVector3Unproject(XMLoadFloat3(&XMFLOAT3(offsetX + (FLOAT)m_pTileMetadata->X + m_pTileMetadata->Width, offsetY + (FLOAT)m_pTileMetadata->Y + m_pTileMetadata->Height, 0.0f)), 
                                                      viewportX, viewportY, viewportWidth, viewportHeight, 0.0f, 1.0f, projectionMatrix, viewMatrix, *worldMatrix));
     vertices[3].Position = m_Vertices[3];
-    vertices[3].Texture = XMFLOAT2(1.0f, 1.0f);
+    vertices[3].Texture = XMFLOAT2(textureRight, textureBottom);
 
     // Set up the description of the static vertex buffer
     D3D11_BUFFER_DESC vertexBufferDesc;
@@ -214,15 +223,38 @@ HRESULT RenderableImageTile::InitializeTexture()
     m_spTextureSRV.Release();
     m_spTexture.Release();
 
+    // A tile of a single color is one texel stretched over the quad, nothing is decoded
+    if (m_pTileMetadata->IsSolidColor())
+    {
+        return CreateTexture(1, 1, DXGI_FORMAT_B8G8R8X8_UNORM, &m_pTileMetadata->SolidColor, sizeof(UINT));
+    }
+
     // Load image data
     SmartPtr<IDxImage> spImage;
     HRESULT hr = m_spImageLoader->GetLevelRowColumnImage(m_pTileMetadata->Level, m_pTileMetadata->Row, m_pTileMetadata->Column, &spImage);
+    IF_FAILED_RETURN(hr);
+
+    // BC7 tiles need feature level 11_0, pyramids for lower levels are built with BC1 through
+    // ImageLoaderOptions::RendererFeatureLevel
+    if (spImage->GetFormat() == DXGI_FORMAT_BC7_UNORM && m_spDevice->GetFeatureLevel() < D3D_FEATURE_LEVEL_11_0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    UINT width = 0, height = 0;
+    spImage->GetSize(width, height);
 
+    return CreateTexture(width, height, (DXGI_FORMAT)spImage->GetFormat(), spImage->GetPixelData(), spImage->GetRowPitch());
+}
+
+HRESULT RenderableImageTile::CreateTexture(__in const UINT &width, __in const UINT &height, __in const DXGI_FORMAT &format, __in const void *pPixelData, __in const UINT &rowPitch)
+{
     D3D11_TEXTURE2D_DESC texDesc;
-    spImage->GetSize(texDesc.Width, texDesc.Height);
+    texDesc.Width                = width;
+    texDesc.Height               = height;
     texDesc.MipLevels            = 1;
     texDesc.ArraySize            = 1;
-    texDesc.Format               = (DXGI_FORMAT)spImage->GetFormat();
+    texDesc.Format               = format;
     texDesc.SampleDesc.Count     = 1;
     texDesc.SampleDesc.Quality   = 0;
 	texDesc.Usage                = D3D11_USAGE_DEFAULT;
@@ -231,15 +263,15 @@ HRESULT RenderableImageTile::InitializeTexture()
     texDesc.MiscFlags            = 0;
 
     D3D11_SUBRESOURCE_DATA data;        
-    data.pSysMem                 = spImage->GetPixelData();
-    data.SysMemPitch             = spImage->GetRowPitch();
+    data.pSysMem                 = pPixelData;
+    data.SysMemPitch             = rowPitch;
     data.SysMemSlicePitch        = 0;
 
-	hr = m_spDevice->CreateTexture2D( &texDesc, &data, &m_spTexture );
+	HRESULT hr = m_spDevice->CreateTexture2D( &texDesc, &data, &m_spTexture );
     IF_FAILED_RETURN(hr);
 
     D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-    srvDesc.Format                       = (DXGI_FORMAT)spImage->GetFormat();
+    srvDesc.Format                       = format;
     srvDesc.ViewDimension                = D3D11_SRV_DIMENSION_TEXTURE2D;
     srvDesc.Texture2D.MipLevels          = 1;
     srvDesc.Texture2D.MostDetailedMip    = 0;
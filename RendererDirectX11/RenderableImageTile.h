@@ -54,6 +54,7 @@ class RenderableImageTile : public ImplementSmartObject
 	HRESULT InitializeVertexBuffer(__deref_in ISceneObjectCamera *pCamera, __in const DirectX::XMMATRIX *worldMatrix);
 	HRESULT InitializeIndexBuffer();
     HRESULT InitializeTexture();
+    HRESULT CreateTexture(__in const UINT &width, __in const UINT &height, __in const DXGI_FORMAT &format, __in const void *pPixelData, __in const UINT &rowPitch);
 
 public:
     RenderableImageTile();
@@ -57,6 +57,7 @@ HRESULT SceneGraph::Destroy()
     m_SceneRoot.Release();
     m_NewTopologyListeners.Clear();
     m_Listeners.Clear();
+    m_EventObjects.Clear();
     return S_OK;
 }
 
@@ -130,6 +131,68 @@ HRESULT SceneGraph::RegisterForValidate(__in ISceneObject *pObject)
     return m_InvalidObjects.Add(pObject);
 }
 
+HRESULT SceneGraph::RegisterForValidateOnEvent(__in ISceneObject *pObject, __in HANDLE hEvent, __in SceneObjectContentType contentType)
+{
+    if (!pObject || !hEvent)
+        return E_INVALIDARG;
+
+    AutoCriticalSection acs(m_Validation);
+
+    if (m_ValidateInProgress)
+        return E_FAIL;
+
+    EventObject eo;
+    eo.object = pObject;
+    eo.hEvent = hEvent;
+    eo.contentType = contentType;
+    return m_EventObjects.Add(eo);
+}
+
+HRESULT SceneGraph::InvalidateSignaledObjects()
+{
+    HRESULT hr = S_FALSE;
+
+    UINT i = 0;
+    while (i < m_EventObjects.Length())
+    {
+        if (WaitForSingleObject(m_EventObjects[i].hEvent, 0) != WAIT_OBJECT_0)
+        {
+            i++;
+            continue;
+        }
+
+        SmartPtr<ISceneObject> spObj = m_EventObjects[i].object;
+        SceneObjectContentType contentType = m_EventObjects[i].contentType;
+
+        // Move the last object to the slot, the slot of the last one keeps no reference
+        m_EventObjects[i] = m_EventObjects.GetLast();
+        m_EventObjects.GetLast().object.Release();
+        m_EventObjects.RemoveLast();
+
+        HRESULT hrInvalidate = spObj->Invalidate(contentType);
+        if (FAILED(hrInvalidate))
+            return hrInvalidate;
+
+        hr = S_OK;
+    }
+
+    return hr;
+}
+
+HRESULT SceneGraph::ValidateSignaledObjects()
+{
+    AutoCriticalSection acs(m_Validation);
+
+    if (m_ValidateInProgress)
+        return E_FAIL;
+
+    HRESULT hr = InvalidateSignaledObjects();
+    if (hr != S_OK)
+        return hr;
+
+    return Validate();
+}
+
 HRESULT SceneGraph::RecurentNotifyAddSceneContent(__in ISceneChangesNotificationListener *pListener, __in ISceneObjectGroup *pGroup)
 {
     HRESULT hr = S_OK;
@@ -161,6 +224,11 @@ HRESULT SceneGraph::Validate()
         return E_FAIL;
 
     AutoCriticalSection acs(m_Validation);
+
+    HRESULT hr = InvalidateSignaledObjects();
+    if (FAILED(hr))
+        return hr;
+
     m_ValidateInProgress = true;
 
     UINT cntTopology = m_NewTopologyListeners.Length();
@@ -33,17 +33,26 @@ class SceneGraph : public ImplementSmartObject
         SmartPtr<ISceneChangesNotificationListener> listener;
     };
 
+    struct EventObject
+    {
+        SmartPtr<ISceneObject> object;
+        HANDLE hEvent;
+        SceneObjectContentType contentType;
+    };
+
     CriticalSection m_Validation;
 
     SmartPtr<ISceneObjectGroup> m_SceneRoot;
     Vector<SmartPtr<ISceneObject>> m_InvalidObjects;
     Vector<NotificationListener> m_Listeners;
     Vector<SmartPtr<ISceneChangesNotificationListener>> m_NewTopologyListeners;
+    Vector<EventObject> m_EventObjects;
     UINT m_Timestamp;
 
     bool m_ValidateInProgress;
 
     HRESULT RecurentNotifyAddSceneContent(__in ISceneChangesNotificationListener *pListener, __in ISceneObjectGroup *pGroup);
+    HRESULT InvalidateSignaledObjects();
 public:
     HRESULT Initialize();
     HRESULT Destroy();
@@ -51,7 +60,9 @@ public:
     HRESULT GetSceneRoot(__deref_out ISceneObjectGroup **ppSceneRoot);
 
     HRESULT RegisterForValidate(__in ISceneObject *pObject);
+    HRESULT RegisterForValidateOnEvent(__in ISceneObject *pObject, __in HANDLE hEvent, __in SceneObjectContentType contentType);
     HRESULT Validate();
+    HRESULT ValidateSignaledObjects();
 
     HRESULT RegisterNotificationListener(__in ISceneChangesNotificationListener *pListener, SceneObjectContentType mask);
     
@@ -220,12 +220,19 @@ DECLAREINTERFACE(ISceneGraph, IUnknown, "{0E38F64D-0198-4BE4-8DC6-D0F363303083}"
 
     HRESULT RegisterForValidate(__in ISceneObject *pObject);
 
+    // Invalidate the object with the content type once the event is set, work finished on another thread
+    // reaches the listeners this way. Every Validate checks the events, the event has to outlive the scene graph.
+    HRESULT RegisterForValidateOnEvent(__in ISceneObject *pObject, __in HANDLE hEvent, __in SceneObjectContentType contentType);
+
     HRESULT RegisterNotificationListener(__in ISceneChangesNotificationListener *pListener, SceneObjectContentType mask);
     
     HRESULT UnregisterNotificationListener(__in ISceneChangesNotificationListener *pListener);
     
     HRESULT Validate();
 
+    // Validate only when the event of an object registered with RegisterForValidateOnEvent is set, S_FALSE otherwise
+    HRESULT ValidateSignaledObjects();
+
     HRESULT Destroy();
 
     UINT GetTimestamp();
@@ -26,16 +26,37 @@ SceneObjectImage::SceneObjectImage(void)
 {
     m_pFilePath = NULL;
     m_IsCalibrated = TRUE;
+    m_hOpenedEvent = NULL;
+    m_hOverviewEvent = NULL;
 }
 
 SceneObjectImage::~SceneObjectImage(void)
 {
+    // The open running in the background sets the event until it is stopped
+    if (m_spImageLoader)
+    {
+        m_spImageLoader->Destroy();
+    }
+
+    if (m_hOpenedEvent)
+    {
+        CloseHandle(m_hOpenedEvent);
+    }
+
+    if (m_hOverviewEvent)
+    {
+        CloseHandle(m_hOverviewEvent);
+    }
+
     free(m_pFilePath);
 }
 
 HRESULT SceneObjectImage::Destroy()
 {
-    m_spImageLoader->Destroy();
+    if (m_spImageLoader)
+    {
+        m_spImageLoader->Destroy();
+    }
     m_spImageLoader.Release();
 
     free(m_pFilePath);
@@ -56,11 +77,26 @@ HRESULT SceneObjectImage::Initialize(__in_z const WCHAR *nodeName, __in_z const
 
         if (SUCCEEDED(hr))
         {
-            hr = CreateImageLoader(filePath, &m_spImageLoader);
+            // The top levels are shown while the rest of the pyramid is generated
+            ImageLoaderOptions options;
+            options.ProgressiveOverview = TRUE;
+
+            hr = CreateImageLoader(filePath, options, &m_spImageLoader);
+
+            // Generation of the pyramid runs in the background, the scene graph picks up the events
+            if (SUCCEEDED(hr))
+            {
+                m_hOpenedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+                m_hOverviewEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+                if (!m_hOpenedEvent || !m_hOverviewEvent)
+                {
+                    hr = HRESULT_FROM_WIN32(GetLastError());
+                }
+            }
 
             if (SUCCEEDED(hr))
             {
-                hr = m_spImageLoader->Open();
+                hr = m_spImageLoader->OpenAsync(m_hOpenedEvent, m_hOverviewEvent);
             }
         }
     }
@@ -68,6 +104,26 @@ HRESULT SceneObjectImage::Initialize(__in_z const WCHAR *nodeName, __in_z const
     return hr;
 }
 
+//-----------------------------------------------------------------------------
+// Register with the scene graph, the shape is invalidated once the overview
+// is published and once the image is open
+//-----------------------------------------------------------------------------
+HRESULT SceneObjectImage::Register(__in ISceneGraph *pSceneGraph)
+{
+    HRESULT hr = SceneObject::Register(pSceneGraph);
+    if (hr == S_OK && m_hOverviewEvent)
+    {
+        hr = pSceneGraph->RegisterForValidateOnEvent(this, m_hOverviewEvent, SOCT_SHAPE);
+    }
+
+    if (hr == S_OK && m_hOpenedEvent)
+    {
+        hr = pSceneGraph->RegisterForValidateOnEvent(this, m_hOpenedEvent, SOCT_SHAPE);
+    }
+
+    return hr;
+}
+
 HRESULT SceneObjectImage::SetFilePath(__in_z const WCHAR *filePath)
 {
 	free(m_pFilePath);
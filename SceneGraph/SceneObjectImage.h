@@ -35,6 +35,10 @@ class SceneObjectImage : public ImplementSmartObject
     SmartPtr<IImageLoader> m_spImageLoader;
     HRESULT SetFilePath(__in_z const WCHAR *filePath);
 
+    // Set once the image loader opened the image in the background, and once its overview can be drawn before that
+    HANDLE m_hOpenedEvent;
+    HANDLE m_hOverviewEvent;
+
     BOOL m_IsCalibrated;
 
 public:
@@ -44,6 +48,7 @@ public:
 	HRESULT Initialize(__in_z const WCHAR *nodeName, __in_z const WCHAR *filePath);
     HRESULT GetImageLoader(__deref_out IImageLoader **ppImageLoader);
     HRESULT Destroy();
+    HRESULT Register(__in ISceneGraph *pSceneGraph);
     HRESULT Calibrate();
     BOOL IsCalibrated();
     void SetCalibrated();
@@ -83,6 +83,76 @@ public:
     }
 };
 
+
+class ReaderWriterLock
+{
+    SRWLOCK m_Obj;
+
+public:
+    ReaderWriterLock()
+    {
+        InitializeSRWLock(&m_Obj);
+    }
+
+    void LockShared()
+    {
+        AcquireSRWLockShared(&m_Obj);
+    }
+
+    void UnLockShared()
+    {
+        ReleaseSRWLockShared(&m_Obj);
+    }
+
+    void LockExclusive()
+    {
+        AcquireSRWLockExclusive(&m_Obj);
+    }
+
+    void UnLockExclusive()
+    {
+        ReleaseSRWLockExclusive(&m_Obj);
+    }
+};
+
+
+class AutoSharedLock
+{
+    ReaderWriterLock *pObj;
+
+public:
+
+    AutoSharedLock(ReaderWriterLock &lock)
+    {
+        pObj = &lock;
+        pObj->LockShared();
+    }
+
+    ~AutoSharedLock()
+    {
+        pObj->UnLockShared();
+    }
+};
+
+
+class AutoExclusiveLock
+{
+    ReaderWriterLock *pObj;
+
+public:
+
+    AutoExclusiveLock(ReaderWriterLock &lock)
+    {
+        pObj = &lock;
+        pObj->LockExclusive();
+    }
+
+    ~AutoExclusiveLock()
+    {
+        pObj->UnLockExclusive();
+    }
+};
+
 template <class Base>
 class AsyncOperation
 {
@@ -139,8 +209,15 @@ public:
         }
         else
         {
+            // Handle of the previous operation, it has finished before the owner starts another one
+            if (m_ThreadHandle)
+            {
+                CloseHandle(m_ThreadHandle);
+            }
+
+            // Operations like opening an image run decoders on the thread, it gets the default stack
             tpb->ptr = owner;
-            m_ThreadHandle = CreateThread(NULL, 8192, &AsyncOperation<Base>::ThreadProc, tpb, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+            m_ThreadHandle = CreateThread(NULL, 0, &AsyncOperation<Base>::ThreadProc, tpb, 0, NULL);
             if (m_ThreadHandle == NULL)
             {
                 delete tpb;
@@ -152,7 +229,7 @@ public:
             }
         }
         
-        return 0;
+        return hr;
     }
 
     HRESULT WaitForFinish()
@@ -75,4 +75,28 @@ BOOL Timer::Stop()
     }
 
     return ok;
-}
\ No newline at end of file
+}
+
+StageTimer::StageTimer()
+{
+    m_StartTicks.QuadPart = 0;
+    m_TotalTicks = 0;
+    QueryPerformanceFrequency(&m_Frequency);
+}
+
+void StageTimer::Start()
+{
+    QueryPerformanceCounter(&m_StartTicks);
+}
+
+void StageTimer::Stop()
+{
+    LARGE_INTEGER endTicks;
+    QueryPerformanceCounter(&endTicks);
+    m_TotalTicks += endTicks.QuadPart - m_StartTicks.QuadPart;
+}
+
+DOUBLE StageTimer::GetSeconds() const
+{
+    return (m_Frequency.QuadPart == 0) ? 0.0 : (DOUBLE)m_TotalTicks / (DOUBLE)m_Frequency.QuadPart;
+}
@@ -51,4 +51,22 @@ public:
     Timer();
     BOOL Start(LPCWSTR szTimerName);
     BOOL Stop();
-};
\ No newline at end of file
+};
+
+//-----------------------------------------------------------------------------
+// Sums durations of repeated Start/Stop intervals without any output,
+// used to measure time spent in a stage of a longer operation
+//-----------------------------------------------------------------------------
+class StageTimer
+{
+private:
+    LARGE_INTEGER m_StartTicks;
+    LARGE_INTEGER m_Frequency;
+    LONGLONG m_TotalTicks;
+
+public:
+    StageTimer();
+    void Start();
+    void Stop();
+    DOUBLE GetSeconds() const;
+};